@@ -0,0 +1,335 @@
+#!/usr/bin/env python3
+"""
+Simulated device fleet for load-testing the server.
+
+Each simulated device keeps a keep-alive connection open and polls
+/status at the device's rate (5 Hz, like the firmware), optionally
+uploading a synthetic recording every few seconds. Prints throughput and
+poll latency percentiles while it runs.
+
+    python3 fleet_simulator.py --devices 1000 --duration 30
+    python3 fleet_simulator.py --devices 50 --upload-every 10 --clip-sec 3
+    python3 fleet_simulator.py --devices 5 --upload-every 10 --clip-sec 5 --stream
+
+With uploads, the server's /inference-stats is read before and after the
+run. The report shows inference throughput next to the queueing and
+batching delay (Rust server; compare MEMO_INFERENCE_BATCH=1 with larger
+batches) and the spread of per-device queue waits.
+"""
+
+import argparse
+import array
+import asyncio
+import json
+import math
+import random
+import resource
+import struct
+import time
+
+
+class Stats:
+    def __init__(self):
+        self.polls = 0
+        self.uploads = 0
+        self.errors = 0
+        self.busy = 0  # uploads refused with 503 (server admission control)
+        self.latencies = []  # seconds, reset every report
+        self.stream_started = {}  # session -> monotonic start, --stream only
+        self.first_partial = []  # seconds from stream start to first partial
+
+    def snapshot(self):
+        latencies = sorted(self.latencies)
+        self.latencies = []
+        return latencies
+
+
+def percentile(values, p):
+    if not values:
+        return float('nan')
+    index = min(len(values) - 1, int(math.ceil(p / 100.0 * len(values))) - 1)
+    return values[max(index, 0)]
+
+
+async def read_response(reader):
+    """Read one HTTP/1.1 response; returns the status code"""
+    status_line = await reader.readline()
+    if not status_line:
+        raise ConnectionError("connection closed")
+    status = int(status_line.split()[1])
+    content_length = 0
+    while True:
+        line = await reader.readline()
+        if line in (b'\r\n', b'\n', b''):
+            break
+        name, _, value = line.decode('latin-1').partition(':')
+        if name.strip().lower() == 'content-length':
+            content_length = int(value.strip())
+    if content_length:
+        await reader.readexactly(content_length)
+    return status
+
+
+async def poll_device(device_id, args, stats, stop_at):
+    interval = 1.0 / args.rate
+    request = (f"GET /status?device={device_id} HTTP/1.1\r\n"
+               f"Host: {args.host}:{args.port}\r\n"
+               f"Connection: keep-alive\r\n\r\n").encode()
+
+    # Spread the fleet over one poll interval so polls don't arrive in lockstep
+    await asyncio.sleep(random.random() * interval)
+    reader = writer = None
+    next_poll = time.monotonic()
+    while time.monotonic() < stop_at:
+        try:
+            if writer is None:
+                reader, writer = await asyncio.open_connection(args.host, args.port)
+            started = time.monotonic()
+            writer.write(request)
+            await writer.drain()
+            status = await read_response(reader)
+            stats.latencies.append(time.monotonic() - started)
+            if status == 200:
+                stats.polls += 1
+            else:
+                stats.errors += 1
+        except (OSError, ConnectionError, ValueError, IndexError, asyncio.IncompleteReadError):
+            stats.errors += 1
+            if writer is not None:
+                writer.close()
+            reader = writer = None
+            await asyncio.sleep(1.0)
+
+        next_poll += interval
+        await asyncio.sleep(max(0.0, next_poll - time.monotonic()))
+
+    if writer is not None:
+        writer.close()
+
+
+def synthetic_pcm(seconds, sample_rate=16000):
+    """A quiet 440 Hz tone, 16-bit mono little-endian"""
+    samples = int(seconds * sample_rate)
+    return struct.pack(f'<{samples}h', *(
+        int(3000 * math.sin(2 * math.pi * 440 * i / sample_rate)) for i in range(samples)))
+
+
+def seeded_pcm(tone, device_id, seq):
+    """The tone with 100 ms of quiet noise, seeded by (device, seq), mixed into
+    its start. Each upload is then distinct audio: the server takes the same
+    audio from a device again within a few minutes as a retry and drops it."""
+    rng = random.Random(f"{device_id}/{seq}")
+    head = array.array('h', tone[:3200])
+    for i in range(len(head)):
+        head[i] += rng.randint(-200, 200)
+    return head.tobytes() + tone[len(head) * 2:]
+
+
+async def send_stream(writer, pcm, session, stats):
+    """Chunked body at real-time pace, 100 ms of audio per chunk"""
+    chunk_bytes = 3200
+    stats.stream_started[session] = time.monotonic()
+    for offset in range(0, len(pcm), chunk_bytes):
+        chunk = pcm[offset:offset + chunk_bytes]
+        writer.write(f"{len(chunk):x}\r\n".encode() + chunk + b"\r\n")
+        await writer.drain()
+        await asyncio.sleep(0.1)
+    writer.write(b"0\r\n\r\n")
+    await writer.drain()
+
+
+async def upload_device(device_id, args, stats, stop_at, tone):
+    seq = 0
+    path = "/audio-stream" if args.stream else "/audio"
+    await asyncio.sleep(random.random() * args.upload_every)
+    while time.monotonic() < stop_at:
+        seq += 1
+        session = f"{device_id}-sim-{seq}"
+        pcm = seeded_pcm(tone, device_id, seq)
+        length_header = ("Transfer-Encoding: chunked\r\n" if args.stream
+                         else f"Content-Length: {len(pcm)}\r\n")
+        request = (f"POST {path}?device={device_id}&rate=16000&bits=16&channels=1 HTTP/1.1\r\n"
+                   f"Host: {args.host}:{args.port}\r\n"
+                   f"Content-Type: application/octet-stream\r\n"
+                   f"{length_header}"
+                   f"X-Recording-Id: {session}\r\n"
+                   f"Connection: close\r\n\r\n").encode()
+        try:
+            reader, writer = await asyncio.open_connection(args.host, args.port)
+            writer.write(request)
+            if args.stream:
+                await send_stream(writer, pcm, session, stats)
+            else:
+                writer.write(pcm)
+            await writer.drain()
+            status = await read_response(reader)
+            writer.close()
+            if status == 200:
+                stats.uploads += 1
+            elif status == 503:
+                stats.busy += 1
+            else:
+                stats.errors += 1
+        except (OSError, ConnectionError, ValueError, IndexError, asyncio.IncompleteReadError):
+            stats.errors += 1
+        await asyncio.sleep(args.upload_every)
+
+
+async def watch_partials(args, stats, stop_at):
+    """Time from stream start to its first partial_transcript event"""
+    reader, writer = await asyncio.open_connection(args.host, args.port)
+    writer.write(f"GET /events HTTP/1.1\r\nHost: {args.host}:{args.port}\r\n\r\n".encode())
+    await writer.drain()
+    event = None
+    while time.monotonic() < stop_at:
+        try:
+            line = await asyncio.wait_for(reader.readline(), timeout=1.0)
+        except asyncio.TimeoutError:
+            continue
+        if not line:
+            break
+        line = line.decode('utf-8', 'replace').strip()
+        if line.startswith('event:'):
+            event = line[6:].strip()
+        elif line.startswith('data:') and event == 'partial_transcript':
+            session = json.loads(line[5:]).get('session')
+            started = stats.stream_started.pop(session, None)
+            if started is not None:
+                stats.first_partial.append(time.monotonic() - started)
+    writer.close()
+
+
+async def fetch_json(args, path):
+    """GET a JSON endpoint; None if the server doesn't have it"""
+    try:
+        reader, writer = await asyncio.open_connection(args.host, args.port)
+        writer.write(f"GET {path} HTTP/1.1\r\nHost: {args.host}:{args.port}\r\n"
+                     f"Connection: close\r\n\r\n".encode())
+        await writer.drain()
+        response = await reader.read()
+        writer.close()
+    except OSError:
+        return None
+    head, _, body = response.partition(b'\r\n\r\n')
+    if b' 200 ' not in head.split(b'\r\n')[0]:
+        return None
+    try:
+        return json.loads(body)
+    except ValueError:
+        return None
+
+
+def report_inference(before, after, elapsed):
+    """Server-side inference totals over the run (Rust server /inference-stats)"""
+    jobs = after['jobs'] - before['jobs']
+    batches = after['batches'] - before['batches']
+    if jobs <= 0:
+        return
+    def mean(key):
+        return (after[key] * after['jobs'] - before[key] * before['jobs']) / jobs
+    print(f"Inference: {jobs} jobs in {batches} passes (avg batch {jobs / max(batches, 1):.2f}, "
+          f"max {after['max_batch']}, window {after['batch_window_ms']} ms)")
+    print(f"  throughput {(after['audio_sec'] - before['audio_sec']) / elapsed:.2f} audio s/s, "
+          f"queue wait {mean('avg_queue_wait_ms'):.0f} ms "
+          f"(of which batching {mean('avg_batch_wait_ms'):.0f} ms), "
+          f"service {mean('avg_service_ms'):.0f} ms")
+    journal = after.get('journal')
+    if journal and journal['appends']:
+        print(f"  ingest journal: {journal['avg_records_per_commit']:.1f} records per fsync, "
+              f"upload waits {journal['avg_append_wait_ms']:.2f} ms avg "
+              f"(commit avg {journal['avg_commit_ms']:.2f} ms, max {journal['max_commit_ms']:.2f} ms, "
+              f"fsync {'on' if journal['fsync'] else 'off'})")
+
+
+def report_fairness(stats):
+    """Per-device queue waits from the transcription scheduler"""
+    scheduler = stats.get('scheduler', stats)
+    devices = [d for d in scheduler.get('devices', []) if d['wait_p99_ms'] is not None]
+    if not devices:
+        return
+    devices.sort(key=lambda d: d['wait_p99_ms'])
+    p99s = [d['wait_p99_ms'] for d in devices]
+    print(f"Scheduler: {len(devices)} devices, per-device wait p99 from {p99s[0]} to {p99s[-1]} ms "
+          f"(median device {p99s[len(p99s) // 2]} ms), {scheduler['rejected']} refused")
+    worst = devices[-1]
+    print(f"  slowest {worst['device_id']}: {worst['jobs']} jobs, "
+          f"wait p50 {worst['wait_p50_ms']} / p90 {worst['wait_p90_ms']} / p99 {worst['wait_p99_ms']} ms")
+
+
+async def report(stats, args, stop_at):
+    last_polls = last_uploads = 0
+    last_time = time.monotonic()
+    while time.monotonic() < stop_at:
+        await asyncio.sleep(args.report_every)
+        now = time.monotonic()
+        elapsed = now - last_time
+        latencies = stats.snapshot()
+        print(f"{(stats.polls - last_polls) / elapsed:8.0f} polls/s  "
+              f"{(stats.uploads - last_uploads) / elapsed:6.1f} uploads/s  "
+              f"p50 {percentile(latencies, 50) * 1000:6.1f} ms  "
+              f"p99 {percentile(latencies, 99) * 1000:6.1f} ms  "
+              f"busy {stats.busy}  errors {stats.errors}")
+        if stats.first_partial:
+            first = sorted(stats.first_partial)
+            print(f"         first partial p50 {percentile(first, 50) * 1000:6.0f} ms  "
+                  f"p99 {percentile(first, 99) * 1000:6.0f} ms  ({len(first)} streams)")
+        last_polls, last_uploads, last_time = stats.polls, stats.uploads, now
+
+
+async def main():
+    parser = argparse.ArgumentParser(description="Simulated device fleet")
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=8000)
+    parser.add_argument('--devices', type=int, default=1000)
+    parser.add_argument('--rate', type=float, default=5.0, help="status polls per second per device")
+    parser.add_argument('--duration', type=float, default=30.0, help="seconds")
+    parser.add_argument('--upload-every', type=float, default=0.0,
+                        help="seconds between uploads per device (0 = polls only)")
+    parser.add_argument('--clip-sec', type=float, default=2.0, help="length of each synthetic upload")
+    parser.add_argument('--stream', action='store_true',
+                        help="upload through /audio-stream in real time and time the first partial transcript")
+    parser.add_argument('--drain', type=float, default=5.0,
+                        help="seconds to wait for queued transcriptions before reading server stats")
+    parser.add_argument('--report-every', type=float, default=5.0)
+    args = parser.parse_args()
+
+    # One socket per device (two while uploading)
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    wanted = args.devices * 2 + 64
+    if soft < wanted:
+        resource.setrlimit(resource.RLIMIT_NOFILE, (min(wanted, hard), hard))
+
+    print(f"Simulating {args.devices} devices at {args.rate} polls/s each "
+          f"against {args.host}:{args.port} for {args.duration:.0f}s")
+    stats = Stats()
+    inference_before = await fetch_json(args, "/inference-stats") if args.upload_every > 0 else None
+    started = time.monotonic()
+    stop_at = started + args.duration
+
+    tasks = [poll_device(f"sim-{i:05d}", args, stats, stop_at) for i in range(args.devices)]
+    if args.upload_every > 0:
+        tone = synthetic_pcm(args.clip_sec)
+        tasks += [upload_device(f"sim-{i:05d}", args, stats, stop_at, tone) for i in range(args.devices)]
+        if args.stream:
+            tasks.append(watch_partials(args, stats, stop_at))
+    tasks.append(report(stats, args, stop_at))
+    await asyncio.gather(*tasks)
+
+    elapsed = min(time.monotonic(), stop_at) - started
+    print(f"\nTotal: {stats.polls} polls ({stats.polls / elapsed:.0f}/s), "
+          f"{stats.uploads} uploads ({stats.busy} refused busy), {stats.errors} errors in {elapsed:.1f}s")
+    if inference_before is not None:
+        # Let the last uploads finish transcribing
+        await asyncio.sleep(args.drain)
+        inference_after = await fetch_json(args, "/inference-stats")
+        if inference_after is not None:
+            if 'jobs' in inference_after:
+                report_inference(inference_before, inference_after, elapsed + args.drain)
+            report_fairness(inference_after)
+
+
+if __name__ == '__main__':
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass
@@ -34,6 +34,32 @@
 #define SERVER_URL "http://192.168.12.118:8000/audio"
 #define DEVICE_ID "esp32-dev-01"
 
+// Upload Queue
+#define UPLOAD_QUEUE_MAX_ENTRIES 16  // Completed recordings waiting for upload
+#define UPLOAD_QUEUE_MAX_BYTES (4 * 1024 * 1024)  // PSRAM budget for the queue
+#define UPLOAD_RETRY_BASE_MS 2000  // First retry delay, doubles per attempt
+#define UPLOAD_RETRY_MAX_MS 60000
+#define UPLOAD_QUEUE_FLASH_SPOOL false  // Persist failed uploads to LittleFS across reboots/deep sleep
+#define UPLOAD_BATCH_ENABLED true  // Send clips finished close together as one /audio-batch request
+#define UPLOAD_BATCH_WINDOW_MS 800  // Hold a just-finished clip this long for others to join it
+#define UPLOAD_BATCH_MAX_CLIPS 8
+#define UPLOAD_BATCH_MAX_BYTES (512 * 1024)
+
+// Power Management
+#define IDLE_POWER_SAVE true  // Modem sleep + automatic light sleep while idle (false = always awake)
+#define IDLE_ENTER_DELAY_MS 3000  // Stay fully awake this long after the last activity
+#define WIFI_BEACON_INTERVAL_MS 102  // Typical AP beacon interval (100 TU)
+#define WIFI_LISTEN_INTERVAL 10  // Station wakes every 10th beacon (~1 s) in modem sleep; sent to the AP on association
+#define IDLE_STATUS_CHECK_INTERVAL_MS 3000  // Idle /status poll; each one keeps the radio up, so server starts wait up to this long (the button doesn't)
+#define DYNAMIC_CPU_FREQ true  // Max clock only while DSP/encoder/upload need it (false = always max)
+#define CPU_FREQ_MAX_MHZ 240
+#define CPU_FREQ_MIN_MHZ 80
+#define ENABLE_AUDIO_METRICS true  // Per-chunk dB/clipping/silence analysis (DSP stage)
+#define DEEP_SLEEP_ENABLED false  // Deep sleep between sessions; button wake starts recording immediately
+#define DEEP_SLEEP_IDLE_MS 60000  // Idle time before deep sleep
+#define DEEP_SLEEP_TIMER_SEC 300  // Also wake on a timer to check in with the server (0 = button only)
+#define DEEP_SLEEP_CHECKIN_MS 5000  // How long a timer wake stays up when nothing happens
+
 // Debug
 #define DEBUG_SERIAL true
 
@@ -5,6 +5,12 @@
 #include <esp_system.h>
 #include <math.h>
 #include <Preferences.h>
+#include <LittleFS.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <esp_wifi.h>
+#include <driver/gpio.h>
+#include <driver/rtc_io.h>
 #include "config.h"
 
 // Global state
@@ -15,12 +21,80 @@ uint8_t audioBuffer[BUFFER_SIZE * sizeof(int16_t)];
 size_t bytesRead = 0;
 unsigned long lastStatusCheck = 0;
 const unsigned long STATUS_CHECK_INTERVAL = 200;  // Check status every 200ms for responsive start/stop
+unsigned long lastRssiReport = 0;
+const unsigned long RSSI_REPORT_INTERVAL = 10000;  // WiFi signal rides along on one status poll every 10s
 
 // Status check retry logic
 int statusCheckFailures = 0;
 const int MAX_CONSECUTIVE_FAILURES = 3;  // Only stop recording after 3 consecutive failures
 bool lastKnownRecordingState = false;  // Maintain last known good state
 
+// Idle power-save state
+bool idleMode = false;
+unsigned long lastActivityTime = 0;
+bool lightSleepEnabled = false;
+esp_pm_lock_handle_t pmCpuLock = nullptr;      // Held while any CPU-bound pipeline stage is running
+esp_pm_lock_handle_t pmNoSleepLock = nullptr;  // Blocks automatic light sleep while active
+SemaphoreHandle_t wakeSemaphore = nullptr;     // Given by the button ISR to cut an idle wait short
+
+// Pipeline load - the CPU clock only goes to CPU_FREQ_MAX_MHZ while a stage
+// that needs it is active. Raw capture runs off I2S DMA at CPU_FREQ_MIN_MHZ.
+enum PipelineLoad : uint8_t {
+    LOAD_CAPTURE = 1 << 0,  // I2S DMA into PSRAM (doesn't need the fast clock)
+    LOAD_DSP = 1 << 1,      // Per-chunk level/clipping analysis
+    LOAD_ENCODER = 1 << 2,  // Compression before upload (no encoder stage yet)
+    LOAD_UPLOAD = 1 << 3,   // HTTP upload in progress
+};
+const uint8_t CPU_BOUND_LOADS = LOAD_DSP | LOAD_ENCODER | LOAD_UPLOAD;
+const int PIPELINE_CONFIGS = 16;
+uint8_t pipelineLoad = 0;
+unsigned long pipelineLoadSince = 0;
+unsigned long lastI2sReturnUs = 0;  // For busy-time accounting between I2S reads
+
+// Time, clock and capture headroom per pipeline configuration
+struct PipelineStats {
+    unsigned long timeMs = 0;
+    uint64_t busyUs = 0;   // Time between I2S reads (processing, polls, copies)
+    uint64_t audioUs = 0;  // Audio captured in the same period
+    uint32_t cpuMhz = 0;
+} pipelineStats[PIPELINE_CONFIGS];
+
+// Push-to-talk button state
+bool buttonRecording = false;
+bool lastButtonState = false;
+unsigned long lastButtonChange = 0;
+const unsigned long BUTTON_DEBOUNCE_MS = 30;
+
+// Start latency measurement (awake vs. idle vs. deep sleep wake)
+enum StartMode { START_AWAKE, START_IDLE, START_DEEP_SLEEP, START_MODES };
+const char* START_MODE_NAMES[START_MODES] = { "awake", "idle", "deep sleep" };
+unsigned long statusRequestRtt = 0;
+unsigned long startCommandSeenAt = 0;
+unsigned long firstSampleAt = 0;      // First sample of the current recording
+unsigned long startPollInterval = 0;  // Poll interval in effect when the start was seen (0 = button)
+bool startLatencyPending = false;
+StartMode startMode = START_AWAKE;
+struct StartLatencyStats {
+    unsigned long count = 0;
+    unsigned long totalMs = 0;
+    unsigned long maxMs = 0;
+} startLatency[START_MODES];
+
+// Deep sleep / wake state
+bool i2sInstalled = false;
+bool fastReconnectPending = false;   // WiFi coming up in the background after a wake
+unsigned long fastReconnectStart = 0;
+unsigned long deepSleepIdleMs = DEEP_SLEEP_IDLE_MS;
+
+// Survives deep sleep: the AP we were last on, so a wake can skip the scan
+const uint32_t WIFI_CACHE_MAGIC = 0x4D454D4F;  // "MEMO"
+RTC_DATA_ATTR struct WiFiLinkCache {
+    uint32_t magic;
+    int networkIndex;
+    uint8_t bssid[6];
+    int32_t channel;
+} wifiLinkCache;
+
 // Device unique ID (generated from MAC address)
 String deviceId;
 
@@ -43,6 +117,102 @@ struct AudioQualityMetrics {
     float clipThreshold = -3.0;  // dB threshold for clipping
 } audioMetrics;
 
+// Upload queue - completed recordings waiting to go out, most urgent first
+enum UploadPriority : uint8_t {
+    PRIORITY_LIVE = 0,     // Server- or button-triggered, just finished
+    PRIORITY_SPOOLED = 1,  // Recovered from the flash spool after a reboot
+};
+struct QueuedRecording {
+    uint8_t* data = nullptr;  // PSRAM copy (nullptr = only on flash)
+    size_t size = 0;
+    uint8_t priority = PRIORITY_LIVE;
+    char id[48] = {0};        // <device>-<boot>-<seq>, lets the server drop duplicate retries
+    unsigned long completedAt = 0;
+    unsigned long lastAttemptAt = 0;
+    unsigned long backoffMs = 0;
+    uint8_t attempts = 0;
+    bool spooled = false;     // Also persisted in LittleFS
+    // Latency trace (millis() of this boot; not kept for spooled recoveries)
+    bool traced = false;
+    unsigned long startSeenAt = 0;
+    unsigned long firstSampleAt = 0;
+    unsigned long pollRtt = 0;
+    AudioQualityMetrics metrics;
+};
+QueuedRecording uploadQueue[UPLOAD_QUEUE_MAX_ENTRIES];
+int uploadQueueDepth = 0;
+size_t uploadQueueBytes = 0;  // PSRAM held by queued recordings
+uint32_t bootId = 0;
+uint32_t recordingSeq = 0;
+bool spoolReady = false;
+
+// Upload accounting - batching shows up as fewer requests than clips
+unsigned long uploadRequestCount = 0;
+unsigned long uploadClipCount = 0;
+bool batchEndpointAvailable = true;  // Cleared if the server has no /audio-batch
+unsigned long serverRetryAfterMs = 0;  // Retry-After of the last refused upload (0 = none)
+const char* uploadResponseHeaders[] = {"Retry-After"};
+
+// Request body for /audio-batch: length-prefixed segments read straight out
+// of the queued PSRAM buffers, so a batch never needs a contiguous copy
+class BatchBodyStream : public Stream {
+public:
+    void add(const uint8_t* data, size_t length) {
+        segments[segmentCount] = data;
+        lengths[segmentCount] = length;
+        segmentCount++;
+        total += length;
+    }
+    size_t size() const { return total; }
+
+    int available() override {
+        size_t left = total - consumed;
+        return left > 0x7FFFFFFF ? 0x7FFFFFFF : (int)left;
+    }
+    int peek() override {
+        return segment < segmentCount ? segments[segment][offset] : -1;
+    }
+    int read() override {
+        uint8_t value;
+        return readBytes((char*)&value, 1) == 1 ? value : -1;
+    }
+    size_t readBytes(char* buffer, size_t length) override {
+        size_t copied = 0;
+        while (copied < length && segment < segmentCount) {
+            size_t n = min(length - copied, lengths[segment] - offset);
+            memcpy(buffer + copied, segments[segment] + offset, n);
+            copied += n;
+            offset += n;
+            if (offset == lengths[segment]) {
+                segment++;
+                offset = 0;
+            }
+        }
+        consumed += copied;
+        return copied;
+    }
+    size_t write(uint8_t) override { return 0; }
+
+private:
+    static const int MAX_SEGMENTS = UPLOAD_BATCH_MAX_CLIPS * 4;  // 2 prefixes + meta + pcm per clip
+    const uint8_t* segments[MAX_SEGMENTS];
+    size_t lengths[MAX_SEGMENTS];
+    int segmentCount = 0;
+    int segment = 0;
+    size_t offset = 0;
+    size_t total = 0;
+    size_t consumed = 0;
+};
+
+// On-flash record header for spooled recordings
+const uint32_t SPOOL_MAGIC = 0x53504F4C;  // "SPOL"
+struct SpoolMeta {
+    uint32_t magic;
+    uint32_t size;
+    char id[48];
+    AudioQualityMetrics metrics;
+};
+
 // WiFi credential storage
 Preferences preferences;
 const char* PREF_NAMESPACE = "wifi_storage";
@@ -54,7 +224,7 @@ void setupI2S();
 void startRecording();
 void stopRecordingAndUpload();
 void captureAudioChunk();
-bool uploadRecording();
+int uploadRecording(struct QueuedRecording& rec);
 bool checkRecordingStatus();
 String getHttpErrorDescription(int errorCode);
 void logHttpError(const char* operation, int httpCode, const char* context = nullptr);
@@ -62,7 +232,32 @@ void initializeDefaultWiFiNetworks();
 int getSavedWiFiCount();
 bool getSavedWiFi(int index, String& ssid, String& password);
 bool saveWiFiNetwork(const String& ssid, const String& password);
+void beginStation(const String& ssid, const String& password, int32_t channel, const uint8_t* bssid);
 bool connectToWiFi(const String& ssid, const String& password);
+void setupPowerManagement();
+void enterIdleMode();
+void exitIdleMode();
+bool isButtonPressed();
+void handleButton();
+void waitForNextPoll(unsigned long interval);
+void recordStartLatency();
+void setPipelineLoad(uint8_t load, bool active);
+void printPowerReport();
+float analyzeAudioChunk(const int16_t* samples, int numSamples);
+void cacheWiFiLink(int networkIndex);
+bool beginFastReconnect();
+void onWiFiConnected();
+void resumeRecordingFromWake();
+void enterDeepSleep();
+void setupUploadQueue();
+bool enqueueRecording(UploadPriority priority);
+void drainUploadQueue();
+unsigned long uploadQueueOldestAge();
+bool uploadQueueSurvivesDeepSleep();
+String spoolPath(const char* id, const char* extension);
+int uploadBatch(const int* indices, int count, String& response);
+int batchClipResult(const String& response, const char* id, int fallback);
+void readRetryAfter(HTTPClient& http);
 
 String generateDeviceId() {
     // Get MAC address (unique to each device)
@@ -122,9 +317,16 @@ void logHttpError(const char* operation, int httpCode, const char* context) {
 }
 
 void setup() {
+    // Waking from our own deep sleep? Then latency matters more than the console.
+    esp_sleep_wakeup_cause_t wakeCause = esp_sleep_get_wakeup_cause();
+    bool buttonWake = (wakeCause == ESP_SLEEP_WAKEUP_EXT0);
+    bool timerWake = (wakeCause == ESP_SLEEP_WAKEUP_TIMER);
+
     // Initialize serial for debugging
     Serial.begin(115200);
-    delay(2000);
+    if (!buttonWake && !timerWake) {
+        delay(2000);
+    }
 
     // Generate unique device ID from MAC address
     deviceId = generateDeviceId();
@@ -149,12 +351,34 @@ void setup() {
         Serial.printf("Allocated %d KB recording buffer in PSRAM\n", recordingBufferCapacity / 1024);
     }
 
+    // Upload queue (+ anything spooled to flash before the last reboot)
+    setupUploadQueue();
+
+    // Hand the button back from the RTC domain before we read it
+    if (buttonWake) {
+        rtc_gpio_deinit((gpio_num_t)BUTTON_PIN);
+    }
+
+    // Power management (starts fully awake; drops to idle once nothing is happening)
+    setupPowerManagement();
+
+    if (buttonWake) {
+        // Capture first - WiFi comes up in parallel and the upload waits for it
+        resumeRecordingFromWake();
+        return;
+    }
+    if (timerWake && beginFastReconnect()) {
+        Serial.println("⏰ Timer wake - checking in with server");
+        deepSleepIdleMs = DEEP_SLEEP_CHECKIN_MS;
+        return;
+    }
+
     // Connect to WiFi
     setupWiFi();
 
     // Initialize I2S microphone
     if (wifiConnected) {
-        setupI2S();
+        onWiFiConnected();
         Serial.println("System ready - waiting for recording start");
     } else {
         Serial.println("WiFi connection failed - cannot stream audio");
@@ -167,23 +391,72 @@ void loop() {
         if (wifiConnected) {
             Serial.println("WiFi disconnected - attempting reconnect");
             wifiConnected = false;
-            recordingActive = false;
+            if (!buttonRecording) {
+                recordingActive = false;
+            }
         }
+
+        if (buttonRecording || fastReconnectPending) {
+            // Audio keeps going into RAM while the link comes up in the background
+            handleButton();
+            if (recordingActive) {
+                captureAudioChunk();
+            } else {
+                delay(10);
+            }
+            if (fastReconnectPending && millis() - fastReconnectStart >= WIFI_TIMEOUT_MS) {
+                Serial.println("⚠️  Fast reconnect timed out - falling back to full scan");
+                fastReconnectPending = false;
+            }
+            return;
+        }
+
+        exitIdleMode();
         setupWiFi();
+        if (wifiConnected) {
+            onWiFiConnected();
+        }
         delay(5000);
         return;
     }
 
+    if (!wifiConnected) {
+        // Link came up in the background (wake reconnect or auto-reconnect)
+        onWiFiConnected();
+    }
+
+    // Send queued recordings between sessions (an upload would starve I2S DMA)
+    if (!recordingActive) {
+        drainUploadQueue();
+    }
+
+    // Push-to-talk button (in idle mode the ISR wakes us for this)
+    handleButton();
+
     // Check recording status from server periodically
+    // In idle mode polls are far apart: every poll holds the radio awake for
+    // the whole exchange, which would undo modem sleep at the awake rate
     unsigned long now = millis();
-    if (now - lastStatusCheck >= STATUS_CHECK_INTERVAL) {
+    unsigned long statusInterval = idleMode ? IDLE_STATUS_CHECK_INTERVAL_MS : STATUS_CHECK_INTERVAL;
+    if (now - lastStatusCheck >= statusInterval) {
         lastStatusCheck = now;
         bool serverRecording = checkRecordingStatus();
+        statusRequestRtt = millis() - now;
 
         // Handle state transitions
         if (serverRecording && !wasRecording) {
             // START: Server wants to record
-            startRecording();
+            startMode = idleMode ? START_IDLE : START_AWAKE;
+            startCommandSeenAt = millis();
+            startPollInterval = statusInterval;
+            startLatencyPending = !buttonRecording;
+            exitIdleMode();
+            if (buttonRecording) {
+                // Already capturing from the button - the server takes over this recording
+                buttonRecording = false;
+            } else {
+                startRecording();
+            }
             wasRecording = true;
             recordingActive = true;
             lastKnownRecordingState = true;
@@ -210,8 +483,19 @@ void loop() {
 
     // Capture audio if recording
     if (recordingActive) {
+        lastActivityTime = millis();
         captureAudioChunk();
+    } else if (idleMode) {
+        if (DEEP_SLEEP_ENABLED && uploadQueueSurvivesDeepSleep() &&
+            millis() - lastActivityTime >= deepSleepIdleMs) {
+            enterDeepSleep();
+        }
+        // Sleep until the next poll is due (or the button is pressed)
+        waitForNextPoll(statusInterval);
     } else {
+        if (IDLE_POWER_SAVE && millis() - lastActivityTime >= IDLE_ENTER_DELAY_MS) {
+            enterIdleMode();
+        }
         // Small delay when not recording to prevent tight loop
         delay(50);
     }
@@ -298,11 +582,23 @@ bool saveWiFiNetwork(const String& ssid, const String& password) {
     return true;
 }
 
+// WiFi.begin() associates with listen_interval 0 (ESP-IDF's default of 3
+// beacons), and the AP only learns it on association, so set ours in between
+void beginStation(const String& ssid, const String& password, int32_t channel, const uint8_t* bssid) {
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(ssid.c_str(), password.c_str(), channel, bssid, false);
+    wifi_config_t conf;
+    if (esp_wifi_get_config(WIFI_IF_STA, &conf) == ESP_OK) {
+        conf.sta.listen_interval = WIFI_LISTEN_INTERVAL;
+        esp_wifi_set_config(WIFI_IF_STA, &conf);
+    }
+    esp_wifi_connect();
+}
+
 bool connectToWiFi(const String& ssid, const String& password) {
     Serial.printf("Attempting to connect to: %s", ssid.c_str());
     
-    WiFi.mode(WIFI_STA);
-    WiFi.begin(ssid.c_str(), password.c_str());
+    beginStation(ssid, password, 0, nullptr);
     
     unsigned long startAttempt = millis();
     while (WiFi.status() != WL_CONNECTED &&
@@ -315,6 +611,8 @@ bool connectToWiFi(const String& ssid, const String& password) {
         Serial.println("\n✓ Connected!");
         Serial.println("  IP address: " + WiFi.localIP().toString());
         Serial.println("  Signal strength: " + String(WiFi.RSSI()) + " dBm");
+        // Stay out of modem sleep until we decide we're idle
+        esp_wifi_set_ps(WIFI_PS_NONE);
         return true;
     } else {
         Serial.println("\n✗ Failed");
@@ -348,6 +646,7 @@ void setupWiFi() {
             Serial.printf("[%d/%d] ", i + 1, networkCount);
             if (connectToWiFi(ssid, password)) {
                 wifiConnected = true;
+                cacheWiFiLink(i);
                 return;  // Successfully connected
             }
         }
@@ -358,7 +657,321 @@ void setupWiFi() {
     wifiConnected = false;
 }
 
+void IRAM_ATTR onButtonWake() {
+    // Level-triggered so it can wake light sleep - mask it until the loop
+    // leaves idle mode, otherwise it refires for as long as the button is held
+    gpio_intr_disable((gpio_num_t)BUTTON_PIN);
+    BaseType_t higherPriorityWoken = pdFALSE;
+    xSemaphoreGiveFromISR(wakeSemaphore, &higherPriorityWoken);
+    if (higherPriorityWoken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+void setupPowerManagement() {
+    pinMode(BUTTON_PIN, BUTTON_ACTIVE_LOW ? INPUT_PULLUP : INPUT);
+    lastButtonState = isButtonPressed();
+    wakeSemaphore = xSemaphoreCreateBinary();
+    lastActivityTime = millis();
+
+    pipelineLoadSince = millis();
+
+    if (!IDLE_POWER_SAVE && !DYNAMIC_CPU_FREQ) {
+        Serial.println("Power management disabled - staying fully awake at full clock");
+        return;
+    }
+
+    // The CPU lock follows pipeline load (setPipelineLoad); the no-sleep lock
+    // is held whenever we're not idle. With neither held the clock drops to
+    // CPU_FREQ_MIN_MHZ and the idle task can enter light sleep.
+    if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "pipeline_cpu", &pmCpuLock) != ESP_OK) {
+        pmCpuLock = nullptr;
+    }
+    if (esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "active_awake", &pmNoSleepLock) != ESP_OK) {
+        pmNoSleepLock = nullptr;
+    }
+    if (pmNoSleepLock) esp_pm_lock_acquire(pmNoSleepLock);
+
+    esp_pm_config_esp32s3_t pmConfig = {
+        .max_freq_mhz = CPU_FREQ_MAX_MHZ,
+        .min_freq_mhz = DYNAMIC_CPU_FREQ ? CPU_FREQ_MIN_MHZ : CPU_FREQ_MAX_MHZ,
+        .light_sleep_enable = IDLE_POWER_SAVE
+    };
+    esp_err_t err = esp_pm_configure(&pmConfig);
+    if (err != ESP_OK) {
+        // Core built without tickless idle - keep frequency scaling + modem sleep only
+        pmConfig.light_sleep_enable = false;
+        err = esp_pm_configure(&pmConfig);
+    }
+    lightSleepEnabled = (err == ESP_OK) && pmConfig.light_sleep_enable;
+
+    if (err != ESP_OK) {
+        Serial.printf("⚠️  esp_pm_configure failed: %d (modem sleep only)\n", err);
+    } else {
+        Serial.printf("Power management: %d-%d MHz, automatic light sleep %s\n",
+                      pmConfig.min_freq_mhz, pmConfig.max_freq_mhz, lightSleepEnabled ? "on" : "off");
+    }
+}
+
+void enterIdleMode() {
+    if (idleMode || !IDLE_POWER_SAVE) {
+        return;
+    }
+    idleMode = true;
+
+    // Modem sleep: the radio only wakes for every WIFI_LISTEN_INTERVAL-th beacon
+    esp_wifi_set_ps(WIFI_PS_MAX_MODEM);
+
+    // Button press wakes the chip out of light sleep and the loop out of its wait
+    attachInterrupt(digitalPinToInterrupt(BUTTON_PIN), onButtonWake, BUTTON_ACTIVE_LOW ? ONLOW : ONHIGH);
+    gpio_wakeup_enable((gpio_num_t)BUTTON_PIN, BUTTON_ACTIVE_LOW ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+
+    Serial.printf("💤 Idle mode (polling every %d ms)\n", IDLE_STATUS_CHECK_INTERVAL_MS);
+    Serial.flush();
+
+    if (pmNoSleepLock) esp_pm_lock_release(pmNoSleepLock);
+}
+
+void exitIdleMode() {
+    lastActivityTime = millis();
+    if (!idleMode) {
+        return;
+    }
+
+    // Wake lock and radio first - these are what the start latency depends on.
+    // The clock is left to the pipeline: capture alone runs fine at the minimum.
+    if (pmNoSleepLock) esp_pm_lock_acquire(pmNoSleepLock);
+    esp_wifi_set_ps(WIFI_PS_NONE);
+
+    gpio_wakeup_disable((gpio_num_t)BUTTON_PIN);
+    detachInterrupt(digitalPinToInterrupt(BUTTON_PIN));
+    idleMode = false;
+}
+
+void setPipelineLoad(uint8_t load, bool active) {
+    uint8_t newLoad = active ? (pipelineLoad | load) : (pipelineLoad & ~load);
+    if (newLoad == pipelineLoad) {
+        return;
+    }
+
+    // Close out the time spent in the previous configuration
+    unsigned long now = millis();
+    pipelineStats[pipelineLoad].timeMs += now - pipelineLoadSince;
+    pipelineLoadSince = now;
+
+    bool neededCpu = (pipelineLoad & CPU_BOUND_LOADS) != 0;
+    bool needsCpu = (newLoad & CPU_BOUND_LOADS) != 0;
+    pipelineLoad = newLoad;
+
+    if (pmCpuLock && needsCpu != neededCpu) {
+        if (needsCpu) {
+            esp_pm_lock_acquire(pmCpuLock);
+        } else {
+            esp_pm_lock_release(pmCpuLock);
+        }
+    }
+}
+
+void printPowerReport() {
+    // Close the current interval so the report is up to date
+    unsigned long now = millis();
+    pipelineStats[pipelineLoad].timeMs += now - pipelineLoadSince;
+    pipelineLoadSince = now;
+
+    Serial.println("⚡ Pipeline power report (time per load and clock; current not measured):");
+    for (int config = 0; config < PIPELINE_CONFIGS; config++) {
+        const PipelineStats& stats = pipelineStats[config];
+        if (stats.timeMs == 0) {
+            continue;
+        }
+
+        char name[40];
+        snprintf(name, sizeof(name), "%s%s%s%s%s",
+                 config == 0 ? "idle" : "",
+                 (config & LOAD_CAPTURE) ? "capture " : "",
+                 (config & LOAD_DSP) ? "dsp " : "",
+                 (config & LOAD_ENCODER) ? "encoder " : "",
+                 (config & LOAD_UPLOAD) ? "upload" : "");
+
+        uint32_t mhz = stats.cpuMhz;
+        if (mhz == 0) {
+            mhz = (config & CPU_BOUND_LOADS) || !DYNAMIC_CPU_FREQ ? CPU_FREQ_MAX_MHZ : CPU_FREQ_MIN_MHZ;
+        }
+        // Time at each clock only: current draw needs a meter, not a guess
+        Serial.printf("   %-24s %7lu ms @ %3lu MHz", name, stats.timeMs, (unsigned long)mhz);
+        if (stats.audioUs > 0) {
+            float busyPercent = (float)stats.busyUs / stats.audioUs * 100.0;
+            Serial.printf(", busy %.1f%% / headroom %.1f%%", busyPercent, 100.0 - busyPercent);
+        }
+        Serial.println();
+    }
+}
+
+void waitForNextPoll(unsigned long interval) {
+    unsigned long elapsed = millis() - lastStatusCheck;
+    if (elapsed >= interval) {
+        return;
+    }
+
+    // Blocking here lets the idle task enter light sleep; a button press
+    // gives the semaphore and brings us straight back
+    if (xSemaphoreTake(wakeSemaphore, pdMS_TO_TICKS(interval - elapsed)) == pdTRUE) {
+        exitIdleMode();
+    }
+}
+
+bool isButtonPressed() {
+    int level = digitalRead(BUTTON_PIN);
+    return BUTTON_ACTIVE_LOW ? (level == LOW) : (level == HIGH);
+}
+
+void handleButton() {
+    bool pressed = isButtonPressed();
+    unsigned long now = millis();
+    if (pressed == lastButtonState || now - lastButtonChange < BUTTON_DEBOUNCE_MS) {
+        return;
+    }
+    lastButtonState = pressed;
+    lastButtonChange = now;
+
+    if (pressed && !recordingActive) {
+        // Push-to-talk: record while the button is held
+        startMode = idleMode ? START_IDLE : START_AWAKE;
+        startCommandSeenAt = now;
+        startPollInterval = 0;
+        statusRequestRtt = 0;
+        startLatencyPending = true;
+        exitIdleMode();
+        Serial.println("\n🔘 Button pressed");
+        startRecording();
+        buttonRecording = true;
+        recordingActive = true;
+    } else if (!pressed && buttonRecording) {
+        buttonRecording = false;
+        recordingActive = false;
+        stopRecordingAndUpload();
+    }
+}
+
+void recordStartLatency() {
+    if (!startLatencyPending) {
+        return;
+    }
+    startLatencyPending = false;
+
+    // Measured: status round trip + command seen to first sample.
+    // The time a command waits on the server for our next poll can't be seen
+    // from here; it averages half the poll interval.
+    unsigned long firstSampleMs = millis() - startCommandSeenAt;
+    unsigned long latencyMs = statusRequestRtt + firstSampleMs;
+
+    StartLatencyStats& stats = startLatency[startMode];
+    stats.count++;
+    stats.totalMs += latencyMs;
+    if (latencyMs > stats.maxMs) {
+        stats.maxMs = latencyMs;
+    }
+
+    Serial.printf("⏱️  Start latency (%s): %lu ms (status RTT %lu ms + first sample %lu ms)",
+                  START_MODE_NAMES[startMode], latencyMs, statusRequestRtt, firstSampleMs);
+    if (startPollInterval > 0) {
+        Serial.printf(" + ~%lu ms avg poll wait", startPollInterval / 2);
+    }
+    Serial.println();
+
+    for (int i = 0; i < START_MODES; i++) {
+        if (startLatency[i].count > 0) {
+            Serial.printf("   %-10s: avg %lu ms, max %lu ms over %lu start(s)\n",
+                          START_MODE_NAMES[i],
+                          startLatency[i].totalMs / startLatency[i].count,
+                          startLatency[i].maxMs, startLatency[i].count);
+        }
+    }
+}
+
+void cacheWiFiLink(int networkIndex) {
+    uint8_t* bssid = WiFi.BSSID();
+    if (!bssid) {
+        return;
+    }
+    memcpy(wifiLinkCache.bssid, bssid, sizeof(wifiLinkCache.bssid));
+    wifiLinkCache.channel = WiFi.channel();
+    wifiLinkCache.networkIndex = networkIndex;
+    wifiLinkCache.magic = WIFI_CACHE_MAGIC;
+}
+
+bool beginFastReconnect() {
+    String ssid, password;
+    if (wifiLinkCache.magic != WIFI_CACHE_MAGIC ||
+        !getSavedWiFi(wifiLinkCache.networkIndex, ssid, password)) {
+        return false;
+    }
+
+    // Non-blocking, straight to the last AP on its channel - no scan
+    beginStation(ssid, password, wifiLinkCache.channel, wifiLinkCache.bssid);
+    fastReconnectPending = true;
+    fastReconnectStart = millis();
+    Serial.printf("Reconnecting to %s (channel %d, cached BSSID)\n", ssid.c_str(), wifiLinkCache.channel);
+    return true;
+}
+
+void onWiFiConnected() {
+    wifiConnected = true;
+    if (fastReconnectPending) {
+        fastReconnectPending = false;
+        Serial.printf("✓ WiFi up %lu ms after wake (IP %s)\n", millis(), WiFi.localIP().toString().c_str());
+    }
+    if (!idleMode) {
+        esp_wifi_set_ps(WIFI_PS_NONE);
+    }
+    setupI2S();
+}
+
+void resumeRecordingFromWake() {
+    Serial.println("🔘 Button wake - recording while WiFi reconnects");
+    setupI2S();
+
+    // Measured from app start (bootloader time comes on top)
+    startMode = START_DEEP_SLEEP;
+    startCommandSeenAt = 0;
+    startPollInterval = 0;
+    statusRequestRtt = 0;
+    startLatencyPending = true;
+
+    startRecording();
+    buttonRecording = true;
+    recordingActive = true;
+    lastButtonState = true;
+    lastButtonChange = millis();
+
+    if (!beginFastReconnect()) {
+        // No cached link - the full scan runs once the button is released
+        Serial.println("No cached WiFi link - will scan after recording");
+    }
+}
+
+void enterDeepSleep() {
+    Serial.printf("🌙 Deep sleep (wake on button%s)\n", DEEP_SLEEP_TIMER_SEC > 0 ? " or timer" : "");
+    Serial.flush();
+
+    WiFi.disconnect(true);
+    esp_sleep_enable_ext0_wakeup((gpio_num_t)BUTTON_PIN, BUTTON_ACTIVE_LOW ? 0 : 1);
+    if (BUTTON_ACTIVE_LOW) {
+        // Digital pull-ups are off in deep sleep - keep the pin high from the RTC domain
+        rtc_gpio_pullup_en((gpio_num_t)BUTTON_PIN);
+        rtc_gpio_pulldown_dis((gpio_num_t)BUTTON_PIN);
+    }
+    if (DEEP_SLEEP_TIMER_SEC > 0) {
+        esp_sleep_enable_timer_wakeup((uint64_t)DEEP_SLEEP_TIMER_SEC * 1000000ULL);
+    }
+    esp_deep_sleep_start();
+}
+
 void setupI2S() {
+    if (i2sInstalled) {
+        return;
+    }
     Serial.println("\nInitializing I2S microphone...");
 
     i2s_config_t i2s_config = {
@@ -405,6 +1018,7 @@ void setupI2S() {
     // Note: This may vary by board, but setting PDM RX clock divider can help
     // The XIAO ESP32-S3 Sense has a built-in mic with fixed gain, but we can optimize I2S settings
     
+    i2sInstalled = true;
     Serial.println("I2S microphone initialized successfully");
     Serial.printf("Sample rate: %d Hz, %d-bit, mono\n", SAMPLE_RATE, BITS_PER_SAMPLE);
     Serial.printf("Data rate: ~%d KB/s\n", (SAMPLE_RATE * BITS_PER_SAMPLE) / 8000);
@@ -412,11 +1026,17 @@ void setupI2S() {
 }
 
 void startRecording() {
-    Serial.println("\n🔴 Recording started by server");
+    Serial.println("\n🔴 Recording started");
+
+    deepSleepIdleMs = DEEP_SLEEP_IDLE_MS;
 
     // Reset buffer
     recordingBufferSize = 0;
 
+    setPipelineLoad(LOAD_CAPTURE, true);
+    setPipelineLoad(LOAD_DSP, ENABLE_AUDIO_METRICS);
+    lastI2sReturnUs = 0;
+
     // Reset audio quality metrics
     audioMetrics.avgDbLevel = 0.0;
     audioMetrics.maxDbLevel = -100.0;
@@ -432,23 +1052,25 @@ void startRecording() {
 }
 
 void stopRecordingAndUpload() {
-    Serial.println("\n⏹️  Recording stopped by server");
+    Serial.println("\n⏹️  Recording stopped");
+    setPipelineLoad(LOAD_CAPTURE | LOAD_DSP, false);
 
     Serial.printf("Captured %d bytes (%.2f seconds)\n",
                   recordingBufferSize,
                   (float)recordingBufferSize / (SAMPLE_RATE * 2));
 
     if (recordingBufferSize > 0) {
-        Serial.println("Uploading to server...");
-        bool success = uploadRecording();
-        if (success) {
-            Serial.println("✓ Upload successful");
-        } else {
-            Serial.println("✗ Upload failed");
+        // Hand it to the queue so the capture buffer is free for the next one
+        if (enqueueRecording(PRIORITY_LIVE) && WiFi.status() == WL_CONNECTED) {
+            drainUploadQueue();
+        } else if (WiFi.status() != WL_CONNECTED) {
+            Serial.println("⏳ WiFi not up yet - upload queued");
         }
     } else {
         Serial.println("⚠️  No audio data captured");
     }
+
+    printPowerReport();
 }
 
 void captureAudioChunk() {
@@ -456,6 +1078,7 @@ void captureAudioChunk() {
     if (recordingBufferSize >= recordingBufferCapacity) {
         Serial.println("⚠️  Recording buffer full - stopping recording");
         recordingActive = false;
+        buttonRecording = false;
         // Trigger stop and upload
         stopRecordingAndUpload();
         wasRecording = false;
@@ -470,8 +1093,18 @@ void captureAudioChunk() {
     
     size_t bytesToRead = min(sizeof(audioBuffer), spaceAvailable);
 
+    // Everything since the last read returned was work the DMA had to cover for
+    unsigned long readStartUs = micros();
+    uint64_t busyUs = lastI2sReturnUs ? (uint64_t)(readStartUs - lastI2sReturnUs) : 0;
+
     // Read from I2S with timeout to prevent blocking indefinitely
     esp_err_t result = i2s_read(I2S_PORT, audioBuffer, bytesToRead, &bytesRead, portMAX_DELAY);
+    lastI2sReturnUs = micros();
+
+    PipelineStats& stats = pipelineStats[pipelineLoad & (PIPELINE_CONFIGS - 1)];
+    stats.busyUs += busyUs;
+    stats.audioUs += (uint64_t)bytesRead * 1000000ULL / (SAMPLE_RATE * (BITS_PER_SAMPLE / 8));
+    stats.cpuMhz = getCpuFrequencyMhz();
 
     if (result == ESP_OK && bytesRead > 0) {
         // Ensure we don't exceed buffer capacity (safety check)
@@ -479,82 +1112,20 @@ void captureAudioChunk() {
             bytesRead = recordingBufferCapacity - recordingBufferSize;
         }
         
-        // Calculate audio level for monitoring (RMS calculation)
-        int16_t* samples = (int16_t*)audioBuffer;
-        int numSamples = bytesRead / sizeof(int16_t);
-        long sumSquares = 0;
-        int clipSamples = 0;
-        
-        for (int i = 0; i < numSamples; i++) {
-            long sample = (long)samples[i];
-            sumSquares += sample * sample;
-            
-            // Detect clipping (samples near max/min values)
-            if (sample > 30000 || sample < -30000) {
-                clipSamples++;
-            }
-        }
-        
-        float rms = sqrt((float)sumSquares / numSamples);
-        
-        // Calculate dB level safely (avoid log10 of 0 or negative)
-        float dbLevel = -100.0;  // Default to very quiet
-        if (rms > 0.0 && rms <= 32768.0) {
-            float ratio = rms / 32768.0;
-            if (ratio > 0.0) {
-                dbLevel = 20.0 * log10(ratio);
-            }
-        } else if (rms > 32768.0) {
-            // Clipping detected
-            dbLevel = 0.0;  // At maximum
-        }
-        
-        // Update audio quality metrics (only if dbLevel is valid)
-        // Check for NaN/Inf using comparison (ESP32 may not have isnan/isinf)
-        bool isValidDb = (dbLevel == dbLevel) && (dbLevel >= -200.0) && (dbLevel <= 100.0);
-        
-        if (isValidDb) {
-            audioMetrics.totalChunks++;
-            
-            // Initialize avgDbLevel on first valid chunk
-            if (audioMetrics.totalChunks == 1) {
-                audioMetrics.avgDbLevel = dbLevel;
-            } else {
-                // Running average calculation
-                audioMetrics.avgDbLevel = (audioMetrics.avgDbLevel * (audioMetrics.totalChunks - 1) + dbLevel) / audioMetrics.totalChunks;
-            }
-            
-            // Ensure avgDbLevel is valid (NaN check: NaN != NaN is true)
-            if (audioMetrics.avgDbLevel != audioMetrics.avgDbLevel || 
-                audioMetrics.avgDbLevel < -200.0 || 
-                audioMetrics.avgDbLevel > 100.0) {
-                audioMetrics.avgDbLevel = dbLevel;  // Reset to current value
-            }
-        }
-        
-        if (dbLevel > audioMetrics.maxDbLevel) {
-            audioMetrics.maxDbLevel = dbLevel;
-        }
-        // Update min level (only if current is valid and less than previous, or if min is uninitialized)
-        bool isValidMin = (dbLevel == dbLevel) && (dbLevel >= -200.0) && (dbLevel <= 100.0);
-        if (isValidMin && (audioMetrics.minDbLevel == 0.0 || dbLevel < audioMetrics.minDbLevel)) {
-            audioMetrics.minDbLevel = dbLevel;
+        // Level/clipping analysis is the DSP stage - it's what needs the fast clock
+        float dbLevel = -100.0;
+        if (ENABLE_AUDIO_METRICS) {
+            dbLevel = analyzeAudioChunk((int16_t*)audioBuffer, bytesRead / sizeof(int16_t));
         }
-        
-        // Detect clipping (more than 1% of samples clipped)
-        if (clipSamples > (numSamples / 100)) {
-            audioMetrics.clipCount++;
-        }
-        
-        // Detect silence
-        if (dbLevel < audioMetrics.silenceThreshold) {
-            audioMetrics.silenceChunks++;
-        }
-        
+
         // Copy to recording buffer
         if (bytesRead > 0) {
+            if (recordingBufferSize == 0) {
+                firstSampleAt = millis();
+            }
             memcpy(recordingBuffer + recordingBufferSize, audioBuffer, bytesRead);
             recordingBufferSize += bytesRead;
+            recordStartLatency();
         }
 
         // Print progress every second with audio level monitoring
@@ -574,13 +1145,565 @@ void captureAudioChunk() {
     }
 }
 
-bool uploadRecording() {
-    if (recordingBufferSize == 0) {
+float analyzeAudioChunk(const int16_t* samples, int numSamples) {
+    // Calculate audio level for monitoring (RMS calculation)
+    long sumSquares = 0;
+    int clipSamples = 0;
+    
+    for (int i = 0; i < numSamples; i++) {
+        long sample = (long)samples[i];
+        sumSquares += sample * sample;
+        
+        // Detect clipping (samples near max/min values)
+        if (sample > 30000 || sample < -30000) {
+            clipSamples++;
+        }
+    }
+    
+    float rms = sqrt((float)sumSquares / numSamples);
+    
+    // Calculate dB level safely (avoid log10 of 0 or negative)
+    float dbLevel = -100.0;  // Default to very quiet
+    if (rms > 0.0 && rms <= 32768.0) {
+        float ratio = rms / 32768.0;
+        if (ratio > 0.0) {
+            dbLevel = 20.0 * log10(ratio);
+        }
+    } else if (rms > 32768.0) {
+        // Clipping detected
+        dbLevel = 0.0;  // At maximum
+    }
+    
+    // Update audio quality metrics (only if dbLevel is valid)
+    // Check for NaN/Inf using comparison (ESP32 may not have isnan/isinf)
+    bool isValidDb = (dbLevel == dbLevel) && (dbLevel >= -200.0) && (dbLevel <= 100.0);
+    
+    if (isValidDb) {
+        audioMetrics.totalChunks++;
+        
+        // Initialize avgDbLevel on first valid chunk
+        if (audioMetrics.totalChunks == 1) {
+            audioMetrics.avgDbLevel = dbLevel;
+        } else {
+            // Running average calculation
+            audioMetrics.avgDbLevel = (audioMetrics.avgDbLevel * (audioMetrics.totalChunks - 1) + dbLevel) / audioMetrics.totalChunks;
+        }
+        
+        // Ensure avgDbLevel is valid (NaN check: NaN != NaN is true)
+        if (audioMetrics.avgDbLevel != audioMetrics.avgDbLevel || 
+            audioMetrics.avgDbLevel < -200.0 || 
+            audioMetrics.avgDbLevel > 100.0) {
+            audioMetrics.avgDbLevel = dbLevel;  // Reset to current value
+        }
+    }
+    
+    if (dbLevel > audioMetrics.maxDbLevel) {
+        audioMetrics.maxDbLevel = dbLevel;
+    }
+    // Update min level (only if current is valid and less than previous, or if min is uninitialized)
+    bool isValidMin = (dbLevel == dbLevel) && (dbLevel >= -200.0) && (dbLevel <= 100.0);
+    if (isValidMin && (audioMetrics.minDbLevel == 0.0 || dbLevel < audioMetrics.minDbLevel)) {
+        audioMetrics.minDbLevel = dbLevel;
+    }
+    
+    // Detect clipping (more than 1% of samples clipped)
+    if (clipSamples > (numSamples / 100)) {
+        audioMetrics.clipCount++;
+    }
+    
+    // Detect silence
+    if (dbLevel < audioMetrics.silenceThreshold) {
+        audioMetrics.silenceChunks++;
+    }
+
+    return dbLevel;
+}
+
+String spoolPath(const char* id, const char* extension) {
+    return String("/spool/") + id + extension;
+}
+
+// PSRAM is lost in deep sleep - only sleep if every queued recording is on flash
+bool uploadQueueSurvivesDeepSleep() {
+    for (int i = 0; i < uploadQueueDepth; i++) {
+        if (!uploadQueue[i].spooled) {
+            return false;
+        }
+    }
+    return true;
+}
+
+unsigned long uploadQueueOldestAge() {
+    unsigned long now = millis();
+    unsigned long oldest = 0;
+    for (int i = 0; i < uploadQueueDepth; i++) {
+        unsigned long age = now - uploadQueue[i].completedAt;
+        if (age > oldest) {
+            oldest = age;
+        }
+    }
+    return oldest;
+}
+
+void removeQueuedRecording(int index) {
+    QueuedRecording& rec = uploadQueue[index];
+    if (rec.data) {
+        free(rec.data);
+        uploadQueueBytes -= rec.size;
+    }
+    if (rec.spooled && spoolReady) {
+        LittleFS.remove(spoolPath(rec.id, ".pcm"));
+        LittleFS.remove(spoolPath(rec.id, ".meta"));
+    }
+    for (int i = index; i < uploadQueueDepth - 1; i++) {
+        uploadQueue[i] = uploadQueue[i + 1];
+    }
+    uploadQueueDepth--;
+    uploadQueue[uploadQueueDepth] = QueuedRecording();
+}
+
+// Lowest priority first, oldest within a priority
+int pickEvictionVictim() {
+    int victim = -1;
+    for (int i = 0; i < uploadQueueDepth; i++) {
+        if (victim < 0 ||
+            uploadQueue[i].priority > uploadQueue[victim].priority ||
+            (uploadQueue[i].priority == uploadQueue[victim].priority &&
+             uploadQueue[i].completedAt < uploadQueue[victim].completedAt)) {
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+// Highest priority first, oldest within a priority, skipping entries still backing off
+int pickNextUpload(const bool* exclude = nullptr, bool inMemoryOnly = false) {
+    unsigned long now = millis();
+    int next = -1;
+    for (int i = 0; i < uploadQueueDepth; i++) {
+        const QueuedRecording& rec = uploadQueue[i];
+        if (rec.attempts > 0 && now - rec.lastAttemptAt < rec.backoffMs) {
+            continue;
+        }
+        if ((exclude && exclude[i]) || (inMemoryOnly && !rec.data)) {
+            continue;
+        }
+        if (next < 0 ||
+            rec.priority < uploadQueue[next].priority ||
+            (rec.priority == uploadQueue[next].priority &&
+             rec.completedAt < uploadQueue[next].completedAt)) {
+            next = i;
+        }
+    }
+    return next;
+}
+
+bool spoolToFlash(QueuedRecording& rec) {
+    if (!spoolReady || rec.spooled || !rec.data) {
+        return rec.spooled;
+    }
+
+    SpoolMeta meta;
+    meta.magic = SPOOL_MAGIC;
+    meta.size = rec.size;
+    memcpy(meta.id, rec.id, sizeof(meta.id));
+    meta.metrics = rec.metrics;
+
+    // Data first, header last - a header only exists for complete recordings
+    File pcm = LittleFS.open(spoolPath(rec.id, ".pcm"), FILE_WRITE);
+    bool ok = pcm && pcm.write(rec.data, rec.size) == rec.size;
+    pcm.close();
+    if (ok) {
+        File metaFile = LittleFS.open(spoolPath(rec.id, ".meta"), FILE_WRITE);
+        ok = metaFile && metaFile.write((const uint8_t*)&meta, sizeof(meta)) == sizeof(meta);
+        metaFile.close();
+    }
+    if (!ok) {
+        Serial.printf("⚠️  Could not spool %s to flash\n", rec.id);
+        LittleFS.remove(spoolPath(rec.id, ".pcm"));
         return false;
     }
 
-    // Store buffer size before upload (in case it changes during upload)
-    size_t bufferSizeToUpload = recordingBufferSize;
+    rec.spooled = true;
+    Serial.printf("💾 Spooled %s to flash (%d KB)\n", rec.id, rec.size / 1024);
+    return true;
+}
+
+void setupUploadQueue() {
+    bootId = esp_random();
+
+    if (!UPLOAD_QUEUE_FLASH_SPOOL) {
+        return;
+    }
+    if (!LittleFS.begin(true)) {
+        Serial.println("⚠️  LittleFS mount failed - flash spool disabled");
+        return;
+    }
+    spoolReady = true;
+    LittleFS.mkdir("/spool");
+
+    // Recordings that never made it out before the last reboot/deep sleep.
+    // They stay on flash and are streamed from there when their turn comes.
+    File dir = LittleFS.open("/spool");
+    for (File entry = dir.openNextFile(); entry; entry = dir.openNextFile()) {
+        String name = entry.name();
+        if (!name.endsWith(".meta")) {
+            continue;
+        }
+        SpoolMeta meta;
+        bool valid = entry.read((uint8_t*)&meta, sizeof(meta)) == sizeof(meta) && meta.magic == SPOOL_MAGIC;
+        entry.close();
+        if (!valid || uploadQueueDepth >= UPLOAD_QUEUE_MAX_ENTRIES) {
+            continue;
+        }
+
+        QueuedRecording& rec = uploadQueue[uploadQueueDepth++];
+        rec = QueuedRecording();
+        rec.size = meta.size;
+        rec.priority = PRIORITY_SPOOLED;
+        memcpy(rec.id, meta.id, sizeof(rec.id));
+        rec.id[sizeof(rec.id) - 1] = '\0';
+        rec.metrics = meta.metrics;
+        rec.completedAt = millis();
+        rec.spooled = true;
+    }
+    dir.close();
+
+    if (uploadQueueDepth > 0) {
+        Serial.printf("Recovered %d spooled recording(s) from flash\n", uploadQueueDepth);
+    }
+}
+
+bool enqueueRecording(UploadPriority priority) {
+    // Make room: drop the least important recordings first
+    while (uploadQueueDepth > 0 &&
+           (uploadQueueDepth >= UPLOAD_QUEUE_MAX_ENTRIES ||
+            uploadQueueBytes + recordingBufferSize > UPLOAD_QUEUE_MAX_BYTES)) {
+        int victim = pickEvictionVictim();
+        Serial.printf("⚠️  Upload queue full - dropping %s\n", uploadQueue[victim].id);
+        removeQueuedRecording(victim);
+    }
+
+    uint8_t* data = (uint8_t*)ps_malloc(recordingBufferSize);
+    if (!data) {
+        Serial.println("ERROR: No PSRAM for upload queue - recording lost");
+        return false;
+    }
+    memcpy(data, recordingBuffer, recordingBufferSize);
+
+    QueuedRecording& rec = uploadQueue[uploadQueueDepth++];
+    rec = QueuedRecording();
+    rec.data = data;
+    rec.size = recordingBufferSize;
+    rec.priority = priority;
+    snprintf(rec.id, sizeof(rec.id), "%s-%08lx-%lu",
+             deviceId.c_str(), (unsigned long)bootId, (unsigned long)++recordingSeq);
+    rec.completedAt = millis();
+    rec.traced = true;
+    rec.startSeenAt = startCommandSeenAt;
+    rec.firstSampleAt = firstSampleAt;
+    rec.pollRtt = statusRequestRtt;
+    rec.metrics = audioMetrics;
+    uploadQueueBytes += rec.size;
+
+    Serial.printf("Queued %s (%d KB, queue depth %d)\n", rec.id, rec.size / 1024, uploadQueueDepth);
+    return true;
+}
+
+// Next in-memory clips in upload order, bounded by clip count and bytes.
+// Returns 0 while a clip that just finished is still inside the batching
+// window - push-to-talk clips tend to come in bursts.
+int collectUploadBatch(int* batch) {
+    unsigned long now = millis();
+    bool taken[UPLOAD_QUEUE_MAX_ENTRIES] = {false};
+    size_t bytes = 0;
+    bool fresh = false;
+    int count = 0;
+
+    while (count < UPLOAD_BATCH_MAX_CLIPS) {
+        int next = pickNextUpload(taken, true);
+        if (next < 0 || (count > 0 && bytes + uploadQueue[next].size > UPLOAD_BATCH_MAX_BYTES)) {
+            break;
+        }
+        const QueuedRecording& rec = uploadQueue[next];
+        if (rec.attempts == 0 && now - rec.completedAt < UPLOAD_BATCH_WINDOW_MS) {
+            fresh = true;
+        }
+        taken[next] = true;
+        batch[count++] = next;
+        bytes += rec.size;
+    }
+
+    if (fresh && count < UPLOAD_BATCH_MAX_CLIPS && bytes < UPLOAD_BATCH_MAX_BYTES) {
+        return 0;
+    }
+    return count;
+}
+
+void applyUploadResult(int index, int httpCode) {
+    QueuedRecording& rec = uploadQueue[index];
+
+    if (httpCode == 200 || httpCode == 204) {
+        Serial.println("✓ Upload successful");
+        removeQueuedRecording(index);
+        return;
+    }
+
+    // 4xx (other than timeout/throttling) won't get better by retrying
+    if (httpCode >= 400 && httpCode < 500 && httpCode != 408 && httpCode != 429) {
+        Serial.printf("✗ Server rejected %s - dropping\n", rec.id);
+        removeQueuedRecording(index);
+        return;
+    }
+
+    int shift = rec.attempts - 1 < 5 ? rec.attempts - 1 : 5;
+    rec.backoffMs = min((unsigned long)UPLOAD_RETRY_BASE_MS << shift, (unsigned long)UPLOAD_RETRY_MAX_MS);
+    // An overloaded server says when it expects room; don't come back sooner
+    if (serverRetryAfterMs > rec.backoffMs) {
+        rec.backoffMs = min(serverRetryAfterMs, (unsigned long)UPLOAD_RETRY_MAX_MS);
+    }
+    if (UPLOAD_QUEUE_FLASH_SPOOL) {
+        spoolToFlash(rec);
+    }
+    Serial.printf("✗ Upload failed - retrying %s in %lu ms\n", rec.id, rec.backoffMs);
+}
+
+// Raw value of "key" in a flat JSON object (strings without their quotes)
+String jsonField(const String& object, const char* key) {
+    String quoted = String("\"") + key + "\"";
+    int pos = object.indexOf(quoted);
+    if (pos < 0) {
+        return "";
+    }
+    pos = object.indexOf(':', pos + quoted.length());
+    if (pos < 0) {
+        return "";
+    }
+    pos++;
+    while (pos < (int)object.length() && object[pos] == ' ') {
+        pos++;
+    }
+    if (pos < (int)object.length() && object[pos] == '"') {
+        int end = object.indexOf('"', pos + 1);
+        return end < 0 ? "" : object.substring(pos + 1, end);
+    }
+    int end = pos;
+    while (end < (int)object.length() && object[end] != ',' && object[end] != '}') {
+        end++;
+    }
+    return object.substring(pos, end);
+}
+
+// One clip's result from an /audio-batch response
+// ({"clips":[{"id":...,"status":...,"code":...},...]}) as an HTTP code for
+// applyUploadResult; the request's own code if the body doesn't list it
+int batchClipResult(const String& response, const char* id, int fallback) {
+    int start = response.indexOf('{', 1);
+    while (start >= 0) {
+        int end = response.indexOf('}', start);
+        if (end < 0) {
+            break;
+        }
+        String clip = response.substring(start, end + 1);
+        if (jsonField(clip, "id") == id) {
+            String status = jsonField(clip, "status");
+            if (status == "success" || status == "duplicate") {
+                return 200;
+            }
+            if (status == "busy") {
+                return 503;
+            }
+            int code = jsonField(clip, "code").toInt();
+            return code > 0 ? code : fallback;
+        }
+        start = response.indexOf('{', end);
+    }
+    return fallback;
+}
+
+// Remember the server's Retry-After (seconds) for applyUploadResult
+void readRetryAfter(HTTPClient& http) {
+    serverRetryAfterMs = http.hasHeader("Retry-After") ? http.header("Retry-After").toInt() * 1000UL : 0;
+}
+
+void drainUploadQueue() {
+    int index = pickNextUpload();
+    if (index < 0) {
+        return;
+    }
+
+    if (UPLOAD_BATCH_ENABLED && batchEndpointAvailable && uploadQueue[index].data) {
+        int batch[UPLOAD_BATCH_MAX_CLIPS];
+        int count = collectUploadBatch(batch);
+        if (count == 0) {
+            return;  // Waiting out the batching window
+        }
+        if (count > 1) {
+            unsigned long now = millis();
+            for (int i = 0; i < count; i++) {
+                uploadQueue[batch[i]].attempts++;
+                uploadQueue[batch[i]].lastAttemptAt = now;
+            }
+            String response;
+            int httpCode = uploadBatch(batch, count, response);
+
+            if (httpCode == 404 || httpCode == 405) {
+                // Older server - fall back to one request per clip
+                Serial.println("⚠️  Server has no /audio-batch - uploading clips individually");
+                batchEndpointAvailable = false;
+                for (int i = 0; i < count; i++) {
+                    uploadQueue[batch[i]].attempts--;
+                }
+                return;
+            }
+
+            // Highest index first so removals don't shift the ones still to handle
+            for (int i = 1; i < count; i++) {
+                for (int j = i; j > 0 && batch[j] > batch[j - 1]; j--) {
+                    int swap = batch[j];
+                    batch[j] = batch[j - 1];
+                    batch[j - 1] = swap;
+                }
+            }
+            // Each clip by its own result: one failed clip mustn't drop or retry the rest
+            for (int i = 0; i < count; i++) {
+                applyUploadResult(batch[i], batchClipResult(response, uploadQueue[batch[i]].id, httpCode));
+            }
+            return;
+        }
+        index = batch[0];
+    }
+
+    QueuedRecording& rec = uploadQueue[index];
+    rec.attempts++;
+    rec.lastAttemptAt = millis();
+    applyUploadResult(index, uploadRecording(rec));
+}
+
+bool validDbLevel(float db) {
+    // NaN != NaN, so this also filters NaN
+    return db == db && db >= -200.0 && db <= 100.0;
+}
+
+void putLe32(uint8_t* out, uint32_t value) {
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+    out[2] = (value >> 16) & 0xFF;
+    out[3] = (value >> 24) & 0xFF;
+}
+
+// Latency trace for the server: how long before this upload the start was
+// seen, the first sample was captured and recording stopped. Offsets rather
+// than timestamps, so the server can place them on its own clock.
+String recordingTrace(const QueuedRecording& rec) {
+    if (!rec.traced) {
+        return String();
+    }
+    unsigned long now = millis();
+    char trace[96];
+    snprintf(trace, sizeof(trace), "start_seen=%lu,first_sample=%lu,stop=%lu,poll_rtt=%lu",
+             now - rec.startSeenAt, now - rec.firstSampleAt, now - rec.completedAt, rec.pollRtt);
+    return String(trace);
+}
+
+// Per-clip metadata for /audio-batch - same fields as the single-upload headers
+String recordingMetaJson(const QueuedRecording& rec) {
+    const AudioQualityMetrics& metrics = rec.metrics;
+    char json[480];
+    int len = snprintf(json, sizeof(json),
+                       "{\"id\":\"%s\",\"priority\":%u,\"age_ms\":%lu,\"attempt\":%u,"
+                       "\"clip_count\":%d,\"silence_chunks\":%d,\"i2s_errors\":%d,\"total_chunks\":%d",
+                       rec.id, rec.priority, millis() - rec.completedAt, rec.attempts,
+                       metrics.clipCount, metrics.silenceChunks, metrics.i2sErrors, metrics.totalChunks);
+    if (validDbLevel(metrics.avgDbLevel)) {
+        len += snprintf(json + len, sizeof(json) - len, ",\"avg_db\":%.1f", metrics.avgDbLevel);
+    }
+    if (validDbLevel(metrics.maxDbLevel)) {
+        len += snprintf(json + len, sizeof(json) - len, ",\"max_db\":%.1f", metrics.maxDbLevel);
+    }
+    if (validDbLevel(metrics.minDbLevel) && metrics.minDbLevel != 0.0) {
+        len += snprintf(json + len, sizeof(json) - len, ",\"min_db\":%.1f", metrics.minDbLevel);
+    }
+    if (rec.traced) {
+        len += snprintf(json + len, sizeof(json) - len, ",\"trace\":\"%s\"", recordingTrace(rec).c_str());
+    }
+    snprintf(json + len, sizeof(json) - len, "}");
+    return String(json);
+}
+
+// Several queued clips in one request:
+// [u32 meta_len][meta JSON][u32 pcm_len][pcm] per clip, little-endian
+int uploadBatch(const int* indices, int count, String& response) {
+    BatchBodyStream body;
+    String metas[UPLOAD_BATCH_MAX_CLIPS];
+    uint8_t prefixes[UPLOAD_BATCH_MAX_CLIPS][2][4];
+    size_t pcmBytes = 0;
+
+    for (int i = 0; i < count; i++) {
+        const QueuedRecording& rec = uploadQueue[indices[i]];
+        metas[i] = recordingMetaJson(rec);
+        putLe32(prefixes[i][0], metas[i].length());
+        putLe32(prefixes[i][1], rec.size);
+        body.add(prefixes[i][0], 4);
+        body.add((const uint8_t*)metas[i].c_str(), metas[i].length());
+        body.add(prefixes[i][1], 4);
+        body.add(rec.data, rec.size);
+        pcmBytes += rec.size;
+    }
+
+    HTTPClient http;
+    String url = String(SERVER_URL) + "-batch" +
+                 "?device=" + deviceId +
+                 "&rate=" + SAMPLE_RATE +
+                 "&bits=" + BITS_PER_SAMPLE +
+                 "&channels=" + CHANNELS;
+
+    http.begin(url);
+    http.addHeader("Content-Type", "application/octet-stream");
+    http.addHeader("X-Audio-Format", "pcm");
+    http.addHeader("X-Batch-Clips", String(count));
+    http.collectHeaders(uploadResponseHeaders, 1);
+    http.addHeader("X-Queue-Depth", String(uploadQueueDepth));
+    http.addHeader("X-Queue-Oldest-Ms", String(uploadQueueOldestAge()));
+
+    // Same sizing as single uploads (~100KB/s minimum, at least 30s)
+    unsigned long calculatedTimeout = (unsigned long)((body.size() / 1024) * 100);
+    unsigned long timeoutMs = (30000UL > calculatedTimeout) ? 30000UL : calculatedTimeout;
+    http.setTimeout(timeoutMs);
+
+    float duration = (float)pcmBytes / (SAMPLE_RATE * 2);
+    Serial.printf("Uploading batch: %d clips, %d bytes (%.2f seconds of audio)...\n",
+                 count, body.size(), duration);
+
+    setPipelineLoad(LOAD_UPLOAD, true);
+    unsigned long uploadStart = millis();
+    int httpCode = http.sendRequest("POST", &body, body.size());
+    unsigned long uploadDuration = millis() - uploadStart;
+    setPipelineLoad(LOAD_UPLOAD, false);
+    readRetryAfter(http);
+    if (httpCode > 0) {
+        response = http.getString();  // Per-clip results, also on failure
+    }
+
+    if (httpCode == 200) {
+        uploadRequestCount++;
+        uploadClipCount += count;
+        Serial.printf("📦 Batch upload successful: %d clips in %lu ms (%lu requests for %lu clips so far)\n",
+                     count, uploadDuration, uploadRequestCount, uploadClipCount);
+    } else {
+        char context[128];
+        snprintf(context, sizeof(context), "Device: %s, Batch: %d clips, %d bytes, Duration: %lums",
+                 deviceId.c_str(), count, body.size(), uploadDuration);
+        logHttpError("Batch upload", httpCode, context);
+    }
+
+    http.end();
+    return httpCode;
+}
+
+int uploadRecording(QueuedRecording& rec) {
+    size_t bufferSizeToUpload = rec.size;
+    const AudioQualityMetrics& metrics = rec.metrics;
 
     HTTPClient http;
 
@@ -600,23 +1723,35 @@ bool uploadRecording() {
     
     // Add audio quality metrics as headers (only if valid)
     // Use NaN check: NaN != NaN is true
-    if (audioMetrics.avgDbLevel == audioMetrics.avgDbLevel && 
-        audioMetrics.avgDbLevel >= -200.0 && audioMetrics.avgDbLevel <= 100.0) {
-        http.addHeader("X-Audio-AvgDb", String(audioMetrics.avgDbLevel, 1));
+    if (metrics.avgDbLevel == metrics.avgDbLevel && 
+        metrics.avgDbLevel >= -200.0 && metrics.avgDbLevel <= 100.0) {
+        http.addHeader("X-Audio-AvgDb", String(metrics.avgDbLevel, 1));
     }
-    if (audioMetrics.maxDbLevel == audioMetrics.maxDbLevel && 
-        audioMetrics.maxDbLevel >= -200.0 && audioMetrics.maxDbLevel <= 100.0) {
-        http.addHeader("X-Audio-MaxDb", String(audioMetrics.maxDbLevel, 1));
+    if (metrics.maxDbLevel == metrics.maxDbLevel && 
+        metrics.maxDbLevel >= -200.0 && metrics.maxDbLevel <= 100.0) {
+        http.addHeader("X-Audio-MaxDb", String(metrics.maxDbLevel, 1));
     }
-    if (audioMetrics.minDbLevel == audioMetrics.minDbLevel && 
-        audioMetrics.minDbLevel >= -200.0 && audioMetrics.minDbLevel <= 100.0 && 
-        audioMetrics.minDbLevel != 0.0) {
-        http.addHeader("X-Audio-MinDb", String(audioMetrics.minDbLevel, 1));
+    if (metrics.minDbLevel == metrics.minDbLevel && 
+        metrics.minDbLevel >= -200.0 && metrics.minDbLevel <= 100.0 && 
+        metrics.minDbLevel != 0.0) {
+        http.addHeader("X-Audio-MinDb", String(metrics.minDbLevel, 1));
     }
-    http.addHeader("X-Audio-ClipCount", String(audioMetrics.clipCount));
-    http.addHeader("X-Audio-SilenceChunks", String(audioMetrics.silenceChunks));
-    http.addHeader("X-Audio-I2SErrors", String(audioMetrics.i2sErrors));
-    http.addHeader("X-Audio-TotalChunks", String(audioMetrics.totalChunks));
+    http.addHeader("X-Audio-ClipCount", String(metrics.clipCount));
+    http.addHeader("X-Audio-SilenceChunks", String(metrics.silenceChunks));
+    http.addHeader("X-Audio-I2SErrors", String(metrics.i2sErrors));
+    http.addHeader("X-Audio-TotalChunks", String(metrics.totalChunks));
+
+    // Queue bookkeeping - the id lets the server drop retries it already has
+    http.addHeader("X-Recording-Id", rec.id);
+    http.addHeader("X-Recording-Priority", String(rec.priority));
+    http.addHeader("X-Recording-Age-Ms", String(millis() - rec.completedAt));
+    http.addHeader("X-Upload-Attempt", String(rec.attempts));
+    if (rec.traced) {
+        http.addHeader("X-Trace-Ms", recordingTrace(rec));
+    }
+    http.collectHeaders(uploadResponseHeaders, 1);
+    http.addHeader("X-Queue-Depth", String(uploadQueueDepth));
+    http.addHeader("X-Queue-Oldest-Ms", String(uploadQueueOldestAge()));
     
     // Calculate timeout based on data size (at least 30s, more for larger files)
     // Assume upload speed of ~100KB/s minimum
@@ -625,12 +1760,23 @@ bool uploadRecording() {
     http.setTimeout(timeoutMs);
 
     float duration = (float)bufferSizeToUpload / (SAMPLE_RATE * 2);
-    Serial.printf("Uploading %d bytes (%.2f seconds, timeout: %lu ms)...\n", 
-                 bufferSizeToUpload, duration, timeoutMs);
+    Serial.printf("Uploading %s: %d bytes (%.2f seconds, attempt %d, timeout: %lu ms)...\n", 
+                 rec.id, bufferSizeToUpload, duration, rec.attempts, timeoutMs);
 
+    setPipelineLoad(LOAD_UPLOAD, true);
     unsigned long uploadStart = millis();
-    int httpCode = http.POST(recordingBuffer, bufferSizeToUpload);
+    int httpCode;
+    if (rec.data) {
+        httpCode = http.POST(rec.data, bufferSizeToUpload);
+    } else {
+        // Spooled from a previous boot - stream it straight from flash
+        File spoolFile = LittleFS.open(spoolPath(rec.id, ".pcm"), FILE_READ);
+        httpCode = spoolFile ? http.sendRequest("POST", &spoolFile, bufferSizeToUpload) : -7;
+        spoolFile.close();
+    }
     unsigned long uploadDuration = millis() - uploadStart;
+    setPipelineLoad(LOAD_UPLOAD, false);
+    readRetryAfter(http);
 
     bool success = (httpCode == 200 || httpCode == 204);
 
@@ -654,17 +1800,27 @@ bool uploadRecording() {
         }
     } else {
         float uploadSpeed = (float)bufferSizeToUpload / (uploadDuration / 1000.0) / 1024.0;  // KB/s
-        Serial.printf("✓ Audio upload successful: HTTP %d, %d bytes in %lu ms (%.1f KB/s)\n", 
-                     httpCode, bufferSizeToUpload, uploadDuration, uploadSpeed);
+        uploadRequestCount++;
+        uploadClipCount++;
+        Serial.printf("✓ Audio upload successful: HTTP %d, %d bytes in %lu ms (%.1f KB/s, %lu requests for %lu clips so far)\n", 
+                     httpCode, bufferSizeToUpload, uploadDuration, uploadSpeed, uploadRequestCount, uploadClipCount);
     }
 
     http.end();
-    return success;
+    return httpCode;
 }
 
 bool checkRecordingStatus() {
     HTTPClient http;
     String url = String("http://") + SERVER_HOST + ":" + SERVER_PORT + "/status?device=" + deviceId;
+    if (uploadQueueDepth > 0) {
+        url += "&queue=" + String(uploadQueueDepth) + "&queue_age=" + String(uploadQueueOldestAge());
+    }
+    // For the server's per-device telemetry (/devices/<id>/metrics)
+    if (lastRssiReport == 0 || millis() - lastRssiReport >= RSSI_REPORT_INTERVAL) {
+        url += "&rssi=" + String(WiFi.RSSI());
+        lastRssiReport = millis();
+    }
 
     http.begin(url);
     http.setTimeout(1000);  // 1 second timeout
@@ -1,25 +1,96 @@
 mod server;
 
 use memo_stt::SttEngine;
+use server::archive::spawn_archiver;
 use server::create_router;
+use server::handlers::{replay_journal, spawn_presence_monitor, spawn_stream_reaper};
+use server::inference::{BatchConfig, InferencePool, SimulatedEngine, Transcriber};
+use server::journal::IngestJournal;
+use server::media::TranscodeCache;
 use server::state::ServerState;
+use server::telemetry::{spawn_telemetry_flusher, TelemetryStore};
+use server::transcripts::TranscriptStore;
 use std::sync::Arc;
+use std::time::Duration;
 use tokio::net::TcpListener;
 
 #[tokio::main]
 async fn main() -> anyhow::Result<()> {
     println!("🚀 Starting memo-esp-server...");
     
-    // Initialize Whisper engine (16kHz for ESP32 audio)
-    println!("Loading Whisper model (16kHz for ESP32 audio)...");
-    let engine = SttEngine::new_default(16000)?;
+    // One engine per inference thread, sized to cores by default
+    let workers = env_usize("MEMO_INFERENCE_WORKERS").unwrap_or_else(|| {
+        std::thread::available_parallelism().map(|n| n.get()).unwrap_or(1)
+    });
+    let queue_capacity = env_usize("MEMO_INFERENCE_QUEUE").unwrap_or(64);
+    // Jobs per engine pass, for engines that support batches (1 = off)
+    let batch = BatchConfig {
+        max_batch: env_usize("MEMO_INFERENCE_BATCH").unwrap_or(8),
+        window: Duration::from_millis(env_usize("MEMO_BATCH_WINDOW_MS").unwrap_or(30) as u64),
+    };
+
+    let mut engines: Vec<Box<dyn Transcriber>> = Vec::with_capacity(workers);
+    if let Some(ms_per_sec) = env_usize("MEMO_SIMULATED_INFERENCE_MS") {
+        // Stand-in engines for load testing: N ms of work per second of audio
+        println!("Using simulated inference ({} ms per audio second)", ms_per_sec);
+        for _ in 0..workers {
+            engines.push(Box::new(SimulatedEngine {
+                sample_rate: 16000,
+                cost_per_audio_sec: Duration::from_millis(ms_per_sec as u64),
+                max_batch: batch.max_batch,
+            }));
+        }
+    } else {
+        // Initialize Whisper engines (16kHz for ESP32 audio)
+        println!("Loading {} Whisper model instance(s) (16kHz for ESP32 audio)...", workers);
+        for _ in 0..workers {
+            let engine = SttEngine::new_default(16000)?;
+            engine.warmup()?;
+            engines.push(Box::new(engine));
+        }
+        println!("✓ Model ready!");
+    }
+    let inference = InferencePool::new(engines, queue_capacity, batch);
+    println!(
+        "✓ Inference pool: {} worker(s), queue capacity {}, batches up to {} ({} ms window)",
+        workers,
+        queue_capacity,
+        batch.max_batch,
+        batch.window.as_millis()
+    );
     
-    println!("Warming up GPU...");
-    engine.warmup()?;
-    println!("✓ Model ready!");
+    // Transcript log + index (imports old per-file transcripts on first run)
+    let transcripts = TranscriptStore::open(std::path::Path::new("transcripts"))?;
     
+    // Accepted uploads are journaled until transcribed (MEMO_JOURNAL_FSYNC=0
+    // keeps the journal but skips fsync, to measure what durability costs)
+    let fsync = std::env::var("MEMO_JOURNAL_FSYNC").map_or(true, |v| v != "0");
+    let (journal, unfinished) =
+        IngestJournal::open(std::path::Path::new("received_audio/ingest.journal"), fsync)?;
+
+    // Opus copies for /audio-file?format=opus, made on first request
+    let transcode_cache = TranscodeCache::new(
+        std::path::Path::new("audio_cache"),
+        env_usize("MEMO_TRANSCODE_CACHE_MB").unwrap_or(512) as u64 * 1024 * 1024,
+        std::env::var("MEMO_FFMPEG").unwrap_or_else(|_| "ffmpeg".to_string()),
+    );
+
+    // Per-device audio and WiFi metrics over time, for /devices/:id/metrics
+    let telemetry = TelemetryStore::open(std::path::Path::new("telemetry"))?;
+
     // Create server state
-    let state = Arc::new(ServerState::new(engine));
+    let state = Arc::new(ServerState::new(inference, transcripts, journal, transcode_cache, telemetry));
+    replay_journal(state.clone(), unfinished);
+    spawn_presence_monitor(state.clone());
+    spawn_stream_reaper(state.clone());
+    spawn_telemetry_flusher(state.clone());
+
+    // Recordings older than MEMO_ARCHIVE_AFTER_HOURS are recompressed to FLAC
+    // while transcription is idle (MEMO_ARCHIVE=0 keeps every WAV)
+    if std::env::var("MEMO_ARCHIVE").map_or(true, |v| v != "0") {
+        let hours = env_usize("MEMO_ARCHIVE_AFTER_HOURS").unwrap_or(24) as u64;
+        spawn_archiver(state.clone(), "received_audio".into(), Duration::from_secs(hours * 3600));
+    }
     
     // Create router
     let app = create_router(state);
@@ -41,3 +112,7 @@ async fn main() -> anyhow::Result<()> {
     
     Ok(())
 }
+
+fn env_usize(name: &str) -> Option<usize> {
+    std::env::var(name).ok()?.parse().ok().filter(|&n| n > 0)
+}
@@ -0,0 +1,160 @@
+use crate::server::audio::{archived_path, wav_format};
+use crate::server::flac;
+use crate::server::metrics::counter;
+use crate::server::state::ServerState;
+use anyhow::{bail, Context, Result};
+use std::collections::HashSet;
+use std::fs::{self, File};
+use std::io::Write;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::Arc;
+use std::thread;
+use std::time::{Duration, Instant, SystemTime};
+
+/// Pause between scans of the audio directory
+const SCAN_INTERVAL: Duration = Duration::from_secs(10 * 60);
+/// How often a waiting archiver checks whether transcription has drained
+const IDLE_POLL: Duration = Duration::from_millis(500);
+/// Share of one core the archiver uses while it runs
+const DUTY_CYCLE: f64 = 0.25;
+
+/// Totals since startup, for `/inference-stats` and `/metrics`
+#[derive(Default)]
+pub struct ArchiveStats {
+    files: AtomicU64,
+    wav_bytes: AtomicU64,
+    flac_bytes: AtomicU64,
+    failures: AtomicU64,
+    /// Times the archiver held off because transcription was running
+    yields: AtomicU64,
+}
+
+impl ArchiveStats {
+    pub fn stats_json(&self) -> serde_json::Value {
+        let wav_bytes = self.wav_bytes.load(Ordering::Relaxed);
+        let flac_bytes = self.flac_bytes.load(Ordering::Relaxed);
+        serde_json::json!({
+            "files": self.files.load(Ordering::Relaxed),
+            "wav_bytes": wav_bytes,
+            "flac_bytes": flac_bytes,
+            "saved_bytes": wav_bytes.saturating_sub(flac_bytes),
+            "ratio": if wav_bytes > 0 { flac_bytes as f64 / wav_bytes as f64 } else { 0.0 },
+            "failures": self.failures.load(Ordering::Relaxed),
+            "yields": self.yields.load(Ordering::Relaxed),
+        })
+    }
+
+    pub fn render(&self, out: &mut String) {
+        let wav_bytes = self.wav_bytes.load(Ordering::Relaxed);
+        let flac_bytes = self.flac_bytes.load(Ordering::Relaxed);
+        counter(out, "memo_archive_files_total", "Recordings compressed to FLAC", self.files.load(Ordering::Relaxed));
+        counter(out, "memo_archive_wav_bytes_total", "WAV bytes compressed to FLAC", wav_bytes);
+        counter(out, "memo_archive_saved_bytes_total", "Disk bytes freed by FLAC archiving", wav_bytes.saturating_sub(flac_bytes));
+        counter(out, "memo_archive_failures_total", "Recordings the archiver could not compress", self.failures.load(Ordering::Relaxed));
+    }
+}
+
+/// Compress recordings in `dir` that are older than `after` from WAV to
+/// FLAC (about two thirds the size for speech, losslessly), on a thread of
+/// its own.
+///
+/// Transcription always comes first: the archiver only starts a file when
+/// the inference pool is idle, and sleeps after each one so it averages
+/// `DUTY_CYCLE` of a core. Readers of a recording (`read_recording`,
+/// `/audio-file`) fall back to the FLAC once the WAV is gone.
+pub fn spawn_archiver(state: Arc<ServerState>, dir: PathBuf, after: Duration) {
+    thread::Builder::new()
+        .name("audio-archiver".to_string())
+        .spawn(move || run_archiver(state, dir, after))
+        .expect("failed to spawn archiver thread");
+}
+
+fn run_archiver(state: Arc<ServerState>, dir: PathBuf, after: Duration) {
+    // Not retried until restart
+    let mut failed: HashSet<PathBuf> = HashSet::new();
+    loop {
+        for wav_path in due_recordings(&dir, after) {
+            if failed.contains(&wav_path) {
+                continue;
+            }
+            wait_until_idle(&state);
+
+            let started = Instant::now();
+            match archive_recording(&state, &wav_path) {
+                Ok((wav_bytes, flac_bytes)) => {
+                    let stats = &state.archive;
+                    stats.files.fetch_add(1, Ordering::Relaxed);
+                    stats.wav_bytes.fetch_add(wav_bytes, Ordering::Relaxed);
+                    stats.flac_bytes.fetch_add(flac_bytes, Ordering::Relaxed);
+                }
+                Err(e) => {
+                    eprintln!("⚠️  Can't archive {}: {}", wav_path.display(), e);
+                    state.archive.failures.fetch_add(1, Ordering::Relaxed);
+                    failed.insert(wav_path);
+                }
+            }
+            thread::sleep(started.elapsed().mul_f64((1.0 - DUTY_CYCLE) / DUTY_CYCLE));
+        }
+        thread::sleep(SCAN_INTERVAL);
+    }
+}
+
+/// Hold off while the inference pool has work
+fn wait_until_idle(state: &ServerState) {
+    if !state.inference.is_idle() {
+        state.archive.yields.fetch_add(1, Ordering::Relaxed);
+        while !state.inference.is_idle() {
+            thread::sleep(IDLE_POLL);
+        }
+    }
+}
+
+/// WAVs last modified at least `after` ago, oldest first
+fn due_recordings(dir: &Path, after: Duration) -> Vec<PathBuf> {
+    let Ok(entries) = fs::read_dir(dir) else {
+        return Vec::new();
+    };
+    let now = SystemTime::now();
+    let mut due: Vec<(SystemTime, PathBuf)> = entries
+        .flatten()
+        .filter(|entry| entry.path().extension().is_some_and(|e| e == "wav"))
+        .filter_map(|entry| {
+            let modified = entry.metadata().ok()?.modified().ok()?;
+            let age = now.duration_since(modified).ok()?;
+            (age >= after).then(|| (modified, entry.path()))
+        })
+        .collect();
+    due.sort();
+    due.into_iter().map(|(_, path)| path).collect()
+}
+
+/// Replace one WAV with a FLAC next to it. The WAV is removed only once the
+/// FLAC is synced to disk, its rename is durable and it decodes to the same
+/// samples. Returns the sizes before and after.
+fn archive_recording(state: &ServerState, wav_path: &Path) -> Result<(u64, u64)> {
+    let contents = fs::read(wav_path)?;
+    let (sample_rate, channels) = wav_format(&contents).context("not a WAV file")?;
+    let samples: Vec<i16> = contents[44..]
+        .chunks_exact(2)
+        .map(|chunk| i16::from_le_bytes([chunk[0], chunk[1]]))
+        .collect();
+    let encoded = flac::encode(&samples, sample_rate, channels);
+    if flac::decode(&encoded)?.samples != samples {
+        bail!("FLAC does not decode to the original samples");
+    }
+
+    let flac_path = archived_path(wav_path);
+    let partial = flac_path.with_extension("flac.partial");
+    let mut file = File::create(&partial)?;
+    file.write_all(&encoded)?;
+    file.sync_all()?;
+    fs::rename(&partial, &flac_path)?;
+    if let Some(dir) = flac_path.parent() {
+        File::open(dir)?.sync_all()?;
+    }
+    // A job queued since the first idle check may be reading the WAV
+    wait_until_idle(state);
+    fs::remove_file(wav_path)?;
+    Ok((contents.len() as u64, encoded.len() as u64))
+}
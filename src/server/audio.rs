@@ -1,7 +1,12 @@
+use axum::body::Bytes;
 use std::fs::File;
-use std::io::Write;
-use std::path::Path;
-use anyhow::Result;
+use std::io::{IoSlice, SeekFrom, Write};
+use std::path::{Path, PathBuf};
+use std::sync::Arc;
+use tokio::io::{AsyncSeekExt, AsyncWriteExt, BufWriter};
+use anyhow::{Context, Result};
+use crate::server::flac;
+use crate::server::peaks::{peaks_path, Peaks, PeaksBuilder};
 
 #[derive(Debug, Clone)]
 pub struct AudioQuality {
@@ -10,52 +15,242 @@ pub struct AudioQuality {
 }
 
 
-/// Save PCM data as WAV file
+/// 16-bit little-endian PCM kept in the request's `Bytes`.
+///
+/// Cloning only bumps a refcount, so storage and inference share one
+/// buffer. Samples are read in place when the buffer is 2-byte aligned on a
+/// little-endian host; otherwise they are converted once up front.
+#[derive(Clone)]
+pub struct PcmBuffer {
+    bytes: Bytes,
+    converted: Option<Arc<[i16]>>,
+}
+
+impl PcmBuffer {
+    pub fn new(bytes: Bytes) -> Self {
+        // A trailing odd byte is not a sample
+        let bytes = bytes.slice(..bytes.len() & !1);
+        // SAFETY: every bit pattern is a valid i16
+        let aligned = unsafe { bytes.align_to::<i16>() }.0.is_empty();
+        let converted = if cfg!(target_endian = "little") && aligned {
+            None
+        } else {
+            Some(
+                bytes
+                    .chunks_exact(2)
+                    .map(|chunk| i16::from_le_bytes([chunk[0], chunk[1]]))
+                    .collect(),
+            )
+        };
+        Self { bytes, converted }
+    }
+
+    pub fn samples(&self) -> &[i16] {
+        match &self.converted {
+            Some(samples) => samples,
+            // SAFETY: checked aligned and little-endian in new()
+            None => unsafe { self.bytes.align_to::<i16>() }.1,
+        }
+    }
+
+    /// Raw little-endian bytes, as they go into the WAV data chunk
+    pub fn as_bytes(&self) -> &[u8] {
+        &self.bytes
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.bytes.is_empty()
+    }
+}
+
+/// Canonical 44-byte header for 16-bit PCM WAV
+pub fn wav_header(pcm_data_len: u32, sample_rate: u32, channels: u16) -> [u8; 44] {
+    let bits_per_sample = 16u16;
+    let mut header = [0u8; 44];
+
+    // RIFF header
+    header[0..4].copy_from_slice(b"RIFF");
+    header[4..8].copy_from_slice(&(36u32 + pcm_data_len).to_le_bytes());
+    header[8..12].copy_from_slice(b"WAVE");
+
+    // fmt chunk
+    header[12..16].copy_from_slice(b"fmt ");
+    header[16..20].copy_from_slice(&16u32.to_le_bytes()); // fmt chunk size
+    header[20..22].copy_from_slice(&1u16.to_le_bytes()); // audio format (PCM)
+    header[22..24].copy_from_slice(&channels.to_le_bytes());
+    header[24..28].copy_from_slice(&sample_rate.to_le_bytes());
+    header[28..32].copy_from_slice(&(sample_rate * channels as u32 * (bits_per_sample as u32 / 8)).to_le_bytes()); // byte rate
+    header[32..34].copy_from_slice(&(channels * (bits_per_sample / 8)).to_le_bytes()); // block align
+    header[34..36].copy_from_slice(&bits_per_sample.to_le_bytes());
+
+    // data chunk
+    header[36..40].copy_from_slice(b"data");
+    header[40..44].copy_from_slice(&pcm_data_len.to_le_bytes());
+
+    header
+}
+
+/// Save PCM data as WAV file (header and body in one vectored write), and
+/// its waveform peaks next to it
 pub fn save_wav_file(
     path: &Path,
-    pcm_data: &[i16],
+    pcm: &PcmBuffer,
     sample_rate: u32,
     channels: u16,
 ) -> Result<()> {
     let mut file = File::create(path)?;
-    
-    let bits_per_sample = 16u16;
-    let pcm_data_len = pcm_data.len() * 2; // 16-bit = 2 bytes per sample
-    let _wav_size = 44 + pcm_data_len;
-    
-    // RIFF header
-    file.write_all(b"RIFF")?;
-    file.write_all(&(36u32 + pcm_data_len as u32).to_le_bytes())?;
-    file.write_all(b"WAVE")?;
-    
-    // fmt chunk
-    file.write_all(b"fmt ")?;
-    file.write_all(&16u32.to_le_bytes())?; // fmt chunk size
-    file.write_all(&1u16.to_le_bytes())?; // audio format (PCM)
-    file.write_all(&channels.to_le_bytes())?;
-    file.write_all(&sample_rate.to_le_bytes())?;
-    file.write_all(&(sample_rate as u32 * channels as u32 * (bits_per_sample as u32 / 8)).to_le_bytes())?; // byte rate
-    file.write_all(&(channels * (bits_per_sample / 8)).to_le_bytes())?; // block align
-    file.write_all(&bits_per_sample.to_le_bytes())?;
-    
-    // data chunk
-    file.write_all(b"data")?;
-    file.write_all(&(pcm_data_len as u32).to_le_bytes())?;
-    
-    // PCM data (16-bit little-endian)
-    for &sample in pcm_data {
-        file.write_all(&sample.to_le_bytes())?;
-    }
-    
+    let body = pcm.as_bytes();
+    let header = wav_header(body.len() as u32, sample_rate, channels);
+
+    let mut slices = [IoSlice::new(&header), IoSlice::new(body)];
+    let mut remaining: &mut [IoSlice] = &mut slices;
+    while !remaining.is_empty() {
+        let written = file.write_vectored(remaining)?;
+        if written == 0 {
+            return Err(std::io::Error::from(std::io::ErrorKind::WriteZero).into());
+        }
+        IoSlice::advance_slices(&mut remaining, written);
+    }
+
+    // Rebuilt on demand if missing, so not worth failing the upload over
+    if let Err(e) = Peaks::of(pcm.samples(), sample_rate, channels).save(&peaks_path(path)) {
+        eprintln!("⚠️  Can't save peaks of {}: {}", path.display(), e);
+    }
     Ok(())
 }
 
+/// Writes a WAV file incrementally as upload chunks arrive. The header goes
+/// out with a zero length first and is patched by `finish`, which also
+/// saves the waveform peaks gathered on the way.
+pub struct WavStreamWriter {
+    file: BufWriter<tokio::fs::File>,
+    path: PathBuf,
+    peaks: PeaksBuilder,
+    data_len: u64,
+    carry: Option<u8>, // Odd byte left over from the previous chunk
+    sample_rate: u32,
+    channels: u16,
+}
+
+impl WavStreamWriter {
+    pub async fn create(path: &Path, sample_rate: u32, channels: u16) -> std::io::Result<Self> {
+        let file = tokio::fs::File::create(path).await?;
+        let mut file = BufWriter::with_capacity(64 * 1024, file);
+        file.write_all(&wav_header(0, sample_rate, channels)).await?;
+        Ok(Self {
+            file,
+            path: path.to_path_buf(),
+            peaks: PeaksBuilder::new(channels),
+            data_len: 0,
+            carry: None,
+            sample_rate,
+            channels,
+        })
+    }
+
+    /// PCM bytes written so far (whole samples only)
+    pub fn data_len(&self) -> u64 {
+        self.data_len
+    }
+
+    pub async fn write(&mut self, mut chunk: &[u8]) -> std::io::Result<()> {
+        // Keep samples whole across chunk boundaries
+        if let Some(low) = self.carry.take() {
+            let Some((&high, rest)) = chunk.split_first() else {
+                self.carry = Some(low);
+                return Ok(());
+            };
+            self.file.write_all(&[low, high]).await?;
+            self.peaks.push(&[i16::from_le_bytes([low, high])]);
+            self.data_len += 2;
+            chunk = rest;
+        }
+        let whole = chunk.len() & !1;
+        self.file.write_all(&chunk[..whole]).await?;
+        self.peaks.push_le_bytes(&chunk[..whole]);
+        self.data_len += whole as u64;
+        if whole < chunk.len() {
+            self.carry = Some(chunk[whole]);
+        }
+        Ok(())
+    }
+
+    /// Patch the header with the final length; returns the PCM byte count
+    pub async fn finish(mut self) -> std::io::Result<u64> {
+        self.file.seek(SeekFrom::Start(0)).await?;
+        self.file
+            .write_all(&wav_header(self.data_len as u32, self.sample_rate, self.channels))
+            .await?;
+        self.file.flush().await?;
+        let peaks = self.peaks.finish(self.sample_rate);
+        if let Err(e) = tokio::fs::write(peaks_path(&self.path), peaks.encode()).await {
+            eprintln!("⚠️  Can't save peaks of {}: {}", self.path.display(), e);
+        }
+        Ok(self.data_len)
+    }
+}
+
+/// Sample rate and channel count from a 44-byte PCM WAV header
+pub fn wav_format(contents: &[u8]) -> Option<(u32, u16)> {
+    if contents.len() < 44 || &contents[0..4] != b"RIFF" || &contents[8..12] != b"WAVE" {
+        return None;
+    }
+    let channels = u16::from_le_bytes(contents[22..24].try_into().ok()?);
+    let sample_rate = u32::from_le_bytes(contents[24..28].try_into().ok()?);
+    Some((sample_rate, channels))
+}
+
+/// Load the PCM body of a WAV file written by this server
+pub fn read_wav_pcm(path: &Path) -> Result<PcmBuffer> {
+    Ok(read_recording(path)?.0)
+}
+
+/// PCM, sample rate and channels of a stored recording, decoding its FLAC
+/// if the archiver has replaced the WAV
+pub fn read_recording(path: &Path) -> Result<(PcmBuffer, u32, u16)> {
+    let flac_path = archived_path(path);
+    if path == flac_path || (!path.exists() && flac_path.exists()) {
+        let decoded = flac::decode(&std::fs::read(&flac_path)?)
+            .with_context(|| format!("can't decode {}", flac_path.display()))?;
+        let bytes: Vec<u8> = decoded.samples.iter().flat_map(|s| s.to_le_bytes()).collect();
+        return Ok((PcmBuffer::new(Bytes::from(bytes)), decoded.sample_rate, decoded.channels));
+    }
+    let contents = Bytes::from(std::fs::read(path)?);
+    let (sample_rate, channels) =
+        wav_format(&contents).with_context(|| format!("{} is not a WAV file", path.display()))?;
+    Ok((PcmBuffer::new(contents.slice(44..)), sample_rate, channels))
+}
+
+/// Where the archiver puts a recording's WAV as FLAC
+pub fn archived_path(wav_path: &Path) -> PathBuf {
+    wav_path.with_extension("flac")
+}
+
+/// Delete a recording that won't be kept, with its peaks
+pub fn remove_recording(wav_path: &Path) {
+    std::fs::remove_file(wav_path).ok();
+    std::fs::remove_file(peaks_path(wav_path)).ok();
+}
+
+/// Whether a recording is still on disk, as WAV or archived
+pub fn recording_exists(wav_path: &Path) -> bool {
+    wav_path.exists() || archived_path(wav_path).exists()
+}
+
+/// Samples per channel in an archived recording, from its FLAC header
+pub fn archived_samples(wav_path: &Path) -> Option<u64> {
+    use std::io::Read;
+    let mut header = [0u8; 42];
+    File::open(archived_path(wav_path)).ok()?.read_exact(&mut header).ok()?;
+    flac::total_samples(&header)
+}
+
 /// Get basic audio info (minimal - no complex analysis)
-pub fn analyze_audio_quality(pcm_data: &[i16], sample_rate: u32) -> AudioQuality {
+pub fn analyze_audio_quality(num_samples: usize, sample_rate: u32) -> AudioQuality {
     AudioQuality {
-        num_samples: pcm_data.len(),
+        num_samples,
         duration_sec: if sample_rate > 0 {
-            pcm_data.len() as f32 / sample_rate as f32
+            num_samples as f32 / sample_rate as f32
         } else {
             0.0
         },
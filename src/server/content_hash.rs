@@ -0,0 +1,72 @@
+use sha2::{Digest, Sha256};
+use std::collections::HashSet;
+use std::sync::Mutex;
+use std::time::Duration;
+
+/// Identical audio from the same device within this long of an earlier
+/// upload is taken as a retry of it. Retries normally carry the same
+/// recording id and are caught by that; the hash is the fallback, so it
+/// never matches other devices or old recordings.
+pub const DUPLICATE_WINDOW: Duration = Duration::from_secs(600);
+
+/// SHA-256 over an upload's format and PCM bytes, fed chunk by chunk as
+/// the body streams in. Identical audio uploaded twice (a device retrying
+/// after a lost response, or a clip re-sent inside a batch) hashes the same
+/// whichever endpoint carried it.
+pub struct AudioHasher(Sha256);
+
+impl AudioHasher {
+    pub fn new(sample_rate: u32, channels: u16) -> Self {
+        let mut hasher = Sha256::new();
+        hasher.update(sample_rate.to_le_bytes());
+        hasher.update(channels.to_le_bytes());
+        Self(hasher)
+    }
+
+    pub fn update(&mut self, pcm: &[u8]) {
+        self.0.update(pcm);
+    }
+
+    /// Lowercase hex digest (stored as `audio_sha256` on the transcript)
+    pub fn finish(self) -> String {
+        self.0
+            .finalize()
+            .iter()
+            .map(|byte| format!("{:02x}", byte))
+            .collect()
+    }
+}
+
+pub fn hash_audio(pcm: &[u8], sample_rate: u32, channels: u16) -> String {
+    let mut hasher = AudioHasher::new(sample_rate, channels);
+    hasher.update(pcm);
+    hasher.finish()
+}
+
+/// (device id, hash) of audio that is queued or being transcribed. Finished
+/// audio is found through the transcript index instead, which survives
+/// restarts.
+pub struct PendingAudio {
+    hashes: Mutex<HashSet<(String, String)>>,
+}
+
+impl PendingAudio {
+    pub fn new() -> Self {
+        Self {
+            hashes: Mutex::new(HashSet::new()),
+        }
+    }
+
+    /// Lock for a check-then-claim; see `handlers::claim_audio`
+    pub fn lock(&self) -> std::sync::MutexGuard<'_, HashSet<(String, String)>> {
+        self.hashes.lock().unwrap()
+    }
+
+    /// Called once the transcript is indexed (or transcription failed)
+    pub fn release(&self, device_id: &str, hash: &str) {
+        self.hashes
+            .lock()
+            .unwrap()
+            .remove(&(device_id.to_string(), hash.to_string()));
+    }
+}
@@ -0,0 +1,257 @@
+use chrono::{DateTime, TimeZone, Utc};
+use std::collections::hash_map::DefaultHasher;
+use std::collections::HashMap;
+use std::hash::{Hash, Hasher};
+use std::net::IpAddr;
+use std::sync::atomic::{AtomicBool, AtomicU32, AtomicU64, Ordering};
+use std::sync::{Arc, Mutex, RwLock};
+use std::time::{SystemTime, UNIX_EPOCH};
+
+const SHARDS: usize = 16;
+
+/// Live state for one device. Everything a status poll touches is atomic,
+/// so the steady-state poll is a shard read-lock, a hash lookup and a few
+/// stores - no allocation, no exclusive lock.
+pub struct DeviceEntry {
+    pub device_id: Arc<str>,
+    last_seen_ms: AtomicU64,
+    /// Announced as online and not yet expired (see `expire`)
+    online: AtomicBool,
+    recording: AtomicBool,
+    upload_queue_depth: AtomicU32,
+    upload_queue_age_ms: AtomicU64,
+    ip: Mutex<Option<IpAddr>>,
+}
+
+impl DeviceEntry {
+    fn new(device_id: Arc<str>) -> Self {
+        Self {
+            device_id,
+            last_seen_ms: AtomicU64::new(0),
+            online: AtomicBool::new(false),
+            recording: AtomicBool::new(false),
+            upload_queue_depth: AtomicU32::new(0),
+            upload_queue_age_ms: AtomicU64::new(0),
+            ip: Mutex::new(None),
+        }
+    }
+
+    /// Returns true if this brought the device online
+    pub fn touch(&self) -> bool {
+        self.last_seen_ms.store(now_ms(), Ordering::Relaxed);
+        // Load first: the steady-state poll stays a plain read
+        !self.online.load(Ordering::Relaxed) && !self.online.swap(true, Ordering::Relaxed)
+    }
+
+    pub fn set_ip(&self, ip: IpAddr) {
+        let mut current = self.ip.lock().unwrap();
+        if *current != Some(ip) {
+            *current = Some(ip);
+        }
+    }
+
+    pub fn ip(&self) -> Option<IpAddr> {
+        *self.ip.lock().unwrap()
+    }
+
+    pub fn recording(&self) -> bool {
+        self.recording.load(Ordering::Relaxed)
+    }
+
+    pub fn set_recording(&self, recording: bool) {
+        self.recording.store(recording, Ordering::Relaxed);
+    }
+
+    pub fn set_upload_queue(&self, depth: u32, age_ms: u64) {
+        self.upload_queue_depth.store(depth, Ordering::Relaxed);
+        self.upload_queue_age_ms.store(age_ms, Ordering::Relaxed);
+    }
+
+    pub fn upload_queue(&self) -> (u32, u64) {
+        (
+            self.upload_queue_depth.load(Ordering::Relaxed),
+            self.upload_queue_age_ms.load(Ordering::Relaxed),
+        )
+    }
+
+    /// None if the device never polled (only has recording state)
+    pub fn last_seen(&self) -> Option<DateTime<Utc>> {
+        match self.last_seen_ms.load(Ordering::Relaxed) {
+            0 => None,
+            ms => Utc.timestamp_millis_opt(ms as i64).single(),
+        }
+    }
+
+    pub fn seconds_since_seen(&self) -> f64 {
+        match self.last_seen_ms.load(Ordering::Relaxed) {
+            0 => f64::INFINITY,
+            ms => now_ms().saturating_sub(ms) as f64 / 1000.0,
+        }
+    }
+}
+
+/// Device id -> entry, split across independently locked shards. Ids are
+/// interned on first sight; later lookups borrow the caller's `&str`.
+pub struct DeviceRegistry {
+    shards: Vec<RwLock<HashMap<Arc<str>, Arc<DeviceEntry>>>>,
+}
+
+impl DeviceRegistry {
+    pub fn new() -> Self {
+        Self {
+            shards: (0..SHARDS).map(|_| RwLock::new(HashMap::new())).collect(),
+        }
+    }
+
+    fn shard(&self, device_id: &str) -> &RwLock<HashMap<Arc<str>, Arc<DeviceEntry>>> {
+        let mut hasher = DefaultHasher::new();
+        device_id.hash(&mut hasher);
+        &self.shards[hasher.finish() as usize % SHARDS]
+    }
+
+    pub fn get(&self, device_id: &str) -> Option<Arc<DeviceEntry>> {
+        self.shard(device_id).read().unwrap().get(device_id).cloned()
+    }
+
+    /// Run `f` on the device's entry, creating it the first time
+    pub fn with_entry<R>(&self, device_id: &str, f: impl FnOnce(&DeviceEntry) -> R) -> R {
+        let shard = self.shard(device_id);
+        if let Some(entry) = shard.read().unwrap().get(device_id) {
+            return f(entry);
+        }
+        let mut map = shard.write().unwrap();
+        let entry = map
+            .entry(Arc::from(device_id))
+            .or_insert_with_key(|id| Arc::new(DeviceEntry::new(id.clone())));
+        f(entry)
+    }
+
+    /// Point-in-time copy of all entries (cheap Arc clones; no lock held
+    /// while the caller builds its response)
+    pub fn snapshot(&self) -> Vec<Arc<DeviceEntry>> {
+        let mut entries = Vec::new();
+        for shard in &self.shards {
+            entries.extend(shard.read().unwrap().values().cloned());
+        }
+        entries
+    }
+
+    /// Recording flag per device, for the UI
+    pub fn recording_states(&self) -> HashMap<String, bool> {
+        self.snapshot()
+            .iter()
+            .map(|entry| (entry.device_id.to_string(), entry.recording()))
+            .collect()
+    }
+
+    /// Mark devices not seen for `timeout_seconds` offline and return them
+    /// (each only once, until it comes back), then prune
+    pub fn expire(&self, timeout_seconds: f64) -> Vec<Arc<DeviceEntry>> {
+        let offline: Vec<Arc<DeviceEntry>> = self
+            .snapshot()
+            .into_iter()
+            .filter(|entry| {
+                entry.seconds_since_seen() > timeout_seconds
+                    && entry.online.swap(false, Ordering::Relaxed)
+            })
+            .collect();
+        self.prune(timeout_seconds);
+        offline
+    }
+
+    /// Forget devices not seen for `timeout_seconds` that aren't recording
+    fn prune(&self, timeout_seconds: f64) {
+        for shard in &self.shards {
+            let stale = shard
+                .read()
+                .unwrap()
+                .values()
+                .any(|entry| entry.seconds_since_seen() > timeout_seconds && !entry.recording());
+            if stale {
+                shard.write().unwrap().retain(|_, entry| {
+                    entry.seconds_since_seen() <= timeout_seconds || entry.recording()
+                });
+            }
+        }
+    }
+}
+
+fn now_ms() -> u64 {
+    SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .map(|d| d.as_millis() as u64)
+        .unwrap_or(0)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn age(registry: &DeviceRegistry, device_id: &str, seconds: u64) {
+        let entry = registry.get(device_id).unwrap();
+        entry.last_seen_ms.store(now_ms() - seconds * 1000, Ordering::Relaxed);
+    }
+
+    #[test]
+    fn entries_are_created_once_and_shared() {
+        let registry = DeviceRegistry::new();
+        assert!(registry.get("a").is_none());
+        registry.with_entry("a", |entry| entry.set_upload_queue(3, 1500));
+        let entry = registry.get("a").unwrap();
+        assert_eq!(entry.upload_queue(), (3, 1500));
+        assert!(entry.last_seen().is_none());
+        assert_eq!(entry.seconds_since_seen(), f64::INFINITY);
+        registry.with_entry("a", |again| assert!(std::ptr::eq(again, &*entry)));
+
+        for i in 0..200 {
+            registry.with_entry(&format!("device-{}", i), |_| ());
+        }
+        assert_eq!(registry.snapshot().len(), 201);
+        assert!(registry.shards.iter().all(|shard| !shard.read().unwrap().is_empty()));
+    }
+
+    #[test]
+    fn touch_reports_coming_online_once() {
+        let registry = DeviceRegistry::new();
+        assert!(registry.with_entry("a", DeviceEntry::touch));
+        assert!(!registry.with_entry("a", DeviceEntry::touch));
+
+        // Racing first polls: exactly one announces the device
+        let registry = Arc::new(DeviceRegistry::new());
+        let announced: usize = (0..8)
+            .map(|_| {
+                let registry = registry.clone();
+                std::thread::spawn(move || registry.with_entry("b", DeviceEntry::touch) as usize)
+            })
+            .collect::<Vec<_>>()
+            .into_iter()
+            .map(|thread| thread.join().unwrap())
+            .sum();
+        assert_eq!(announced, 1);
+    }
+
+    #[test]
+    fn expire_announces_once_and_prunes_idle_devices() {
+        let registry = DeviceRegistry::new();
+        for id in ["fresh", "stale", "stale-recording"] {
+            registry.with_entry(id, DeviceEntry::touch);
+        }
+        registry.with_entry("stale-recording", |entry| entry.set_recording(true));
+        age(&registry, "stale", 30);
+        age(&registry, "stale-recording", 30);
+
+        let mut offline: Vec<String> = registry.expire(10.0).iter().map(|e| e.device_id.to_string()).collect();
+        offline.sort();
+        assert_eq!(offline, ["stale", "stale-recording"]);
+        // Recording devices stay listed; the others are forgotten
+        assert!(registry.get("stale").is_none());
+        assert!(registry.get("stale-recording").is_some());
+        assert!(registry.get("fresh").is_some());
+        assert!(registry.expire(10.0).is_empty());
+
+        // Back online after a poll, offline again after the next timeout
+        assert!(registry.with_entry("stale-recording", DeviceEntry::touch));
+        age(&registry, "stale-recording", 30);
+        assert_eq!(registry.expire(10.0).len(), 1);
+    }
+}
@@ -0,0 +1,626 @@
+use anyhow::{bail, Context, Result};
+
+/// Samples per channel per frame (the reference encoder's default)
+const BLOCK_SIZE: usize = 4096;
+const MAX_FIXED_ORDER: usize = 4;
+/// Up to 16 Rice partitions per subframe
+const MAX_PARTITION_ORDER: u32 = 4;
+/// Largest parameter the 4-bit Rice coding method can carry (15 = escape)
+const MAX_RICE_PARAM: u32 = 14;
+
+/// Audio decoded from a FLAC stream
+pub struct Decoded {
+    /// Interleaved 16-bit samples
+    pub samples: Vec<i16>,
+    pub sample_rate: u32,
+    pub channels: u16,
+}
+
+/// Encode 16-bit interleaved PCM as FLAC.
+///
+/// Fixed predictors (orders 0-4) with partitioned Rice residuals, no LPC:
+/// on 16 kHz speech this lands within a few percent of `flac -5` at a
+/// fraction of the CPU, which matters more for a background job. The MD5
+/// in STREAMINFO is left unset; callers verify by decoding instead.
+pub fn encode(samples: &[i16], sample_rate: u32, channels: u16) -> Vec<u8> {
+    let channels = channels.max(1) as usize;
+    let frames = samples.len() / channels;
+    let mut out = BitWriter::with_capacity(samples.len());
+
+    out.bytes.extend_from_slice(b"fLaC");
+    // STREAMINFO, flagged as the last metadata block
+    out.write(1, 1);
+    out.write(0, 7);
+    out.write(34, 24);
+    out.write(BLOCK_SIZE.min(frames.max(16)) as u64, 16);
+    out.write(BLOCK_SIZE as u64, 16);
+    out.write(0, 24); // Min/max frame size unknown
+    out.write(0, 24);
+    out.write(sample_rate as u64, 20);
+    out.write(channels as u64 - 1, 3);
+    out.write(15, 5); // 16 bits per sample
+    out.write((frames as u64) >> 32, 4);
+    out.write(frames as u64 & 0xFFFF_FFFF, 32);
+    out.bytes.extend_from_slice(&[0; 16]); // MD5 unknown
+
+    let mut channel = Vec::with_capacity(BLOCK_SIZE);
+    for (frame_number, start) in (0..frames).step_by(BLOCK_SIZE).enumerate() {
+        let block = (frames - start).min(BLOCK_SIZE);
+        let mut frame = BitWriter::with_capacity(block * channels * 2);
+        frame.write(0b11_1111_1111_1110, 14);
+        frame.write(0, 1); // Reserved
+        frame.write(0, 1); // Fixed block size
+        frame.write(0b0111, 4); // Block size - 1 follows as 16 bits
+        frame.write(0b0000, 4); // Sample rate from STREAMINFO
+        frame.write(channels as u64 - 1, 4); // Independent channels
+        frame.write(0b100, 3); // 16 bits per sample
+        frame.write(0, 1);
+        write_utf8_number(&mut frame, frame_number as u64);
+        frame.write(block as u64 - 1, 16);
+        let crc = crc8(&frame.bytes);
+        frame.write(crc as u64, 8);
+
+        for ch in 0..channels {
+            channel.clear();
+            channel.extend((start..start + block).map(|i| samples[i * channels + ch] as i32));
+            write_subframe(&mut frame, &channel);
+        }
+        frame.align();
+        let crc = crc16(&frame.bytes);
+        frame.write(crc as u64, 16);
+        out.bytes.extend_from_slice(&frame.bytes);
+    }
+    out.bytes
+}
+
+fn write_subframe(out: &mut BitWriter, samples: &[i32]) {
+    const BPS: u32 = 16;
+    if samples.iter().all(|&s| s == samples[0]) {
+        out.write(0b0000_0000, 8); // CONSTANT
+        out.write_signed(samples[0] as i64, BPS);
+        return;
+    }
+
+    // Predictor order with the smallest residual, then its best partitioning
+    let max_order = MAX_FIXED_ORDER.min(samples.len() - 1);
+    let (order, residuals) = (0..=max_order)
+        .map(|order| (order, fixed_residuals(samples, order)))
+        .min_by_key(|(_, residuals)| residuals.iter().map(|r| r.unsigned_abs() as u64).sum::<u64>())
+        .unwrap_or_default();
+    let (partition_order, params, rice_bits) = best_partitioning(&residuals, samples.len(), order);
+
+    let verbatim_bits = samples.len() as u64 * BPS as u64;
+    let fixed_bits = order as u64 * BPS as u64 + 6 + rice_bits;
+    if fixed_bits >= verbatim_bits {
+        out.write(0b0000_0010, 8); // VERBATIM
+        for &sample in samples {
+            out.write_signed(sample as i64, BPS);
+        }
+        return;
+    }
+
+    out.write(0, 1);
+    out.write(0b001000 | order as u64, 6); // FIXED
+    out.write(0, 1); // No wasted bits
+    for &sample in &samples[..order] {
+        out.write_signed(sample as i64, BPS);
+    }
+    out.write(0, 2); // Rice, 4-bit parameters
+    out.write(partition_order as u64, 4);
+    let partition_len = samples.len() >> partition_order;
+    let mut residuals = residuals.iter();
+    for (partition, &param) in params.iter().enumerate() {
+        out.write(param as u64, 4);
+        let len = if partition == 0 { partition_len - order } else { partition_len };
+        for &residual in residuals.by_ref().take(len) {
+            let folded = zigzag(residual);
+            out.unary(folded >> param);
+            out.write(folded & ((1 << param) - 1), param);
+        }
+    }
+}
+
+/// Prediction error of the fixed polynomial predictor of `order`
+fn fixed_residuals(x: &[i32], order: usize) -> Vec<i64> {
+    (order..x.len())
+        .map(|i| {
+            let s = |back: usize| x[i - back] as i64;
+            match order {
+                0 => s(0),
+                1 => s(0) - s(1),
+                2 => s(0) - 2 * s(1) + s(2),
+                3 => s(0) - 3 * s(1) + 3 * s(2) - s(3),
+                _ => s(0) - 4 * s(1) + 6 * s(2) - 4 * s(3) + s(4),
+            }
+        })
+        .collect()
+}
+
+/// Partition order, per-partition Rice parameters and total residual bits
+fn best_partitioning(residuals: &[i64], block: usize, order: usize) -> (u32, Vec<u32>, u64) {
+    let mut best: Option<(u32, Vec<u32>, u64)> = None;
+    for partition_order in 0..=MAX_PARTITION_ORDER {
+        let partition_len = block >> partition_order;
+        if block % (1 << partition_order) != 0 || partition_len <= order {
+            break;
+        }
+        let mut params = Vec::with_capacity(1 << partition_order);
+        let mut bits = 0;
+        let mut start = 0;
+        for partition in 0..1 << partition_order {
+            let len = if partition == 0 { partition_len - order } else { partition_len };
+            let (param, cost) = best_rice_param(&residuals[start..start + len]);
+            params.push(param);
+            bits += 4 + cost;
+            start += len;
+        }
+        if best.as_ref().map_or(true, |(_, _, best_bits)| bits < *best_bits) {
+            best = Some((partition_order, params, bits));
+        }
+    }
+    best.unwrap_or((0, vec![0], 0))
+}
+
+fn best_rice_param(residuals: &[i64]) -> (u32, u64) {
+    let folded: Vec<u64> = residuals.iter().map(|&r| zigzag(r)).collect();
+    (0..=MAX_RICE_PARAM)
+        .map(|param| {
+            let cost = folded.len() as u64 * (param as u64 + 1) + folded.iter().map(|u| u >> param).sum::<u64>();
+            (param, cost)
+        })
+        .min_by_key(|&(_, cost)| cost)
+        .unwrap_or((0, 0))
+}
+
+fn zigzag(value: i64) -> u64 {
+    ((value << 1) ^ (value >> 63)) as u64
+}
+
+/// Decode a FLAC stream with 16-bit samples and a fixed block size (as
+/// written by `encode`, `flac` or ffmpeg)
+pub fn decode(data: &[u8]) -> Result<Decoded> {
+    if data.get(..4) != Some(b"fLaC".as_slice()) {
+        bail!("not a FLAC stream");
+    }
+    let mut reader = BitReader::new(&data[4..]);
+    let mut info = None;
+    loop {
+        let last = reader.read(1)? == 1;
+        let block_type = reader.read(7)?;
+        let len = reader.read(24)? as usize;
+        if block_type == 0 {
+            reader.read(16)?; // Min block size
+            reader.read(16)?; // Max block size
+            reader.read(24)?;
+            reader.read(24)?;
+            let sample_rate = reader.read(20)? as u32;
+            let channels = reader.read(3)? as u16 + 1;
+            let bits_per_sample = reader.read(5)? as u32 + 1;
+            let total = (reader.read(4)? << 32) | reader.read(32)?;
+            reader.skip_bytes(16)?;
+            info = Some((sample_rate, channels, bits_per_sample, total));
+        } else {
+            reader.skip_bytes(len)?;
+        }
+        if last {
+            break;
+        }
+    }
+    let (sample_rate, channels, bits_per_sample, total) = info.context("FLAC stream has no STREAMINFO")?;
+    if bits_per_sample != 16 {
+        bail!("{}-bit FLAC is not supported", bits_per_sample);
+    }
+
+    let mut samples = Vec::with_capacity(total as usize * channels as usize);
+    let mut decoded: Vec<Vec<i32>> = vec![Vec::new(); channels as usize];
+    while !reader.at_end() {
+        if reader.read(14)? != 0b11_1111_1111_1110 {
+            bail!("lost FLAC frame sync");
+        }
+        reader.read(2)?;
+        let block_code = reader.read(4)?;
+        let rate_code = reader.read(4)?;
+        let assignment = reader.read(4)?;
+        reader.read(4)?; // Sample size (16, from STREAMINFO)
+        reader.read_utf8_number()?;
+        let block = match block_code {
+            1 => 192,
+            2..=5 => 576 << (block_code - 2),
+            6 => reader.read(8)? as usize + 1,
+            7 => reader.read(16)? as usize + 1,
+            8..=15 => 256 << (block_code - 8),
+            _ => bail!("reserved FLAC block size"),
+        };
+        match rate_code {
+            12 => drop(reader.read(8)?),
+            13 | 14 => drop(reader.read(16)?),
+            _ => {}
+        }
+        reader.read(8)?; // Header CRC
+
+        for (ch, channel) in decoded.iter_mut().enumerate() {
+            // The side channel of a stereo pair carries one extra bit
+            let side = matches!((assignment, ch), (8, 1) | (9, 0) | (10, 1));
+            read_subframe(&mut reader, block, 16 + side as u32, channel)?;
+        }
+        reader.align();
+        reader.read(16)?; // Frame CRC
+
+        if channels == 2 && assignment >= 8 {
+            let (left, right) = decoded.split_at_mut(1);
+            for (a, b) in left[0].iter_mut().zip(right[0].iter_mut()) {
+                let (l, r) = match assignment {
+                    8 => (*a, *a - *b),
+                    9 => (*a + *b, *b),
+                    _ => {
+                        let mid = (*a << 1) | (*b & 1);
+                        ((mid + *b) >> 1, (mid - *b) >> 1)
+                    }
+                };
+                *a = l;
+                *b = r;
+            }
+        }
+        for i in 0..block {
+            for channel in &decoded {
+                samples.push(channel[i] as i16);
+            }
+        }
+    }
+    // STREAMINFO may leave the total unknown (0); ours always sets it
+    let expected = total as usize * channels as usize;
+    if total != 0 && samples.len() != expected {
+        bail!("FLAC stream has {} of its {} samples", samples.len(), expected);
+    }
+    Ok(Decoded {
+        samples,
+        sample_rate,
+        channels,
+    })
+}
+
+fn read_subframe(reader: &mut BitReader, block: usize, bps: u32, out: &mut Vec<i32>) -> Result<()> {
+    out.clear();
+    reader.read(1)?;
+    let kind = reader.read(6)?;
+    let wasted = if reader.read(1)? == 1 { reader.read_unary()? + 1 } else { 0 };
+    let bps = bps - wasted;
+    match kind {
+        0 => {
+            let value = reader.read_signed(bps)?;
+            out.resize(block, value);
+        }
+        1 => {
+            for _ in 0..block {
+                out.push(reader.read_signed(bps)?);
+            }
+        }
+        8..=12 => {
+            let order = (kind - 8) as usize;
+            for _ in 0..order {
+                out.push(reader.read_signed(bps)?);
+            }
+            read_residual(reader, block, order, out)?;
+            for i in order..block {
+                let s = |back: usize| out[i - back] as i64;
+                let prediction = match order {
+                    0 => 0,
+                    1 => s(1),
+                    2 => 2 * s(1) - s(2),
+                    3 => 3 * s(1) - 3 * s(2) + s(3),
+                    _ => 4 * s(1) - 6 * s(2) + 4 * s(3) - s(4),
+                };
+                out[i] = (out[i] as i64 + prediction) as i32;
+            }
+        }
+        32..=63 => {
+            let order = (kind - 31) as usize;
+            for _ in 0..order {
+                out.push(reader.read_signed(bps)?);
+            }
+            let precision = reader.read(4)? as u32 + 1;
+            let shift = reader.read_signed(5)?.max(0);
+            let coefficients: Vec<i64> = (0..order)
+                .map(|_| reader.read_signed(precision).map(i64::from))
+                .collect::<Result<_>>()?;
+            read_residual(reader, block, order, out)?;
+            for i in order..block {
+                let prediction: i64 = coefficients
+                    .iter()
+                    .enumerate()
+                    .map(|(j, c)| c * out[i - j - 1] as i64)
+                    .sum();
+                out[i] = (out[i] as i64 + (prediction >> shift)) as i32;
+            }
+        }
+        _ => bail!("reserved FLAC subframe type {}", kind),
+    }
+    if wasted > 0 {
+        out.iter_mut().for_each(|s| *s <<= wasted);
+    }
+    Ok(())
+}
+
+/// Append the residuals of one subframe to `out` (after its warm-up samples)
+fn read_residual(reader: &mut BitReader, block: usize, order: usize, out: &mut Vec<i32>) -> Result<()> {
+    let param_bits = match reader.read(2)? {
+        0 => 4,
+        1 => 5,
+        _ => bail!("reserved FLAC residual coding"),
+    };
+    let escape = (1 << param_bits) - 1;
+    let partition_order = reader.read(4)?;
+    let partition_len = block >> partition_order;
+    if partition_len < order {
+        bail!("bad FLAC partition order");
+    }
+    for partition in 0..1usize << partition_order {
+        let len = if partition == 0 { partition_len - order } else { partition_len };
+        let param = reader.read(param_bits)? as u32;
+        if param == escape {
+            let bits = reader.read(5)? as u32;
+            for _ in 0..len {
+                out.push(if bits == 0 { 0 } else { reader.read_signed(bits)? });
+            }
+        } else {
+            for _ in 0..len {
+                let folded = ((reader.read_unary()? as u64) << param) | reader.read(param)?;
+                out.push(((folded >> 1) as i64 ^ -((folded & 1) as i64)) as i32);
+            }
+        }
+    }
+    Ok(())
+}
+
+/// Number of samples per channel, from STREAMINFO alone
+pub fn total_samples(header: &[u8]) -> Option<u64> {
+    if header.get(..4)? != b"fLaC" || header.get(4)? & 0x7F != 0 {
+        return None;
+    }
+    let info = header.get(8..8 + 34)?;
+    Some(((info[13] as u64 & 0x0F) << 32) | u32::from_be_bytes(info[14..18].try_into().ok()?) as u64)
+}
+
+struct BitWriter {
+    bytes: Vec<u8>,
+    acc: u64,
+    bits: u32,
+}
+
+impl BitWriter {
+    fn with_capacity(capacity: usize) -> Self {
+        Self {
+            bytes: Vec::with_capacity(capacity),
+            acc: 0,
+            bits: 0,
+        }
+    }
+
+    /// Low `n` bits of `value`, most significant first (n <= 32)
+    fn write(&mut self, value: u64, n: u32) {
+        if n == 0 {
+            return;
+        }
+        self.acc = (self.acc << n) | (value & ((1 << n) - 1));
+        self.bits += n;
+        while self.bits >= 8 {
+            self.bits -= 8;
+            self.bytes.push((self.acc >> self.bits) as u8);
+        }
+    }
+
+    fn write_signed(&mut self, value: i64, n: u32) {
+        self.write(value as u64, n);
+    }
+
+    /// `q` zero bits, then a one
+    fn unary(&mut self, mut q: u64) {
+        while q >= 32 {
+            self.write(0, 32);
+            q -= 32;
+        }
+        self.write(1, q as u32 + 1);
+    }
+
+    fn align(&mut self) {
+        if self.bits > 0 {
+            self.write(0, 8 - self.bits);
+        }
+    }
+}
+
+fn write_utf8_number(out: &mut BitWriter, n: u64) {
+    if n < 0x80 {
+        out.write(n, 8);
+        return;
+    }
+    let continuation = match n {
+        0..=0x7FF => 1,
+        0x800..=0xFFFF => 2,
+        0x1_0000..=0x1F_FFFF => 3,
+        0x20_0000..=0x3FF_FFFF => 4,
+        _ => 5,
+    };
+    let lead_bits = 6 - continuation;
+    let marker = (0xFF00u64 >> (continuation + 1)) & 0xFF;
+    out.write(marker | (n >> (6 * continuation)) & ((1 << lead_bits) - 1), 8);
+    for i in (0..continuation).rev() {
+        out.write(0x80 | (n >> (6 * i)) & 0x3F, 8);
+    }
+}
+
+struct BitReader<'a> {
+    data: &'a [u8],
+    /// Position in bits
+    pos: usize,
+}
+
+impl<'a> BitReader<'a> {
+    fn new(data: &'a [u8]) -> Self {
+        Self { data, pos: 0 }
+    }
+
+    fn at_end(&self) -> bool {
+        self.pos / 8 >= self.data.len()
+    }
+
+    fn read(&mut self, mut n: u32) -> Result<u64> {
+        let mut value = 0u64;
+        while n > 0 {
+            let byte = *self.data.get(self.pos / 8).context("truncated FLAC stream")?;
+            let offset = (self.pos % 8) as u32;
+            let take = n.min(8 - offset);
+            let bits = (byte >> (8 - offset - take)) & ((1u16 << take) - 1) as u8;
+            value = (value << take) | bits as u64;
+            self.pos += take as usize;
+            n -= take;
+        }
+        Ok(value)
+    }
+
+    fn read_signed(&mut self, n: u32) -> Result<i32> {
+        let value = self.read(n)?;
+        Ok(((value << (64 - n)) as i64 >> (64 - n)) as i32)
+    }
+
+    /// Zero bits before the next one
+    fn read_unary(&mut self) -> Result<u32> {
+        let mut count = 0;
+        loop {
+            let byte = *self.data.get(self.pos / 8).context("truncated FLAC stream")?;
+            let offset = self.pos % 8;
+            let rest = byte << offset;
+            if rest == 0 {
+                count += 8 - offset as u32;
+                self.pos += 8 - offset;
+                continue;
+            }
+            let zeros = rest.leading_zeros();
+            count += zeros;
+            self.pos += zeros as usize + 1;
+            return Ok(count);
+        }
+    }
+
+    fn read_utf8_number(&mut self) -> Result<u64> {
+        let first = self.read(8)? as u8;
+        let continuation = first.leading_ones().saturating_sub(1);
+        let mut value = match continuation {
+            0 => first as u64,
+            _ => (first & (0x7F >> (continuation + 1))) as u64,
+        };
+        for _ in 0..continuation {
+            value = (value << 6) | (self.read(8)? & 0x3F);
+        }
+        Ok(value)
+    }
+
+    fn skip_bytes(&mut self, n: usize) -> Result<()> {
+        self.pos += n * 8;
+        if self.pos > self.data.len() * 8 {
+            bail!("truncated FLAC stream");
+        }
+        Ok(())
+    }
+
+    fn align(&mut self) {
+        self.pos = (self.pos + 7) & !7;
+    }
+}
+
+fn crc8(data: &[u8]) -> u8 {
+    data.iter().fold(0u8, |mut crc, &byte| {
+        crc ^= byte;
+        for _ in 0..8 {
+            crc = if crc & 0x80 != 0 { (crc << 1) ^ 0x07 } else { crc << 1 };
+        }
+        crc
+    })
+}
+
+fn crc16(data: &[u8]) -> u16 {
+    data.iter().fold(0u16, |mut crc, &byte| {
+        crc ^= (byte as u16) << 8;
+        for _ in 0..8 {
+            crc = if crc & 0x8000 != 0 { (crc << 1) ^ 0x8005 } else { crc << 1 };
+        }
+        crc
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Deterministic white noise (xorshift), full 16-bit range
+    fn noise(len: usize, mut state: u32) -> Vec<i16> {
+        (0..len)
+            .map(|_| {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                state as i16
+            })
+            .collect()
+    }
+
+    fn tone(len: usize) -> Vec<i16> {
+        (0..len)
+            .map(|i| (8000.0 * (i as f32 * 440.0 * std::f32::consts::TAU / 16000.0).sin()) as i16)
+            .collect()
+    }
+
+    fn round_trip(samples: &[i16], sample_rate: u32, channels: u16) -> Vec<u8> {
+        let encoded = encode(samples, sample_rate, channels);
+        let decoded = decode(&encoded).unwrap();
+        assert_eq!(decoded.sample_rate, sample_rate);
+        assert_eq!(decoded.channels, channels);
+        assert!(decoded.samples == samples, "{} samples differ after decoding", samples.len());
+        assert_eq!(total_samples(&encoded[..42]), Some((samples.len() / channels as usize) as u64));
+        encoded
+    }
+
+    #[test]
+    fn speech_like_audio_round_trips_smaller() {
+        let samples = tone(16000 * 3);
+        let encoded = round_trip(&samples, 16000, 1);
+        assert!(encoded.len() < samples.len(), "{} bytes for {} samples", encoded.len(), samples.len());
+    }
+
+    #[test]
+    fn hard_signals_round_trip() {
+        round_trip(&vec![0; 10000], 16000, 1);
+        round_trip(&noise(10000, 1), 16000, 1);
+        // Full-scale square wave: the largest residuals fixed predictors make
+        let square: Vec<i16> = (0..10000).map(|i| if i / 3 % 2 == 0 { i16::MAX } else { i16::MIN }).collect();
+        round_trip(&square, 16000, 1);
+    }
+
+    #[test]
+    fn block_boundaries_and_short_recordings_round_trip() {
+        for len in [0, 1, 15, 16, BLOCK_SIZE - 1, BLOCK_SIZE, BLOCK_SIZE + 1, 3 * BLOCK_SIZE + 17] {
+            round_trip(&noise(len, len as u32 + 1), 16000, 1);
+        }
+        // Frame numbers past 127 take more than one byte
+        round_trip(&tone(200 * BLOCK_SIZE), 16000, 1);
+    }
+
+    #[test]
+    fn stereo_round_trips() {
+        let left = tone(5000);
+        let right = noise(5000, 7);
+        let interleaved: Vec<i16> = left.iter().zip(&right).flat_map(|(&l, &r)| [l, r]).collect();
+        round_trip(&interleaved, 44100, 2);
+    }
+
+    #[test]
+    fn damaged_streams_are_errors() {
+        assert!(decode(b"RIFF....").is_err());
+        assert!(decode(b"").is_err());
+        let encoded = encode(&noise(5000, 3), 16000, 1);
+        for cut in [4, 20, 42, 50, encoded.len() / 2, encoded.len() - 1] {
+            assert!(decode(&encoded[..cut]).is_err(), "decoded {} of {} bytes", cut, encoded.len());
+        }
+        assert_eq!(total_samples(b"RIFF"), None);
+    }
+}
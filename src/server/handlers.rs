@@ -1,21 +1,39 @@
-use crate::server::audio::{analyze_audio_quality, save_wav_file};
-use crate::server::state::{ServerState, Transcript};
+use crate::server::audio::{
+    analyze_audio_quality, archived_path, read_recording, recording_exists, remove_recording, save_wav_file, PcmBuffer,
+    WavStreamWriter,
+};
+use crate::server::content_hash::{hash_audio, AudioHasher, DUPLICATE_WINDOW};
+use crate::server::devices::DeviceEntry;
+use crate::server::inference::{PcmSource, TranscriptionJob};
+use crate::server::journal::JournalEntry;
+use crate::server::latency::{now_ms, LatencyTrace};
+use crate::server::media::{serve_archived, serve_file};
+use crate::server::metrics::{gauge, Metrics, ROUTES};
+use crate::server::peaks::{Peaks, BASE_FRAMES};
+use crate::server::scheduler::{Priority, Rejection};
+use crate::server::search::{parse_time_bound, terms, SearchQuery};
+use crate::server::state::{ServerState, SseMessage, Transcript};
+use crate::server::streaming::StreamSession;
+use crate::server::telemetry::{parse_range, recording_samples, DEFAULT_RANGE, RSSI};
 use axum::{
-    body::Bytes,
-    extract::{Query, State, ConnectInfo},
-    http::{HeaderMap, StatusCode},
-    response::{IntoResponse, Sse},
+    body::{Body, Bytes},
+    extract::{ConnectInfo, MatchedPath, Path, Query, Request, State},
+    http::{header, HeaderMap, HeaderValue, Method, StatusCode, Uri},
+    middleware::Next,
+    response::{sse::Event, IntoResponse, Response, Sse},
     Json,
 };
 use std::net::SocketAddr;
 use chrono::Utc;
 use serde::Deserialize;
-use std::collections::HashMap;
+use std::collections::{HashMap, HashSet};
 use std::fs;
 use std::path::PathBuf;
-use std::sync::Arc;
-use tokio::sync::mpsc;
-use tokio_stream::{wrappers::UnboundedReceiverStream, Stream, StreamExt};
+use std::sync::atomic::Ordering;
+use std::sync::{Arc, Mutex};
+use std::time::{Duration, Instant};
+use tokio::sync::{broadcast, mpsc};
+use tokio_stream::{wrappers::ReceiverStream, Stream, StreamExt};
 
 #[derive(Deserialize)]
 pub struct AudioQuery {
@@ -25,73 +43,896 @@ pub struct AudioQuery {
     channels: u16,
 }
 
+fn header_u64(headers: &HeaderMap, name: &str) -> Option<u64> {
+    headers.get(name)?.to_str().ok()?.parse().ok()
+}
+
+fn update_device_from_upload(state: &ServerState, device_id: &str, headers: &HeaderMap) {
+    let came_online = state.devices.with_entry(device_id, |device| {
+        if let Some(depth) = header_u64(headers, "x-queue-depth") {
+            device.set_upload_queue(depth as u32, header_u64(headers, "x-queue-oldest-ms").unwrap_or(0));
+        }
+        device.touch()
+    });
+    if came_online {
+        broadcast_presence(state, device_id, true);
+    }
+}
+
+/// Upper bound for a single streamed upload (the device caps recordings at 30 s)
+const MAX_UPLOAD_BYTES: u64 = 32 * 1024 * 1024;
 
 /// Handle POST /audio - receive audio from ESP32
 pub async fn handle_audio(
     State(state): State<Arc<ServerState>>,
     Query(params): Query<AudioQuery>,
     headers: HeaderMap,
-    body: Bytes,
-) -> Result<impl IntoResponse, StatusCode> {
+    body: Body,
+) -> Result<Response, StatusCode> {
+    let upload_begin = now_ms();
     let device_id = params.device.clone();
     let sample_rate = params.rate;
     let bits_per_sample = params.bits;
     let channels = params.channels;
 
-    println!("\n📥 Received audio from {}: {} bytes", device_id, body.len());
+    let content_length = header_u64(&headers, "content-length").unwrap_or(0);
+    println!("\n📥 Receiving audio from {}: {} bytes", device_id, content_length);
+
+    if bits_per_sample != 16 {
+        return Err(StatusCode::BAD_REQUEST);
+    }
 
     // Update device info
-    {
-        let mut devices = state.devices.lock().unwrap();
-        devices.insert(
-            device_id.clone(),
-            crate::server::state::DeviceInfo {
-                device_id: device_id.clone(),
-                last_seen: Utc::now(),
-                ip_address: None, // Could extract from request if needed
-            },
+    update_device_from_upload(&state, &device_id, &headers);
+
+    let priority = Priority::from_upload(header_u64(&headers, "x-recording-priority").unwrap_or(0));
+
+    // Queued uploads are retried; drop ones we already have
+    if let Some(recording_id) = headers.get("x-recording-id").and_then(|v| v.to_str().ok()) {
+        if !state.recent_recording_ids.lock().unwrap().insert(recording_id) {
+            println!("  Duplicate upload of {} - already ingested", recording_id);
+            return Ok(StatusCode::OK.into_response());
+        }
+        println!(
+            "  Recording {} (priority {}, age {} ms, attempt {})",
+            recording_id,
+            header_u64(&headers, "x-recording-priority").unwrap_or(0),
+            header_u64(&headers, "x-recording-age-ms").unwrap_or(0),
+            header_u64(&headers, "x-upload-attempt").unwrap_or(1),
         );
     }
 
-    // Convert bytes to i16 samples
-    let pcm_samples: Vec<i16> = if bits_per_sample == 16 {
-        body.chunks_exact(2)
-            .map(|chunk| i16::from_le_bytes([chunk[0], chunk[1]]))
-            .collect()
-    } else {
+    // Extract audio quality metrics from headers (from ESP32)
+    let mut audio_quality_json = serde_json::json!({});
+    for (key, value) in headers.iter() {
+        if let Some(header_name) = key.as_str().to_lowercase().strip_prefix("x-audio-") {
+            if let Ok(header_value) = value.to_str() {
+                if let Ok(num_value) = header_value.parse::<f64>() {
+                    audio_quality_json[header_name] = serde_json::json!(num_value);
+                }
+            }
+        }
+    }
+
+    let telemetry = recording_samples(&audio_quality_json);
+    let recorded_at = upload_begin - header_u64(&headers, "x-recording-age-ms").unwrap_or(0) as f64;
+
+    let trace = LatencyTrace::from_device(
+        headers.get("x-recording-id").and_then(|v| v.to_str().ok()),
+        headers.get("x-trace-ms").and_then(|v| v.to_str().ok()),
+        upload_begin,
+    );
+    match receive_recording(&state, &device_id, sample_rate, channels, priority, body, audio_quality_json, trace).await {
+        Ok(Ingested::Queued) => {
+            state.telemetry.record(&device_id, (recorded_at / 1000.0) as u64, &telemetry);
+            Ok(StatusCode::OK.into_response())
+        }
+        // Same audio as an earlier upload - answer with that one's result
+        Ok(duplicate) => Ok(Json(duplicate.to_json()).into_response()),
+        Err(status) => {
+            // Not ingested - let the device's retry through
+            if let Some(recording_id) = headers.get("x-recording-id").and_then(|v| v.to_str().ok()) {
+                state.recent_recording_ids.lock().unwrap().forget(recording_id);
+            }
+            if status == StatusCode::SERVICE_UNAVAILABLE {
+                return Ok(busy_response(&state));
+            }
+            Err(status)
+        }
+    }
+}
+
+/// Handle POST /audio-batch - several queued recordings in one request
+///
+/// Body is a sequence of length-prefixed clips (little-endian u32 lengths):
+/// `[meta_len][meta JSON][pcm_len][pcm]`, repeated. The meta object carries
+/// the same fields as the single-upload headers (`id`, `priority`, `age_ms`,
+/// `attempt`, and audio metrics such as `avg_db`).
+///
+/// Answers with each clip's `status` (and `code` when rejected). If any clip
+/// failed the response carries the worst failure's status code, so a device
+/// that applies one code to the whole batch keeps the clips and retries;
+/// the ones that made it come back as duplicates.
+pub async fn handle_audio_batch(
+    State(state): State<Arc<ServerState>>,
+    Query(params): Query<AudioQuery>,
+    headers: HeaderMap,
+    body: Body,
+) -> Result<Response, StatusCode> {
+    let upload_begin = now_ms();
+    let device_id = params.device.clone();
+    if params.bits != 16 {
+        return Err(StatusCode::BAD_REQUEST);
+    }
+
+    // Read here rather than by the extractor, so the upload can be timed
+    let body = axum::body::to_bytes(body, MAX_UPLOAD_BYTES as usize)
+        .await
+        .map_err(|_| StatusCode::PAYLOAD_TOO_LARGE)?;
+    let received_at = Instant::now();
+    let clips = split_audio_batch(&body).ok_or(StatusCode::BAD_REQUEST)?;
+    println!(
+        "\n📦 Received batch from {}: {} clips, {} bytes",
+        device_id,
+        clips.len(),
+        body.len()
+    );
+
+    update_device_from_upload(&state, &device_id, &headers);
+
+    let mut results = Vec::with_capacity(clips.len());
+    let mut busy = false;
+    let mut failed: Option<StatusCode> = None;
+    for (meta, pcm) in clips {
+        let recording_id = meta.get("id").and_then(|v| v.as_str()).unwrap_or("").to_string();
+        if !recording_id.is_empty()
+            && !state.recent_recording_ids.lock().unwrap().insert(&recording_id)
+        {
+            println!("  Duplicate upload of {} - already ingested", recording_id);
+            results.push(serde_json::json!({"id": recording_id, "status": "duplicate"}));
+            continue;
+        }
+
+        // Same keys as the x-audio-* headers of a single upload (avg_db -> avgdb)
+        let mut audio_quality_json = serde_json::json!({});
+        if let Some(fields) = meta.as_object() {
+            for (key, value) in fields {
+                if value.is_number() && !matches!(key.as_str(), "priority" | "age_ms" | "attempt" | "trace") {
+                    audio_quality_json[key.replace('_', "")] = value.clone();
+                }
+            }
+        }
+
+        let telemetry = recording_samples(&audio_quality_json);
+        let recorded_at = upload_begin - meta.get("age_ms").and_then(|v| v.as_u64()).unwrap_or(0) as f64;
+
+        let priority = Priority::from_upload(meta.get("priority").and_then(|v| v.as_u64()).unwrap_or(0));
+        let mut trace = LatencyTrace::from_device(
+            Some(recording_id.as_str()).filter(|id| !id.is_empty()),
+            meta.get("trace").and_then(|v| v.as_str()),
+            upload_begin,
+        );
+        trace.stamp_at("received", received_at);
+        let result = match ingest_recording(&state, &device_id, params.rate, params.channels, priority, pcm, audio_quality_json, trace).await {
+            Ok(Ingested::Queued) => {
+                state.telemetry.record(&device_id, (recorded_at / 1000.0) as u64, &telemetry);
+                serde_json::json!({"id": recording_id, "status": "success"})
+            }
+            Ok(Ingested::Duplicate(_)) => serde_json::json!({"id": recording_id, "status": "duplicate"}),
+            Err(status) => {
+                // Not ingested - let the device's retry through
+                if !recording_id.is_empty() {
+                    state.recent_recording_ids.lock().unwrap().forget(&recording_id);
+                }
+                if status == StatusCode::SERVICE_UNAVAILABLE {
+                    busy = true;
+                    serde_json::json!({"id": recording_id, "status": "busy"})
+                } else {
+                    // 5xx outranks 4xx: a clip that may succeed on retry must not be dropped
+                    failed = failed.max(Some(status));
+                    serde_json::json!({"id": recording_id, "status": "rejected", "code": status.as_u16()})
+                }
+            }
+        };
+        results.push(result);
+    }
+
+    // The device retries the whole batch; clips that made it are deduplicated
+    if busy {
+        return Ok(busy_response(&state));
+    }
+
+    let body = Json(serde_json::json!({"clips": results}));
+    Ok(match failed {
+        Some(status) => (status, body).into_response(),
+        None => body.into_response(),
+    })
+}
+
+/// 503 with a `Retry-After` sized to the inference backlog, so refused
+/// devices come back when there is room instead of on their own backoff
+fn busy_response(state: &ServerState) -> Response {
+    let retry_after = state.inference.retry_after().as_secs();
+    (
+        StatusCode::SERVICE_UNAVAILABLE,
+        [(header::RETRY_AFTER, retry_after.to_string())],
+    )
+        .into_response()
+}
+
+/// Whether the inference queue would take a job from this device; logs why not
+fn admit_upload(state: &ServerState, device_id: &str, priority: Priority, what: &str) -> Result<(), StatusCode> {
+    state.inference.admits(device_id, priority).map_err(|rejection| {
+        eprintln!("⚠️  {} - rejecting {} from {}", rejection_reason(rejection), what, device_id);
+        StatusCode::SERVICE_UNAVAILABLE
+    })
+}
+
+fn rejection_reason(rejection: Rejection) -> &'static str {
+    match rejection {
+        Rejection::QueueFull => "Inference queue full",
+        Rejection::DeviceLimit => "Device has its share of the inference queue",
+    }
+}
+
+/// Split an /audio-batch body into (meta, pcm) pairs; None if malformed
+/// (PCM parts are zero-copy slices of the request body)
+fn split_audio_batch(body: &Bytes) -> Option<Vec<(serde_json::Value, Bytes)>> {
+    fn take(body: &Bytes, pos: &mut usize) -> Option<Bytes> {
+        let len_bytes = body.get(*pos..*pos + 4)?;
+        let len = u32::from_le_bytes(len_bytes.try_into().ok()?) as usize;
+        let end = pos.checked_add(4 + len).filter(|&end| end <= body.len())?;
+        let part = body.slice(*pos + 4..end);
+        *pos = end;
+        Some(part)
+    }
+
+    let mut clips = Vec::new();
+    let mut pos = 0;
+    while pos < body.len() {
+        let meta: serde_json::Value = serde_json::from_slice(&take(body, &mut pos)?).ok()?;
+        let pcm = take(body, &mut pos)?;
+        clips.push((meta, pcm));
+    }
+    Some(clips)
+}
+
+/// Handle POST /audio-stream - a recording uploaded as it is captured
+/// (chunked transfer encoding). Partial transcripts are published as
+/// `partial_transcript` SSE events about once a second of audio; when the
+/// body ends the full recording is transcribed as usual and a `final`
+/// event follows the `transcript` event.
+pub async fn handle_audio_stream(
+    State(state): State<Arc<ServerState>>,
+    Query(params): Query<AudioQuery>,
+    headers: HeaderMap,
+    body: Body,
+) -> Result<Response, StatusCode> {
+    let device_id = params.device.clone();
+    if params.bits != 16 {
         return Err(StatusCode::BAD_REQUEST);
+    }
+    update_device_from_upload(&state, &device_id, &headers);
+
+    let recording_id = headers.get("x-recording-id").and_then(|v| v.to_str().ok());
+    if let Some(recording_id) = recording_id {
+        if !state.recent_recording_ids.lock().unwrap().insert(recording_id) {
+            println!("  Duplicate upload of {} - already ingested", recording_id);
+            return Ok(Json(serde_json::json!({"session": recording_id, "status": "duplicate"})).into_response());
+        }
+    }
+    if admit_upload(&state, &device_id, Priority::Live, "stream").is_err() {
+        if let Some(recording_id) = recording_id {
+            state.recent_recording_ids.lock().unwrap().forget(recording_id);
+        }
+        return Ok(busy_response(&state));
+    }
+
+    let session_id = recording_id
+        .map(str::to_string)
+        .unwrap_or_else(|| format!("{}-{}", device_id, Utc::now().timestamp_millis()));
+    println!("\n📡 Streaming from {} (session {})", device_id, session_id);
+    let session = Arc::new(Mutex::new(StreamSession::new(
+        &session_id,
+        &device_id,
+        params.rate,
+        params.channels,
+    )));
+
+    let received = async {
+        let mut stream = body.into_data_stream();
+        while let Some(chunk) = stream.next().await {
+            let chunk = chunk.map_err(|_| StatusCode::BAD_REQUEST)?;
+            {
+                let mut session = session.lock().unwrap();
+                if (session.len() + chunk.len()) as u64 > MAX_UPLOAD_BYTES {
+                    return Err(StatusCode::PAYLOAD_TOO_LARGE);
+                }
+                session.push(&chunk);
+            }
+            schedule_partial(&state, &session);
+        }
+        Ok(())
+    }
+    .await;
+
+    let result = match received {
+        Ok(()) => finish_stream(&state, &session).await,
+        Err(status) => Err(status),
     };
+    match result {
+        Ok(ingested) => {
+            let mut response = ingested.to_json();
+            response["session"] = serde_json::json!(session_id);
+            Ok(Json(response).into_response())
+        }
+        Err(status) => {
+            if let Some(recording_id) = recording_id {
+                state.recent_recording_ids.lock().unwrap().forget(recording_id);
+            }
+            if status == StatusCode::SERVICE_UNAVAILABLE {
+                return Ok(busy_response(&state));
+            }
+            Err(status)
+        }
+    }
+}
 
-    if pcm_samples.is_empty() {
+#[derive(Deserialize)]
+pub struct SegmentQuery {
+    device: String,
+    rate: u32,
+    bits: u16,
+    channels: u16,
+    session: String,
+    seq: u64,
+    #[serde(default)]
+    last: u8,
+}
+
+/// Handle POST /audio-segment - a recording uploaded as numbered segments
+///
+/// For devices that can't hold one chunked request open. Segments of a
+/// session must arrive in `seq` order starting at 0; a repeated segment (a
+/// retry) is acknowledged and ignored, a gap is 409. `last=1` closes the
+/// session; if saving it fails, the closing segment can be retried. A later
+/// segment of a session the server doesn't have (closed as idle by
+/// `spawn_stream_reaper`, or lost in a restart) is 410, and the device
+/// should start again at seq 0.
+pub async fn handle_audio_segment(
+    State(state): State<Arc<ServerState>>,
+    Query(params): Query<SegmentQuery>,
+    headers: HeaderMap,
+    body: Bytes,
+) -> Result<Response, StatusCode> {
+    if params.bits != 16 || params.session.is_empty() {
         return Err(StatusCode::BAD_REQUEST);
     }
+    update_device_from_upload(&state, &params.device, &headers);
 
-    // Get basic audio info (minimal - no complex analysis)
-    let quality = analyze_audio_quality(&pcm_samples, sample_rate);
-    println!("  Audio: {} samples, {:.2}s", quality.num_samples, quality.duration_sec);
+    // Retry of the closing segment after the session was already transcribed
+    if state.recent_recording_ids.lock().unwrap().contains(&params.session) {
+        return Ok(StatusCode::OK.into_response());
+    }
+
+    let session = match state.streams.get(&params.session) {
+        Some(session) => session,
+        None if params.seq != 0 => return Err(StatusCode::GONE),
+        None => {
+            if admit_upload(&state, &params.device, Priority::Live, "stream").is_err() {
+                return Ok(busy_response(&state));
+            }
+            state
+                .streams
+                .get_or_open(&params.session, &params.device, params.rate, params.channels)
+        }
+    };
+    let retrying_close = {
+        let mut session = session.lock().unwrap();
+        if session.is_finished() {
+            // Being saved right now; the retry will see how that went
+            return Ok(busy_response(&state));
+        }
+        if params.last != 0 && params.seq + 1 == session.next_segment {
+            true // Closing segment again after saving the session failed
+        } else if params.seq < session.next_segment {
+            return Ok(StatusCode::OK.into_response()); // Retry of a segment we have
+        } else if params.seq > session.next_segment {
+            return Err(StatusCode::CONFLICT);
+        } else {
+            if (session.len() + body.len()) as u64 > MAX_UPLOAD_BYTES {
+                return Err(StatusCode::PAYLOAD_TOO_LARGE);
+            }
+            session.push(&body);
+            session.next_segment += 1;
+            false
+        }
+    };
+    if params.seq == 0 && !retrying_close {
+        println!(
+            "\n📡 Streaming from {} (session {}, {} open)",
+            params.device,
+            params.session,
+            state.streams.len()
+        );
+    }
+    schedule_partial(&state, &session);
+
+    if params.last != 0 {
+        finish_stream(&state, &session).await?;
+        state.recent_recording_ids.lock().unwrap().insert(&params.session);
+        state.streams.remove(&params.session);
+    }
+    Ok(StatusCode::OK.into_response())
+}
+
+/// How often `/audio-segment` sessions are checked for idleness
+const STREAM_REAP_INTERVAL: Duration = Duration::from_secs(5);
+
+/// Close `/audio-segment` sessions whose device stopped sending for
+/// `SESSION_IDLE_TIMEOUT`, with the audio they have. A session that can't be
+/// saved yet (pool busy, disk error) stays open and is tried again.
+pub fn spawn_stream_reaper(state: Arc<ServerState>) {
+    tokio::spawn(async move {
+        let mut interval = tokio::time::interval(STREAM_REAP_INTERVAL);
+        loop {
+            interval.tick().await;
+            for idle in state.streams.idle() {
+                let session_id = idle.lock().unwrap().id.clone();
+                println!("⌛ Closing idle stream {}", session_id);
+                match finish_stream(&state, &idle).await {
+                    Err(StatusCode::SERVICE_UNAVAILABLE | StatusCode::INTERNAL_SERVER_ERROR) => {}
+                    _ => {
+                        state.streams.remove(&session_id);
+                    }
+                }
+            }
+        }
+    });
+}
+
+/// Transcribe the session's current window if it is due, and publish the
+/// result as a `partial_transcript` event. Partials are best effort: they
+/// are skipped while the pool already has a backlog, so they never delay
+/// complete recordings.
+fn schedule_partial(state: &Arc<ServerState>, session: &Arc<Mutex<StreamSession>>) {
+    if state.inference.queue_depth() >= state.inference.workers() {
+        return;
+    }
+    let Some(run) = session.lock().unwrap().take_partial_run() else {
+        return;
+    };
+    let (label, device) = {
+        let session = session.lock().unwrap();
+        (format!("{} partial", session.id), session.device_id.clone())
+    };
+
+    let state_clone = state.clone();
+    let session_clone = session.clone();
+    let job = TranscriptionJob {
+        label,
+        device,
+        priority: Priority::Live,
+        audio: PcmSource::Memory(PcmBuffer::new(run.window)),
+        on_done: Box::new(move |result, _timing| {
+            let event = {
+                let mut session = session_clone.lock().unwrap();
+                if !session.apply_partial(run.end, result.as_deref().ok()) || result.is_err() {
+                    None
+                } else {
+                    Some(serde_json::json!({
+                        "device_id": &*session.device_id,
+                        "session": &*session.id,
+                        "committed": session.committed(),
+                        "tentative": session.tentative(),
+                        "audio_sec": run.end as f32 / (session.sample_rate as f32 * session.channels as f32 * 2.0),
+                        "elapsed_ms": session.started.elapsed().as_millis() as u64,
+                    }))
+                }
+            };
+            if let Some(event) = event {
+                state_clone.broadcast_sse("partial_transcript", &event);
+            }
+            // Audio that arrived while this run was busy
+            schedule_partial(&state_clone, &session_clone);
+        }),
+    };
+    if state.inference.submit(job).is_err() {
+        session.lock().unwrap().apply_partial(run.end, None);
+    }
+}
+
+/// Save a finished stream and queue the full recording; its transcript is
+/// followed by a `final` event for the session. If that fails, the session
+/// gets its audio back so closing it can be retried.
+async fn finish_stream(state: &Arc<ServerState>, session: &Arc<Mutex<StreamSession>>) -> Result<Ingested, StatusCode> {
+    let pcm = session.lock().unwrap().finish();
+    let result = save_stream(state, session, pcm.clone()).await;
+    if result.is_err() {
+        session.lock().unwrap().reopen(pcm);
+    }
+    result
+}
+
+async fn save_stream(
+    state: &Arc<ServerState>,
+    session: &Arc<Mutex<StreamSession>>,
+    pcm: Bytes,
+) -> Result<Ingested, StatusCode> {
+    let (session_id, device_id, sample_rate, channels, started) = {
+        let session = session.lock().unwrap();
+        (session.id.clone(), session.device_id.clone(), session.sample_rate, session.channels, session.started)
+    };
+    let mut trace = LatencyTrace::new(Some(&session_id));
+    trace.stamp_at("upload_begin", started);
+    trace.stamp("received");
+    let pcm = PcmBuffer::new(pcm);
+    if pcm.is_empty() {
+        return Err(StatusCode::BAD_REQUEST);
+    }
+
+    let (wav_filename, wav_path) = new_wav_path(&device_id)?;
+    let audio_hash = hash_audio(pcm.as_bytes(), sample_rate, channels);
+    if let Some(duplicate) = claim_audio(state, &device_id, &audio_hash, DUPLICATE_WINDOW) {
+        // Close the live view with the earlier result
+        let text = duplicate
+            .as_deref()
+            .and_then(|record| serde_json::from_str::<serde_json::Value>(record).ok())
+            .and_then(|record| record.get("transcript").cloned());
+        state.broadcast_sse("final", &serde_json::json!({
+            "device_id": &*device_id,
+            "session": &*session_id,
+            "transcript": text,
+            "duplicate": true,
+        }));
+        return Ok(Ingested::Duplicate(duplicate));
+    }
+
+    let write_started = Instant::now();
+    let saved = save_wav_file(&wav_path, &pcm, sample_rate, channels);
+    state.metrics.wav_write_seconds.observe_duration(write_started.elapsed());
+    if saved.is_err() {
+        state.pending_audio.release(&device_id, &audio_hash);
+        return Err(StatusCode::INTERNAL_SERVER_ERROR);
+    }
+    println!("  Saved: {} (stream {})", wav_path.display(), session_id);
+    trace.stamp("stored");
+
+    let recording = NewRecording {
+        device_id: device_id.to_string(),
+        wav_filename,
+        wav_path,
+        num_samples: pcm.samples().len(),
+        sample_rate,
+        audio_quality: serde_json::json!({}),
+        stream_session: Some(session_id),
+        audio_hash,
+        priority: Priority::Live,
+        trace,
+    };
+    queue_transcription(state, recording, PcmSource::Memory(pcm)).await
+}
+
+/// What became of an uploaded recording
+enum Ingested {
+    Queued,
+    /// Same audio as an earlier upload: that upload's transcript, or None
+    /// while it is still being transcribed
+    Duplicate(Option<Arc<str>>),
+}
+
+impl Ingested {
+    fn to_json(&self) -> serde_json::Value {
+        match self {
+            Ingested::Queued => serde_json::json!({"status": "success"}),
+            Ingested::Duplicate(record) => serde_json::json!({
+                "status": "duplicate",
+                "transcript": record
+                    .as_deref()
+                    .and_then(|record| serde_json::from_str::<serde_json::Value>(record).ok()),
+            }),
+        }
+    }
+}
+
+/// Claim a device's audio for transcription by its hash. Returns None if it
+/// is new (the caller must then queue it or `release` the claim); otherwise
+/// the device's transcript of the same audio from at most `max_age` ago, or
+/// Some(None) if that is still in progress.
+///
+/// The pending set stays locked across both lookups, and a finished job
+/// indexes its transcript before releasing its claim, so concurrent
+/// uploads of the same audio can't both get through.
+fn claim_audio(
+    state: &ServerState,
+    device_id: &str,
+    audio_hash: &str,
+    max_age: Duration,
+) -> Option<Option<Arc<str>>> {
+    let mut pending = state.pending_audio.lock();
+    if let Some(record) = state.transcripts.find_by_audio_hash(device_id, audio_hash, max_age) {
+        println!("  Same audio as transcript already on file - not transcribing again");
+        return Some(Some(record));
+    }
+    if !pending.insert((device_id.to_string(), audio_hash.to_string())) {
+        println!("  Same audio as a recording still being transcribed");
+        return Some(None);
+    }
+    None
+}
+
+/// Save one recording as WAV and queue it for transcription
+async fn ingest_recording(
+    state: &Arc<ServerState>,
+    device_id: &str,
+    sample_rate: u32,
+    channels: u16,
+    priority: Priority,
+    pcm: Bytes,
+    audio_quality_json: serde_json::Value,
+    mut trace: LatencyTrace,
+) -> Result<Ingested, StatusCode> {
+    // One buffer, shared by the WAV writer and the inference job
+    let pcm = PcmBuffer::new(pcm);
+
+    if pcm.is_empty() {
+        return Err(StatusCode::BAD_REQUEST);
+    }
+
+    let audio_hash = hash_audio(pcm.as_bytes(), sample_rate, channels);
+    if let Some(duplicate) = claim_audio(state, device_id, &audio_hash, DUPLICATE_WINDOW) {
+        return Ok(Ingested::Duplicate(duplicate));
+    }
 
     // Save WAV file directly (no processing)
-    let timestamp = Utc::now().format("%Y%m%d_%H%M%S");
-    let wav_filename = format!("{}_{}.wav", device_id, timestamp);
-    let wav_path = PathBuf::from("received_audio").join(&wav_filename);
-    
-    fs::create_dir_all("received_audio").map_err(|_| StatusCode::INTERNAL_SERVER_ERROR)?;
-    save_wav_file(&wav_path, &pcm_samples, sample_rate, channels)
-        .map_err(|_| StatusCode::INTERNAL_SERVER_ERROR)?;
+    let saved = new_wav_path(device_id).and_then(|(wav_filename, wav_path)| {
+        let write_started = Instant::now();
+        save_wav_file(&wav_path, &pcm, sample_rate, channels)
+            .map_err(|_| StatusCode::INTERNAL_SERVER_ERROR)?;
+        state.metrics.wav_write_seconds.observe_duration(write_started.elapsed());
+        Ok((wav_filename, wav_path))
+    });
+    let (wav_filename, wav_path) = match saved {
+        Ok(saved) => saved,
+        Err(status) => {
+            state.pending_audio.release(device_id, &audio_hash);
+            return Err(status);
+        }
+    };
     
     println!("  Saved: {}", wav_path.display());
+    trace.stamp("stored");
 
-    // Extract audio quality metrics from headers (from ESP32)
-    let mut audio_quality_json = serde_json::json!({});
-    for (key, value) in headers.iter() {
-        if let Some(header_name) = key.as_str().to_lowercase().strip_prefix("x-audio-") {
-            if let Ok(header_value) = value.to_str() {
-                if let Ok(num_value) = header_value.parse::<f64>() {
-                    audio_quality_json[header_name] = serde_json::json!(num_value);
-                }
+    let recording = NewRecording {
+        device_id: device_id.to_string(),
+        wav_filename,
+        wav_path: wav_path.clone(),
+        num_samples: pcm.samples().len(),
+        sample_rate,
+        audio_quality: audio_quality_json,
+        stream_session: None,
+        audio_hash,
+        priority,
+        trace,
+    };
+    queue_transcription(state, recording, PcmSource::Memory(pcm)).await.map_err(|status| {
+        remove_recording(&wav_path);
+        status
+    })
+}
+
+/// Stream a request body straight into a WAV file, then queue the file for
+/// transcription. Only the write buffer is held per upload, regardless of
+/// recording length; samples are loaded when an inference worker is free.
+/// The audio is hashed on the way through, so a re-upload of a recording
+/// we already have is dropped instead of transcribed again.
+async fn receive_recording(
+    state: &Arc<ServerState>,
+    device_id: &str,
+    sample_rate: u32,
+    channels: u16,
+    priority: Priority,
+    body: Body,
+    audio_quality_json: serde_json::Value,
+    mut trace: LatencyTrace,
+) -> Result<Ingested, StatusCode> {
+    // Don't take the upload if there is nowhere to queue it
+    admit_upload(state, device_id, priority, "upload")?;
+
+    let (wav_filename, wav_path) = new_wav_path(device_id)?;
+    let mut hasher = AudioHasher::new(sample_rate, channels);
+    // Time in the writer only, not waiting on the network
+    let mut write_time = Duration::ZERO;
+    let streamed = async {
+        let mut writer = WavStreamWriter::create(&wav_path, sample_rate, channels)
+            .await
+            .map_err(|_| StatusCode::INTERNAL_SERVER_ERROR)?;
+        let mut stream = body.into_data_stream();
+        while let Some(chunk) = stream.next().await {
+            let chunk = chunk.map_err(|_| StatusCode::BAD_REQUEST)?;
+            if writer.data_len() + chunk.len() as u64 > MAX_UPLOAD_BYTES {
+                return Err(StatusCode::PAYLOAD_TOO_LARGE);
             }
+            hasher.update(&chunk);
+            let write_started = Instant::now();
+            writer.write(&chunk).await.map_err(|_| StatusCode::INTERNAL_SERVER_ERROR)?;
+            write_time += write_started.elapsed();
+        }
+        let write_started = Instant::now();
+        let data_len = writer.finish().await.map_err(|_| StatusCode::INTERNAL_SERVER_ERROR)?;
+        write_time += write_started.elapsed();
+        Ok(data_len)
+    }
+    .await;
+    state.metrics.wav_write_seconds.observe_duration(write_time);
+
+    let data_len = match streamed {
+        Ok(data_len) if data_len > 0 => data_len,
+        Ok(_) => {
+            remove_recording(&wav_path);
+            return Err(StatusCode::BAD_REQUEST);
+        }
+        Err(status) => {
+            remove_recording(&wav_path);
+            return Err(status);
+        }
+    };
+
+    // The WAV is written as the body arrives, so there is no separate write stage
+    trace.stamp("received");
+    let audio_hash = hasher.finish();
+    if let Some(duplicate) = claim_audio(state, device_id, &audio_hash, DUPLICATE_WINDOW) {
+        remove_recording(&wav_path);
+        return Ok(Ingested::Duplicate(duplicate));
+    }
+    println!("  Saved: {} ({} bytes streamed)", wav_path.display(), data_len);
+
+    let recording = NewRecording {
+        device_id: device_id.to_string(),
+        wav_filename,
+        wav_path: wav_path.clone(),
+        num_samples: data_len as usize / 2,
+        sample_rate,
+        audio_quality: audio_quality_json,
+        stream_session: None,
+        audio_hash,
+        priority,
+        trace,
+    };
+    queue_transcription(state, recording, PcmSource::WavFile(wav_path.clone())).await.map_err(|status| {
+        remove_recording(&wav_path);
+        status
+    })
+}
+
+/// Name for a new recording under received_audio/
+fn new_wav_path(device_id: &str) -> Result<(String, PathBuf), StatusCode> {
+    // Millisecond resolution - a batch lands several clips in the same second
+    let timestamp = Utc::now().format("%Y%m%d_%H%M%S_%3f");
+    let wav_filename = format!("{}_{}.wav", device_id, timestamp);
+    fs::create_dir_all("received_audio").map_err(|_| StatusCode::INTERNAL_SERVER_ERROR)?;
+    let wav_path = PathBuf::from("received_audio").join(&wav_filename);
+    Ok((wav_filename, wav_path))
+}
+
+/// A stored recording on its way to the inference pool
+struct NewRecording {
+    device_id: String,
+    wav_filename: String,
+    wav_path: PathBuf,
+    num_samples: usize,
+    sample_rate: u32,
+    audio_quality: serde_json::Value,
+    /// Set for `/audio-stream` and `/audio-segment` uploads
+    stream_session: Option<Arc<str>>,
+    /// Claimed in `pending_audio` until the transcript is indexed
+    audio_hash: String,
+    priority: Priority,
+    /// Stamped at each step on the way to a published transcript
+    trace: LatencyTrace,
+}
+
+impl NewRecording {
+    fn journal_entry(&self, id: u64) -> JournalEntry {
+        JournalEntry {
+            id,
+            device_id: self.device_id.clone(),
+            wav_filename: self.wav_filename.clone(),
+            wav_path: self.wav_path.clone(),
+            num_samples: self.num_samples,
+            sample_rate: self.sample_rate,
+            audio_quality: self.audio_quality.clone(),
+            stream_session: self.stream_session.as_deref().map(str::to_string),
+            audio_hash: self.audio_hash.clone(),
         }
     }
+}
+
+impl From<JournalEntry> for NewRecording {
+    fn from(entry: JournalEntry) -> Self {
+        Self {
+            device_id: entry.device_id,
+            wav_filename: entry.wav_filename,
+            wav_path: entry.wav_path,
+            num_samples: entry.num_samples,
+            sample_rate: entry.sample_rate,
+            audio_quality: entry.audio_quality,
+            stream_session: entry.stream_session.map(Arc::from),
+            audio_hash: entry.audio_hash,
+            // Replays queue behind live work
+            priority: Priority::Bulk,
+            trace: LatencyTrace::new(None),
+        }
+    }
+}
+
+/// Journal a stored recording, then hand it to the inference pool. Callers
+/// acknowledge the upload only after this returns, so an accepted recording
+/// survives a crash. On error the audio hash claim is released; removing
+/// the WAV is up to the caller.
+async fn queue_transcription(
+    state: &Arc<ServerState>,
+    mut recording: NewRecording,
+    audio: PcmSource,
+) -> Result<Ingested, StatusCode> {
+    let entry = recording.journal_entry(state.journal.next_id());
+    if let Err(e) = state.journal.record_queued(&entry).await {
+        eprintln!("❌ Ingest journal: {}", e);
+        state.pending_audio.release(&entry.device_id, &entry.audio_hash);
+        return Err(StatusCode::INTERNAL_SERVER_ERROR);
+    }
+    recording.trace.stamp("journaled");
+    submit_transcription(state, recording, audio, entry.id).map_err(|status| {
+        state.journal.record_done(entry.id);
+        status
+    })
+}
+
+/// Re-queue jobs the journal says were accepted but never finished (the
+/// server stopped first). Runs on its own thread at startup, feeding the
+/// pool as it has room; audio that meanwhile got a transcript is skipped.
+pub fn replay_journal(state: Arc<ServerState>, entries: Vec<JournalEntry>) {
+    if entries.is_empty() {
+        return;
+    }
+    println!("🧾 Replaying {} unfinished transcription(s) from the ingest journal", entries.len());
+    std::thread::spawn(move || {
+        for entry in entries {
+            if !recording_exists(&entry.wav_path) {
+                state.journal.record_done(entry.id);
+                continue;
+            }
+            loop {
+                while state.inference.admits(&entry.device_id, Priority::Bulk).is_err() {
+                    std::thread::sleep(std::time::Duration::from_millis(100));
+                }
+                // Any transcript of it counts here, however old: it is the
+                // same recording, finished just before the server stopped
+                if claim_audio(&state, &entry.device_id, &entry.audio_hash, Duration::MAX).is_some() {
+                    state.journal.record_done(entry.id);
+                    break;
+                }
+                let audio = PcmSource::WavFile(entry.wav_path.clone());
+                if submit_transcription(&state, entry.clone().into(), audio, entry.id).is_ok() {
+                    break;
+                }
+                // Lost a race with live uploads for the last queue slot
+            }
+        }
+    });
+}
+
+/// Hand a journaled recording to the inference pool; the job marks its
+/// journal entry done when it finishes
+fn submit_transcription(
+    state: &Arc<ServerState>,
+    mut recording: NewRecording,
+    audio: PcmSource,
+    journal_id: u64,
+) -> Result<Ingested, StatusCode> {
+    // Get basic audio info (minimal - no complex analysis)
+    let quality = analyze_audio_quality(recording.num_samples, recording.sample_rate);
+    println!("  Audio: {} samples, {:.2}s", quality.num_samples, quality.duration_sec);
 
     // Minimal server-side info
     let server_analysis = serde_json::json!({
@@ -99,93 +940,190 @@ pub async fn handle_audio(
         "duration_sec": quality.duration_sec,
     });
 
-    // Queue transcription
+    // Queue transcription on the inference pool
     let state_clone = state.clone();
-    let samples_clone = pcm_samples.clone();
-    let device_id_clone = device_id.clone();
-    let wav_filename_clone = wav_filename.clone();
-    let audio_quality_clone = audio_quality_json.clone();
-    let server_analysis_clone = server_analysis.clone();
+    let wav_filename = recording.wav_filename.clone();
+    let device: Arc<str> = Arc::from(recording.device_id.as_str());
+    let audio_hash = recording.audio_hash.clone();
+    recording.trace.stamp("enqueued");
+    let job = TranscriptionJob {
+        label: recording.wav_filename.clone(),
+        device: device.clone(),
+        priority: recording.priority,
+        audio,
+        on_done: Box::new(move |result, timing| {
+            let mut recording = recording;
+            let metrics = &state_clone.metrics;
+            metrics.queue_wait_seconds.observe_duration(timing.queue_wait);
+            let audio_sec = recording.num_samples as f64 / recording.sample_rate.max(1) as f64;
+            if audio_sec > 0.0 {
+                // A batched pass is shared evenly between its jobs
+                let engine_sec = (timing.service - timing.load).as_secs_f64() / timing.batch.max(1) as f64;
+                metrics.real_time_factor.observe(engine_sec / audio_sec);
+            }
+            let dequeued_at = timing.finished_at - timing.service;
+            recording.trace.stamp_at("dequeued", dequeued_at);
+            recording.trace.stamp_at("inference_start", dequeued_at + timing.load);
+            recording.trace.stamp_at("inference_end", timing.finished_at);
+            let device_id = recording.device_id.clone();
+            let audio_hash = recording.audio_hash.clone();
+            match result {
+                Ok(text) => finish_transcript(&state_clone, recording, server_analysis, text),
+                Err(e) => eprintln!("❌ Transcription error: {}", e),
+            }
+            state_clone.journal.record_done(journal_id);
+            state_clone.pending_audio.release(&device_id, &audio_hash);
+        }),
+    };
 
-    tokio::spawn(async move {
-        println!("🔄 Transcribing...");
-        let mut engine = state_clone.engine.lock().unwrap();
-        
-        match engine.transcribe(&samples_clone) {
-            Ok(text) => {
-                // Calculate duration from server_analysis before moving it
-                let duration = server_analysis_clone.get("duration_sec")
-                    .and_then(|v| v.as_f64())
-                    .unwrap_or(0.0);
-                
-                let transcript = Transcript {
-                    device_id: device_id_clone.clone(),
-                    timestamp: Utc::now(),
-                    text: text.clone(),
-                    audio_file: Some(format!("received_audio/{}", wav_filename_clone)),
-                    audio_quality: Some(audio_quality_clone.clone()),
-                    server_analysis: Some(server_analysis_clone.clone()),
-                };
-
-                // Save transcript to disk
-                let transcript_dir = PathBuf::from("transcripts");
-                fs::create_dir_all(&transcript_dir).ok();
-                let transcript_filename = format!("{}_{}.json", 
-                    device_id_clone, 
-                    Utc::now().format("%Y%m%d_%H%M%S"));
-                let transcript_path = transcript_dir.join(&transcript_filename);
-                
-                let transcript_json = serde_json::json!({
-                    "device_id": transcript.device_id,
-                    "timestamp": transcript.timestamp.to_rfc3339(),
-                    "transcript": transcript.text,  // UI expects "transcript" field
-                    "text": transcript.text,  // Keep both for compatibility
-                    "audio_file": transcript.audio_file,
-                    "duration": duration,  // UI expects duration field
-                    "audio_quality": transcript.audio_quality,
-                    "server_analysis": transcript.server_analysis,
-                });
-
-                if let Ok(json_str) = serde_json::to_string_pretty(&transcript_json) {
-                    fs::write(&transcript_path, json_str).ok();
-                    println!("📝 Transcript saved: {}", transcript_path.display());
-                }
+    if let Err((_, rejection)) = state.inference.submit(job) {
+        // Shed load rather than queue without bound; the device retries later
+        eprintln!("⚠️  {} - rejecting {}", rejection_reason(rejection), wav_filename);
+        state.pending_audio.release(&device, &audio_hash);
+        return Err(StatusCode::SERVICE_UNAVAILABLE);
+    }
 
-                // Save text file
-                let txt_path = transcript_dir.join(
-                    transcript_filename.replace(".json", ".txt"));
-                fs::write(&txt_path, &text).ok();
-
-                // Add to in-memory transcripts
-                {
-                    let mut transcripts = state_clone.transcripts.lock().unwrap();
-                    transcripts.push(transcript.clone());
-                    if transcripts.len() > 1000 {
-                        transcripts.remove(0);
-                    }
-                }
+    Ok(Ingested::Queued)
+}
 
-                // Broadcast via SSE
-                state_clone.broadcast_sse("transcript", &transcript_json);
-                
-                println!("📝 Transcript: {}", text);
-                println!("{}", "=".repeat(60));
-            }
-            Err(e) => {
-                eprintln!("❌ Transcription error: {}", e);
-            }
-        }
+/// Persist a finished transcript and push it to the UI
+fn finish_transcript(
+    state: &Arc<ServerState>,
+    mut recording: NewRecording,
+    server_analysis: serde_json::Value,
+    text: String,
+) {
+    let duration = server_analysis.get("duration_sec")
+        .and_then(|v| v.as_f64())
+        .unwrap_or(0.0);
+
+    let transcript = Transcript {
+        device_id: recording.device_id.clone(),
+        timestamp: Utc::now(),
+        text: text.clone(),
+        audio_file: Some(format!("received_audio/{}", recording.wav_filename)),
+        audio_quality: Some(recording.audio_quality),
+        server_analysis: Some(server_analysis),
+    };
+
+    let mut transcript_json = serde_json::json!({
+        "device_id": transcript.device_id,
+        "timestamp": transcript.timestamp.to_rfc3339(),
+        "transcript": transcript.text,  // UI expects "transcript" field
+        "text": transcript.text,  // Keep both for compatibility
+        "audio_file": transcript.audio_file,
+        "duration": duration,  // UI expects duration field
+        "audio_quality": transcript.audio_quality,
+        "server_analysis": transcript.server_analysis,
+        "audio_sha256": recording.audio_hash,
     });
+    if let Some(session) = &recording.stream_session {
+        transcript_json["stream_session"] = serde_json::json!(&**session);
+    }
+    // Indexing and the SSE send that follow take microseconds
+    recording.trace.stamp("published");
+    transcript_json["latency"] = recording.trace.to_json();
+
+    // Append to the transcript log (assigns the record's seq)
+    let transcript_json = match state.transcripts.append(transcript_json) {
+        Ok(record) => record,
+        Err(e) => {
+            eprintln!("❌ Failed to save transcript: {}", e);
+            return;
+        }
+    };
+    println!("📝 Transcript saved (seq {})", transcript_json["seq"]);
+    state.latency.record(&recording.trace);
+    println!(
+        "⏱️  Latency {} ms: {}",
+        recording.trace.total_ms().round(),
+        recording
+            .trace
+            .stages()
+            .iter()
+            .map(|(stage, ms)| format!("{} {:.0}", stage, ms))
+            .collect::<Vec<_>>()
+            .join(", ")
+    );
+
+    // Save text file
+    let transcript_dir = PathBuf::from("transcripts");
+    let txt_path = transcript_dir.join(format!("{}_{}.txt",
+        recording.device_id,
+        transcript.timestamp.format("%Y%m%d_%H%M%S_%3f")));
+    fs::write(&txt_path, &text).ok();
 
-    Ok(StatusCode::OK)
+    // Broadcast via SSE
+    state.broadcast_sse("transcript", &transcript_json);
+    if let Some(session) = &recording.stream_session {
+        // Closes the live partial view for this recording
+        state.broadcast_sse("final", &serde_json::json!({
+            "device_id": recording.device_id,
+            "session": &**session,
+            "transcript": text,
+            "seq": transcript_json["seq"],
+        }));
+    }
+    
+    println!("📝 Transcript: {}", text);
+    println!("{}", "=".repeat(60));
 }
 
-/// Handle GET /audio-file - serve WAV files
+/// Handle GET /audio-file?path=...[&format=opus] - serve a recording,
+/// streamed from disk with range and conditional request support (archived
+/// recordings are decoded back to WAV)
 pub async fn handle_audio_file(
+    State(state): State<Arc<ServerState>>,
     Query(params): Query<HashMap<String, String>>,
-) -> Result<impl IntoResponse, StatusCode> {
+    headers: HeaderMap,
+) -> Result<Response, StatusCode> {
     let filepath = params.get("path").ok_or(StatusCode::BAD_REQUEST)?;
-    
+    let full_path = resolve_audio_path(filepath)?;
+
+    // Falls back to the WAV if there is no ffmpeg
+    if params.get("format").map(String::as_str) == Some("opus") {
+        if let Some(opus_path) = state.transcode_cache.opus(&full_path).await {
+            return serve_file(&opus_path, &headers).await;
+        }
+    }
+    if full_path.extension().is_some_and(|e| e == "flac") {
+        return serve_archived(&full_path, &headers, &state.transcode_cache).await;
+    }
+    serve_file(&full_path, &headers).await
+}
+
+#[derive(Deserialize)]
+pub struct PeaksQuery {
+    path: String,
+    /// Frames per peak wanted; the answer has at least this much detail
+    resolution: Option<u64>,
+    /// Seconds into the recording (default all of it)
+    start: Option<f64>,
+    end: Option<f64>,
+}
+
+/// Handle GET /audio-peaks?path=...&resolution=... - min/max peaks of a
+/// recording for drawing its waveform, from the pyramid saved with it
+pub async fn handle_audio_peaks(Query(params): Query<PeaksQuery>) -> Result<Response, StatusCode> {
+    let full_path = resolve_audio_path(&params.path)?;
+    let peaks = tokio::task::spawn_blocking(move || Peaks::load_or_build(&full_path))
+        .await
+        .map_err(|_| StatusCode::INTERNAL_SERVER_ERROR)?
+        .map_err(|e| {
+            eprintln!("⚠️  Can't read peaks: {}", e);
+            StatusCode::INTERNAL_SERVER_ERROR
+        })?;
+    let body = peaks.to_json(
+        params.resolution.unwrap_or(BASE_FRAMES),
+        params.start.unwrap_or(0.0),
+        params.end.unwrap_or(f64::INFINITY),
+    );
+    Ok(([(header::CACHE_CONTROL, "public, max-age=3600")], Json(body)).into_response())
+}
+
+/// Map a UI-supplied recording path onto a file under received_audio/ (its
+/// FLAC if the WAV has been archived)
+fn resolve_audio_path(filepath: &str) -> Result<PathBuf, StatusCode> {
     // Normalize path and prevent directory traversal
     let mut path_str = filepath.to_string();
     
@@ -202,7 +1140,10 @@ pub async fn handle_audio_file(
         return Err(StatusCode::FORBIDDEN);
     }
     
-    let full_path = PathBuf::from("received_audio").join(&path_str);
+    let mut full_path = PathBuf::from("received_audio").join(&path_str);
+    if !full_path.exists() && archived_path(&full_path).exists() {
+        full_path = archived_path(&full_path);
+    }
     
     // Additional security: ensure canonical path is within received_audio
     let canonical_base = std::fs::canonicalize("received_audio")
@@ -214,60 +1155,130 @@ pub async fn handle_audio_file(
         return Err(StatusCode::FORBIDDEN);
     }
 
-    let contents = fs::read(&full_path).map_err(|_| StatusCode::NOT_FOUND)?;
-    
-    Ok((
-        StatusCode::OK,
-        [("Content-Type", "audio/wav")],
-        contents,
-    ))
+    Ok(full_path)
+}
+
+/// Handle POST /reprocess?path=...[&force=1] - transcribe a stored recording again
+///
+/// Audio that already has a transcript returns that transcript without
+/// running the engine, unless `force=1` (e.g. after a model change).
+pub async fn handle_reprocess(
+    State(state): State<Arc<ServerState>>,
+    Query(params): Query<HashMap<String, String>>,
+) -> Result<Json<serde_json::Value>, StatusCode> {
+    let mut trace = LatencyTrace::new(None);
+    trace.stamp("received");
+    let filepath = params.get("path").ok_or(StatusCode::BAD_REQUEST)?;
+    let force = params.get("force").is_some_and(|v| v == "1" || v == "true");
+    let wav_path = resolve_audio_path(filepath)?;
+    let wav_filename = wav_path
+        .file_name()
+        .and_then(|name| name.to_str())
+        .ok_or(StatusCode::BAD_REQUEST)?
+        .to_string();
+
+    let (pcm, sample_rate, channels) =
+        read_recording(&wav_path).map_err(|_| StatusCode::UNPROCESSABLE_ENTITY)?;
+    let audio_hash = hash_audio(pcm.as_bytes(), sample_rate, channels);
+
+    // Recordings are named <device>_<YYYYmmdd>_<HHMMSS>_<ms>.wav (or .flac)
+    let device_id = wav_filename
+        .rsplit_once('.')
+        .map_or(wav_filename.as_str(), |(stem, _)| stem)
+        .rsplitn(4, '_')
+        .nth(3)
+        .unwrap_or("unknown")
+        .to_string();
+
+    if force {
+        if !state.pending_audio.lock().insert((device_id.clone(), audio_hash.clone())) {
+            return Ok(Json(Ingested::Duplicate(None).to_json()));
+        }
+    } else if let Some(duplicate) = claim_audio(&state, &device_id, &audio_hash, DUPLICATE_WINDOW) {
+        return Ok(Json(Ingested::Duplicate(duplicate).to_json()));
+    }
+
+    println!("\n🔁 Reprocessing {} (device {})", wav_filename, device_id);
+
+    let recording = NewRecording {
+        device_id,
+        wav_filename,
+        wav_path,
+        num_samples: pcm.samples().len(),
+        sample_rate,
+        audio_quality: serde_json::json!({}),
+        stream_session: None,
+        audio_hash,
+        priority: Priority::Bulk,
+        trace,
+    };
+    Ok(Json(queue_transcription(&state, recording, PcmSource::Memory(pcm)).await?.to_json()))
+}
+
+/// Value of `key` in a raw query string, borrowed (None if absent or if it
+/// needs percent-decoding, which device ids never do)
+fn raw_query_param<'a>(query: &'a str, key: &str) -> Option<&'a str> {
+    query
+        .split('&')
+        .filter_map(|pair| pair.split_once('='))
+        .find(|(k, _)| *k == key)
+        .map(|(_, v)| v)
+        .filter(|v| !v.contains(['%', '+']))
 }
 
 /// Handle GET /status - device status (used by ESP32 for polling)
+///
+/// Devices poll this several times a second, so the device path allocates
+/// nothing once the device is registered: the id is borrowed from the URI,
+/// the registry update is atomic stores under a shard read lock, and the
+/// body is a static string.
 pub async fn handle_status(
     State(state): State<Arc<ServerState>>,
     ConnectInfo(addr): ConnectInfo<SocketAddr>,
-    Query(params): Query<HashMap<String, String>>,
-) -> Result<impl IntoResponse, StatusCode> {
-    let device_id = params.get("device").cloned().unwrap_or_default();
-    
+    uri: Uri,
+) -> Response {
+    let query = uri.query().unwrap_or("");
+    let decoded;
+    let device_id = match raw_query_param(query, "device") {
+        Some(device_id) => device_id,
+        None => {
+            // Rare: encoded or missing id
+            decoded = Query::<HashMap<String, String>>::try_from_uri(&uri)
+                .ok()
+                .and_then(|Query(mut params)| params.remove("device"))
+                .unwrap_or_default();
+            decoded.as_str()
+        }
+    };
+
+    if device_id.is_empty() {
+        // Return all device statuses for UI
+        return Json(serde_json::json!({
+            "devices": state.devices.recording_states()
+        }))
+        .into_response();
+    }
+
     // Track device as active
-    if !device_id.is_empty() {
-        let mut devices = state.devices.lock().unwrap();
-        devices.insert(
-            device_id.clone(),
-            crate::server::state::DeviceInfo {
-                device_id: device_id.clone(),
-                last_seen: Utc::now(),
-                ip_address: Some(addr.ip().to_string()),
-            },
-        );
+    let (recording, came_online) = state.devices.with_entry(device_id, |device| {
+        device.set_ip(addr.ip());
+        // Devices only report their upload queue while it is non-empty
+        let queue_depth = raw_query_param(query, "queue").and_then(|v| v.parse().ok()).unwrap_or(0);
+        let queue_age_ms = raw_query_param(query, "queue_age").and_then(|v| v.parse().ok()).unwrap_or(0);
+        device.set_upload_queue(queue_depth, queue_age_ms);
+        (device.recording(), device.touch())
+    });
+    if came_online {
+        broadcast_presence(&state, device_id, true);
     }
-    
-    let recording = state
-        .recording_state
-        .lock()
-        .unwrap()
-        .get(&device_id)
-        .copied()
-        .unwrap_or(false);
-    
-    // Return format expected by ESP32: {"recording": true/false}
-    if !device_id.is_empty() {
-        Ok(Json(serde_json::json!({
-            "recording": recording
-        })))
-    } else {
-        // Return all device statuses for UI
-        let devices_status: HashMap<String, bool> = state
-            .recording_state
-            .lock()
-            .unwrap()
-            .clone();
-        Ok(Json(serde_json::json!({
-            "devices": devices_status
-        })))
+    // Sent every few seconds rather than on every poll
+    if let Some(rssi) = raw_query_param(query, "rssi").and_then(|v| v.parse().ok()) {
+        state.telemetry.record(device_id, (now_ms() / 1000.0) as u64, &[(RSSI, rssi)]);
     }
+
+    // Return format expected by ESP32: {"recording": true/false}
+    let body = if recording { r#"{"recording":true}"# } else { r#"{"recording":false}"# };
+    ([(header::CONTENT_TYPE, "application/json")], body).into_response()
 }
 
 /// Handle GET /recording-status - compatibility endpoint
@@ -277,104 +1288,246 @@ pub async fn handle_recording_status(
     Query(_params): Query<HashMap<String, String>>,
 ) -> Json<serde_json::Value> {
     // Return format compatible with Python server
-    let devices: HashMap<String, bool> = state
-        .recording_state
-        .lock()
-        .unwrap()
-        .clone();
-    
     Json(serde_json::json!({
-        "devices": devices
+        "devices": state.devices.recording_states()
     }))
 }
 
+/// Devices not seen polling for this long are dropped from `/devices`
+const DEVICE_TIMEOUT_SECONDS: f64 = 10.0;
+/// How often devices past the timeout are announced offline
+const PRESENCE_CHECK_INTERVAL: Duration = Duration::from_secs(2);
+
+/// A device as listed by `/devices` and the `presence`/`status` events
+fn device_json(device: &DeviceEntry) -> serde_json::Value {
+    let (upload_queue, upload_queue_age_ms) = device.upload_queue();
+    serde_json::json!({
+        "device_id": &*device.device_id,
+        "ip": device.ip().map(|ip| ip.to_string()).unwrap_or_default(),
+        "last_seen": device.last_seen().map(|t| t.to_rfc3339()),
+        "seconds_ago": device.seconds_since_seen().round(),
+        "upload_queue": upload_queue,
+        "upload_queue_age_ms": upload_queue_age_ms
+    })
+}
+
+fn broadcast_presence(state: &ServerState, device_id: &str, online: bool) {
+    let mut event = match state.devices.get(device_id) {
+        Some(device) if online => device_json(&device),
+        _ => serde_json::json!({ "device_id": device_id }),
+    };
+    event["online"] = online.into();
+    state.broadcast_sse("presence", &event);
+}
+
+/// Announce devices that stopped polling as offline (they are announced
+/// online by their first poll or upload), so dashboards need not poll
+/// `/devices`
+pub fn spawn_presence_monitor(state: Arc<ServerState>) {
+    tokio::spawn(async move {
+        let mut interval = tokio::time::interval(PRESENCE_CHECK_INTERVAL);
+        loop {
+            interval.tick().await;
+            for device in state.devices.expire(DEVICE_TIMEOUT_SECONDS) {
+                broadcast_presence(&state, &device.device_id, false);
+            }
+        }
+    });
+}
+
 /// Handle GET /devices - list active devices
 pub async fn handle_devices(
     State(state): State<Arc<ServerState>>,
 ) -> Json<Vec<serde_json::Value>> {
-    let now = Utc::now();
-    let timeout_seconds = 10.0; // DEVICE_TIMEOUT_SECONDS
-    
-    let mut active_devices = Vec::new();
-    let mut devices = state.devices.lock().unwrap();
-    
-    // Filter devices seen within timeout window
-    devices.retain(|device_id, info| {
-        let seconds_since_seen = (now - info.last_seen).num_seconds() as f64;
-        
-        if seconds_since_seen <= timeout_seconds {
-            active_devices.push(serde_json::json!({
-                "device_id": device_id,
-                "ip": info.ip_address.clone().unwrap_or_default(),
-                "last_seen": info.last_seen.to_rfc3339(),
-                "seconds_ago": seconds_since_seen.round()
-            }));
-            true
-        } else {
-            false // Remove stale devices
-        }
-    });
-    
-    Json(active_devices)
+    // Built from a snapshot, so polls are never blocked behind this; the
+    // presence monitor prunes stale entries
+    Json(
+        state
+            .devices
+            .snapshot()
+            .iter()
+            .filter(|device| device.seconds_since_seen() <= DEVICE_TIMEOUT_SECONDS)
+            .map(|device| device_json(device))
+            .collect(),
+    )
 }
 
-/// Handle GET /transcripts - list all transcripts
-pub async fn handle_transcripts(
+#[derive(Deserialize)]
+pub struct DeviceMetricsQuery {
+    /// `90s`, `30m`, `6h`, `7d`, or seconds (default a day)
+    range: Option<String>,
+}
+
+/// Handle GET /devices/:id/metrics - the device's audio metrics and WiFi
+/// signal over `range`, as min/mean/max per bucket
+pub async fn handle_device_metrics(
     State(state): State<Arc<ServerState>>,
-) -> Result<Json<Vec<serde_json::Value>>, StatusCode> {
-    let transcript_dir = PathBuf::from("transcripts");
-    let mut transcripts = Vec::new();
+    Path(device_id): Path<String>,
+    Query(params): Query<DeviceMetricsQuery>,
+) -> Result<Json<serde_json::Value>, StatusCode> {
+    let range = match params.range.as_deref() {
+        Some(range) => parse_range(range).ok_or(StatusCode::BAD_REQUEST)?,
+        None => DEFAULT_RANGE,
+    };
+    state.telemetry.query(&device_id, range).map(Json).ok_or(StatusCode::NOT_FOUND)
+}
 
-    if transcript_dir.exists() {
-        let entries = fs::read_dir(&transcript_dir)
-            .map_err(|_| StatusCode::INTERNAL_SERVER_ERROR)?;
+/// Handle GET /inference-stats - pool totals (jobs, batches, waits)
+pub async fn handle_inference_stats(
+    State(state): State<Arc<ServerState>>,
+) -> Json<serde_json::Value> {
+    let mut stats = state.inference.stats_json();
+    stats["journal"] = state.journal.stats_json();
+    stats["archive"] = state.archive.stats_json();
+    Json(stats)
+}
 
-        for entry in entries {
-            if let Ok(entry) = entry {
-                let path = entry.path();
-                if path.extension().and_then(|s| s.to_str()) == Some("json") {
-                    if let Ok(content) = fs::read_to_string(&path) {
-                        if let Ok(mut data) = serde_json::from_str::<serde_json::Value>(&content) {
-                            // Ensure timestamp is in ISO format for UI compatibility
-                            if let Some(ts) = data.get("timestamp") {
-                                if let Some(ts_str) = ts.as_str() {
-                                    // Check if already ISO format (contains 'T')
-                                    if !ts_str.contains('T') {
-                                        // Old format: "20260119_172003" - try to parse and convert
-                                        if ts_str.len() >= 15 && ts_str.contains('_') {
-                                            // Format: YYYYMMDD_HHMMSS
-                                            if let Ok(dt) = chrono::NaiveDateTime::parse_from_str(ts_str, "%Y%m%d_%H%M%S") {
-                                                let dt_utc = dt.and_utc();
-                                                data["timestamp"] = serde_json::json!(dt_utc.to_rfc3339());
-                                            }
-                                        }
-                                    }
-                                    // If already ISO format or parse failed, keep as-is
-                                }
-                            }
-                            
-                            // Ensure transcript field exists (UI expects it)
-                            if !data.get("transcript").is_some() {
-                                if let Some(text) = data.get("text") {
-                                    data["transcript"] = text.clone();
-                                }
-                            }
-                            transcripts.push(data);
-                        }
-                    }
+/// Handle GET /latency - per-stage latency percentiles over recent recordings
+pub async fn handle_latency(State(state): State<Arc<ServerState>>) -> Json<serde_json::Value> {
+    Json(state.latency.percentiles_json())
+}
+
+/// Handle GET /metrics - Prometheus text format
+///
+/// Gauges are read from the structures that already hold them, so nothing
+/// but the scrape itself pays for them.
+pub async fn handle_metrics(State(state): State<Arc<ServerState>>) -> Response {
+    let mut body = String::with_capacity(8 * 1024);
+    state.metrics.render(&mut body);
+    state.archive.render(&mut body);
+    gauge(&mut body, "memo_inference_queue_depth", "Transcription jobs waiting for a worker", state.inference.queue_depth() as u64);
+    gauge(&mut body, "memo_inference_queue_capacity", "Transcription jobs the queue admits", state.inference.capacity() as u64);
+    gauge(&mut body, "memo_inference_workers", "Inference worker threads", state.inference.workers() as u64);
+    gauge(&mut body, "memo_sse_clients", "Connected /events clients", state.sse.receiver_count() as u64);
+    let active_devices = state
+        .devices
+        .snapshot()
+        .iter()
+        .filter(|device| device.seconds_since_seen() <= DEVICE_TIMEOUT_SECONDS)
+        .count();
+    gauge(&mut body, "memo_active_devices", "Devices that polled /status recently", active_devices as u64);
+    gauge(&mut body, "memo_stream_sessions", "Open /audio-stream and /audio-segment sessions", state.streams.len() as u64);
+    ([(header::CONTENT_TYPE, "text/plain; version=0.0.4")], body).into_response()
+}
+
+/// Counts requests per route and times `/status` polls and uploads, for
+/// `/metrics`. Upload bodies are counted as they stream through, so an
+/// upload is never buffered for this.
+pub async fn track_requests(State(state): State<Arc<ServerState>>, request: Request, next: Next) -> Response {
+    let Some(route) = request
+        .extensions()
+        .get::<MatchedPath>()
+        .and_then(|path| Metrics::route_index(path.as_str()))
+    else {
+        return next.run(request).await;
+    };
+    let upload = request.method() == Method::POST && ROUTES[route].starts_with("/audio");
+    let request = if upload {
+        let counted = state.clone();
+        request.map(|body| {
+            Body::from_stream(body.into_data_stream().map(move |chunk| {
+                if let Ok(chunk) = &chunk {
+                    counted.metrics.upload_bytes.fetch_add(chunk.len() as u64, Ordering::Relaxed);
                 }
-            }
-        }
+                chunk
+            }))
+        })
+    } else {
+        request
+    };
+
+    let started = Instant::now();
+    let response = next.run(request).await;
+    state.metrics.record_request(route, response.status().as_u16());
+    if upload {
+        state.metrics.upload_seconds.observe_duration(started.elapsed());
+    } else if ROUTES[route] == "/status" {
+        state.metrics.status_seconds.observe_duration(started.elapsed());
     }
+    response
+}
 
-    // Sort by timestamp descending
-    transcripts.sort_by(|a, b| {
-        let ts_a = a.get("timestamp").and_then(|t| t.as_str()).unwrap_or("");
-        let ts_b = b.get("timestamp").and_then(|t| t.as_str()).unwrap_or("");
-        ts_b.cmp(ts_a)
-    });
+#[derive(Deserialize)]
+pub struct TranscriptsQuery {
+    /// Cursor: only records with a smaller `seq` (from `X-Next-Before`)
+    before: Option<u64>,
+    limit: Option<usize>,
+    device: Option<String>,
+}
+
+const TRANSCRIPTS_DEFAULT_LIMIT: usize = 200;
+const TRANSCRIPTS_MAX_LIMIT: usize = 1000;
+
+/// Handle GET /transcripts - newest first, paginated
+///
+/// Returns a JSON array. When older records exist, `X-Next-Before` holds the
+/// cursor to pass as `?before=` for the next page.
+pub async fn handle_transcripts(
+    State(state): State<Arc<ServerState>>,
+    Query(params): Query<TranscriptsQuery>,
+) -> impl IntoResponse {
+    let limit = params
+        .limit
+        .unwrap_or(TRANSCRIPTS_DEFAULT_LIMIT)
+        .min(TRANSCRIPTS_MAX_LIMIT);
+    let page = state
+        .transcripts
+        .page(params.before, limit, params.device.as_deref());
 
-    Ok(Json(transcripts))
+    let mut headers = HeaderMap::new();
+    headers.insert(header::CONTENT_TYPE, HeaderValue::from_static("application/json"));
+    if let Some(next_before) = page.next_before {
+        headers.insert("x-next-before", HeaderValue::from(next_before));
+        headers.insert(header::ACCESS_CONTROL_EXPOSE_HEADERS, HeaderValue::from_static("x-next-before"));
+    }
+
+    (headers, page.to_json_array())
+}
+
+/// Handle GET /transcript-counts - transcripts in total and per device, so
+/// the UI can label tabs without loading every page
+pub async fn handle_transcript_counts(State(state): State<Arc<ServerState>>) -> Json<serde_json::Value> {
+    Json(state.transcripts.counts())
+}
+
+#[derive(Deserialize)]
+pub struct SearchParams {
+    q: Option<String>,
+    device: Option<String>,
+    /// RFC 3339 or YYYY-MM-DD, inclusive
+    from: Option<String>,
+    /// RFC 3339 (exclusive) or YYYY-MM-DD (that whole day included)
+    to: Option<String>,
+    offset: Option<usize>,
+    limit: Option<usize>,
+}
+
+const SEARCH_DEFAULT_LIMIT: usize = 20;
+const SEARCH_MAX_LIMIT: usize = 100;
+
+/// Handle GET /search?q=...[&device=&from=&to=&offset=&limit=] - transcripts
+/// ranked by relevance (BM25), each with a `<mark>`-highlighted snippet
+pub async fn handle_search(
+    State(state): State<Arc<ServerState>>,
+    Query(params): Query<SearchParams>,
+) -> Result<Json<serde_json::Value>, StatusCode> {
+    let query_terms: Vec<String> = terms(params.q.as_deref().unwrap_or("")).collect();
+    if query_terms.is_empty() {
+        return Err(StatusCode::BAD_REQUEST);
+    }
+    let bound = |value: &Option<String>, end_of_day: bool| match value {
+        Some(value) => parse_time_bound(value, end_of_day).map(Some).ok_or(StatusCode::BAD_REQUEST),
+        None => Ok(None),
+    };
+    let query = SearchQuery {
+        terms: query_terms,
+        device: params.device.as_deref().filter(|d| !d.is_empty()),
+        from_ms: bound(&params.from, false)?,
+        to_ms: bound(&params.to, true)?,
+        offset: params.offset.unwrap_or(0),
+        limit: params.limit.unwrap_or(SEARCH_DEFAULT_LIMIT).clamp(1, SEARCH_MAX_LIMIT),
+    };
+    Ok(Json(state.transcripts.search(&query)))
 }
 
 /// Handle POST /record/start - start recording for device
@@ -384,10 +1537,7 @@ pub async fn handle_recording_start(
 ) -> Result<impl IntoResponse, StatusCode> {
     let device_id = params.get("device").cloned().ok_or(StatusCode::BAD_REQUEST)?;
     
-    {
-        let mut recording = state.recording_state.lock().unwrap();
-        recording.insert(device_id.clone(), true);
-    }
+    state.devices.with_entry(&device_id, |device| device.set_recording(true));
 
     println!("\n🔴 RECORDING STARTED for device: {}", device_id);
     println!("{}", "=".repeat(60));
@@ -410,10 +1560,7 @@ pub async fn handle_recording_stop(
 ) -> Result<impl IntoResponse, StatusCode> {
     let device_id = params.get("device").cloned().ok_or(StatusCode::BAD_REQUEST)?;
     
-    {
-        let mut recording = state.recording_state.lock().unwrap();
-        recording.insert(device_id.clone(), false);
-    }
+    state.devices.with_entry(&device_id, |device| device.set_recording(false));
 
     println!("\n⏹️  RECORDING STOPPED for device: {}", device_id);
     println!("{}", "=".repeat(60));
@@ -429,19 +1576,168 @@ pub async fn handle_recording_stop(
     })))
 }
 
-/// Handle GET /events - Server-Sent Events stream
+#[derive(Deserialize)]
+pub struct EventsQuery {
+    /// Comma-separated device ids; omitted = all devices
+    device: Option<String>,
+    /// Resume after this event, for clients that can't send `Last-Event-ID`
+    last_event_id: Option<u64>,
+}
+
+/// Events queued per client between the broadcast channel and its socket
+const SSE_CLIENT_BUFFER: usize = 32;
+
+/// Handle GET /events - Server-Sent Events, optionally for some devices only
+///
+/// Every broadcast event carries an `id`. A client reconnecting with
+/// `Last-Event-ID` (or `?last_event_id=`) is first sent what it missed from
+/// the replay buffer; a fresh client gets a `status` snapshot of recording
+/// state and online devices instead. A client that falls behind the
+/// broadcast channel is caught up from the same buffer, and only when that
+/// no longer reaches back far enough is it sent `resync` (reload
+/// transcripts) and a new snapshot.
 pub async fn handle_events(
     State(state): State<Arc<ServerState>>,
-) -> Sse<impl Stream<Item = Result<axum::response::sse::Event, axum::Error>>> {
-    let (tx, rx) = mpsc::unbounded_channel();
-    state.add_sse_sender(tx);
+    Query(params): Query<EventsQuery>,
+    headers: HeaderMap,
+) -> Sse<impl Stream<Item = Result<Event, axum::Error>>> {
+    let devices: Option<HashSet<String>> = params.device.map(|list| {
+        list.split(',')
+            .filter(|d| !d.is_empty())
+            .map(str::to_string)
+            .collect()
+    });
+    let last_event_id = header_u64(&headers, "last-event-id").or(params.last_event_id);
+    let (mut receiver, newest, missed) = state.subscribe_sse(last_event_id);
+    let (tx, rx) = mpsc::channel::<Event>(SSE_CLIENT_BUFFER);
+
+    tokio::spawn(async move {
+        let wanted = |message: &SseMessage| match (&devices, &message.device_id) {
+            (Some(devices), Some(device_id)) => devices.contains(&**device_id),
+            _ => true,
+        };
+        let event = |message: &SseMessage| {
+            Event::default().id(message.id.to_string()).event(message.event).data(&*message.data)
+        };
+        // Highest id sent (or covered by a snapshot), so replayed events
+        // aren't repeated by the channel
+        let mut last_id = newest;
+        let mut catch_up = missed.unwrap_or(Err(0));
+        let mut resync = last_event_id.is_some();
+        loop {
+            match catch_up {
+                Ok(messages) => {
+                    for message in messages {
+                        last_id = message.id;
+                        if wanted(&message) && tx.send(event(&message)).await.is_err() {
+                            return;
+                        }
+                    }
+                }
+                Err(skipped) => {
+                    // Nothing to resume from: a snapshot stands in for the
+                    // missed events
+                    if resync {
+                        state.metrics.sse_dropped.fetch_add(skipped, Ordering::Relaxed);
+                        let notice = Event::default().event("resync").data(format!("{{\"skipped\":{}}}", skipped));
+                        if tx.send(notice).await.is_err() {
+                            return;
+                        }
+                    }
+                    if tx.send(status_event(&state, devices.as_ref())).await.is_err() {
+                        return;
+                    }
+                }
+            }
 
-    let stream = UnboundedReceiverStream::new(rx)
-        .map(|msg| Ok(axum::response::sse::Event::default().data(msg)));
+            resync = true;
+            catch_up = loop {
+                match receiver.recv().await {
+                    Ok(message) => {
+                        if message.id <= last_id {
+                            continue; // Already replayed
+                        }
+                        last_id = message.id;
+                        if wanted(&message) && tx.send(event(&message)).await.is_err() {
+                            return; // Client went away
+                        }
+                    }
+                    // Too slow to keep up - replay what the channel dropped
+                    Err(broadcast::error::RecvError::Lagged(_)) => break state.sse_since(last_id),
+                    Err(broadcast::error::RecvError::Closed) => return,
+                }
+            };
+        }
+    });
 
-    Sse::new(stream).keep_alive(
+    Sse::new(ReceiverStream::new(rx).map(Ok)).keep_alive(
         axum::response::sse::KeepAlive::new()
             .interval(std::time::Duration::from_secs(15))
             .text("keep-alive-text"),
     )
 }
+
+/// Recording state and online devices, limited to `devices` if given
+fn status_event(state: &ServerState, devices: Option<&HashSet<String>>) -> Event {
+    let subscribed = |id: &str| devices.map_or(true, |d| d.contains(id));
+    let snapshot = state.devices.snapshot();
+    let recording: serde_json::Map<String, serde_json::Value> = snapshot
+        .iter()
+        .filter(|device| subscribed(&device.device_id))
+        .map(|device| (device.device_id.to_string(), device.recording().into()))
+        .collect();
+    let online: Vec<serde_json::Value> = snapshot
+        .iter()
+        .filter(|device| subscribed(&device.device_id) && device.seconds_since_seen() <= DEVICE_TIMEOUT_SECONDS)
+        .map(|device| device_json(device))
+        .collect();
+    Event::default()
+        .event("status")
+        .data(serde_json::json!({ "devices": recording, "online": online }).to_string())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn clip(meta: &str, pcm: &[u8]) -> Vec<u8> {
+        let mut out = (meta.len() as u32).to_le_bytes().to_vec();
+        out.extend_from_slice(meta.as_bytes());
+        out.extend_from_slice(&(pcm.len() as u32).to_le_bytes());
+        out.extend_from_slice(pcm);
+        out
+    }
+
+    #[test]
+    fn split_audio_batch_reads_every_clip() {
+        let mut body = clip(r#"{"id":"a","age_ms":5}"#, &[1, 2, 3, 4]);
+        body.extend(clip(r#"{"id":"b"}"#, &[]));
+        let clips = split_audio_batch(&Bytes::from(body)).unwrap();
+        assert_eq!(clips.len(), 2);
+        assert_eq!(clips[0].0["id"], "a");
+        assert_eq!(clips[0].0["age_ms"], 5);
+        assert_eq!(&clips[0].1[..], &[1, 2, 3, 4]);
+        assert_eq!(clips[1].0["id"], "b");
+        assert!(clips[1].1.is_empty());
+    }
+
+    #[test]
+    fn split_audio_batch_accepts_an_empty_body() {
+        assert_eq!(split_audio_batch(&Bytes::new()).unwrap().len(), 0);
+    }
+
+    #[test]
+    fn split_audio_batch_rejects_malformed_bodies() {
+        let whole = clip(r#"{"id":"a"}"#, &[1, 2]);
+        // Cut anywhere inside the clip: length prefix, meta, second prefix or PCM
+        for cut in 1..whole.len() {
+            assert!(split_audio_batch(&Bytes::copy_from_slice(&whole[..cut])).is_none(), "cut at {}", cut);
+        }
+        // Meta that isn't JSON
+        assert!(split_audio_batch(&Bytes::from(clip("{id", &[1, 2]))).is_none());
+        // Length far past the end (and past usize on 32-bit targets)
+        let mut huge = u32::MAX.to_le_bytes().to_vec();
+        huge.extend_from_slice(b"{}");
+        assert!(split_audio_batch(&Bytes::from(huge)).is_none());
+    }
+}
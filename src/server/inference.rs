@@ -0,0 +1,388 @@
+use crate::server::audio::{archived_samples, read_wav_pcm, PcmBuffer};
+use crate::server::scheduler::{FairQueue, Priority, Rejection, Scheduled};
+use memo_stt::SttEngine;
+use std::path::PathBuf;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::Arc;
+use std::thread;
+use std::time::{Duration, Instant};
+
+/// Anything that turns 16-bit PCM into text. Implemented by the real
+/// Whisper engine and by `SimulatedEngine` for load testing without a model.
+pub trait Transcriber: Send + 'static {
+    fn transcribe(&mut self, samples: &[i16]) -> anyhow::Result<String>;
+
+    /// Largest batch `transcribe_batch` handles in one pass. 1 means the
+    /// engine has no batched path and the pool never waits to fill one.
+    fn max_batch(&self) -> usize {
+        1
+    }
+
+    /// Transcribe several clips in one padded pass; one result per clip
+    fn transcribe_batch(&mut self, batch: &[&[i16]]) -> Vec<anyhow::Result<String>> {
+        batch.iter().map(|samples| self.transcribe(samples)).collect()
+    }
+}
+
+impl Transcriber for SttEngine {
+    fn transcribe(&mut self, samples: &[i16]) -> anyhow::Result<String> {
+        SttEngine::transcribe(self, samples).map_err(|e| anyhow::anyhow!("{}", e))
+    }
+}
+
+/// Stand-in engine that burns `cost_per_audio_sec` of wall time per second
+/// of audio, so queueing behavior can be exercised without a GPU.
+///
+/// It "hears" one word per 500 ms of audio, picked from the samples, so the
+/// same audio always yields the same words and a growing recording yields a
+/// growing transcript (what streaming partials need to be testable).
+///
+/// Batches are modelled like a CPU encoder pass: every clip is padded to the
+/// longest one, and each extra clip adds `SIMULATED_BATCH_MARGINAL` of a
+/// single pass.
+pub struct SimulatedEngine {
+    pub sample_rate: u32,
+    pub cost_per_audio_sec: Duration,
+    pub max_batch: usize,
+}
+
+const SIMULATED_BATCH_MARGINAL: f64 = 0.25;
+
+/// Engines are created for 16 kHz audio (see main.rs)
+const ENGINE_SAMPLE_RATE: u64 = 16000;
+
+const SIMULATED_WORDS: [&str; 16] = [
+    "alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel",
+    "india", "juliet", "kilo", "lima", "mike", "november", "oscar", "papa",
+];
+
+impl SimulatedEngine {
+    fn words(&self, samples: &[i16]) -> String {
+        let block = (self.sample_rate as usize / 2).max(1);
+        let words: Vec<&str> = samples
+            .chunks_exact(block)
+            .map(|chunk| {
+                let sum = chunk.iter().fold(0u32, |acc, &s| acc.wrapping_mul(31).wrapping_add(s as u16 as u32));
+                SIMULATED_WORDS[(sum >> 7) as usize % SIMULATED_WORDS.len()]
+            })
+            .collect();
+        words.join(" ")
+    }
+}
+
+impl Transcriber for SimulatedEngine {
+    fn transcribe(&mut self, samples: &[i16]) -> anyhow::Result<String> {
+        let audio_sec = samples.len() as f64 / self.sample_rate as f64;
+        thread::sleep(self.cost_per_audio_sec.mul_f64(audio_sec));
+        Ok(self.words(samples))
+    }
+
+    fn max_batch(&self) -> usize {
+        self.max_batch
+    }
+
+    fn transcribe_batch(&mut self, batch: &[&[i16]]) -> Vec<anyhow::Result<String>> {
+        let longest = batch.iter().map(|samples| samples.len()).max().unwrap_or(0);
+        let padded_sec = longest as f64 / self.sample_rate as f64;
+        let extra = batch.len().saturating_sub(1) as f64 * SIMULATED_BATCH_MARGINAL;
+        thread::sleep(self.cost_per_audio_sec.mul_f64(padded_sec * (1.0 + extra)));
+        batch.iter().map(|samples| Ok(self.words(samples))).collect()
+    }
+}
+
+/// Where a job's time went
+#[derive(Debug, Clone, Copy)]
+pub struct JobTiming {
+    pub queue_wait: Duration,
+    pub service: Duration,
+    /// Part of `service` spent loading audio before the engine ran
+    pub load: Duration,
+    /// When the engine returned
+    pub finished_at: Instant,
+    pub worker: usize,
+    /// Jobs in the engine pass this one ran in
+    pub batch: usize,
+}
+
+/// How workers gather jobs into batches
+#[derive(Debug, Clone, Copy)]
+pub struct BatchConfig {
+    /// Upper bound on jobs per engine pass (also capped by the engine)
+    pub max_batch: usize,
+    /// How long a worker holding a job waits for others to join it. Only
+    /// used when the queue is empty: with a backlog, batches fill from the
+    /// queue without waiting.
+    pub window: Duration,
+}
+
+/// Running totals for `/inference-stats`
+#[derive(Default)]
+struct PoolCounters {
+    jobs: AtomicU64,
+    batches: AtomicU64,
+    audio_ms: AtomicU64,
+    queue_wait_ms: AtomicU64,
+    batch_wait_ms: AtomicU64,
+    service_ms: AtomicU64,
+    /// Workers in an engine pass right now
+    busy: AtomicU64,
+}
+
+/// Where a job's audio lives until a worker picks it up
+pub enum PcmSource {
+    /// Already in memory (shared with storage)
+    Memory(PcmBuffer),
+    /// Streamed to disk; loaded only when a worker is free, so queued
+    /// jobs don't hold their audio in memory
+    WavFile(PathBuf),
+}
+
+impl PcmSource {
+    /// Engine audio this will take, for fair scheduling (WAV files are sized
+    /// from their length, not read; archived ones from the FLAC header)
+    fn duration_ms(&self) -> u64 {
+        let bytes = match self {
+            PcmSource::Memory(pcm) => pcm.samples().len() as u64 * 2,
+            PcmSource::WavFile(path) => match std::fs::metadata(path) {
+                Ok(metadata) => metadata.len().saturating_sub(44),
+                Err(_) => archived_samples(path).unwrap_or(0) * 2,
+            },
+        };
+        bytes / 2 * 1000 / ENGINE_SAMPLE_RATE
+    }
+
+    fn load(self) -> anyhow::Result<PcmBuffer> {
+        match self {
+            PcmSource::Memory(pcm) => Ok(pcm),
+            PcmSource::WavFile(path) => read_wav_pcm(&path),
+        }
+    }
+}
+
+pub struct TranscriptionJob {
+    pub label: String,
+    /// Whose queue the job waits in
+    pub device: Arc<str>,
+    pub priority: Priority,
+    pub audio: PcmSource,
+    /// Runs on the inference thread once the engine is done
+    pub on_done: Box<dyn FnOnce(anyhow::Result<String>, JobTiming) + Send>,
+}
+
+/// A job whose audio is loaded and ready for the engine
+struct ReadyJob {
+    label: String,
+    device: Arc<str>,
+    on_done: Box<dyn FnOnce(anyhow::Result<String>, JobTiming) + Send>,
+    enqueued_at: Instant,
+    pcm: anyhow::Result<PcmBuffer>,
+}
+
+/// Bounded job queue feeding one engine per dedicated OS thread, so
+/// inference never parks Tokio workers and several jobs run at once.
+///
+/// Jobs wait in a `FairQueue`: live work before bulk, devices served in
+/// turn. Engines with a batched path get several jobs per pass: see
+/// `BatchConfig`.
+pub struct InferencePool {
+    queue: Arc<FairQueue<TranscriptionJob>>,
+    counters: Arc<PoolCounters>,
+    workers: usize,
+    batch: BatchConfig,
+    started: Instant,
+}
+
+impl InferencePool {
+    pub fn new(engines: Vec<Box<dyn Transcriber>>, capacity: usize, batch: BatchConfig) -> Self {
+        let queue = Arc::new(FairQueue::new(capacity));
+        let counters = Arc::new(PoolCounters::default());
+        let workers = engines.len();
+
+        for (worker, engine) in engines.into_iter().enumerate() {
+            let queue = queue.clone();
+            let counters = counters.clone();
+            thread::Builder::new()
+                .name(format!("inference-{}", worker))
+                .spawn(move || run_worker(worker, engine, queue, counters, batch))
+                .expect("failed to spawn inference thread");
+        }
+
+        Self {
+            queue,
+            counters,
+            workers,
+            batch,
+            started: Instant::now(),
+        }
+    }
+
+    /// Queue a job; hands it back if it is not admitted
+    pub fn submit(&self, job: TranscriptionJob) -> Result<(), (TranscriptionJob, Rejection)> {
+        let device = job.device.clone();
+        let priority = job.priority;
+        let cost_ms = job.audio.duration_ms();
+        self.queue.push(&device, priority, cost_ms, job)
+    }
+
+    /// Would a job from this device be queued right now? Checked before an
+    /// upload body is read.
+    pub fn admits(&self, device: &str, priority: Priority) -> Result<(), Rejection> {
+        self.queue.admits(device, priority)
+    }
+
+    /// How long a refused client should wait: the queued audio at the
+    /// measured real-time factor, spread over the workers
+    pub fn retry_after(&self) -> Duration {
+        let c = &self.counters;
+        let audio_ms = c.audio_ms.load(Ordering::Relaxed);
+        let jobs = c.jobs.load(Ordering::Relaxed);
+        let batches = c.batches.load(Ordering::Relaxed).max(1);
+        // service_ms is summed per job; per pass it is that over avg batch
+        let service_ms = c.service_ms.load(Ordering::Relaxed) as f64 * batches as f64 / jobs.max(1) as f64;
+        let real_time_factor = if audio_ms > 0 { service_ms / audio_ms as f64 } else { 1.0 };
+        let backlog_sec = self.queue.queued_cost_ms() as f64 / 1000.0 * real_time_factor / self.workers.max(1) as f64;
+        Duration::from_secs(backlog_sec.ceil().clamp(1.0, 60.0) as u64)
+    }
+
+    /// Jobs waiting for an engine
+    pub fn queue_depth(&self) -> usize {
+        self.queue.len()
+    }
+
+    /// Nothing queued and no engine running; background work yields otherwise
+    pub fn is_idle(&self) -> bool {
+        self.queue.len() == 0 && self.counters.busy.load(Ordering::Relaxed) == 0
+    }
+
+    pub fn workers(&self) -> usize {
+        self.workers
+    }
+
+    pub fn capacity(&self) -> usize {
+        self.queue.capacity()
+    }
+
+    /// Totals since startup, for comparing batch settings under load
+    pub fn stats_json(&self) -> serde_json::Value {
+        let c = &self.counters;
+        let jobs = c.jobs.load(Ordering::Relaxed);
+        let batches = c.batches.load(Ordering::Relaxed);
+        let per_job = |total: &AtomicU64| {
+            if jobs > 0 { total.load(Ordering::Relaxed) as f64 / jobs as f64 } else { 0.0 }
+        };
+        serde_json::json!({
+            "workers": self.workers,
+            "queue_depth": self.queue_depth(),
+            "capacity": self.capacity(),
+            "retry_after_sec": self.retry_after().as_secs(),
+            "scheduler": self.queue.stats_json(),
+            "max_batch": self.batch.max_batch,
+            "batch_window_ms": self.batch.window.as_millis() as u64,
+            "jobs": jobs,
+            "batches": batches,
+            "avg_batch": if batches > 0 { jobs as f64 / batches as f64 } else { 0.0 },
+            "avg_queue_wait_ms": per_job(&c.queue_wait_ms),
+            "avg_batch_wait_ms": per_job(&c.batch_wait_ms),
+            "avg_service_ms": per_job(&c.service_ms),
+            "audio_sec": c.audio_ms.load(Ordering::Relaxed) as f64 / 1000.0,
+            "uptime_sec": self.started.elapsed().as_secs_f64(),
+        })
+    }
+}
+
+fn run_worker(
+    worker: usize,
+    mut engine: Box<dyn Transcriber>,
+    queue: Arc<FairQueue<TranscriptionJob>>,
+    counters: Arc<PoolCounters>,
+    config: BatchConfig,
+) {
+    let max_batch = config.max_batch.min(engine.max_batch()).max(1);
+    // No point waiting for company if the engine can't use it
+    let window = if max_batch > 1 { config.window } else { Duration::ZERO };
+
+    loop {
+        let gather_started = Instant::now();
+        let batch = queue.pop_batch(max_batch, window);
+        counters.busy.fetch_add(1, Ordering::Relaxed);
+
+        let started = Instant::now();
+        let ready: Vec<ReadyJob> = batch
+            .into_iter()
+            .map(|Scheduled { item: job, device, enqueued_at }| ReadyJob {
+                label: job.label,
+                device,
+                on_done: job.on_done,
+                enqueued_at,
+                pcm: job.audio.load(),
+            })
+            .collect();
+        let load = started.elapsed();
+
+        // Jobs whose audio failed to load fail alone; the rest share a pass
+        let loaded: Vec<&[i16]> = ready
+            .iter()
+            .filter_map(|job| job.pcm.as_ref().ok().map(|pcm| pcm.samples()))
+            .collect();
+        if loaded.len() > 1 {
+            println!("🔄 Transcribing batch of {} (worker {})...", loaded.len(), worker);
+        } else if let Some(job) = ready.iter().find(|job| job.pcm.is_ok()) {
+            println!("🔄 Transcribing {} (worker {})...", job.label, worker);
+        }
+        let mut results = match loaded.len() {
+            0 => Vec::new(),
+            1 => vec![engine.transcribe(loaded[0])],
+            _ => engine.transcribe_batch(&loaded),
+        }
+        .into_iter();
+        let audio_ms: u64 = loaded
+            .iter()
+            .map(|samples| samples.len() as u64 * 1000 / ENGINE_SAMPLE_RATE)
+            .sum();
+        let finished_at = Instant::now();
+        let service = finished_at - started;
+        let batch_len = ready.len();
+
+        counters.jobs.fetch_add(batch_len as u64, Ordering::Relaxed);
+        counters.batches.fetch_add(1, Ordering::Relaxed);
+        counters.audio_ms.fetch_add(audio_ms, Ordering::Relaxed);
+        counters.service_ms.fetch_add(service.as_millis() as u64 * batch_len as u64, Ordering::Relaxed);
+
+        for job in ready {
+            let result = match job.pcm {
+                Ok(_) => results
+                    .next()
+                    .unwrap_or_else(|| Err(anyhow::anyhow!("engine returned too few results"))),
+                Err(e) => Err(e),
+            };
+            let timing = JobTiming {
+                queue_wait: started - job.enqueued_at,
+                service,
+                load,
+                finished_at,
+                worker,
+                batch: batch_len,
+            };
+            // Part of the queue wait spent in this worker holding out for a fuller batch
+            let batch_wait = started.saturating_duration_since(gather_started.max(job.enqueued_at));
+            counters
+                .queue_wait_ms
+                .fetch_add(timing.queue_wait.as_millis() as u64, Ordering::Relaxed);
+            counters
+                .batch_wait_ms
+                .fetch_add(batch_wait.as_millis() as u64, Ordering::Relaxed);
+            println!(
+                "⏱️  {} from {}: queue wait {} ms, service {} ms (worker {}, batch {}, {} queued)",
+                job.label,
+                job.device,
+                timing.queue_wait.as_millis(),
+                timing.service.as_millis(),
+                timing.worker,
+                timing.batch,
+                queue.len()
+            );
+            (job.on_done)(result, timing);
+        }
+        counters.busy.fetch_sub(1, Ordering::Relaxed);
+    }
+}
@@ -0,0 +1,386 @@
+use serde::{Deserialize, Serialize};
+use std::collections::{HashMap, HashSet};
+use std::fs::{self, File, OpenOptions};
+use std::io::{BufRead, BufReader, Write};
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::mpsc::{self, Receiver, Sender};
+use std::sync::Arc;
+use std::thread;
+use std::time::Instant;
+use tokio::sync::oneshot;
+
+/// Truncate the journal once no job is open and it has grown past this
+const COMPACT_BYTES: u64 = 4 * 1024 * 1024;
+
+/// A queued transcription, as recorded in the journal. The audio itself is
+/// the WAV at `wav_path`, which is synced before the entry is.
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub struct JournalEntry {
+    pub id: u64,
+    pub device_id: String,
+    pub wav_filename: String,
+    pub wav_path: PathBuf,
+    pub num_samples: usize,
+    pub sample_rate: u32,
+    pub audio_quality: serde_json::Value,
+    pub stream_session: Option<String>,
+    pub audio_hash: String,
+}
+
+#[derive(Serialize, Deserialize)]
+#[serde(tag = "op", rename_all = "lowercase")]
+enum Record {
+    Queued(JournalEntry),
+    Done { id: u64 },
+}
+
+enum Op {
+    Queued {
+        line: String,
+        id: u64,
+        wav_path: PathBuf,
+        enqueued_at: Instant,
+        durable: oneshot::Sender<std::io::Result<()>>,
+    },
+    Done {
+        line: String,
+        id: u64,
+    },
+}
+
+/// Running totals, for measuring what durability costs per upload
+#[derive(Default)]
+struct JournalCounters {
+    appends: AtomicU64,
+    commits: AtomicU64,
+    /// Time from append to durable, summed over appends
+    wait_us: AtomicU64,
+    /// Write + fsync time, summed over commits
+    commit_us: AtomicU64,
+    max_commit_us: AtomicU64,
+}
+
+/// Write-ahead journal of accepted uploads (`received_audio/ingest.journal`,
+/// one JSON record per line).
+///
+/// An upload is acknowledged only once its `queued` record is on disk, and
+/// a `done` record follows when transcription finishes, so jobs still open
+/// after a crash are replayed on startup. A single committer thread writes
+/// every record that arrived while the previous fsync was running and syncs
+/// them together (group commit): concurrent uploads share one journal fsync
+/// instead of queueing behind each other's.
+pub struct IngestJournal {
+    sender: Sender<Op>,
+    next_id: AtomicU64,
+    counters: Arc<JournalCounters>,
+    fsync: bool,
+}
+
+impl IngestJournal {
+    /// Open the journal and return it with the jobs that never finished
+    pub fn open(path: &Path, fsync: bool) -> std::io::Result<(Self, Vec<JournalEntry>)> {
+        if let Some(dir) = path.parent() {
+            fs::create_dir_all(dir)?;
+        }
+
+        let mut open: HashMap<u64, JournalEntry> = HashMap::new();
+        let mut next_id = 0;
+        if path.exists() {
+            let mut reader = BufReader::new(File::open(path)?);
+            let mut line = String::new();
+            while reader.read_line(&mut line)? > 0 {
+                // A torn final line was never acknowledged
+                if !line.ends_with('\n') {
+                    break;
+                }
+                match serde_json::from_str::<Record>(line.trim_end()) {
+                    Ok(Record::Queued(entry)) => {
+                        next_id = next_id.max(entry.id + 1);
+                        open.insert(entry.id, entry);
+                    }
+                    Ok(Record::Done { id }) => {
+                        open.remove(&id);
+                    }
+                    Err(_) => {}
+                }
+                line.clear();
+            }
+        }
+
+        let mut unfinished: Vec<JournalEntry> = open.into_values().collect();
+        unfinished.sort_by_key(|entry| entry.id);
+
+        // Start a fresh file holding only the open jobs
+        let tmp_path = path.with_extension("journal.tmp");
+        {
+            let mut tmp = File::create(&tmp_path)?;
+            for entry in &unfinished {
+                writeln!(tmp, "{}", serde_json::to_string(&Record::Queued(entry.clone()))?)?;
+            }
+            tmp.sync_all()?;
+        }
+        fs::rename(&tmp_path, path)?;
+        let file = OpenOptions::new().append(true).open(path)?;
+
+        let (sender, receiver) = mpsc::channel();
+        let counters = Arc::new(JournalCounters::default());
+        let open_ids = unfinished.iter().map(|entry| entry.id).collect();
+        {
+            let counters = counters.clone();
+            thread::Builder::new()
+                .name("ingest-journal".to_string())
+                .spawn(move || run_committer(file, receiver, open_ids, counters, fsync))
+                .expect("failed to spawn journal thread");
+        }
+
+        Ok((
+            Self {
+                sender,
+                next_id: AtomicU64::new(next_id),
+                counters,
+                fsync,
+            },
+            unfinished,
+        ))
+    }
+
+    pub fn next_id(&self) -> u64 {
+        self.next_id.fetch_add(1, Ordering::Relaxed)
+    }
+
+    /// Append a `queued` record; resolves once it and its WAV are durable
+    pub async fn record_queued(&self, entry: &JournalEntry) -> std::io::Result<()> {
+        let line = serde_json::to_string(&Record::Queued(entry.clone()))?;
+        let (durable, committed) = oneshot::channel();
+        self.sender
+            .send(Op::Queued {
+                line,
+                id: entry.id,
+                wav_path: entry.wav_path.clone(),
+                enqueued_at: Instant::now(),
+                durable,
+            })
+            .map_err(|_| std::io::Error::other("journal thread stopped"))?;
+        committed
+            .await
+            .map_err(|_| std::io::Error::other("journal thread stopped"))?
+    }
+
+    /// Append a `done` record. Not waited for: if it is lost in a crash the
+    /// job is replayed, and the audio hash check finds its transcript.
+    pub fn record_done(&self, id: u64) {
+        if let Ok(line) = serde_json::to_string(&Record::Done { id }) {
+            let _ = self.sender.send(Op::Done { line, id });
+        }
+    }
+
+    pub fn stats_json(&self) -> serde_json::Value {
+        let c = &self.counters;
+        let appends = c.appends.load(Ordering::Relaxed);
+        let commits = c.commits.load(Ordering::Relaxed);
+        serde_json::json!({
+            "fsync": self.fsync,
+            "appends": appends,
+            "commits": commits,
+            "avg_records_per_commit": if commits > 0 { appends as f64 / commits as f64 } else { 0.0 },
+            "avg_append_wait_ms": if appends > 0 {
+                c.wait_us.load(Ordering::Relaxed) as f64 / appends as f64 / 1000.0
+            } else { 0.0 },
+            "avg_commit_ms": if commits > 0 {
+                c.commit_us.load(Ordering::Relaxed) as f64 / commits as f64 / 1000.0
+            } else { 0.0 },
+            "max_commit_ms": c.max_commit_us.load(Ordering::Relaxed) as f64 / 1000.0,
+        })
+    }
+}
+
+fn run_committer(
+    mut file: File,
+    receiver: Receiver<Op>,
+    mut open_ids: HashSet<u64>,
+    counters: Arc<JournalCounters>,
+    fsync: bool,
+) {
+    let mut pending = Vec::new();
+    loop {
+        // Everything that queued up while the last commit was syncing
+        let Ok(first) = receiver.recv() else {
+            return; // Journal dropped
+        };
+        pending.push(first);
+        while let Ok(op) = receiver.try_recv() {
+            pending.push(op);
+        }
+
+        let started = Instant::now();
+        let mut buffer = String::new();
+        let mut needs_sync = false;
+        for op in &pending {
+            match op {
+                Op::Queued { line, id, wav_path, .. } => {
+                    buffer.push_str(line);
+                    open_ids.insert(*id);
+                    needs_sync = true;
+                    // The record must not outlive its audio
+                    if fsync {
+                        if let Ok(wav) = File::open(wav_path) {
+                            wav.sync_data().ok();
+                        }
+                    }
+                }
+                Op::Done { line, id } => {
+                    buffer.push_str(line);
+                    open_ids.remove(id);
+                }
+            }
+            buffer.push('\n');
+        }
+
+        let mut result = file.write_all(buffer.as_bytes());
+        if result.is_ok() && needs_sync && fsync {
+            result = file.sync_data();
+        }
+        if needs_sync {
+            let commit_us = started.elapsed().as_micros() as u64;
+            counters.commits.fetch_add(1, Ordering::Relaxed);
+            counters.commit_us.fetch_add(commit_us, Ordering::Relaxed);
+            counters.max_commit_us.fetch_max(commit_us, Ordering::Relaxed);
+        }
+
+        for op in pending.drain(..) {
+            if let Op::Queued { enqueued_at, durable, .. } = op {
+                counters.appends.fetch_add(1, Ordering::Relaxed);
+                counters
+                    .wait_us
+                    .fetch_add(enqueued_at.elapsed().as_micros() as u64, Ordering::Relaxed);
+                let _ = durable.send(match &result {
+                    Ok(()) => Ok(()),
+                    Err(e) => Err(std::io::Error::new(e.kind(), e.to_string())),
+                });
+            }
+        }
+        if let Err(e) = &result {
+            eprintln!("❌ Ingest journal write failed: {}", e);
+        }
+
+        // Nothing in flight: the journal can start over
+        if open_ids.is_empty() && file.metadata().map(|m| m.len() > COMPACT_BYTES).unwrap_or(false) {
+            if file.set_len(0).is_ok() {
+                println!("🧾 Ingest journal compacted");
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// A journal path of its own per test, starting empty
+    fn scratch(name: &str) -> PathBuf {
+        let dir = std::env::temp_dir().join(format!("memo-journal-test-{}-{}", std::process::id(), name));
+        fs::remove_dir_all(&dir).ok();
+        dir.join("ingest.journal")
+    }
+
+    fn entry(id: u64) -> JournalEntry {
+        JournalEntry {
+            id,
+            device_id: "device".to_string(),
+            wav_filename: format!("{}.wav", id),
+            wav_path: PathBuf::from(format!("received_audio/{}.wav", id)),
+            num_samples: 16000,
+            sample_rate: 16000,
+            audio_quality: serde_json::json!({}),
+            stream_session: None,
+            audio_hash: format!("hash-{}", id),
+        }
+    }
+
+    fn line(record: &Record) -> String {
+        serde_json::to_string(record).unwrap() + "\n"
+    }
+
+    fn ids(entries: &[JournalEntry]) -> Vec<u64> {
+        entries.iter().map(|entry| entry.id).collect()
+    }
+
+    #[test]
+    fn open_replays_jobs_without_a_done_record() {
+        let path = scratch("replay");
+        fs::create_dir_all(path.parent().unwrap()).unwrap();
+        let mut contents = String::new();
+        for id in [3, 1, 2] {
+            contents += &line(&Record::Queued(entry(id)));
+        }
+        contents += &line(&Record::Done { id: 2 });
+        contents += "not json\n";
+        contents += &line(&Record::Done { id: 7 });
+        // Torn final line: never acknowledged, so not replayed
+        contents += line(&Record::Queued(entry(9))).trim_end();
+        fs::write(&path, contents).unwrap();
+
+        let (journal, unfinished) = IngestJournal::open(&path, false).unwrap();
+        assert_eq!(ids(&unfinished), [1, 3]);
+        assert_eq!(unfinished[1].audio_hash, "hash-3");
+        assert_eq!(journal.next_id(), 4);
+
+        // The file now holds just the open jobs
+        let rewritten = fs::read_to_string(&path).unwrap();
+        assert_eq!(rewritten, line(&Record::Queued(entry(1))) + &line(&Record::Queued(entry(3))));
+        fs::remove_dir_all(path.parent().unwrap()).ok();
+    }
+
+    #[tokio::test]
+    async fn records_survive_a_reopen() {
+        let path = scratch("reopen");
+        let (journal, unfinished) = IngestJournal::open(&path, false).unwrap();
+        assert!(unfinished.is_empty());
+        assert_eq!(journal.next_id(), 0);
+
+        journal.record_queued(&entry(0)).await.unwrap();
+        journal.record_queued(&entry(1)).await.unwrap();
+        journal.record_done(0);
+        // Ops are written in order, so this being durable means the done is too
+        journal.record_queued(&entry(2)).await.unwrap();
+        assert_eq!(journal.stats_json()["appends"], 3);
+
+        let (journal, unfinished) = IngestJournal::open(&path, false).unwrap();
+        assert_eq!(ids(&unfinished), [1, 2]);
+        assert_eq!(journal.next_id(), 3);
+        fs::remove_dir_all(path.parent().unwrap()).ok();
+    }
+
+    #[tokio::test]
+    async fn journal_is_truncated_once_nothing_is_open() {
+        let path = scratch("compact");
+        let (journal, _) = IngestJournal::open(&path, false).unwrap();
+        let padding = "x".repeat(COMPACT_BYTES as usize / 4);
+        for id in 0..5 {
+            let mut entry = entry(id);
+            entry.audio_quality = serde_json::json!({ "padding": padding });
+            journal.record_queued(&entry).await.unwrap();
+        }
+        for id in 0..4 {
+            journal.record_done(id);
+        }
+        // One job still open: past the size limit, but kept
+        journal.record_queued(&entry(5)).await.unwrap();
+        assert!(fs::metadata(&path).unwrap().len() > COMPACT_BYTES);
+
+        journal.record_done(4);
+        journal.record_done(5);
+        let deadline = Instant::now() + std::time::Duration::from_secs(5);
+        while fs::metadata(&path).unwrap().len() > 0 {
+            assert!(Instant::now() < deadline, "journal was not compacted");
+            thread::sleep(std::time::Duration::from_millis(10));
+        }
+
+        // Appends continue in the truncated file
+        journal.record_queued(&entry(6)).await.unwrap();
+        let (_, unfinished) = IngestJournal::open(&path, false).unwrap();
+        assert_eq!(ids(&unfinished), [6]);
+        fs::remove_dir_all(path.parent().unwrap()).ok();
+    }
+}
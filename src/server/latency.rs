@@ -0,0 +1,205 @@
+use std::collections::{BTreeMap, VecDeque};
+use std::sync::Mutex;
+use std::time::{Instant, SystemTime, UNIX_EPOCH};
+
+/// Breakdowns kept for `/latency`
+const RECENT_TRACES: usize = 1024;
+
+/// Stage name for the interval that ends at each stamp, in pipeline order
+const STAGES: [(&str, &str); 12] = [
+    ("start_seen", "poll"),
+    ("first_sample", "capture_start"),
+    ("stop", "recording"),
+    ("upload_begin", "device_queue"),
+    ("received", "upload"),
+    ("stored", "wav_write"),
+    ("journaled", "journal"),
+    ("enqueued", "enqueue"),
+    ("dequeued", "queue"),
+    ("inference_start", "load"),
+    ("inference_end", "inference"),
+    ("published", "publish"),
+];
+
+/// Device stamps accepted from `X-Trace-Ms` / a batch clip's `trace`
+const DEVICE_STAMPS: [&str; 3] = ["start_seen", "first_sample", "stop"];
+
+/// Wall clock as fractional epoch milliseconds
+pub fn now_ms() -> f64 {
+    SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .map(|d| d.as_secs_f64() * 1000.0)
+        .unwrap_or(0.0)
+}
+
+/// Wall clock time of an earlier `Instant`
+fn instant_ms(at: Instant) -> f64 {
+    now_ms() - at.elapsed().as_secs_f64() * 1000.0
+}
+
+/// Timestamps of one recording from capture to published transcript.
+///
+/// Device stamps arrive as offsets before the upload began (`X-Trace-Ms:
+/// start_seen=1830,first_sample=1790,stop=312,poll_rtt=40`) and are placed
+/// on the server clock relative to when the request arrived, so no clock
+/// sync is needed; the one-way network delay before the first byte is
+/// not visible.
+#[derive(Debug, Clone, Default)]
+pub struct LatencyTrace {
+    recording_id: Option<String>,
+    stamps: Vec<(&'static str, f64)>,
+}
+
+impl LatencyTrace {
+    pub fn new(recording_id: Option<&str>) -> Self {
+        Self {
+            recording_id: recording_id.map(str::to_string),
+            stamps: Vec::new(),
+        }
+    }
+
+    /// Device stamps from the upload's trace string, then `upload_begin`
+    pub fn from_device(recording_id: Option<&str>, device_trace: Option<&str>, upload_begin_ms: f64) -> Self {
+        let mut trace = Self::new(recording_id);
+        let offsets: BTreeMap<&str, f64> = device_trace
+            .unwrap_or("")
+            .split(',')
+            .filter_map(|field| {
+                let (name, value) = field.split_once('=')?;
+                Some((name.trim(), value.trim().parse().ok()?))
+            })
+            .collect();
+        for name in DEVICE_STAMPS {
+            if let Some(offset) = offsets.get(name) {
+                if name == "start_seen" {
+                    if let Some(rtt) = offsets.get("poll_rtt").filter(|&&rtt| rtt > 0.0) {
+                        trace.stamps.push(("poll_sent", upload_begin_ms - offset - rtt));
+                    }
+                }
+                trace.stamps.push((name, upload_begin_ms - offset));
+            }
+        }
+        trace.stamps.push(("upload_begin", upload_begin_ms));
+        trace
+    }
+
+    pub fn stamp(&mut self, name: &'static str) {
+        self.stamps.push((name, now_ms()));
+    }
+
+    pub fn stamp_at(&mut self, name: &'static str, at: Instant) {
+        self.stamps.push((name, instant_ms(at)));
+    }
+
+    /// Milliseconds per stage, each ending at one stamp
+    pub fn stages(&self) -> Vec<(&'static str, f64)> {
+        self.stamps
+            .windows(2)
+            .map(|pair| {
+                let stage = STAGES
+                    .iter()
+                    .find(|(stamp, _)| *stamp == pair[1].0)
+                    .map_or(pair[1].0, |(_, stage)| stage);
+                (stage, (pair[1].1 - pair[0].1).max(0.0))
+            })
+            .collect()
+    }
+
+    pub fn total_ms(&self) -> f64 {
+        match (self.stamps.first(), self.stamps.last()) {
+            (Some(first), Some(last)) => last.1 - first.1,
+            _ => 0.0,
+        }
+    }
+
+    /// Stored as the transcript's `latency` field
+    pub fn to_json(&self) -> serde_json::Value {
+        let round = |ms: f64| (ms * 10.0).round() / 10.0;
+        let stamps: serde_json::Map<String, serde_json::Value> = self
+            .stamps
+            .iter()
+            .map(|(name, ms)| (name.to_string(), serde_json::json!(round(*ms))))
+            .collect();
+        let stages: serde_json::Map<String, serde_json::Value> = self
+            .stages()
+            .into_iter()
+            .map(|(name, ms)| (name.to_string(), serde_json::json!(round(ms))))
+            .collect();
+        serde_json::json!({
+            "recording_id": self.recording_id,
+            "stamps_ms": stamps,
+            "stages_ms": stages,
+            "total_ms": round(self.total_ms()),
+        })
+    }
+}
+
+/// Stage breakdowns of recent recordings, for `/latency`
+pub struct LatencyLog {
+    recent: Mutex<VecDeque<(Vec<(&'static str, f64)>, f64)>>,
+}
+
+impl LatencyLog {
+    pub fn new() -> Self {
+        Self {
+            recent: Mutex::new(VecDeque::new()),
+        }
+    }
+
+    pub fn record(&self, trace: &LatencyTrace) {
+        let mut recent = self.recent.lock().unwrap();
+        if recent.len() == RECENT_TRACES {
+            recent.pop_front();
+        }
+        recent.push_back((trace.stages(), trace.total_ms()));
+    }
+
+    /// Percentiles per stage over the recent recordings that have it
+    pub fn percentiles_json(&self) -> serde_json::Value {
+        let recent = self.recent.lock().unwrap();
+        let mut by_stage: BTreeMap<&'static str, Vec<f64>> = BTreeMap::new();
+        let mut totals = Vec::with_capacity(recent.len());
+        for (stages, total) in recent.iter() {
+            for (stage, ms) in stages {
+                by_stage.entry(stage).or_default().push(*ms);
+            }
+            totals.push(*total);
+        }
+        drop(recent);
+
+        // Pipeline order, anything unknown after
+        let order = |stage: &str| STAGES.iter().position(|(_, name)| *name == stage).unwrap_or(STAGES.len());
+        let mut stages: Vec<(&'static str, Vec<f64>)> = by_stage.into_iter().collect();
+        stages.sort_by_key(|(stage, _)| order(stage));
+        let stages: Vec<serde_json::Value> = stages
+            .into_iter()
+            .map(|(stage, samples)| {
+                let mut summary = summarize(samples);
+                summary["stage"] = serde_json::json!(stage);
+                summary
+            })
+            .collect();
+        serde_json::json!({
+            "recordings": totals.len(),
+            "stages": stages,
+            "total": summarize(totals),
+        })
+    }
+}
+
+fn summarize(mut samples: Vec<f64>) -> serde_json::Value {
+    samples.sort_by(|a, b| a.total_cmp(b));
+    let percentile = |p: f64| {
+        let rank = ((p / 100.0) * samples.len() as f64).ceil() as usize;
+        samples
+            .get(rank.clamp(1, samples.len().max(1)) - 1)
+            .map(|ms| (ms * 10.0).round() / 10.0)
+    };
+    serde_json::json!({
+        "count": samples.len(),
+        "p50_ms": percentile(50.0),
+        "p90_ms": percentile(90.0),
+        "p99_ms": percentile(99.0),
+        "max_ms": samples.last().map(|ms| (ms * 10.0).round() / 10.0),
+    })
+}
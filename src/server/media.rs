@@ -0,0 +1,546 @@
+use crate::server::audio::{read_recording, wav_header};
+use axum::{
+    body::{Body, Bytes},
+    http::{header, HeaderMap, HeaderValue, StatusCode},
+    response::{IntoResponse, Response},
+};
+use chrono::{DateTime, Utc};
+use std::collections::HashMap;
+use std::fs;
+use std::future::Future;
+use std::io::{SeekFrom, Write};
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::{Arc, Mutex};
+use std::time::{SystemTime, UNIX_EPOCH};
+use tokio::io::{AsyncReadExt, AsyncSeekExt};
+use tokio::sync::mpsc;
+use tokio_stream::wrappers::ReceiverStream;
+
+/// Read size when streaming a file into a response
+const CHUNK_BYTES: usize = 64 * 1024;
+/// Chunks read ahead of a slow client
+const CHUNKS_AHEAD: usize = 4;
+
+/// Serve a file from disk with `Range`, `ETag` and conditional request
+/// support. Only the requested bytes are read, a chunk at a time, so a
+/// browser seeking through a long recording never pulls the whole file.
+pub async fn serve_file(path: &Path, headers: &HeaderMap) -> Result<Response, StatusCode> {
+    let file = tokio::fs::File::open(path).await.map_err(|_| StatusCode::NOT_FOUND)?;
+    let metadata = file.metadata().await.map_err(|_| StatusCode::INTERNAL_SERVER_ERROR)?;
+    let modified = metadata.modified().unwrap_or(UNIX_EPOCH);
+    let etag = entity_tag(metadata.len(), modified);
+    if let Some(response) = not_modified_response(headers, &etag, modified) {
+        return Ok(response);
+    }
+    respond(headers, &etag, modified, content_type(path), metadata.len(), Content::File(file)).await
+}
+
+/// Serve an archived recording as the WAV it was, with the same range and
+/// conditional support. The FLAC is decoded once into `cache`, so seeking
+/// reads only the requested bytes of that copy; if it can't be cached, it
+/// is decoded in memory. Validators come from the FLAC, so a revalidating
+/// client is answered without decoding.
+pub async fn serve_archived(flac_path: &Path, headers: &HeaderMap, cache: &TranscodeCache) -> Result<Response, StatusCode> {
+    let metadata = tokio::fs::metadata(flac_path).await.map_err(|_| StatusCode::NOT_FOUND)?;
+    let modified = metadata.modified().unwrap_or(UNIX_EPOCH);
+    let etag = entity_tag(metadata.len(), modified);
+    if let Some(response) = not_modified_response(headers, &etag, modified) {
+        return Ok(response);
+    }
+
+    if let Some(wav_path) = cache.decoded_wav(flac_path).await {
+        // Evicted between the two calls: fall through and decode
+        if let Ok(file) = tokio::fs::File::open(&wav_path).await {
+            let len = file.metadata().await.map_err(|_| StatusCode::INTERNAL_SERVER_ERROR)?.len();
+            return respond(headers, &etag, modified, "audio/wav", len, Content::File(file)).await;
+        }
+    }
+
+    let path = flac_path.to_path_buf();
+    let wav = tokio::task::spawn_blocking(move || -> anyhow::Result<Bytes> {
+        let (pcm, sample_rate, channels) = read_recording(&path)?;
+        let mut wav = Vec::with_capacity(44 + pcm.as_bytes().len());
+        wav.extend_from_slice(&wav_header(pcm.as_bytes().len() as u32, sample_rate, channels));
+        wav.extend_from_slice(pcm.as_bytes());
+        Ok(Bytes::from(wav))
+    })
+    .await
+    .map_err(|_| StatusCode::INTERNAL_SERVER_ERROR)?
+    .map_err(|e| {
+        eprintln!("⚠️  {}", e);
+        StatusCode::INTERNAL_SERVER_ERROR
+    })?;
+    respond(headers, &etag, modified, "audio/wav", wav.len() as u64, Content::Memory(wav)).await
+}
+
+/// Where a response body comes from
+enum Content {
+    File(tokio::fs::File),
+    Memory(Bytes),
+}
+
+fn not_modified_response(headers: &HeaderMap, etag: &str, modified: SystemTime) -> Option<Response> {
+    not_modified(headers, etag, modified).then(|| {
+        (
+            StatusCode::NOT_MODIFIED,
+            [(header::ETAG, etag.to_string()), (header::LAST_MODIFIED, http_date(modified))],
+        )
+            .into_response()
+    })
+}
+
+/// The whole content or the requested range of it, with validators
+async fn respond(
+    headers: &HeaderMap,
+    etag: &str,
+    modified: SystemTime,
+    content_type: &'static str,
+    len: u64,
+    content: Content,
+) -> Result<Response, StatusCode> {
+    let last_modified = http_date(modified);
+
+    // A stale If-Range means the client's partial copy is outdated: send it all
+    let range_valid = headers
+        .get(header::IF_RANGE)
+        .and_then(|v| v.to_str().ok())
+        .map_or(true, |validator| validator == etag || validator == last_modified);
+    let range = headers
+        .get(header::RANGE)
+        .and_then(|v| v.to_str().ok())
+        .filter(|_| range_valid)
+        .and_then(|range| parse_range(range, len));
+
+    let (status, start, end) = match range {
+        None => (StatusCode::OK, 0, len),
+        Some(Ok((start, end))) => (StatusCode::PARTIAL_CONTENT, start, end),
+        Some(Err(())) => {
+            return Ok((
+                StatusCode::RANGE_NOT_SATISFIABLE,
+                [(header::CONTENT_RANGE, format!("bytes */{}", len))],
+            )
+                .into_response());
+        }
+    };
+    let body = match content {
+        Content::File(mut file) => {
+            if start > 0 {
+                file.seek(SeekFrom::Start(start)).await.map_err(|_| StatusCode::INTERNAL_SERVER_ERROR)?;
+            }
+            file_body(file, end - start)
+        }
+        Content::Memory(bytes) => Body::from(bytes.slice(start as usize..end as usize)),
+    };
+
+    let mut response = Response::new(body);
+    *response.status_mut() = status;
+    let response_headers = response.headers_mut();
+    response_headers.insert(header::CONTENT_TYPE, HeaderValue::from_static(content_type));
+    response_headers.insert(header::CONTENT_LENGTH, HeaderValue::from(end - start));
+    response_headers.insert(header::ACCEPT_RANGES, HeaderValue::from_static("bytes"));
+    response_headers.insert(header::CACHE_CONTROL, HeaderValue::from_static("public, max-age=3600"));
+    if let Ok(etag) = HeaderValue::from_str(etag) {
+        response_headers.insert(header::ETAG, etag);
+    }
+    if let Ok(last_modified) = HeaderValue::from_str(&last_modified) {
+        response_headers.insert(header::LAST_MODIFIED, last_modified);
+    }
+    if status == StatusCode::PARTIAL_CONTENT {
+        if let Ok(content_range) = HeaderValue::from_str(&format!("bytes {}-{}/{}", start, end - 1, len)) {
+            response_headers.insert(header::CONTENT_RANGE, content_range);
+        }
+    }
+    Ok(response)
+}
+
+/// `remaining` bytes from the file's current position, read on a separate
+/// task that stays at most `CHUNKS_AHEAD` chunks ahead of the client
+fn file_body(mut file: tokio::fs::File, mut remaining: u64) -> Body {
+    let (tx, rx) = mpsc::channel::<std::io::Result<Bytes>>(CHUNKS_AHEAD);
+    tokio::spawn(async move {
+        let mut buffer = vec![0u8; CHUNK_BYTES];
+        while remaining > 0 {
+            let want = remaining.min(CHUNK_BYTES as u64) as usize;
+            let chunk = match file.read(&mut buffer[..want]).await {
+                Ok(0) => return, // Truncated since the length was taken
+                Ok(n) => {
+                    remaining -= n as u64;
+                    Ok(Bytes::copy_from_slice(&buffer[..n]))
+                }
+                Err(e) => Err(e),
+            };
+            let failed = chunk.is_err();
+            if tx.send(chunk).await.is_err() || failed {
+                return; // Client went away
+            }
+        }
+    });
+    Body::from_stream(ReceiverStream::new(rx))
+}
+
+/// Strong validator from size and modification time; recordings are written
+/// once, so either changing means different content
+fn entity_tag(len: u64, modified: SystemTime) -> String {
+    let nanos = modified.duration_since(UNIX_EPOCH).map_or(0, |d| d.as_nanos());
+    format!("\"{:x}-{:x}\"", len, nanos)
+}
+
+fn http_date(time: SystemTime) -> String {
+    DateTime::<Utc>::from(time).format("%a, %d %b %Y %H:%M:%S GMT").to_string()
+}
+
+/// `If-None-Match` wins over `If-Modified-Since` when both are sent
+fn not_modified(headers: &HeaderMap, etag: &str, modified: SystemTime) -> bool {
+    if let Some(if_none_match) = headers.get(header::IF_NONE_MATCH).and_then(|v| v.to_str().ok()) {
+        return if_none_match
+            .split(',')
+            .map(|tag| tag.trim().trim_start_matches("W/"))
+            .any(|tag| tag == "*" || tag == etag);
+    }
+    let Some(since) = headers
+        .get(header::IF_MODIFIED_SINCE)
+        .and_then(|v| v.to_str().ok())
+        .and_then(|v| DateTime::parse_from_rfc2822(v).ok())
+    else {
+        return false;
+    };
+    // HTTP dates have whole seconds
+    let modified_secs = modified.duration_since(UNIX_EPOCH).map_or(0, |d| d.as_secs());
+    modified_secs as i64 <= since.timestamp()
+}
+
+/// A single `bytes=` range as `[start, end)`. None means ignore the header
+/// (malformed, another unit, or several ranges) and send the whole file;
+/// `Err` means no byte of it exists (416).
+fn parse_range(range: &str, len: u64) -> Option<Result<(u64, u64), ()>> {
+    let spec = range.trim().strip_prefix("bytes=")?;
+    if spec.contains(',') {
+        return None;
+    }
+    let (first, last) = spec.split_once('-')?;
+    let (first, last) = (first.trim(), last.trim());
+    let (start, end) = if first.is_empty() {
+        // Suffix: the last N bytes
+        let suffix: u64 = last.parse().ok()?;
+        if suffix == 0 {
+            return Some(Err(()));
+        }
+        (len.saturating_sub(suffix), len)
+    } else {
+        let start: u64 = first.parse().ok()?;
+        let end = if last.is_empty() {
+            len
+        } else {
+            let last: u64 = last.parse().ok()?;
+            if last < start {
+                return None;
+            }
+            last.saturating_add(1).min(len)
+        };
+        (start, end)
+    };
+    if start >= len {
+        return Some(Err(()));
+    }
+    Some(Ok((start, end)))
+}
+
+fn content_type(path: &Path) -> &'static str {
+    match path.extension().and_then(|e| e.to_str()) {
+        Some("wav") => "audio/wav",
+        Some("opus") => "audio/ogg; codecs=opus",
+        Some("flac") => "audio/flac",
+        Some("mp3") => "audio/mpeg",
+        _ => "application/octet-stream",
+    }
+}
+
+/// Opus copies of recordings for the UI (`/audio-file?format=opus`), made
+/// with ffmpeg on first request and kept under `dir`. Speech at 24 kbit/s
+/// is about a tenth of the 16 kHz WAV. Archived recordings played as WAV
+/// are decoded into the same cache.
+///
+/// A transcode is named after its source's size and modification time, so
+/// a changed source gets a new one. Concurrent requests for the same file
+/// wait for one transcode. Past `max_bytes` the oldest copies are removed.
+pub struct TranscodeCache {
+    dir: PathBuf,
+    max_bytes: u64,
+    ffmpeg: String,
+    in_flight: Mutex<HashMap<PathBuf, Arc<tokio::sync::Mutex<()>>>>,
+    /// Set after ffmpeg failed to start, so the WAV is served without retrying
+    unavailable: AtomicBool,
+}
+
+impl TranscodeCache {
+    pub fn new(dir: &Path, max_bytes: u64, ffmpeg: String) -> Self {
+        Self {
+            dir: dir.to_path_buf(),
+            max_bytes,
+            ffmpeg,
+            in_flight: Mutex::new(HashMap::new()),
+            unavailable: AtomicBool::new(false),
+        }
+    }
+
+    /// Path of the Opus copy of `source`, transcoding it if needed; None if
+    /// it can't be made (the caller serves the original)
+    pub async fn opus(&self, source: &Path) -> Option<PathBuf> {
+        if self.unavailable.load(Ordering::Relaxed) {
+            return None;
+        }
+        let target = self.target(source, "opus")?;
+        self.make_once(&target, self.transcode(source, &target)).await
+    }
+
+    /// Path of the WAV decoded from an archived recording, decoding it if
+    /// needed; None if it can't be written
+    pub async fn decoded_wav(&self, flac: &Path) -> Option<PathBuf> {
+        let target = self.target(flac, "wav")?;
+        self.make_once(&target, self.decode(flac, &target)).await
+    }
+
+    /// Cache path for `source` converted to `extension`
+    fn target(&self, source: &Path, extension: &str) -> Option<PathBuf> {
+        let metadata = fs::metadata(source).ok()?;
+        let modified = metadata.modified().ok()?.duration_since(UNIX_EPOCH).ok()?.as_secs();
+        let stem = source.file_stem()?.to_str()?;
+        Some(self.dir.join(format!("{}-{:x}-{:x}.{}", stem, metadata.len(), modified, extension)))
+    }
+
+    /// `target` if it exists, otherwise what `make` produces; concurrent
+    /// callers for one target share a single `make`
+    async fn make_once(&self, target: &Path, make: impl Future<Output = Option<PathBuf>>) -> Option<PathBuf> {
+        if target.exists() {
+            return Some(target.to_path_buf());
+        }
+        let target = target.to_path_buf();
+
+        let lock = self
+            .in_flight
+            .lock()
+            .unwrap()
+            .entry(target.clone())
+            .or_default()
+            .clone();
+        let guard = lock.lock().await;
+        let result = if target.exists() {
+            Some(target.clone()) // Another request made it while we waited
+        } else {
+            make.await
+        };
+        drop(guard);
+        {
+            let mut in_flight = self.in_flight.lock().unwrap();
+            // Only the map and this request hold it: nobody else is waiting
+            if Arc::strong_count(&lock) == 2 {
+                in_flight.remove(&target);
+            }
+        }
+        result
+    }
+
+    async fn transcode(&self, source: &Path, target: &Path) -> Option<PathBuf> {
+        fs::create_dir_all(&self.dir).ok()?;
+        let partial = target.with_extension("opus.partial");
+        let started = std::time::Instant::now();
+        let status = tokio::process::Command::new(&self.ffmpeg)
+            .args(["-nostdin", "-loglevel", "error", "-y", "-i"])
+            .arg(source)
+            .args(["-c:a", "libopus", "-b:a", "24k", "-application", "voip", "-f", "ogg"])
+            .arg(&partial)
+            .status()
+            .await;
+        match status {
+            Ok(status) if status.success() => {}
+            Ok(status) => {
+                eprintln!("⚠️  ffmpeg failed on {} ({})", source.display(), status);
+                fs::remove_file(&partial).ok();
+                return None;
+            }
+            Err(e) => {
+                eprintln!("⚠️  Can't run {} ({}) - serving WAV instead of Opus", self.ffmpeg, e);
+                self.unavailable.store(true, Ordering::Relaxed);
+                return None;
+            }
+        }
+        fs::rename(&partial, target).ok()?;
+        println!(
+            "🎧 Transcoded {} to Opus in {} ms",
+            source.file_name().and_then(|n| n.to_str()).unwrap_or("?"),
+            started.elapsed().as_millis()
+        );
+        self.evict();
+        Some(target.to_path_buf())
+    }
+
+    async fn decode(&self, flac: &Path, target: &Path) -> Option<PathBuf> {
+        fs::create_dir_all(&self.dir).ok()?;
+        let (source, target) = (flac.to_path_buf(), target.to_path_buf());
+        let started = std::time::Instant::now();
+        let decoded = tokio::task::spawn_blocking(move || -> anyhow::Result<PathBuf> {
+            let (pcm, sample_rate, channels) = read_recording(&source)?;
+            let partial = target.with_extension("wav.partial");
+            let written = fs::File::create(&partial).and_then(|mut file| {
+                file.write_all(&wav_header(pcm.as_bytes().len() as u32, sample_rate, channels))?;
+                file.write_all(pcm.as_bytes())
+            });
+            if let Err(e) = written.and_then(|()| fs::rename(&partial, &target)) {
+                fs::remove_file(&partial).ok();
+                return Err(e.into());
+            }
+            Ok(target)
+        })
+        .await
+        .ok()?;
+        let target = match decoded {
+            Ok(target) => target,
+            Err(e) => {
+                eprintln!("⚠️  Can't cache decoded {}: {}", flac.display(), e);
+                return None;
+            }
+        };
+        println!(
+            "🎧 Decoded {} to WAV in {} ms",
+            flac.file_name().and_then(|n| n.to_str()).unwrap_or("?"),
+            started.elapsed().as_millis()
+        );
+        self.evict();
+        Some(target)
+    }
+
+    /// Remove the oldest copies while the cache is over its budget. Only
+    /// finished `.opus` and `.wav` files count; `.partial` ones are still
+    /// being written.
+    fn evict(&self) {
+        let Ok(entries) = fs::read_dir(&self.dir) else {
+            return;
+        };
+        let mut files: Vec<(SystemTime, u64, PathBuf)> = entries
+            .flatten()
+            .filter(|entry| entry.path().extension().is_some_and(|ext| ext == "opus" || ext == "wav"))
+            .filter_map(|entry| {
+                let metadata = entry.metadata().ok()?;
+                Some((metadata.modified().ok()?, metadata.len(), entry.path()))
+            })
+            .collect();
+        let mut total: u64 = files.iter().map(|(_, len, _)| len).sum();
+        if total <= self.max_bytes {
+            return;
+        }
+        files.sort();
+        for (_, len, path) in files {
+            if total <= self.max_bytes {
+                break;
+            }
+            if fs::remove_file(&path).is_ok() {
+                total -= len;
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn parse_range_reads_single_byte_ranges() {
+        assert_eq!(parse_range("bytes=0-99", 1000), Some(Ok((0, 100))));
+        assert_eq!(parse_range(" bytes=100- ", 1000), Some(Ok((100, 1000))));
+        assert_eq!(parse_range("bytes=990-2000", 1000), Some(Ok((990, 1000))));
+        assert_eq!(parse_range("bytes=999-999", 1000), Some(Ok((999, 1000))));
+        assert_eq!(parse_range("bytes= 5 - 9", 1000), Some(Ok((5, 10))));
+        assert_eq!(parse_range("bytes=0-18446744073709551615", 1000), Some(Ok((0, 1000))));
+    }
+
+    #[test]
+    fn parse_range_reads_suffix_ranges() {
+        assert_eq!(parse_range("bytes=-100", 1000), Some(Ok((900, 1000))));
+        assert_eq!(parse_range("bytes=-5000", 1000), Some(Ok((0, 1000))));
+        assert_eq!(parse_range("bytes=-0", 1000), Some(Err(())));
+        assert_eq!(parse_range("bytes=-1", 0), Some(Err(())));
+    }
+
+    #[test]
+    fn parse_range_refuses_ranges_past_the_end() {
+        assert_eq!(parse_range("bytes=1000-", 1000), Some(Err(())));
+        assert_eq!(parse_range("bytes=1000-1999", 1000), Some(Err(())));
+        assert_eq!(parse_range("bytes=0-", 0), Some(Err(())));
+    }
+
+    #[test]
+    fn parse_range_ignores_what_it_does_not_serve() {
+        for range in [
+            "",
+            "bytes=",
+            "bytes=-",
+            "items=0-10",
+            "bytes=0-10,20-30",
+            "bytes=10-5",
+            "bytes=a-b",
+            "bytes=5",
+            "bytes=-1-2",
+            "bytes=99999999999999999999-",
+        ] {
+            assert_eq!(parse_range(range, 1000), None, "{:?}", range);
+        }
+    }
+
+    #[test]
+    fn evict_removes_oldest_transcodes_and_leaves_partial_ones() {
+        let dir = std::env::temp_dir().join(format!("memo-transcode-test-{}", std::process::id()));
+        fs::remove_dir_all(&dir).ok();
+        fs::create_dir_all(&dir).unwrap();
+        let write = |name: &str, age_secs: u64| {
+            let path = dir.join(name);
+            fs::write(&path, vec![0u8; 100]).unwrap();
+            let modified = SystemTime::now() - std::time::Duration::from_secs(age_secs);
+            fs::File::options().write(true).open(&path).unwrap().set_modified(modified).unwrap();
+        };
+        write("oldest.opus", 300);
+        write("older.opus", 200);
+        write("newest.opus", 100);
+        write("in-progress.opus.partial", 400);
+
+        TranscodeCache::new(&dir, 150, "ffmpeg".to_string()).evict();
+        let mut left: Vec<String> = fs::read_dir(&dir)
+            .unwrap()
+            .flatten()
+            .map(|entry| entry.file_name().to_string_lossy().into_owned())
+            .collect();
+        left.sort();
+        assert_eq!(left, ["in-progress.opus.partial", "newest.opus"]);
+        fs::remove_dir_all(&dir).ok();
+    }
+
+    #[tokio::test]
+    async fn archived_recordings_are_decoded_once() {
+        let dir = std::env::temp_dir().join(format!("memo-decode-test-{}", std::process::id()));
+        fs::remove_dir_all(&dir).ok();
+        fs::create_dir_all(&dir).unwrap();
+        let samples: Vec<i16> = (0..20000).map(|i| (i % 200 * 50) as i16).collect();
+        let flac_path = dir.join("device_20250101_120000_000.flac");
+        fs::write(&flac_path, crate::server::flac::encode(&samples, 16000, 1)).unwrap();
+
+        let cache = TranscodeCache::new(&dir.join("cache"), 1 << 30, "ffmpeg".to_string());
+        let wav_path = cache.decoded_wav(&flac_path).await.unwrap();
+        let wav = fs::read(&wav_path).unwrap();
+        let pcm: Vec<u8> = samples.iter().flat_map(|s| s.to_le_bytes()).collect();
+        assert_eq!(wav[..44], wav_header(pcm.len() as u32, 16000, 1));
+        assert_eq!(wav[44..], pcm[..]);
+
+        // Served from the cache from then on, not decoded again
+        let modified = fs::metadata(&wav_path).unwrap().modified().unwrap();
+        assert_eq!(cache.decoded_wav(&flac_path).await.unwrap(), wav_path);
+        assert_eq!(fs::metadata(&wav_path).unwrap().modified().unwrap(), modified);
+
+        assert!(cache.decoded_wav(&dir.join("missing.flac")).await.is_none());
+        fs::write(dir.join("broken.flac"), b"fLaC").unwrap();
+        assert!(cache.decoded_wav(&dir.join("broken.flac")).await.is_none());
+        let left: Vec<_> = fs::read_dir(dir.join("cache")).unwrap().flatten().collect();
+        assert_eq!(left.len(), 1, "no partial file is left behind");
+        fs::remove_dir_all(&dir).ok();
+    }
+}
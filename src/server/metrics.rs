@@ -0,0 +1,162 @@
+use std::fmt::Write;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::time::Duration;
+
+/// Routes counted per status class, in router order. Anything else
+/// (static files, 404s) is not counted.
+pub const ROUTES: [&str; 20] = [
+    "/audio",
+    "/audio-batch",
+    "/audio-stream",
+    "/audio-segment",
+    "/audio-file",
+    "/audio-peaks",
+    "/status",
+    "/recording-status",
+    "/devices",
+    "/devices/:id/metrics",
+    "/inference-stats",
+    "/latency",
+    "/metrics",
+    "/transcripts",
+    "/transcript-counts",
+    "/search",
+    "/record/start",
+    "/record/stop",
+    "/reprocess",
+    "/events",
+];
+
+const STATUS_CLASSES: [&str; 5] = ["1xx", "2xx", "3xx", "4xx", "5xx"];
+
+/// Seconds, for request handling (fast paths resolve in well under 1 ms)
+const FAST_SECONDS: [f64; 12] = [0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 1.0];
+/// Seconds, for uploads and queue waits
+const SLOW_SECONDS: [f64; 12] = [0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0];
+/// Engine time per second of audio
+const REAL_TIME_FACTORS: [f64; 10] = [0.02, 0.05, 0.1, 0.2, 0.3, 0.5, 0.75, 1.0, 1.5, 2.0];
+
+/// Fixed-bucket histogram; an observation is two relaxed atomic adds and a
+/// search over a dozen bounds, so it can sit on every request.
+pub struct Histogram {
+    bounds: &'static [f64],
+    /// Per bucket (not cumulative); the last one is +Inf
+    buckets: Box<[AtomicU64]>,
+    /// Sum of observations in millionths
+    sum_micros: AtomicU64,
+}
+
+impl Histogram {
+    fn new(bounds: &'static [f64]) -> Self {
+        Self {
+            bounds,
+            buckets: (0..=bounds.len()).map(|_| AtomicU64::new(0)).collect(),
+            sum_micros: AtomicU64::new(0),
+        }
+    }
+
+    pub fn observe(&self, value: f64) {
+        let bucket = self.bounds.partition_point(|&bound| bound < value);
+        self.buckets[bucket].fetch_add(1, Ordering::Relaxed);
+        self.sum_micros.fetch_add((value.max(0.0) * 1e6) as u64, Ordering::Relaxed);
+    }
+
+    pub fn observe_duration(&self, duration: Duration) {
+        self.observe(duration.as_secs_f64());
+    }
+
+    fn render(&self, out: &mut String, name: &str, help: &str) {
+        let _ = writeln!(out, "# HELP {} {}\n# TYPE {} histogram", name, help, name);
+        let mut cumulative = 0;
+        for (i, bucket) in self.buckets.iter().enumerate() {
+            cumulative += bucket.load(Ordering::Relaxed);
+            match self.bounds.get(i) {
+                Some(bound) => {
+                    let _ = writeln!(out, "{}_bucket{{le=\"{}\"}} {}", name, bound, cumulative);
+                }
+                None => {
+                    let _ = writeln!(out, "{}_bucket{{le=\"+Inf\"}} {}", name, cumulative);
+                }
+            }
+        }
+        let sum = self.sum_micros.load(Ordering::Relaxed) as f64 / 1e6;
+        let _ = writeln!(out, "{}_sum {}\n{}_count {}", name, sum, name, cumulative);
+    }
+}
+
+/// Counters and histograms behind `/metrics` (Prometheus text format).
+///
+/// Everything here is recorded with relaxed atomics on the request path;
+/// gauges that already live elsewhere (queue depth, SSE clients, active
+/// devices) are read when `/metrics` is scraped instead of being tracked.
+pub struct Metrics {
+    /// `ROUTES.len()` x status class
+    requests: Box<[AtomicU64]>,
+    pub status_seconds: Histogram,
+    pub upload_bytes: AtomicU64,
+    pub upload_seconds: Histogram,
+    pub wav_write_seconds: Histogram,
+    pub queue_wait_seconds: Histogram,
+    pub real_time_factor: Histogram,
+    pub sse_dropped: AtomicU64,
+}
+
+impl Metrics {
+    pub fn new() -> Self {
+        Self {
+            requests: (0..ROUTES.len() * STATUS_CLASSES.len()).map(|_| AtomicU64::new(0)).collect(),
+            status_seconds: Histogram::new(&FAST_SECONDS),
+            upload_bytes: AtomicU64::new(0),
+            upload_seconds: Histogram::new(&SLOW_SECONDS),
+            wav_write_seconds: Histogram::new(&FAST_SECONDS),
+            queue_wait_seconds: Histogram::new(&SLOW_SECONDS),
+            real_time_factor: Histogram::new(&REAL_TIME_FACTORS),
+            sse_dropped: AtomicU64::new(0),
+        }
+    }
+
+    /// Index into `ROUTES`, resolved before the request runs
+    pub fn route_index(route: &str) -> Option<usize> {
+        ROUTES.iter().position(|r| *r == route)
+    }
+
+    /// Count a finished request to `ROUTES[route]`
+    pub fn record_request(&self, route: usize, status: u16) {
+        let class = (status as usize / 100).clamp(1, STATUS_CLASSES.len()) - 1;
+        self.requests[route * STATUS_CLASSES.len() + class].fetch_add(1, Ordering::Relaxed);
+    }
+
+    /// Counters and histograms in Prometheus text format
+    pub fn render(&self, out: &mut String) {
+        out.push_str("# HELP memo_http_requests_total Requests handled, by route and status class\n");
+        out.push_str("# TYPE memo_http_requests_total counter\n");
+        for (i, route) in ROUTES.iter().enumerate() {
+            for (j, class) in STATUS_CLASSES.iter().enumerate() {
+                let count = self.requests[i * STATUS_CLASSES.len() + j].load(Ordering::Relaxed);
+                if count > 0 {
+                    let _ = writeln!(out, "memo_http_requests_total{{route=\"{}\",status=\"{}\"}} {}", route, class, count);
+                }
+            }
+        }
+        self.status_seconds
+            .render(out, "memo_status_request_seconds", "Time to answer a device /status poll");
+        counter(out, "memo_upload_bytes_total", "Audio bytes received in uploads", self.upload_bytes.load(Ordering::Relaxed));
+        self.upload_seconds
+            .render(out, "memo_upload_seconds", "Time to receive, store and journal an upload");
+        self.wav_write_seconds
+            .render(out, "memo_wav_write_seconds", "Time spent writing a recording's WAV file");
+        self.queue_wait_seconds
+            .render(out, "memo_inference_queue_wait_seconds", "Time a transcription job waited for a worker");
+        self.real_time_factor
+            .render(out, "memo_inference_real_time_factor", "Engine time per second of audio");
+        counter(out, "memo_sse_dropped_total", "SSE events skipped for clients that fell behind", self.sse_dropped.load(Ordering::Relaxed));
+    }
+}
+
+pub fn counter(out: &mut String, name: &str, help: &str, value: u64) {
+    let _ = writeln!(out, "# HELP {} {}\n# TYPE {} counter\n{} {}", name, help, name, name, value);
+}
+
+pub fn gauge(out: &mut String, name: &str, help: &str, value: u64) {
+    let _ = writeln!(out, "# HELP {} {}\n# TYPE {} gauge\n{} {}", name, help, name, name, value);
+}
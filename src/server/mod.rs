@@ -1,15 +1,32 @@
+pub mod archive;
 pub mod audio;
+pub mod content_hash;
+pub mod devices;
+pub mod flac;
 pub mod handlers;
+pub mod inference;
+pub mod journal;
+pub mod latency;
+pub mod media;
+pub mod metrics;
+pub mod peaks;
+pub mod scheduler;
+pub mod search;
 pub mod state;
+pub mod streaming;
+pub mod telemetry;
+pub mod transcripts;
 
 use axum::{
+    middleware,
     routing::{get, post},
     Router,
 };
 use handlers::{
-    handle_audio, handle_audio_file, handle_devices, handle_events,
-    handle_recording_start, handle_recording_stop, handle_recording_status,
-    handle_status, handle_transcripts,
+    handle_audio, handle_audio_batch, handle_audio_file, handle_audio_peaks, handle_audio_segment, handle_audio_stream,
+    handle_device_metrics, handle_devices, handle_events, handle_inference_stats, handle_latency, handle_metrics,
+    handle_recording_start, handle_reprocess, handle_recording_stop, handle_recording_status, handle_search, handle_status,
+    handle_transcript_counts, handle_transcripts, track_requests,
 };
 use state::ServerState;
 use std::sync::Arc;
@@ -22,14 +39,27 @@ use tower_http::{
 pub fn create_router(state: Arc<ServerState>) -> Router {
     Router::new()
         .route("/audio", post(handle_audio))
+        .route("/audio-batch", post(handle_audio_batch))
+        .route("/audio-stream", post(handle_audio_stream))
+        .route("/audio-segment", post(handle_audio_segment))
         .route("/audio-file", get(handle_audio_file))
+        .route("/audio-peaks", get(handle_audio_peaks))
         .route("/status", get(handle_status))
         .route("/recording-status", get(handle_recording_status))
         .route("/devices", get(handle_devices))
+        .route("/devices/:id/metrics", get(handle_device_metrics))
+        .route("/inference-stats", get(handle_inference_stats))
+        .route("/latency", get(handle_latency))
+        .route("/metrics", get(handle_metrics))
         .route("/transcripts", get(handle_transcripts))
+        .route("/transcript-counts", get(handle_transcript_counts))
+        .route("/search", get(handle_search))
         .route("/record/start", post(handle_recording_start))
         .route("/record/stop", post(handle_recording_stop))
+        .route("/reprocess", post(handle_reprocess))
         .route("/events", get(handle_events))
+        // Routes above only, so static files and 404s aren't counted
+        .route_layer(middleware::from_fn_with_state(state.clone(), track_requests))
         .nest_service("/", ServeDir::new("static"))
         .layer(
             ServiceBuilder::new()
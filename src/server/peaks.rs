@@ -0,0 +1,305 @@
+use crate::server::audio::read_recording;
+use anyhow::{bail, Result};
+use std::fs;
+use std::path::{Path, PathBuf};
+
+/// Frames per peak at the finest level; each level above has half as many
+/// peaks, so the whole pyramid is under twice the size of the finest
+pub const BASE_FRAMES: u64 = 256;
+const MAGIC: &[u8; 4] = b"MPK1";
+/// magic, sample rate, channels, base frames, frames, levels
+const HEADER_BYTES: usize = 4 + 4 + 2 + 4 + 8 + 1;
+
+/// Min and max sample of each `BASE_FRAMES` frames, folded in as the
+/// samples go past (all channels of a frame count towards its peak)
+pub struct PeaksBuilder {
+    channels: u16,
+    /// Samples in the block under construction
+    filled: u64,
+    samples: u64,
+    low: i16,
+    high: i16,
+    base: Vec<(i16, i16)>,
+}
+
+impl PeaksBuilder {
+    pub fn new(channels: u16) -> Self {
+        Self { channels: channels.max(1), filled: 0, samples: 0, low: i16::MAX, high: i16::MIN, base: Vec::new() }
+    }
+
+    pub fn push(&mut self, mut samples: &[i16]) {
+        let block = BASE_FRAMES * self.channels as u64;
+        while !samples.is_empty() {
+            let take = ((block - self.filled) as usize).min(samples.len());
+            let (part, rest) = samples.split_at(take);
+            // Separate passes vectorize; one fold with both doesn't
+            self.low = self.low.min(part.iter().copied().min().unwrap_or(i16::MAX));
+            self.high = self.high.max(part.iter().copied().max().unwrap_or(i16::MIN));
+            self.filled += take as u64;
+            self.samples += take as u64;
+            if self.filled == block {
+                self.close_block();
+            }
+            samples = rest;
+        }
+    }
+
+    /// Whole little-endian samples, as they go into the WAV data chunk
+    pub fn push_le_bytes(&mut self, bytes: &[u8]) {
+        let samples: Vec<i16> = bytes
+            .chunks_exact(2)
+            .map(|chunk| i16::from_le_bytes([chunk[0], chunk[1]]))
+            .collect();
+        self.push(&samples);
+    }
+
+    fn close_block(&mut self) {
+        self.base.push((self.low, self.high));
+        self.filled = 0;
+        self.low = i16::MAX;
+        self.high = i16::MIN;
+    }
+
+    pub fn finish(mut self, sample_rate: u32) -> Peaks {
+        if self.filled > 0 {
+            self.close_block();
+        }
+        let mut levels = vec![self.base];
+        while levels.last().unwrap().len() > 1 {
+            let coarser = levels
+                .last()
+                .unwrap()
+                .chunks(2)
+                .map(|pair| pair.iter().fold((i16::MAX, i16::MIN), |(l, h), &(low, high)| (l.min(low), h.max(high))))
+                .collect();
+            levels.push(coarser);
+        }
+        Peaks { sample_rate, channels: self.channels, frames: self.samples / self.channels as u64, levels }
+    }
+}
+
+/// A recording's min/max peak pyramid, stored next to it as `.peaks` so a
+/// waveform at any zoom never needs the audio
+pub struct Peaks {
+    pub sample_rate: u32,
+    pub channels: u16,
+    pub frames: u64,
+    /// `levels[k]` has a (min, max) per `BASE_FRAMES << k` frames
+    levels: Vec<Vec<(i16, i16)>>,
+}
+
+impl Peaks {
+    pub fn of(samples: &[i16], sample_rate: u32, channels: u16) -> Self {
+        let mut builder = PeaksBuilder::new(channels);
+        builder.push(samples);
+        builder.finish(sample_rate)
+    }
+
+    /// The peaks file of a recording, built from its audio (WAV or FLAC) and
+    /// saved if there is none yet - recordings from before peaks were kept
+    pub fn load_or_build(recording: &Path) -> Result<Self> {
+        let path = peaks_path(recording);
+        if let Ok(bytes) = fs::read(&path) {
+            match Self::decode(&bytes) {
+                Ok(peaks) => return Ok(peaks),
+                Err(e) => eprintln!("⚠️  Rebuilding {}: {}", path.display(), e),
+            }
+        }
+        let (pcm, sample_rate, channels) = read_recording(recording)?;
+        let peaks = Self::of(pcm.samples(), sample_rate, channels);
+        if let Err(e) = peaks.save(&path) {
+            eprintln!("⚠️  Can't save {}: {}", path.display(), e);
+        }
+        Ok(peaks)
+    }
+
+    pub fn save(&self, path: &Path) -> std::io::Result<()> {
+        fs::write(path, self.encode())
+    }
+
+    pub fn encode(&self) -> Vec<u8> {
+        let peaks: usize = self.levels.iter().map(Vec::len).sum();
+        let mut out = Vec::with_capacity(HEADER_BYTES + 4 * self.levels.len() + 4 * peaks);
+        out.extend_from_slice(MAGIC);
+        out.extend_from_slice(&self.sample_rate.to_le_bytes());
+        out.extend_from_slice(&self.channels.to_le_bytes());
+        out.extend_from_slice(&(BASE_FRAMES as u32).to_le_bytes());
+        out.extend_from_slice(&self.frames.to_le_bytes());
+        out.push(self.levels.len() as u8);
+        for level in &self.levels {
+            out.extend_from_slice(&(level.len() as u32).to_le_bytes());
+            for &(low, high) in level {
+                out.extend_from_slice(&low.to_le_bytes());
+                out.extend_from_slice(&high.to_le_bytes());
+            }
+        }
+        out
+    }
+
+    pub fn decode(bytes: &[u8]) -> Result<Self> {
+        if bytes.len() < HEADER_BYTES || &bytes[..4] != MAGIC {
+            bail!("not a peaks file");
+        }
+        let u32_at = |pos: usize| u32::from_le_bytes(bytes[pos..pos + 4].try_into().unwrap());
+        if u32_at(10) as u64 != BASE_FRAMES {
+            bail!("peaks of {} frames, not {}", u32_at(10), BASE_FRAMES);
+        }
+        let mut levels = Vec::with_capacity(bytes[22] as usize);
+        let mut pos = HEADER_BYTES;
+        for _ in 0..bytes[22] {
+            let Some(count) = bytes.get(pos..pos + 4).map(|_| u32_at(pos) as usize) else {
+                bail!("truncated");
+            };
+            let Some(data) = bytes.get(pos + 4..pos + 4 + 4 * count) else {
+                bail!("truncated");
+            };
+            levels.push(
+                data.chunks_exact(4)
+                    .map(|p| (i16::from_le_bytes([p[0], p[1]]), i16::from_le_bytes([p[2], p[3]])))
+                    .collect(),
+            );
+            pos += 4 + 4 * count;
+        }
+        Ok(Self {
+            sample_rate: u32_at(4),
+            channels: u16::from_le_bytes([bytes[8], bytes[9]]),
+            frames: u64::from_le_bytes(bytes[14..22].try_into().unwrap()),
+            levels,
+        })
+    }
+
+    /// Peaks from the coarsest level with at most `frames_per_peak` frames
+    /// each, covering `start..end` seconds, with min and max interleaved
+    pub fn to_json(&self, frames_per_peak: u64, start: f64, end: f64) -> serde_json::Value {
+        let level = (frames_per_peak / BASE_FRAMES).max(1).ilog2() as usize;
+        let level = level.min(self.levels.len().saturating_sub(1));
+        let frames_per_peak = BASE_FRAMES << level;
+        let peaks = self.levels.get(level).map_or(&[][..], Vec::as_slice);
+        let rate = self.sample_rate.max(1) as f64;
+        let first = ((start.max(0.0) * rate) as u64 / frames_per_peak).min(peaks.len() as u64) as usize;
+        let last = ((end.max(0.0) * rate).ceil() as u64).div_ceil(frames_per_peak).min(peaks.len() as u64) as usize;
+        let values: Vec<i16> = peaks[first..last.max(first)].iter().flat_map(|&(low, high)| [low, high]).collect();
+        serde_json::json!({
+            "sample_rate": self.sample_rate,
+            "channels": self.channels,
+            "frames": self.frames,
+            "duration_sec": self.frames as f64 / rate,
+            "samples_per_peak": frames_per_peak,
+            "start_frame": first as u64 * frames_per_peak,
+            "peaks": values,
+        })
+    }
+}
+
+/// Where a recording's peaks are kept (the same for its WAV and its FLAC)
+pub fn peaks_path(recording: &Path) -> PathBuf {
+    recording.with_extension("peaks")
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// A ramp that wraps, so every block has a different min and max
+    fn samples(len: usize) -> Vec<i16> {
+        (0..len).map(|i| (i as i32 * 37 % 65536 - 32768) as i16).collect()
+    }
+
+    fn block_peaks(samples: &[i16], block: usize) -> Vec<(i16, i16)> {
+        samples
+            .chunks(block)
+            .map(|chunk| (*chunk.iter().min().unwrap(), *chunk.iter().max().unwrap()))
+            .collect()
+    }
+
+    #[test]
+    fn peaks_do_not_depend_on_how_the_audio_arrives() {
+        let audio = samples(10 * BASE_FRAMES as usize + 77);
+        let whole = Peaks::of(&audio, 16000, 1);
+        assert_eq!(whole.levels[0], block_peaks(&audio, BASE_FRAMES as usize));
+        assert_eq!(whole.frames, audio.len() as u64);
+
+        for split in [1, 2, 255, 256, 257, 1000] {
+            let mut builder = PeaksBuilder::new(1);
+            for chunk in audio.chunks(split) {
+                builder.push(chunk);
+            }
+            assert_eq!(builder.finish(16000).levels, whole.levels, "chunks of {}", split);
+        }
+
+        // Raw upload bytes build the same pyramid
+        let bytes: Vec<u8> = audio.iter().flat_map(|s| s.to_le_bytes()).collect();
+        let mut builder = PeaksBuilder::new(1);
+        for chunk in bytes.chunks(512) {
+            builder.push_le_bytes(chunk);
+        }
+        assert_eq!(builder.finish(16000).levels, whole.levels);
+    }
+
+    #[test]
+    fn every_level_halves_the_one_below() {
+        let audio = samples(13 * BASE_FRAMES as usize);
+        let peaks = Peaks::of(&audio, 16000, 1);
+        let lengths: Vec<usize> = peaks.levels.iter().map(Vec::len).collect();
+        assert_eq!(lengths, [13, 7, 4, 2, 1]);
+        for (k, level) in peaks.levels.iter().enumerate() {
+            assert_eq!(level, &block_peaks(&audio, (BASE_FRAMES as usize) << k));
+        }
+
+        let empty = Peaks::of(&[], 16000, 1);
+        assert_eq!(empty.levels, [Vec::<(i16, i16)>::new()]);
+        assert_eq!(empty.to_json(BASE_FRAMES, 0.0, f64::INFINITY)["peaks"], serde_json::json!([]));
+    }
+
+    #[test]
+    fn stereo_frames_count_both_channels() {
+        let audio = samples(4 * BASE_FRAMES as usize);
+        let peaks = Peaks::of(&audio, 16000, 2);
+        assert_eq!(peaks.frames, 2 * BASE_FRAMES);
+        assert_eq!(peaks.levels[0], block_peaks(&audio, 2 * BASE_FRAMES as usize));
+    }
+
+    #[test]
+    fn files_round_trip_and_damage_is_an_error() {
+        let peaks = Peaks::of(&samples(5000), 22050, 2);
+        let bytes = peaks.encode();
+        let decoded = Peaks::decode(&bytes).unwrap();
+        assert_eq!((decoded.sample_rate, decoded.channels, decoded.frames), (22050, 2, 2500));
+        assert_eq!(decoded.levels, peaks.levels);
+
+        for cut in [0, 3, HEADER_BYTES - 1, HEADER_BYTES + 2, bytes.len() - 1] {
+            assert!(Peaks::decode(&bytes[..cut]).is_err(), "decoded {} of {} bytes", cut, bytes.len());
+        }
+        let mut other_base = bytes.clone();
+        other_base[10] = 128;
+        assert!(Peaks::decode(&other_base).is_err());
+        let mut other_magic = bytes;
+        other_magic[3] = b'2';
+        assert!(Peaks::decode(&other_magic).is_err());
+    }
+
+    #[test]
+    fn json_picks_the_level_and_the_time_range() {
+        // 64 base peaks of 256 frames at 256 frames/s: one peak per second
+        let audio = samples(64 * BASE_FRAMES as usize);
+        let peaks = Peaks::of(&audio, BASE_FRAMES as u32, 1);
+
+        let all = peaks.to_json(BASE_FRAMES, 0.0, f64::INFINITY);
+        assert_eq!(all["samples_per_peak"], BASE_FRAMES);
+        assert_eq!(all["peaks"].as_array().unwrap().len(), 2 * 64);
+        assert_eq!(all["duration_sec"], 64.0);
+
+        // The coarsest level that is no coarser than asked for
+        let coarse = peaks.to_json(1000, 0.0, f64::INFINITY);
+        assert_eq!(coarse["samples_per_peak"], 512);
+        assert_eq!(peaks.to_json(1 << 30, 0.0, f64::INFINITY)["peaks"].as_array().unwrap().len(), 2);
+        assert_eq!(peaks.to_json(1, 0.0, f64::INFINITY)["samples_per_peak"], BASE_FRAMES);
+
+        let window = peaks.to_json(BASE_FRAMES, 10.5, 12.2);
+        assert_eq!(window["start_frame"], 10 * BASE_FRAMES);
+        let expected: Vec<i16> = peaks.levels[0][10..13].iter().flat_map(|&(l, h)| [l, h]).collect();
+        assert_eq!(window["peaks"], serde_json::json!(expected));
+        assert_eq!(peaks.to_json(BASE_FRAMES, 100.0, 200.0)["peaks"], serde_json::json!([]));
+        assert_eq!(peaks.to_json(BASE_FRAMES, 5.0, 1.0)["peaks"], serde_json::json!([]));
+    }
+}
@@ -0,0 +1,433 @@
+use std::collections::{HashMap, VecDeque};
+use std::sync::{Arc, Condvar, Mutex};
+use std::time::{Duration, Instant};
+
+/// Audio a device may be served per round-robin turn before the next
+/// device gets one (deficit round robin, cost = audio milliseconds)
+const QUANTUM_MS: u64 = 3000;
+/// Queue waits kept per device for the percentiles in `/inference-stats`
+const WAIT_SAMPLES: usize = 256;
+
+/// Scheduling class of a transcription job. Live work is always taken
+/// before bulk work.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Priority {
+    /// Just recorded (push-to-talk, server-triggered) or a streaming partial
+    Live = 0,
+    /// Spooled uploads from a previous boot, journal replays, reprocessing
+    Bulk = 1,
+}
+
+impl Priority {
+    /// From the firmware's `X-Recording-Priority` / batch `priority`
+    /// (0 = live, 1 = spooled)
+    pub fn from_upload(value: u64) -> Self {
+        if value == 0 {
+            Priority::Live
+        } else {
+            Priority::Bulk
+        }
+    }
+}
+
+/// Why a job was turned away
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Rejection {
+    /// The whole queue is full (or, for bulk work, the share bulk may use)
+    QueueFull,
+    /// This device already has its share of the queue
+    DeviceLimit,
+}
+
+pub struct Scheduled<T> {
+    pub item: T,
+    pub device: Arc<str>,
+    pub enqueued_at: Instant,
+}
+
+struct Entry<T> {
+    item: T,
+    cost: u64,
+    enqueued_at: Instant,
+}
+
+struct DeviceQueue<T> {
+    jobs: VecDeque<Entry<T>>,
+    deficit: u64,
+}
+
+/// One priority class: a queue per device, served in rotation
+struct ClassQueue<T> {
+    devices: HashMap<Arc<str>, DeviceQueue<T>>,
+    rotation: VecDeque<Arc<str>>,
+}
+
+impl<T> ClassQueue<T> {
+    fn new() -> Self {
+        Self {
+            devices: HashMap::new(),
+            rotation: VecDeque::new(),
+        }
+    }
+
+    fn push(&mut self, device: &Arc<str>, entry: Entry<T>) {
+        let queue = self.devices.entry(device.clone()).or_insert_with(|| {
+            self.rotation.push_back(device.clone());
+            DeviceQueue {
+                jobs: VecDeque::new(),
+                deficit: QUANTUM_MS,
+            }
+        });
+        queue.jobs.push_back(entry);
+    }
+
+    /// Deficit round robin: the device at the front is served while its
+    /// credit covers its next job, then goes to the back with a fresh
+    /// quantum. Fair by audio time, so long clips don't buy extra turns.
+    fn pop(&mut self) -> Option<(Arc<str>, Entry<T>)> {
+        loop {
+            let device = self.rotation.front()?.clone();
+            let queue = self.devices.get_mut(&device)?;
+            let cost = queue.jobs.front().map_or(0, |entry| entry.cost);
+            if queue.deficit < cost {
+                queue.deficit += QUANTUM_MS;
+                self.rotation.rotate_left(1);
+                continue;
+            }
+            queue.deficit -= cost;
+            let entry = queue.jobs.pop_front()?;
+            if queue.jobs.is_empty() {
+                // Idle devices don't bank credit
+                self.devices.remove(&device);
+                self.rotation.pop_front();
+            }
+            return Some((device, entry));
+        }
+    }
+}
+
+#[derive(Default)]
+struct DeviceStats {
+    queued: usize,
+    jobs: u64,
+    rejected: u64,
+    waits_ms: VecDeque<u32>,
+}
+
+struct QueueState<T> {
+    /// Indexed by `Priority`
+    classes: [ClassQueue<T>; 2],
+    len: usize,
+    queued_cost: u64,
+    rejected: u64,
+    devices: HashMap<Arc<str>, DeviceStats>,
+}
+
+/// Bounded transcription queue with per-device fairness and priority
+/// classes, replacing a FIFO in which one chatty device could keep
+/// everyone else waiting.
+///
+/// Admission is decided up front: a job is refused when the queue is full,
+/// when it is bulk work and only the headroom kept for live work is left,
+/// or when its device already holds its share of the queue.
+pub struct FairQueue<T> {
+    state: Mutex<QueueState<T>>,
+    ready: Condvar,
+    /// One worker gathers a batch at a time (see `pop_batch`)
+    gather: Mutex<()>,
+    capacity: usize,
+}
+
+impl<T> FairQueue<T> {
+    pub fn new(capacity: usize) -> Self {
+        Self {
+            state: Mutex::new(QueueState {
+                classes: [ClassQueue::new(), ClassQueue::new()],
+                len: 0,
+                queued_cost: 0,
+                rejected: 0,
+                devices: HashMap::new(),
+            }),
+            ready: Condvar::new(),
+            gather: Mutex::new(()),
+            capacity,
+        }
+    }
+
+    pub fn capacity(&self) -> usize {
+        self.capacity
+    }
+
+    /// Bulk work may fill this much of the queue
+    fn bulk_limit(&self) -> usize {
+        (self.capacity * 3 / 4).max(1)
+    }
+
+    /// Queued jobs one device may hold
+    fn device_limit(&self) -> usize {
+        (self.capacity / 4).max(1)
+    }
+
+    fn admission(&self, state: &QueueState<T>, device: &str, priority: Priority) -> Result<(), Rejection> {
+        let limit = match priority {
+            Priority::Live => self.capacity,
+            Priority::Bulk => self.bulk_limit(),
+        };
+        if state.len >= limit {
+            return Err(Rejection::QueueFull);
+        }
+        if state.devices.get(device).map_or(0, |stats| stats.queued) >= self.device_limit() {
+            return Err(Rejection::DeviceLimit);
+        }
+        Ok(())
+    }
+
+    /// Would a job from this device be admitted right now? For refusing an
+    /// upload before receiving its body; `push` decides for real.
+    pub fn admits(&self, device: &str, priority: Priority) -> Result<(), Rejection> {
+        let state = self.state.lock().unwrap();
+        self.admission(&state, device, priority)
+    }
+
+    /// Queue an item costing `cost_ms` of engine audio; hands it back if
+    /// it is not admitted
+    pub fn push(&self, device: &str, priority: Priority, cost_ms: u64, item: T) -> Result<(), (T, Rejection)> {
+        let mut state = self.state.lock().unwrap();
+        if let Err(rejection) = self.admission(&state, device, priority) {
+            state.rejected += 1;
+            if let Some(stats) = state.devices.get_mut(device) {
+                stats.rejected += 1;
+            }
+            return Err((item, rejection));
+        }
+
+        let device: Arc<str> = match state.devices.get_key_value(device) {
+            Some((interned, _)) => interned.clone(),
+            None => Arc::from(device),
+        };
+        let cost = cost_ms.max(1);
+        state.classes[priority as usize].push(&device, Entry {
+            item,
+            cost,
+            enqueued_at: Instant::now(),
+        });
+        state.len += 1;
+        state.queued_cost += cost;
+        state.devices.entry(device).or_default().queued += 1;
+        drop(state);
+        self.ready.notify_one();
+        Ok(())
+    }
+
+    fn pop_locked(state: &mut QueueState<T>) -> Option<Scheduled<T>> {
+        let (device, entry) = state.classes.iter_mut().find_map(|class| class.pop())?;
+        state.len -= 1;
+        state.queued_cost -= entry.cost;
+        let stats = state.devices.get_mut(&device)?;
+        stats.queued -= 1;
+        stats.jobs += 1;
+        if stats.waits_ms.len() == WAIT_SAMPLES {
+            stats.waits_ms.pop_front();
+        }
+        stats.waits_ms.push_back(entry.enqueued_at.elapsed().as_millis().min(u32::MAX as u128) as u32);
+        Some(Scheduled {
+            item: entry.item,
+            device,
+            enqueued_at: entry.enqueued_at,
+        })
+    }
+
+    /// Next batch for a worker: blocks for the first job, then takes whatever
+    /// is already queued, in fair order. If that leaves the queue empty and
+    /// the batch has room, waits up to `window` for stragglers (devices that
+    /// stopped at the same moment).
+    pub fn pop_batch(&self, max_batch: usize, window: Duration) -> Vec<Scheduled<T>> {
+        // Only held while gathering jobs, never during inference
+        let _gather = self.gather.lock().unwrap();
+        let mut state = self.state.lock().unwrap();
+        let first = loop {
+            if let Some(job) = Self::pop_locked(&mut state) {
+                break job;
+            }
+            state = self.ready.wait(state).unwrap();
+        };
+        let mut batch = vec![first];
+        let deadline = Instant::now() + window;
+        while batch.len() < max_batch {
+            if let Some(job) = Self::pop_locked(&mut state) {
+                batch.push(job);
+                continue;
+            }
+            let remaining = deadline.saturating_duration_since(Instant::now());
+            if remaining.is_zero() {
+                break;
+            }
+            state = self.ready.wait_timeout(state, remaining).unwrap().0;
+        }
+        batch
+    }
+
+    pub fn len(&self) -> usize {
+        self.state.lock().unwrap().len
+    }
+
+    /// Audio milliseconds waiting for an engine
+    pub fn queued_cost_ms(&self) -> u64 {
+        self.state.lock().unwrap().queued_cost
+    }
+
+    /// Queue depth per class, refusals, and per-device queue waits
+    pub fn stats_json(&self) -> serde_json::Value {
+        let state = self.state.lock().unwrap();
+        let mut devices: Vec<(&Arc<str>, &DeviceStats)> = state.devices.iter().collect();
+        devices.sort_by(|a, b| a.0.cmp(b.0));
+        let devices: Vec<serde_json::Value> = devices
+            .into_iter()
+            .map(|(device, stats)| {
+                let mut waits: Vec<u32> = stats.waits_ms.iter().copied().collect();
+                waits.sort_unstable();
+                serde_json::json!({
+                    "device_id": &**device,
+                    "queued": stats.queued,
+                    "jobs": stats.jobs,
+                    "rejected": stats.rejected,
+                    "wait_p50_ms": percentile(&waits, 50.0),
+                    "wait_p90_ms": percentile(&waits, 90.0),
+                    "wait_p99_ms": percentile(&waits, 99.0),
+                })
+            })
+            .collect();
+        serde_json::json!({
+            "live_queued": state.classes[Priority::Live as usize].devices.values().map(|q| q.jobs.len()).sum::<usize>(),
+            "bulk_queued": state.classes[Priority::Bulk as usize].devices.values().map(|q| q.jobs.len()).sum::<usize>(),
+            "device_limit": self.device_limit(),
+            "bulk_limit": self.bulk_limit(),
+            "rejected": state.rejected,
+            "devices": devices,
+        })
+    }
+}
+
+/// Nearest-rank percentile of sorted samples; null when there are none
+fn percentile(sorted: &[u32], p: f64) -> Option<u32> {
+    if sorted.is_empty() {
+        return None;
+    }
+    let rank = ((p / 100.0) * sorted.len() as f64).ceil() as usize;
+    Some(sorted[rank.clamp(1, sorted.len()) - 1])
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Device of every queued job, in the order they are served
+    fn drain(queue: &FairQueue<u64>) -> Vec<(String, u64)> {
+        let mut served = Vec::new();
+        while queue.len() > 0 {
+            for job in queue.pop_batch(64, Duration::ZERO) {
+                served.push((job.device.to_string(), job.item));
+            }
+        }
+        served
+    }
+
+    #[test]
+    fn equal_jobs_alternate_between_devices() {
+        let queue = FairQueue::new(64);
+        for i in 0..6 {
+            queue.push("chatty", Priority::Live, 3000, i).unwrap();
+        }
+        queue.push("quiet", Priority::Live, 3000, 100).unwrap();
+        let order: Vec<String> = drain(&queue).into_iter().map(|(device, _)| device).collect();
+        assert_eq!(order[..3], ["chatty", "quiet", "chatty"]);
+    }
+
+    #[test]
+    fn devices_get_equal_audio_time_whatever_their_clip_length() {
+        let queue = FairQueue::new(128);
+        for _ in 0..8 {
+            queue.push("long", Priority::Live, 6000, 6000).unwrap();
+        }
+        for _ in 0..30 {
+            queue.push("short", Priority::Live, 1000, 1000).unwrap();
+        }
+
+        let mut served: HashMap<String, u64> = HashMap::new();
+        let mut remaining: HashMap<&str, usize> = HashMap::from([("long", 8), ("short", 30)]);
+        for (device, cost) in drain(&queue) {
+            *served.entry(device.clone()).or_default() += cost;
+            *remaining.get_mut(device.as_str()).unwrap() -= 1;
+            if remaining.values().all(|&left| left > 0) {
+                // While both are backlogged, neither gets ahead by more than
+                // one quantum plus one job
+                let gap = served.get("long").copied().unwrap_or(0).abs_diff(served.get("short").copied().unwrap_or(0));
+                assert!(gap <= QUANTUM_MS + 6000, "gap {} ms", gap);
+            }
+        }
+        assert_eq!(served["long"], 48000);
+        assert_eq!(served["short"], 30000);
+    }
+
+    #[test]
+    fn live_work_is_served_before_bulk() {
+        let queue = FairQueue::new(64);
+        queue.push("a", Priority::Bulk, 1000, 1).unwrap();
+        queue.push("b", Priority::Bulk, 1000, 2).unwrap();
+        queue.push("c", Priority::Live, 1000, 3).unwrap();
+        let items: Vec<u64> = drain(&queue).into_iter().map(|(_, item)| item).collect();
+        assert_eq!(items, [3, 1, 2]);
+    }
+
+    #[test]
+    fn admission_limits_devices_and_keeps_headroom_for_live_work() {
+        let queue = FairQueue::new(8);
+        assert_eq!((queue.device_limit(), queue.bulk_limit()), (2, 6));
+
+        queue.push("a", Priority::Live, 1000, 0).unwrap();
+        queue.push("a", Priority::Live, 1000, 1).unwrap();
+        assert_eq!(queue.admits("a", Priority::Live), Err(Rejection::DeviceLimit));
+        assert!(matches!(queue.push("a", Priority::Live, 1000, 2), Err((2, Rejection::DeviceLimit))));
+
+        for (i, device) in ["b", "b", "c", "c"].into_iter().enumerate() {
+            queue.push(device, Priority::Bulk, 1000, i as u64).unwrap();
+        }
+        assert_eq!(queue.admits("d", Priority::Bulk), Err(Rejection::QueueFull));
+        queue.push("d", Priority::Live, 1000, 10).unwrap();
+        queue.push("e", Priority::Live, 1000, 11).unwrap();
+        assert_eq!(queue.admits("f", Priority::Live), Err(Rejection::QueueFull));
+        assert_eq!(queue.len(), 8);
+        assert_eq!(queue.queued_cost_ms(), 8000);
+
+        let stats = queue.stats_json();
+        assert_eq!(stats["rejected"], 1);
+        assert_eq!(stats["live_queued"], 4);
+        assert_eq!(stats["bulk_queued"], 4);
+
+        // Serving a job frees its device's share
+        drain(&queue);
+        assert!(queue.admits("a", Priority::Live).is_ok());
+        assert_eq!(queue.queued_cost_ms(), 0);
+    }
+
+    #[test]
+    fn pop_batch_takes_what_is_queued_up_to_the_limit() {
+        let queue = FairQueue::new(64);
+        for i in 0..5 {
+            queue.push(&format!("d{}", i), Priority::Live, 1000, i).unwrap();
+        }
+        assert_eq!(queue.pop_batch(3, Duration::ZERO).len(), 3);
+        assert_eq!(queue.pop_batch(3, Duration::from_millis(10)).len(), 2);
+        assert_eq!(queue.len(), 0);
+    }
+
+    #[test]
+    fn percentile_uses_nearest_rank() {
+        assert_eq!(percentile(&[], 50.0), None);
+        assert_eq!(percentile(&[7], 99.0), Some(7));
+        let sorted: Vec<u32> = (1..=100).collect();
+        assert_eq!(percentile(&sorted, 50.0), Some(50));
+        assert_eq!(percentile(&sorted, 90.0), Some(90));
+        assert_eq!(percentile(&sorted, 0.0), Some(1));
+    }
+}
@@ -0,0 +1,557 @@
+use chrono::{DateTime, NaiveDate};
+use std::collections::{BinaryHeap, HashMap};
+
+/// BM25 term-frequency saturation and length normalization
+const K1: f32 = 1.2;
+const B: f32 = 0.75;
+/// A term in more transcripts than this only re-ranks results found by a
+/// rarer term of the same query, so "the" never walks a million postings
+const COMMON_TERM_POSTINGS: usize = 50_000;
+/// Score into a dense array rather than a hash map once the candidate
+/// postings exceed 1/DENSE_SHARE of all transcripts
+const DENSE_SHARE: usize = 32;
+/// Longer tokens are cut to this many characters
+const MAX_TERM_CHARS: usize = 32;
+/// Words of context in a snippet
+const SNIPPET_WORDS: usize = 24;
+
+struct Posting {
+    seq: u32,
+    /// Occurrences in the transcript
+    tf: u32,
+}
+
+struct Doc {
+    /// Tokens in the transcript
+    len: u32,
+    /// Epoch milliseconds of its `timestamp` (0 if missing)
+    time_ms: i64,
+    device: u32,
+}
+
+/// Inverted index over transcript text, with device and time per
+/// transcript for filtering. Records are added in `seq` order, so each
+/// posting list is sorted by construction and appending is the only update.
+#[derive(Default)]
+pub struct SearchIndex {
+    postings: HashMap<Box<str>, Vec<Posting>>,
+    /// Position == seq
+    docs: Vec<Doc>,
+    devices: HashMap<String, u32>,
+    total_len: u64,
+}
+
+pub struct SearchQuery<'a> {
+    /// Normalized with `terms`
+    pub terms: Vec<String>,
+    pub device: Option<&'a str>,
+    /// Epoch milliseconds, inclusive
+    pub from_ms: Option<i64>,
+    /// Epoch milliseconds, exclusive
+    pub to_ms: Option<i64>,
+    pub offset: usize,
+    pub limit: usize,
+}
+
+pub struct SearchHits {
+    /// Matching transcripts, before pagination
+    pub total: usize,
+    /// (seq, score), best first
+    pub hits: Vec<(u64, f32)>,
+}
+
+impl SearchIndex {
+    /// Index the record stored at `seq` (the next one)
+    pub fn add(&mut self, seq: u64, record: &serde_json::Value) {
+        debug_assert_eq!(seq as usize, self.docs.len());
+        let device_id = record.get("device_id").and_then(|d| d.as_str()).unwrap_or("");
+        let next_device = self.devices.len() as u32;
+        let device = *self.devices.entry(device_id.to_string()).or_insert(next_device);
+        let time_ms = record
+            .get("timestamp")
+            .and_then(|t| t.as_str())
+            .and_then(|t| DateTime::parse_from_rfc3339(t).ok())
+            .map_or(0, |t| t.timestamp_millis());
+
+        let mut counts: HashMap<String, u32> = HashMap::new();
+        let mut len = 0;
+        for term in terms(record_text(record)) {
+            *counts.entry(term).or_default() += 1;
+            len += 1;
+        }
+        for (term, tf) in counts {
+            self.postings
+                .entry(term.into_boxed_str())
+                .or_default()
+                .push(Posting { seq: seq as u32, tf });
+        }
+        self.docs.push(Doc { len, time_ms, device });
+        self.total_len += len as u64;
+    }
+
+    /// BM25-ranked transcripts containing any of the query terms
+    pub fn search(&self, query: &SearchQuery) -> SearchHits {
+        let empty = SearchHits { total: 0, hits: Vec::new() };
+        let device = match query.device {
+            Some(device_id) => match self.devices.get(device_id) {
+                Some(&device) => Some(device),
+                None => return empty,
+            },
+            None => None,
+        };
+        let accept = |doc: &Doc| {
+            device.map_or(true, |d| doc.device == d)
+                && query.from_ms.map_or(true, |from| doc.time_ms >= from)
+                && query.to_ms.map_or(true, |to| doc.time_ms < to)
+        };
+
+        let n = self.docs.len() as f32;
+        let avg_len = (self.total_len as f32 / n.max(1.0)).max(1.0);
+        let mut terms: Vec<(&[Posting], f32)> = Vec::new();
+        let mut seen: Vec<&str> = Vec::new();
+        for term in &query.terms {
+            if seen.contains(&term.as_str()) {
+                continue;
+            }
+            seen.push(term);
+            let postings = self.postings_of(term);
+            if !postings.is_empty() {
+                let df = postings.len() as f32;
+                terms.push((postings, (1.0 + (n - df + 0.5) / (df + 0.5)).ln()));
+            }
+        }
+        if terms.is_empty() {
+            return empty;
+        }
+        terms.sort_by_key(|(postings, _)| postings.len());
+        let bm25 = |tf: u32, doc: &Doc, idf: f32| {
+            let tf = tf as f32;
+            idf * tf * (K1 + 1.0) / (tf + K1 * (1.0 - B + B * doc.len as f32 / avg_len))
+        };
+
+        // Rare terms find candidates, common ones only add to their scores
+        let generators = terms
+            .iter()
+            .filter(|(postings, _)| postings.len() <= COMMON_TERM_POSTINGS)
+            .count()
+            .max(1);
+        let wanted = query.offset.saturating_add(query.limit);
+        let generator_postings: usize = terms[..generators].iter().map(|(postings, _)| postings.len()).sum();
+        let (total, ranked) = if generator_postings > self.docs.len() / DENSE_SHARE {
+            // A slot per transcript beats hashing this many postings; every
+            // BM25 term is positive, so a zero slot is a non-match
+            let mut scores = vec![0f32; self.docs.len()];
+            for &(postings, idf) in &terms[..generators] {
+                for posting in postings {
+                    let doc = &self.docs[posting.seq as usize];
+                    if accept(doc) {
+                        scores[posting.seq as usize] += bm25(posting.tf, doc, idf);
+                    }
+                }
+            }
+            for &(postings, idf) in &terms[generators..] {
+                for posting in postings {
+                    let score = &mut scores[posting.seq as usize];
+                    if *score > 0.0 {
+                        *score += bm25(posting.tf, &self.docs[posting.seq as usize], idf);
+                    }
+                }
+            }
+            top_hits(
+                scores
+                    .into_iter()
+                    .enumerate()
+                    .filter(|&(_, score)| score > 0.0)
+                    .map(|(seq, score)| (seq as u32, score)),
+                wanted,
+            )
+        } else {
+            let mut scores: HashMap<u32, f32> = HashMap::new();
+            for &(postings, idf) in &terms[..generators] {
+                for posting in postings {
+                    let doc = &self.docs[posting.seq as usize];
+                    if accept(doc) {
+                        *scores.entry(posting.seq).or_default() += bm25(posting.tf, doc, idf);
+                    }
+                }
+            }
+            for &(postings, idf) in &terms[generators..] {
+                for (&seq, score) in scores.iter_mut() {
+                    if let Ok(i) = postings.binary_search_by_key(&seq, |posting| posting.seq) {
+                        *score += bm25(postings[i].tf, &self.docs[seq as usize], idf);
+                    }
+                }
+            }
+            top_hits(scores.into_iter(), wanted)
+        };
+
+        SearchHits {
+            total,
+            hits: ranked
+                .into_iter()
+                .skip(query.offset)
+                .map(|Hit { seq, score }| (seq as u64, score))
+                .collect(),
+        }
+    }
+
+    fn postings_of(&self, term: &str) -> &[Posting] {
+        self.postings.get(term).map_or(&[], Vec::as_slice)
+    }
+}
+
+/// A scored transcript, ordered best first (higher score, then newer)
+#[derive(PartialEq)]
+struct Hit {
+    seq: u32,
+    score: f32,
+}
+
+impl Eq for Hit {}
+
+impl PartialOrd for Hit {
+    fn partial_cmp(&self, other: &Self) -> Option<std::cmp::Ordering> {
+        Some(self.cmp(other))
+    }
+}
+
+impl Ord for Hit {
+    fn cmp(&self, other: &Self) -> std::cmp::Ordering {
+        other.score.total_cmp(&self.score).then(other.seq.cmp(&self.seq))
+    }
+}
+
+/// Match count and the best `wanted` hits in order, keeping only those in a
+/// heap whose top is the worst kept
+fn top_hits(scores: impl Iterator<Item = (u32, f32)>, wanted: usize) -> (usize, Vec<Hit>) {
+    let mut total = 0;
+    let mut heap: BinaryHeap<Hit> = BinaryHeap::with_capacity(wanted.min(4096) + 1);
+    for (seq, score) in scores {
+        total += 1;
+        let hit = Hit { seq, score };
+        if heap.len() < wanted {
+            heap.push(hit);
+        } else if heap.peek().is_some_and(|worst| hit < *worst) {
+            heap.pop();
+            heap.push(hit);
+        }
+    }
+    (total, heap.into_sorted_vec())
+}
+
+/// The transcript text of a stored record
+pub fn record_text(record: &serde_json::Value) -> &str {
+    record
+        .get("transcript")
+        .or_else(|| record.get("text"))
+        .and_then(|t| t.as_str())
+        .unwrap_or("")
+}
+
+/// Byte ranges of the words in `text` (runs of letters and digits)
+fn word_spans(text: &str) -> Vec<(usize, usize)> {
+    let mut spans = Vec::new();
+    let mut start = None;
+    for (i, c) in text.char_indices() {
+        match (c.is_alphanumeric(), start) {
+            (true, None) => start = Some(i),
+            (false, Some(s)) => {
+                spans.push((s, i));
+                start = None;
+            }
+            _ => {}
+        }
+    }
+    if let Some(s) = start {
+        spans.push((s, text.len()));
+    }
+    spans
+}
+
+fn normalize(word: &str) -> String {
+    word.chars().flat_map(char::to_lowercase).take(MAX_TERM_CHARS).collect()
+}
+
+/// Index terms of `text`, in order: lowercased words
+pub fn terms(text: &str) -> impl Iterator<Item = String> + '_ {
+    word_spans(text).into_iter().map(move |(start, end)| normalize(&text[start..end]))
+}
+
+/// `from`/`to` as epoch milliseconds: RFC 3339, or a date meaning its
+/// midnight UTC (the following midnight for `to`, so the day is included)
+pub fn parse_time_bound(value: &str, end_of_day: bool) -> Option<i64> {
+    if let Ok(time) = DateTime::parse_from_rfc3339(value) {
+        return Some(time.timestamp_millis());
+    }
+    let date = NaiveDate::parse_from_str(value, "%Y-%m-%d").ok()?;
+    let date = if end_of_day { date.succ_opt()? } else { date };
+    Some(date.and_hms_opt(0, 0, 0)?.and_utc().timestamp_millis())
+}
+
+/// The `SNIPPET_WORDS` of `text` with the most query terms, HTML-escaped,
+/// matches wrapped in `<mark>`
+pub fn snippet(text: &str, query_terms: &[String]) -> String {
+    let spans = word_spans(text);
+    let mut out = String::new();
+    if spans.is_empty() {
+        escape_into(&mut out, text);
+        return out;
+    }
+    let matched: Vec<bool> = spans
+        .iter()
+        .map(|&(start, end)| query_terms.contains(&normalize(&text[start..end])))
+        .collect();
+
+    // Densest window of matches
+    let window = SNIPPET_WORDS.min(spans.len());
+    let mut best = (0, 0);
+    let mut count = matched[..window].iter().filter(|&&m| m).count();
+    best.1 = count;
+    for first in 1..=spans.len() - window {
+        count = count + matched[first + window - 1] as usize - matched[first - 1] as usize;
+        if count > best.1 {
+            best = (first, count);
+        }
+    }
+    // Start a little before the first match so it has some context
+    let first_match = (best.0..best.0 + window).find(|&i| matched[i]).unwrap_or(best.0);
+    let first = first_match.saturating_sub(3).min(spans.len() - window);
+    let last = first + window;
+
+    let mut pos = 0;
+    if first > 0 {
+        out.push('…');
+        pos = spans[first].0;
+    }
+    for i in first..last {
+        let (start, end) = spans[i];
+        escape_into(&mut out, &text[pos..start]);
+        if matched[i] {
+            out.push_str("<mark>");
+            escape_into(&mut out, &text[start..end]);
+            out.push_str("</mark>");
+        } else {
+            escape_into(&mut out, &text[start..end]);
+        }
+        pos = end;
+    }
+    if last < spans.len() {
+        out.push('…');
+    } else {
+        escape_into(&mut out, &text[pos..]);
+    }
+    out
+}
+
+fn escape_into(out: &mut String, text: &str) {
+    for c in text.chars() {
+        match c {
+            '&' => out.push_str("&amp;"),
+            '<' => out.push_str("&lt;"),
+            '>' => out.push_str("&gt;"),
+            '"' => out.push_str("&quot;"),
+            '\'' => out.push_str("&#39;"),
+            _ => out.push(c),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn record(device: &str, time_ms: i64, text: &str) -> serde_json::Value {
+        let timestamp = DateTime::from_timestamp_millis(time_ms).unwrap().to_rfc3339();
+        serde_json::json!({"device_id": device, "timestamp": timestamp, "transcript": text})
+    }
+
+    fn index_of(records: &[serde_json::Value]) -> SearchIndex {
+        let mut index = SearchIndex::default();
+        for (seq, record) in records.iter().enumerate() {
+            index.add(seq as u64, record);
+        }
+        index
+    }
+
+    fn query(text: &str) -> SearchQuery<'static> {
+        SearchQuery {
+            terms: terms(text).collect(),
+            device: None,
+            from_ms: None,
+            to_ms: None,
+            offset: 0,
+            limit: 100,
+        }
+    }
+
+    fn seqs(hits: &SearchHits) -> Vec<u64> {
+        hits.hits.iter().map(|&(seq, _)| seq).collect()
+    }
+
+    /// Straight from the BM25 definition, one transcript at a time
+    fn reference(records: &[serde_json::Value], query: &SearchQuery) -> Vec<(u64, f32)> {
+        let docs: Vec<Vec<String>> = records.iter().map(|r| terms(record_text(r)).collect()).collect();
+        let n = docs.len() as f32;
+        let avg_len = (docs.iter().map(Vec::len).sum::<usize>() as f32 / n).max(1.0);
+        let mut unique: Vec<String> = Vec::new();
+        for term in &query.terms {
+            if !unique.contains(term) {
+                unique.push(term.clone());
+            }
+        }
+        let mut hits: Vec<(u64, f32)> = Vec::new();
+        for (seq, doc) in docs.iter().enumerate() {
+            let record = &records[seq];
+            let time_ms = DateTime::parse_from_rfc3339(record["timestamp"].as_str().unwrap()).unwrap().timestamp_millis();
+            if query.device.is_some_and(|d| record["device_id"] != d)
+                || query.from_ms.is_some_and(|from| time_ms < from)
+                || query.to_ms.is_some_and(|to| time_ms >= to)
+            {
+                continue;
+            }
+            let mut score = 0.0;
+            for term in &unique {
+                let tf = doc.iter().filter(|t| *t == term).count() as f32;
+                if tf == 0.0 {
+                    continue;
+                }
+                let df = docs.iter().filter(|d| d.contains(term)).count() as f32;
+                let idf = (1.0 + (n - df + 0.5) / (df + 0.5)).ln();
+                score += idf * tf * (K1 + 1.0) / (tf + K1 * (1.0 - B + B * doc.len() as f32 / avg_len));
+            }
+            if score > 0.0 {
+                hits.push((seq as u64, score));
+            }
+        }
+        hits.sort_by(|a, b| b.1.total_cmp(&a.1).then(b.0.cmp(&a.0)));
+        hits
+    }
+
+    /// Transcripts over a skewed vocabulary, so queries mix rare and
+    /// frequent terms (and so both scoring paths)
+    fn corpus(len: usize) -> Vec<serde_json::Value> {
+        let mut state: u64 = 42;
+        let mut next = move |modulo: u64| {
+            state = state.wrapping_mul(6364136223846793005).wrapping_add(1442695040888963407);
+            (state >> 33) % modulo
+        };
+        (0..len)
+            .map(|i| {
+                let words: Vec<String> = (0..1 + next(30))
+                    .map(|_| format!("w{}", next(40).min(next(40))))
+                    .collect();
+                record(&format!("d{}", next(3)), 1_700_000_000_000 + i as i64 * 60_000, &words.join(" "))
+            })
+            .collect()
+    }
+
+    #[test]
+    fn scores_match_the_bm25_definition() {
+        let records = corpus(400);
+        let index = index_of(&records);
+        for text in ["w0", "w39", "w38 w39", "w1 w2 w3", "w0 w37 w0", "w5 nothing", "missing"] {
+            let mut query = query(text);
+            query.limit = 1000;
+            let found = index.search(&query);
+            let expected = reference(&records, &query);
+            assert_eq!(found.total, expected.len(), "{:?}", text);
+            assert_eq!(found.hits.len(), expected.len());
+            for (&(seq, score), &(expected_seq, expected_score)) in found.hits.iter().zip(&expected) {
+                assert!((score - expected_score).abs() < 1e-4, "{:?}: {} vs {}", text, score, expected_score);
+                // Equal scores may come in either order only if truly equal
+                if seq != expected_seq {
+                    assert!((score - expected_score).abs() < 1e-6);
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn frequent_short_and_rare_matches_rank_first() {
+        let records = [
+            record("a", 0, "the cat sat on the mat"),
+            record("a", 1, "cat cat cat"),
+            record("a", 2, "a very long transcript that mentions the cat once among many other words"),
+            record("a", 3, "the dog"),
+            record("a", 4, "the dog and the cat"),
+        ];
+        let index = index_of(&records);
+        // More occurrences first, then shorter transcripts
+        assert_eq!(seqs(&index.search(&query("cat"))), [1, 4, 0, 2]);
+        // "dog" is rarer than "cat", so a dog-only transcript beats a cat-only one
+        let hits = seqs(&index.search(&query("dog cat")));
+        assert_eq!(hits[0], 4);
+        assert_eq!(hits[1], 3);
+        // A repeated query term counts once
+        let once = index.search(&query("dog"));
+        let twice = index.search(&query("dog DOG"));
+        assert_eq!(once.hits, twice.hits);
+    }
+
+    #[test]
+    fn equal_scores_list_newer_transcripts_first() {
+        let records = [record("a", 0, "hello"), record("a", 1, "hello"), record("a", 2, "bye")];
+        assert_eq!(seqs(&index_of(&records).search(&query("hello"))), [1, 0]);
+    }
+
+    #[test]
+    fn filters_and_pagination() {
+        let records: Vec<serde_json::Value> = (0..10)
+            .map(|i| record(if i % 2 == 0 { "even" } else { "odd" }, i * 1000, "note"))
+            .collect();
+        let index = index_of(&records);
+
+        let mut query = query("note");
+        query.device = Some("odd");
+        assert_eq!(seqs(&index.search(&query)), [9, 7, 5, 3, 1]);
+        query.device = Some("nobody");
+        assert_eq!(index.search(&query).total, 0);
+
+        query.device = None;
+        query.from_ms = Some(2000);
+        query.to_ms = Some(5000);
+        assert_eq!(seqs(&index.search(&query)), [4, 3, 2]);
+
+        query.from_ms = None;
+        query.to_ms = None;
+        query.offset = 3;
+        query.limit = 4;
+        let page = index.search(&query);
+        assert_eq!(page.total, 10);
+        assert_eq!(seqs(&page), [6, 5, 4, 3]);
+        query.offset = 20;
+        assert!(index.search(&query).hits.is_empty());
+    }
+
+    #[test]
+    fn terms_are_lowercased_words() {
+        let found: Vec<String> = terms("Hello, WORLD! it's 3pm — Grüße").collect();
+        assert_eq!(found, ["hello", "world", "it", "s", "3pm", "grüße"]);
+        let long = "x".repeat(40);
+        assert_eq!(terms(&long).next().unwrap().len(), MAX_TERM_CHARS);
+        assert_eq!(terms(" ... ").count(), 0);
+    }
+
+    #[test]
+    fn time_bounds_take_dates_or_timestamps() {
+        let day = 86_400_000;
+        assert_eq!(parse_time_bound("1970-01-02", false), Some(day));
+        assert_eq!(parse_time_bound("1970-01-02", true), Some(2 * day));
+        assert_eq!(parse_time_bound("1970-01-01T00:00:01+00:00", true), Some(1000));
+        assert_eq!(parse_time_bound("yesterday", false), None);
+    }
+
+    #[test]
+    fn snippets_mark_matches_in_context() {
+        let terms: Vec<String> = vec!["cat".to_string()];
+        assert_eq!(snippet("The <cat> & dog", &terms), "The &lt;<mark>cat</mark>&gt; &amp; dog");
+        assert_eq!(snippet("", &terms), "");
+
+        let words: Vec<String> = (0..100).map(|i| format!("w{}", i)).collect();
+        let text = words.join(" ").replace("w50", "cat");
+        let cut = snippet(&text, &terms);
+        assert!(cut.starts_with("…w47 w48 w49 <mark>cat</mark> w51"), "{}", cut);
+        assert!(cut.ends_with('…'));
+        assert_eq!(cut.matches(' ').count(), SNIPPET_WORDS - 1);
+    }
+}
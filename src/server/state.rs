@@ -1,16 +1,64 @@
-use memo_stt::SttEngine;
+use crate::server::archive::ArchiveStats;
+use crate::server::content_hash::PendingAudio;
+use crate::server::devices::DeviceRegistry;
+use crate::server::inference::InferencePool;
+use crate::server::journal::IngestJournal;
+use crate::server::latency::LatencyLog;
+use crate::server::media::TranscodeCache;
+use crate::server::metrics::Metrics;
+use crate::server::streaming::StreamSessions;
+use crate::server::telemetry::TelemetryStore;
+use crate::server::transcripts::TranscriptStore;
 use serde::{Deserialize, Serialize};
-use std::collections::HashMap;
+use std::collections::{HashSet, VecDeque};
 use std::sync::Arc;
 use std::sync::Mutex;
-use tokio::sync::mpsc;
+use std::time::{SystemTime, UNIX_EPOCH};
+use tokio::sync::broadcast;
 use chrono::{DateTime, Utc};
 
-#[derive(Debug, Clone, Serialize, Deserialize)]
-pub struct DeviceInfo {
-    pub device_id: String,
-    pub last_seen: DateTime<Utc>,
-    pub ip_address: Option<String>,
+/// Recently ingested recording ids, so device retries of an upload that
+/// actually landed (response lost) are not transcribed twice.
+pub struct RecentRecordingIds {
+    ids: HashSet<String>,
+    order: VecDeque<String>,
+}
+
+const RECENT_RECORDING_IDS: usize = 1024;
+
+impl RecentRecordingIds {
+    pub fn new() -> Self {
+        Self {
+            ids: HashSet::new(),
+            order: VecDeque::new(),
+        }
+    }
+
+    /// Returns false if the id was already seen
+    pub fn insert(&mut self, id: &str) -> bool {
+        if self.ids.contains(id) {
+            return false;
+        }
+        if self.order.len() >= RECENT_RECORDING_IDS {
+            if let Some(oldest) = self.order.pop_front() {
+                self.ids.remove(&oldest);
+            }
+        }
+        self.ids.insert(id.to_string());
+        self.order.push_back(id.to_string());
+        true
+    }
+
+    pub fn contains(&self, id: &str) -> bool {
+        self.ids.contains(id)
+    }
+
+    /// Drop an id whose ingest failed so a retry is accepted
+    pub fn forget(&mut self, id: &str) {
+        if self.ids.remove(id) {
+            self.order.retain(|queued| queued != id);
+        }
+    }
 }
 
 #[derive(Debug, Clone, Serialize, Deserialize)]
@@ -23,40 +71,135 @@ pub struct Transcript {
     pub server_analysis: Option<serde_json::Value>,
 }
 
+/// How many events a slow SSE client may fall behind before it is caught
+/// up from the replay buffer
+pub const SSE_CHANNEL_CAPACITY: usize = 256;
+/// Recent events kept for clients resuming with `Last-Event-ID`
+const SSE_REPLAY_EVENTS: usize = 1024;
+
+/// One server-sent event, shared by every subscriber
+pub struct SseMessage {
+    /// Increases by one per event
+    pub id: u64,
+    pub event: &'static str,
+    pub device_id: Option<Arc<str>>,
+    pub data: Arc<str>,
+}
+
+/// The last `SSE_REPLAY_EVENTS` events, oldest first
+struct SseReplay {
+    next_id: u64,
+    events: VecDeque<Arc<SseMessage>>,
+}
+
+impl SseReplay {
+    fn new() -> Self {
+        // Ids start at the startup time in microseconds, so they keep
+        // increasing across restarts and an id from a previous run always
+        // reads as too old to resume from
+        let start = SystemTime::now()
+            .duration_since(UNIX_EPOCH)
+            .map_or(1, |d| d.as_micros() as u64);
+        Self {
+            next_id: start,
+            events: VecDeque::with_capacity(SSE_REPLAY_EVENTS),
+        }
+    }
+
+    /// Events after `last_id`, or how many of them are no longer buffered
+    fn since(&self, last_id: u64) -> Result<Vec<Arc<SseMessage>>, u64> {
+        let first = self.events.front().map_or(self.next_id, |message| message.id);
+        if last_id >= self.next_id {
+            // Not an id this server has handed out
+            return Err(0);
+        }
+        if last_id + 1 < first {
+            return Err(first - last_id - 1);
+        }
+        let skip = (last_id + 1 - first) as usize;
+        Ok(self.events.iter().skip(skip).cloned().collect())
+    }
+}
+
 pub struct ServerState {
-    pub engine: Arc<Mutex<SttEngine>>,
-    pub devices: Arc<Mutex<HashMap<String, DeviceInfo>>>,
-    pub transcripts: Arc<Mutex<Vec<Transcript>>>,
-    pub recording_state: Arc<Mutex<HashMap<String, bool>>>,
-    pub sse_senders: Arc<Mutex<Vec<mpsc::UnboundedSender<String>>>>,
+    pub inference: InferencePool,
+    pub devices: DeviceRegistry,
+    pub transcripts: TranscriptStore,
+    pub streams: StreamSessions,
+    pub sse: broadcast::Sender<Arc<SseMessage>>,
+    sse_replay: Mutex<SseReplay>,
+    pub recent_recording_ids: Arc<Mutex<RecentRecordingIds>>,
+    pub pending_audio: PendingAudio,
+    pub journal: IngestJournal,
+    pub latency: LatencyLog,
+    pub metrics: Metrics,
+    pub transcode_cache: TranscodeCache,
+    pub archive: ArchiveStats,
+    pub telemetry: TelemetryStore,
 }
 
 impl ServerState {
-    pub fn new(engine: SttEngine) -> Self {
+    pub fn new(
+        inference: InferencePool,
+        transcripts: TranscriptStore,
+        journal: IngestJournal,
+        transcode_cache: TranscodeCache,
+        telemetry: TelemetryStore,
+    ) -> Self {
         Self {
-            engine: Arc::new(Mutex::new(engine)),
-            devices: Arc::new(Mutex::new(HashMap::new())),
-            transcripts: Arc::new(Mutex::new(Vec::new())),
-            recording_state: Arc::new(Mutex::new(HashMap::new())),
-            sse_senders: Arc::new(Mutex::new(Vec::new())),
+            inference,
+            devices: DeviceRegistry::new(),
+            transcripts,
+            streams: StreamSessions::new(),
+            sse: broadcast::channel(SSE_CHANNEL_CAPACITY).0,
+            sse_replay: Mutex::new(SseReplay::new()),
+            recent_recording_ids: Arc::new(Mutex::new(RecentRecordingIds::new())),
+            pending_audio: PendingAudio::new(),
+            journal,
+            latency: LatencyLog::new(),
+            metrics: Metrics::new(),
+            transcode_cache,
+            archive: ArchiveStats::default(),
+            telemetry,
         }
     }
 
-    pub fn broadcast_sse(&self, event_type: &str, data: &serde_json::Value) {
-        let message = format!(
-            "event: {}\ndata: {}\n\n",
-            event_type,
-            serde_json::to_string(data).unwrap_or_default()
-        );
-
-        let mut senders = self.sse_senders.lock().unwrap();
-        senders.retain(|sender| {
-            sender.send(message.clone()).is_ok()
+    /// Serialize once and fan out a shared copy; events carrying a
+    /// `device_id` only reach clients subscribed to that device (or to all)
+    pub fn broadcast_sse(&self, event_type: &'static str, data: &serde_json::Value) {
+        let device_id = data.get("device_id").and_then(|d| d.as_str()).map(Arc::from);
+        let data = Arc::from(serde_json::to_string(data).unwrap_or_default());
+        // Numbered and sent under the lock, so the channel and the replay
+        // buffer see the same order
+        let mut replay = self.sse_replay.lock().unwrap();
+        let message = Arc::new(SseMessage {
+            id: replay.next_id,
+            event: event_type,
+            device_id,
+            data,
         });
+        replay.next_id += 1;
+        if replay.events.len() == SSE_REPLAY_EVENTS {
+            replay.events.pop_front();
+        }
+        replay.events.push_back(message.clone());
+        // Err only means nobody is listening
+        let _ = self.sse.send(message);
+    }
+
+    /// A new receiver, the id of the newest event it will not see, and the
+    /// events after `last_id` it would have missed (Err: how many of those
+    /// are no longer buffered)
+    pub fn subscribe_sse(
+        &self,
+        last_id: Option<u64>,
+    ) -> (broadcast::Receiver<Arc<SseMessage>>, u64, Option<Result<Vec<Arc<SseMessage>>, u64>>) {
+        let replay = self.sse_replay.lock().unwrap();
+        (self.sse.subscribe(), replay.next_id - 1, last_id.map(|id| replay.since(id)))
     }
 
-    pub fn add_sse_sender(&self, sender: mpsc::UnboundedSender<String>) {
-        let mut senders = self.sse_senders.lock().unwrap();
-        senders.push(sender);
+    /// Events after `last_id`, for a receiver that lagged behind the channel
+    pub fn sse_since(&self, last_id: u64) -> Result<Vec<Arc<SseMessage>>, u64> {
+        self.sse_replay.lock().unwrap().since(last_id)
     }
 }
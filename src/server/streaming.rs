@@ -0,0 +1,442 @@
+use axum::body::Bytes;
+use std::collections::HashMap;
+use std::sync::{Arc, Mutex};
+use std::time::{Duration, Instant};
+
+/// New audio needed before the window is transcribed again
+pub const PARTIAL_INTERVAL_SEC: f32 = 1.0;
+/// Once the previous hypothesis is fully confirmed and the window is at least
+/// this long, the window restarts after it
+const WINDOW_SLIDE_SEC: f32 = 6.0;
+/// Hard cap on the window, so each partial costs a bounded amount of inference
+const WINDOW_MAX_SEC: f32 = 15.0;
+/// Segment sessions with no upload for this long are closed
+pub const SESSION_IDLE_TIMEOUT: Duration = Duration::from_secs(30);
+
+/// Stable-prefix commit policy for sliding-window partials.
+///
+/// Each run transcribes the whole current window. A word is committed once
+/// two consecutive hypotheses for the window agree on it; committed words
+/// never change. The rest of the latest hypothesis is shown as tentative.
+#[derive(Default)]
+pub struct StablePrefix {
+    committed: Vec<String>,
+    /// Words of the current window's hypotheses already in `committed`
+    window_committed: usize,
+    previous: Vec<String>,
+    tentative: Vec<String>,
+}
+
+impl StablePrefix {
+    /// Apply a new hypothesis for the current window. Returns true if it
+    /// confirmed every word of the previous one.
+    pub fn update(&mut self, text: &str) -> bool {
+        let words: Vec<String> = text.split_whitespace().map(str::to_string).collect();
+        let agreed = self
+            .previous
+            .iter()
+            .zip(&words)
+            .take_while(|(a, b)| a == b)
+            .count();
+        if agreed > self.window_committed {
+            self.committed
+                .extend(words[self.window_committed..agreed].iter().cloned());
+            self.window_committed = agreed;
+        }
+        let confirmed = !self.previous.is_empty() && agreed == self.previous.len();
+        self.tentative = words.get(self.window_committed..).unwrap_or(&[]).to_vec();
+        self.previous = words;
+        confirmed
+    }
+
+    /// Start a new window where the previous run's audio ended. The first
+    /// `covered` words of the latest hypothesis belong to the old window and
+    /// are committed; the rest are what the new window should start with.
+    pub fn slide(&mut self, covered: usize) {
+        let covered = covered.min(self.previous.len());
+        if covered > self.window_committed {
+            self.committed
+                .extend(self.previous[self.window_committed..covered].iter().cloned());
+        }
+        self.previous.drain(..covered);
+        self.tentative = self.previous.clone();
+        self.window_committed = 0;
+    }
+
+    pub fn committed(&self) -> String {
+        self.committed.join(" ")
+    }
+
+    pub fn tentative(&self) -> String {
+        self.tentative.join(" ")
+    }
+
+    fn previous_len(&self) -> usize {
+        self.previous.len()
+    }
+}
+
+/// A window of audio handed to the engine for a partial result
+pub struct PartialRun {
+    pub window: Bytes,
+    /// Byte offset the window ends at
+    pub end: usize,
+}
+
+/// A recording being transcribed while it is still arriving (chunked
+/// `/audio-stream` body or `/audio-segment` uploads).
+pub struct StreamSession {
+    pub id: Arc<str>,
+    pub device_id: Arc<str>,
+    pub sample_rate: u32,
+    pub channels: u16,
+    pcm: Vec<u8>,
+    carry: Option<u8>,
+    partials: StablePrefix,
+    /// Byte offset of the current window
+    window_start: usize,
+    /// Where the previous run over this window ended
+    previous_end: usize,
+    next_partial_at: usize,
+    in_flight: bool,
+    finished: bool,
+    /// Next `/audio-segment` sequence number expected
+    pub next_segment: u64,
+    pub last_activity: Instant,
+    pub started: Instant,
+}
+
+impl StreamSession {
+    pub fn new(id: &str, device_id: &str, sample_rate: u32, channels: u16) -> Self {
+        let mut session = Self {
+            id: Arc::from(id),
+            device_id: Arc::from(device_id),
+            sample_rate,
+            channels,
+            pcm: Vec::new(),
+            carry: None,
+            partials: StablePrefix::default(),
+            window_start: 0,
+            previous_end: 0,
+            next_partial_at: 0,
+            in_flight: false,
+            finished: false,
+            next_segment: 0,
+            last_activity: Instant::now(),
+            started: Instant::now(),
+        };
+        session.next_partial_at = session.bytes_for(PARTIAL_INTERVAL_SEC);
+        session
+    }
+
+    fn bytes_for(&self, seconds: f32) -> usize {
+        (seconds * self.sample_rate as f32) as usize * self.channels as usize * 2
+    }
+
+    /// PCM bytes received so far (whole samples only)
+    pub fn len(&self) -> usize {
+        self.pcm.len()
+    }
+
+    pub fn push(&mut self, mut chunk: &[u8]) {
+        self.last_activity = Instant::now();
+        // Keep samples whole across chunk boundaries
+        if let Some(low) = self.carry.take() {
+            let Some((&high, rest)) = chunk.split_first() else {
+                self.carry = Some(low);
+                return;
+            };
+            self.pcm.extend_from_slice(&[low, high]);
+            chunk = rest;
+        }
+        let whole = chunk.len() & !1;
+        self.pcm.extend_from_slice(&chunk[..whole]);
+        if whole < chunk.len() {
+            self.carry = Some(chunk[whole]);
+        }
+    }
+
+    /// The next window to transcribe, if enough new audio has arrived and
+    /// no run is already in flight
+    pub fn take_partial_run(&mut self) -> Option<PartialRun> {
+        if self.finished || self.in_flight || self.pcm.len() < self.next_partial_at {
+            return None;
+        }
+        let end = self.pcm.len();
+        self.in_flight = true;
+        self.next_partial_at = end + self.bytes_for(PARTIAL_INTERVAL_SEC);
+        Some(PartialRun {
+            window: Bytes::copy_from_slice(&self.pcm[self.window_start..end]),
+            end,
+        })
+    }
+
+    /// Fold in the hypothesis for a run; returns false if the session has
+    /// already finished (the result is stale)
+    pub fn apply_partial(&mut self, run_end: usize, text: Option<&str>) -> bool {
+        self.in_flight = false;
+        if self.finished {
+            return false;
+        }
+        let Some(text) = text else {
+            return true;
+        };
+
+        let previous_words = self.partials.previous_len();
+        let confirmed = self.partials.update(text);
+        let window_len = run_end - self.window_start;
+        let slide = self.previous_end > self.window_start
+            && ((confirmed && window_len >= self.bytes_for(WINDOW_SLIDE_SEC))
+                || window_len >= self.bytes_for(WINDOW_MAX_SEC));
+        if slide {
+            // Words the previous run heard belong to the old window
+            self.partials.slide(previous_words);
+            self.window_start = self.previous_end;
+        }
+        self.previous_end = run_end;
+        true
+    }
+
+    pub fn committed(&self) -> String {
+        self.partials.committed()
+    }
+
+    pub fn tentative(&self) -> String {
+        self.partials.tentative()
+    }
+
+    /// Mark the session done and hand over the full recording
+    pub fn finish(&mut self) -> Bytes {
+        self.finished = true;
+        Bytes::from(std::mem::take(&mut self.pcm))
+    }
+
+    /// Undo `finish` after the recording could not be saved, so closing the
+    /// session can be retried
+    pub fn reopen(&mut self, pcm: Bytes) {
+        self.pcm = Vec::from(pcm);
+        self.finished = false;
+    }
+
+    /// Being closed (or already closed) by `finish`
+    pub fn is_finished(&self) -> bool {
+        self.finished
+    }
+}
+
+/// Open `/audio-segment` sessions by id
+pub struct StreamSessions {
+    sessions: Mutex<HashMap<String, Arc<Mutex<StreamSession>>>>,
+}
+
+impl StreamSessions {
+    pub fn new() -> Self {
+        Self {
+            sessions: Mutex::new(HashMap::new()),
+        }
+    }
+
+    pub fn get(&self, id: &str) -> Option<Arc<Mutex<StreamSession>>> {
+        self.sessions.lock().unwrap().get(id).cloned()
+    }
+
+    /// The session with this id, creating it if this is its first segment
+    pub fn get_or_open(
+        &self,
+        id: &str,
+        device_id: &str,
+        sample_rate: u32,
+        channels: u16,
+    ) -> Arc<Mutex<StreamSession>> {
+        self.sessions
+            .lock()
+            .unwrap()
+            .entry(id.to_string())
+            .or_insert_with(|| {
+                Arc::new(Mutex::new(StreamSession::new(id, device_id, sample_rate, channels)))
+            })
+            .clone()
+    }
+
+    pub fn remove(&self, id: &str) -> Option<Arc<Mutex<StreamSession>>> {
+        self.sessions.lock().unwrap().remove(id)
+    }
+
+    /// Sessions that stopped receiving segments and aren't already being
+    /// closed. They stay listed until the caller has closed them.
+    pub fn idle(&self) -> Vec<Arc<Mutex<StreamSession>>> {
+        self.sessions
+            .lock()
+            .unwrap()
+            .values()
+            .filter(|session| {
+                let session = session.lock().unwrap();
+                !session.is_finished() && session.last_activity.elapsed() > SESSION_IDLE_TIMEOUT
+            })
+            .cloned()
+            .collect()
+    }
+
+    pub fn len(&self) -> usize {
+        self.sessions.lock().unwrap().len()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// 16 kHz mono: 32000 bytes per second
+    fn session() -> StreamSession {
+        StreamSession::new("s", "d", 16000, 1)
+    }
+
+    fn seconds(session: &StreamSession, seconds: f32) -> Vec<u8> {
+        vec![0; session.bytes_for(seconds)]
+    }
+
+    #[test]
+    fn words_commit_once_two_hypotheses_agree() {
+        let mut prefix = StablePrefix::default();
+        assert!(!prefix.update("the quick"));
+        assert_eq!(prefix.committed(), "");
+        assert_eq!(prefix.tentative(), "the quick");
+
+        assert!(prefix.update("the quick brown"));
+        assert_eq!(prefix.committed(), "the quick");
+        assert_eq!(prefix.tentative(), "brown");
+
+        // A disagreement never takes back committed words
+        assert!(!prefix.update("a quick brown fox"));
+        assert_eq!(prefix.committed(), "the quick");
+        assert_eq!(prefix.tentative(), "brown fox");
+
+        assert!(prefix.update("a quick brown fox jumps"));
+        assert_eq!(prefix.committed(), "the quick brown fox");
+        assert_eq!(prefix.tentative(), "jumps");
+
+        assert!(!prefix.update(""));
+        assert_eq!(prefix.committed(), "the quick brown fox");
+        assert_eq!(prefix.tentative(), "");
+    }
+
+    #[test]
+    fn slide_commits_the_covered_words_and_keeps_the_rest() {
+        let mut prefix = StablePrefix::default();
+        prefix.update("one two three four");
+        prefix.update("one two three four five");
+        assert_eq!(prefix.committed(), "one two three four");
+
+        // The old window heard four words; "five" starts the new one
+        prefix.slide(4);
+        assert_eq!(prefix.committed(), "one two three four");
+        assert_eq!(prefix.tentative(), "five");
+        assert_eq!(prefix.previous_len(), 1);
+
+        assert!(prefix.update("five six"));
+        assert_eq!(prefix.committed(), "one two three four five");
+        assert_eq!(prefix.tentative(), "six");
+
+        // Unconfirmed words the old window covered are committed by the slide
+        prefix.update("five six seven eight");
+        prefix.slide(10);
+        assert_eq!(prefix.committed(), "one two three four five six seven eight");
+        assert_eq!(prefix.tentative(), "");
+        assert_eq!(prefix.previous_len(), 0);
+    }
+
+    #[test]
+    fn push_keeps_samples_whole_across_chunks() {
+        let mut session = session();
+        session.push(&[1, 2, 3]);
+        assert_eq!(session.len(), 2);
+        session.push(&[]);
+        session.push(&[4]);
+        assert_eq!(session.len(), 4);
+        session.push(&[5, 6, 7]);
+        assert_eq!(session.len(), 6);
+        assert_eq!(&session.finish()[..], &[1, 2, 3, 4, 5, 6]);
+    }
+
+    #[test]
+    fn partial_runs_wait_for_new_audio_and_the_previous_run() {
+        let mut session = session();
+        session.push(&seconds(&session, 0.5));
+        assert!(session.take_partial_run().is_none());
+        session.push(&seconds(&session, 0.5));
+        let run = session.take_partial_run().unwrap();
+        assert_eq!(run.end, 32000);
+        assert_eq!(run.window.len(), 32000);
+
+        session.push(&seconds(&session, 2.0));
+        assert!(session.take_partial_run().is_none(), "a run is in flight");
+        assert!(session.apply_partial(run.end, Some("hello")));
+        let run = session.take_partial_run().unwrap();
+        assert_eq!(run.window.len(), 96000);
+
+        // Results that land after the session finished are dropped
+        session.finish();
+        assert!(!session.apply_partial(run.end, Some("hello there")));
+        assert!(session.take_partial_run().is_none());
+    }
+
+    #[test]
+    fn window_slides_once_confirmed_and_long_enough() {
+        let mut session = session();
+        let mut text = String::new();
+        for second in 1..=6 {
+            assert_eq!(session.window_start, 0);
+            session.push(&seconds(&session, 1.0));
+            let run = session.take_partial_run().unwrap();
+            text.push_str(&format!("w{} ", second));
+            assert!(session.apply_partial(run.end, Some(&text)));
+        }
+        // The 6 s pass confirmed the 5 s one: the window restarts where that
+        // pass ended, and its words are committed
+        assert_eq!(session.window_start, session.bytes_for(5.0));
+        assert_eq!(session.committed(), "w1 w2 w3 w4 w5");
+        assert_eq!(session.tentative(), "w6");
+
+        session.push(&seconds(&session, 1.0));
+        let run = session.take_partial_run().unwrap();
+        assert_eq!(run.window.len(), session.bytes_for(2.0));
+        assert!(session.apply_partial(run.end, Some("w6 w7")));
+        assert_eq!(session.committed(), "w1 w2 w3 w4 w5 w6");
+        assert_eq!(session.tentative(), "w7");
+    }
+
+    #[test]
+    fn reopen_restores_the_audio_after_a_failed_finish() {
+        let mut session = session();
+        session.push(&[1, 2, 3, 4]);
+        let pcm = session.finish();
+        assert!(session.is_finished());
+        assert_eq!(session.len(), 0);
+        session.reopen(pcm);
+        assert!(!session.is_finished());
+        assert_eq!(&session.finish()[..], &[1, 2, 3, 4]);
+    }
+
+    #[test]
+    fn idle_sessions_stay_listed_until_removed() {
+        let sessions = StreamSessions::new();
+        let a = sessions.get_or_open("a", "d", 16000, 1);
+        let b = sessions.get_or_open("b", "d", 16000, 1);
+        assert!(Arc::ptr_eq(&a, &sessions.get_or_open("a", "other", 8000, 2)));
+        assert!(sessions.get("c").is_none());
+        assert!(sessions.idle().is_empty());
+
+        let long_ago = Instant::now() - SESSION_IDLE_TIMEOUT - Duration::from_secs(1);
+        a.lock().unwrap().last_activity = long_ago;
+        b.lock().unwrap().last_activity = long_ago;
+        b.lock().unwrap().finish();
+        let idle = sessions.idle();
+        assert_eq!(idle.len(), 1, "sessions already closing are skipped");
+        assert!(Arc::ptr_eq(&idle[0], &a));
+        assert_eq!(sessions.len(), 2);
+
+        sessions.remove("a");
+        assert!(sessions.get("a").is_none());
+        assert_eq!(sessions.len(), 1);
+    }
+}
@@ -0,0 +1,561 @@
+use crate::server::latency::now_ms;
+use crate::server::state::ServerState;
+use anyhow::Result;
+use std::collections::{BTreeMap, HashMap, VecDeque};
+use std::fs::{self, OpenOptions};
+use std::io::Write;
+use std::path::{Path, PathBuf};
+use std::sync::{Arc, Mutex};
+use std::thread;
+use std::time::Duration;
+
+/// Series kept per device: a recording's audio metrics, then the WiFi signal
+/// its status polls report. The position is the metric's id on disk.
+pub const METRICS: [&str; 7] = ["avg_db", "max_db", "min_db", "clip_count", "silence_chunks", "i2s_errors", "rssi"];
+pub const RSSI: usize = 6;
+
+/// (seconds per bucket, buckets kept), finest first: a minute for 3 hours,
+/// 15 minutes for a week, 4 hours for 90 days
+const TIERS: [(u32, u32); 3] = [(60, 180), (15 * 60, 672), (4 * 3600, 540)];
+/// How often closed buckets are appended to disk
+const FLUSH_INTERVAL: Duration = Duration::from_secs(60);
+/// Range of a query without `range`
+pub const DEFAULT_RANGE: Duration = Duration::from_secs(24 * 3600);
+/// id length, id, metric, period, count, sum, min, max
+const RECORD_FIXED_BYTES: usize = 1 + 1 + 4 + 4 + 4 + 4 + 4;
+
+#[derive(Clone, Copy)]
+struct Bucket {
+    /// Bucket start / tier resolution, in seconds since the epoch
+    period: u32,
+    count: u32,
+    sum: f32,
+    min: f32,
+    max: f32,
+    /// Changed since it was last written
+    dirty: bool,
+}
+
+impl Bucket {
+    fn empty(period: u32) -> Self {
+        Self { period, count: 0, sum: 0.0, min: f32::INFINITY, max: f32::NEG_INFINITY, dirty: false }
+    }
+
+    fn add(&mut self, value: f32) {
+        self.count += 1;
+        self.sum += value;
+        self.min = self.min.min(value);
+        self.max = self.max.max(value);
+        self.dirty = true;
+    }
+
+    fn merge(&mut self, other: &Bucket) {
+        self.count += other.count;
+        self.sum += other.sum;
+        self.min = self.min.min(other.min);
+        self.max = self.max.max(other.max);
+        self.dirty = true;
+    }
+}
+
+/// One tier of a series: fixed-interval buckets, oldest first. Only buckets
+/// with samples are kept, so a quiet device costs little.
+#[derive(Default)]
+struct Ring {
+    buckets: VecDeque<Bucket>,
+    /// Oldest bucket that may be dirty, so a flush skips the rest
+    oldest_dirty: Option<u32>,
+}
+
+impl Ring {
+    /// The bucket for `period`, created if missing; None if it is older than
+    /// the tier keeps
+    fn bucket(&mut self, period: u32, capacity: u32) -> Option<&mut Bucket> {
+        let newest = self.buckets.back().map_or(period, |b| b.period.max(period));
+        if period + capacity <= newest {
+            return None;
+        }
+        self.oldest_dirty = Some(self.oldest_dirty.map_or(period, |p| p.min(period)));
+        if newest == period && self.buckets.back().map_or(true, |b| b.period < period) {
+            while self.buckets.front().is_some_and(|b| b.period + capacity <= period) {
+                self.buckets.pop_front();
+            }
+            self.buckets.push_back(Bucket::empty(period));
+            return self.buckets.back_mut();
+        }
+        let i = match self.buckets.binary_search_by_key(&period, |b| b.period) {
+            Ok(i) => i,
+            Err(i) => {
+                // A late sample, e.g. from a recording that waited in the device's queue
+                self.buckets.insert(i, Bucket::empty(period));
+                i
+            }
+        };
+        self.buckets.get_mut(i)
+    }
+}
+
+#[derive(Default)]
+struct DeviceTelemetry {
+    /// Metric x tier
+    series: [[Ring; TIERS.len()]; METRICS.len()],
+}
+
+/// Per-device time series of device telemetry, for spotting a failing
+/// microphone or weak WiFi across the fleet.
+///
+/// Each sample lands in a bucket of every tier, so the coarse tiers need no
+/// rollup pass. Closed buckets are appended to `dir` once a minute, one
+/// file per tier and retention span (`60s-<n>.bin`); a file is deleted once
+/// everything in it has aged out. The newest buckets of the coarser tiers
+/// are rebuilt from the finer ones on startup, so a restart loses at most
+/// the last couple of minutes.
+pub struct TelemetryStore {
+    dir: PathBuf,
+    devices: Mutex<HashMap<Arc<str>, DeviceTelemetry>>,
+}
+
+impl TelemetryStore {
+    pub fn open(dir: &Path) -> Result<Self> {
+        fs::create_dir_all(dir)?;
+        let now = now_secs();
+        let mut devices: HashMap<Arc<str>, DeviceTelemetry> = HashMap::new();
+        let mut loaded = 0;
+        for (tier, &(resolution, capacity)) in TIERS.iter().enumerate() {
+            let current = period_of(now, resolution) / capacity;
+            for chunk in current.saturating_sub(1)..=current {
+                let path = chunk_path(dir, tier, chunk);
+                let Ok(bytes) = fs::read(&path) else {
+                    continue;
+                };
+                let complete = decode(&bytes, |device_id, metric, bucket| {
+                    if !devices.contains_key(device_id) {
+                        devices.insert(Arc::from(device_id), DeviceTelemetry::default());
+                    }
+                    let ring = &mut devices.get_mut(device_id).unwrap().series[metric][tier];
+                    if let Some(slot) = ring.bucket(bucket.period, capacity) {
+                        *slot = bucket;
+                    }
+                    ring.oldest_dirty = None;
+                    loaded += 1;
+                });
+                if complete < bytes.len() {
+                    // Torn by a crash mid-append
+                    OpenOptions::new().write(true).open(&path)?.set_len(complete as u64)?;
+                }
+            }
+        }
+
+        // Coarse buckets are only written once closed: rebuild the ones
+        // after the newest on disk from the tier below
+        for device in devices.values_mut() {
+            for series in device.series.iter_mut() {
+                for tier in 1..TIERS.len() {
+                    let (resolution, capacity) = TIERS[tier];
+                    let ratio = resolution / TIERS[tier - 1].0;
+                    let (finer, coarser) = series.split_at_mut(tier);
+                    let ring = &mut coarser[0];
+                    let newest = ring.buckets.back().map(|b| b.period);
+                    for bucket in &finer[tier - 1].buckets {
+                        let period = bucket.period / ratio;
+                        if newest.map_or(true, |newest| period > newest) {
+                            if let Some(slot) = ring.bucket(period, capacity) {
+                                slot.merge(bucket);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        if loaded > 0 {
+            println!("📈 Loaded {} telemetry buckets for {} device(s)", loaded, devices.len());
+        }
+        Ok(Self { dir: dir.to_path_buf(), devices: Mutex::new(devices) })
+    }
+
+    /// Add `(metric, value)` samples taken at `time` (epoch seconds)
+    pub fn record(&self, device_id: &str, time: u64, samples: &[(usize, f32)]) {
+        if samples.is_empty() {
+            return;
+        }
+        let mut devices = self.devices.lock().unwrap();
+        if !devices.contains_key(device_id) {
+            devices.insert(Arc::from(device_id), DeviceTelemetry::default());
+        }
+        let device = devices.get_mut(device_id).unwrap();
+        for &(metric, value) in samples {
+            if !value.is_finite() {
+                continue;
+            }
+            for (ring, &(resolution, capacity)) in device.series[metric].iter_mut().zip(&TIERS) {
+                if let Some(bucket) = ring.bucket(period_of(time, resolution), capacity) {
+                    bucket.add(value);
+                }
+            }
+        }
+    }
+
+    /// Every metric over the last `range`, from the finest tier that keeps
+    /// that long. Each point is `[time ms, count, mean, min, max]`. None for
+    /// a device that never reported any.
+    pub fn query(&self, device_id: &str, range: Duration) -> Option<serde_json::Value> {
+        let tier = TIERS
+            .iter()
+            .position(|&(resolution, capacity)| range.as_secs() <= resolution as u64 * capacity as u64)
+            .unwrap_or(TIERS.len() - 1);
+        let (resolution, capacity) = TIERS[tier];
+        let range = range.min(Duration::from_secs(resolution as u64 * capacity as u64));
+        let now = now_secs();
+        let first = period_of(now.saturating_sub(range.as_secs()), resolution);
+
+        let devices = self.devices.lock().unwrap();
+        let device = devices.get(device_id)?;
+        let metrics: serde_json::Map<String, serde_json::Value> = METRICS
+            .iter()
+            .zip(&device.series)
+            .map(|(&name, series)| {
+                let buckets = &series[tier].buckets;
+                let start = buckets.partition_point(|b| b.period < first);
+                let points: Vec<serde_json::Value> = buckets
+                    .range(start..)
+                    .filter(|b| b.count > 0)
+                    .map(|b| {
+                        serde_json::json!([
+                            b.period as u64 * resolution as u64 * 1000,
+                            b.count,
+                            round(b.sum / b.count as f32),
+                            round(b.min),
+                            round(b.max),
+                        ])
+                    })
+                    .collect();
+                (name.to_string(), points.into())
+            })
+            .collect();
+        Some(serde_json::json!({
+            "device_id": device_id,
+            "range_seconds": range.as_secs(),
+            "resolution_seconds": resolution,
+            "columns": ["time", "count", "mean", "min", "max"],
+            "metrics": metrics,
+        }))
+    }
+
+    /// Append the closed buckets changed since the last flush, and delete
+    /// files that have aged out
+    fn flush(&self) -> std::io::Result<()> {
+        let now = now_secs();
+        // (tier, file chunk) -> records
+        let mut pending: BTreeMap<(usize, u32), Vec<u8>> = BTreeMap::new();
+        {
+            let mut devices = self.devices.lock().unwrap();
+            for (device_id, device) in devices.iter_mut() {
+                // Longer ids are kept in memory only
+                let Ok(id_len) = u8::try_from(device_id.len()) else {
+                    continue;
+                };
+                for (metric, series) in device.series.iter_mut().enumerate() {
+                    for (tier, ring) in series.iter_mut().enumerate() {
+                        let Some(oldest_dirty) = ring.oldest_dirty else {
+                            continue;
+                        };
+                        let (resolution, capacity) = TIERS[tier];
+                        let open = period_of(now, resolution);
+                        let start = ring.buckets.partition_point(|b| b.period < oldest_dirty);
+                        ring.oldest_dirty = None;
+                        for bucket in ring.buckets.range_mut(start..).filter(|b| b.dirty) {
+                            if bucket.period >= open {
+                                ring.oldest_dirty.get_or_insert(bucket.period);
+                                continue;
+                            }
+                            let out = pending.entry((tier, bucket.period / capacity)).or_default();
+                            out.push(id_len);
+                            out.extend_from_slice(device_id.as_bytes());
+                            out.push(metric as u8);
+                            out.extend_from_slice(&bucket.period.to_le_bytes());
+                            out.extend_from_slice(&bucket.count.to_le_bytes());
+                            out.extend_from_slice(&bucket.sum.to_le_bytes());
+                            out.extend_from_slice(&bucket.min.to_le_bytes());
+                            out.extend_from_slice(&bucket.max.to_le_bytes());
+                            bucket.dirty = false;
+                        }
+                    }
+                }
+            }
+        }
+
+        for ((tier, chunk), records) in pending {
+            let mut file = OpenOptions::new().create(true).append(true).open(chunk_path(&self.dir, tier, chunk))?;
+            file.write_all(&records)?;
+        }
+        for entry in fs::read_dir(&self.dir)?.flatten() {
+            let name = entry.file_name();
+            let Some((resolution, chunk)) = name.to_str().and_then(parse_chunk_name) else {
+                continue;
+            };
+            if let Some(&(_, capacity)) = TIERS.iter().find(|&&(r, _)| r == resolution) {
+                if chunk + 1 < period_of(now, resolution) / capacity {
+                    fs::remove_file(entry.path())?;
+                }
+            }
+        }
+        Ok(())
+    }
+}
+
+/// Write closed buckets to disk once a minute, on a thread of its own
+pub fn spawn_telemetry_flusher(state: Arc<ServerState>) {
+    thread::Builder::new()
+        .name("telemetry-flush".to_string())
+        .spawn(move || loop {
+            thread::sleep(FLUSH_INTERVAL);
+            if let Err(e) = state.telemetry.flush() {
+                eprintln!("⚠️  Can't write telemetry: {}", e);
+            }
+        })
+        .expect("failed to spawn telemetry thread");
+}
+
+/// A recording's audio metrics, from its `audio_quality` (keys without
+/// underscores, as the x-audio-* headers give them)
+pub fn recording_samples(audio_quality: &serde_json::Value) -> Vec<(usize, f32)> {
+    METRICS[..RSSI]
+        .iter()
+        .enumerate()
+        .filter_map(|(metric, name)| {
+            let value = audio_quality.get(name.replace('_', ""))?.as_f64()?;
+            Some((metric, value as f32))
+        })
+        .collect()
+}
+
+/// `90s`, `30m`, `6h`, `7d`, or plain seconds
+pub fn parse_range(value: &str) -> Option<Duration> {
+    let (number, unit) = match value.char_indices().last()? {
+        (i, c) if c.is_ascii_alphabetic() => (&value[..i], c),
+        _ => (value, 's'),
+    };
+    let seconds = match unit {
+        's' => 1,
+        'm' => 60,
+        'h' => 3600,
+        'd' => 86400,
+        _ => return None,
+    };
+    let number: u64 = number.parse().ok().filter(|&n| n > 0)?;
+    Some(Duration::from_secs(number.checked_mul(seconds)?))
+}
+
+/// Calls `f` for each complete record; returns the bytes they span
+fn decode(bytes: &[u8], mut f: impl FnMut(&str, usize, Bucket)) -> usize {
+    let mut pos = 0;
+    while let Some(&id_len) = bytes.get(pos) {
+        let end = pos + RECORD_FIXED_BYTES + id_len as usize;
+        if end > bytes.len() {
+            break;
+        }
+        let id = &bytes[pos + 1..pos + 1 + id_len as usize];
+        let fields = &bytes[pos + 1 + id_len as usize..end];
+        let word = |i: usize| <[u8; 4]>::try_from(&fields[1 + 4 * i..5 + 4 * i]).unwrap();
+        let metric = fields[0] as usize;
+        if let (Ok(id), true) = (std::str::from_utf8(id), metric < METRICS.len()) {
+            f(
+                id,
+                metric,
+                Bucket {
+                    period: u32::from_le_bytes(word(0)),
+                    count: u32::from_le_bytes(word(1)),
+                    sum: f32::from_le_bytes(word(2)),
+                    min: f32::from_le_bytes(word(3)),
+                    max: f32::from_le_bytes(word(4)),
+                    dirty: false,
+                },
+            );
+        }
+        pos = end;
+    }
+    pos
+}
+
+fn chunk_path(dir: &Path, tier: usize, chunk: u32) -> PathBuf {
+    dir.join(format!("{}s-{}.bin", TIERS[tier].0, chunk))
+}
+
+/// (resolution, chunk) from a `chunk_path` file name
+fn parse_chunk_name(name: &str) -> Option<(u32, u32)> {
+    let (resolution, chunk) = name.strip_suffix(".bin")?.split_once("s-")?;
+    Some((resolution.parse().ok()?, chunk.parse().ok()?))
+}
+
+fn period_of(time: u64, resolution: u32) -> u32 {
+    (time / resolution as u64) as u32
+}
+
+fn now_secs() -> u64 {
+    (now_ms() / 1000.0) as u64
+}
+
+fn round(value: f32) -> f64 {
+    (value as f64 * 100.0).round() / 100.0
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn scratch(name: &str) -> PathBuf {
+        let dir = std::env::temp_dir().join(format!("memo-telemetry-test-{}-{}", std::process::id(), name));
+        fs::remove_dir_all(&dir).ok();
+        dir
+    }
+
+    fn periods(ring: &Ring) -> Vec<u32> {
+        ring.buckets.iter().map(|b| b.period).collect()
+    }
+
+    #[test]
+    fn ring_keeps_buckets_in_order_within_its_capacity() {
+        let mut ring = Ring::default();
+        for period in [100, 101, 105] {
+            ring.bucket(period, 10).unwrap().add(1.0);
+        }
+        // A late sample lands in its own slot, in order
+        ring.bucket(103, 10).unwrap().add(2.0);
+        ring.bucket(101, 10).unwrap().add(3.0);
+        assert_eq!(periods(&ring), [100, 101, 103, 105]);
+        assert_eq!(ring.buckets[1].count, 2);
+        assert_eq!((ring.buckets[1].min, ring.buckets[1].max, ring.buckets[1].sum), (1.0, 3.0, 4.0));
+        assert_eq!(ring.oldest_dirty, Some(100));
+
+        // Too old for the tier: dropped
+        assert!(ring.bucket(95, 10).is_none());
+        // Moving on retires what falls out of the window
+        ring.bucket(111, 10).unwrap().add(1.0);
+        assert_eq!(periods(&ring), [103, 105, 111]);
+        assert!(ring.bucket(101, 10).is_none());
+    }
+
+    #[test]
+    fn samples_are_summarized_per_bucket() {
+        let dir = scratch("summary");
+        let store = TelemetryStore::open(&dir).unwrap();
+        let now = now_secs();
+        let minute = now - now % 60 - 120;
+        store.record("mic", minute + 1, &[(0, -30.0), (RSSI, -60.0)]);
+        store.record("mic", minute + 20, &[(0, -20.0), (0, f32::NAN)]);
+        store.record("mic", minute + 59, &[(0, -40.0)]);
+        store.record("mic", minute + 60, &[]);
+        assert!(store.query("other", DEFAULT_RANGE).is_none());
+
+        let result = store.query("mic", Duration::from_secs(3600)).unwrap();
+        assert_eq!(result["resolution_seconds"], 60);
+        assert_eq!(
+            result["metrics"]["avg_db"],
+            serde_json::json!([[minute * 1000, 3, -30.0, -40.0, -20.0]])
+        );
+        assert_eq!(result["metrics"]["rssi"][0][1], 1);
+        assert_eq!(result["metrics"]["max_db"], serde_json::json!([]));
+
+        // Coarser tiers for longer ranges, capped at what is kept
+        assert_eq!(store.query("mic", Duration::from_secs(2 * 86400)).unwrap()["resolution_seconds"], 900);
+        assert_eq!(store.query("mic", Duration::from_secs(30 * 86400)).unwrap()["resolution_seconds"], 14400);
+        let longest = store.query("mic", Duration::from_secs(400 * 86400)).unwrap();
+        assert_eq!(longest["range_seconds"], 90 * 86400);
+        assert_eq!(longest["metrics"]["avg_db"][0][1], 3);
+        fs::remove_dir_all(&dir).ok();
+    }
+
+    #[test]
+    fn flushed_buckets_survive_a_restart() {
+        let dir = scratch("reload");
+        let store = TelemetryStore::open(&dir).unwrap();
+        let now = now_secs();
+        // Two hours of closed minutes (the open one is only written once closed)
+        for minutes_ago in 2..120u64 {
+            let time = now - now % 60 - minutes_ago * 60;
+            store.record("mic", time, &[(0, -(minutes_ago as f32)), (RSSI, -50.0 - (minutes_ago % 7) as f32)]);
+            store.record("wifi-only", time, &[(RSSI, -70.0)]);
+        }
+        let ranges = [3600, 2 * 86400, 30 * 86400].map(Duration::from_secs);
+        let before: Vec<_> = ranges.iter().map(|&range| store.query("mic", range).unwrap()).collect();
+        store.flush().unwrap();
+        drop(store);
+
+        // Coarse buckets still open were never written; they are rebuilt
+        // from the minute tier
+        let store = TelemetryStore::open(&dir).unwrap();
+        for (range, before) in ranges.iter().zip(&before) {
+            assert_eq!(&store.query("mic", *range).unwrap(), before, "range {:?}", range);
+        }
+        assert!(store.query("wifi-only", ranges[0]).is_some());
+        fs::remove_dir_all(&dir).ok();
+    }
+
+    #[test]
+    fn a_torn_append_is_cut_off_on_open() {
+        let dir = scratch("torn");
+        let store = TelemetryStore::open(&dir).unwrap();
+        let now = now_secs();
+        let time = now - now % 60 - 180;
+        store.record("mic", time, &[(0, -30.0)]);
+        store.flush().unwrap();
+        // Written buckets aren't dirty any more: nothing is appended twice
+        let path = chunk_path(&dir, 0, period_of(time, 60) / TIERS[0].1);
+        let written = fs::metadata(&path).unwrap().len();
+        store.flush().unwrap();
+        assert_eq!(fs::metadata(&path).unwrap().len(), written);
+        drop(store);
+
+        let complete = fs::metadata(&path).unwrap().len();
+        OpenOptions::new().append(true).open(&path).unwrap().write_all(&[3, b'm', b'i']).unwrap();
+
+        let store = TelemetryStore::open(&dir).unwrap();
+        assert_eq!(fs::metadata(&path).unwrap().len(), complete);
+        let result = store.query("mic", Duration::from_secs(3600)).unwrap();
+        assert_eq!(result["metrics"]["avg_db"][0][2], -30.0);
+        fs::remove_dir_all(&dir).ok();
+    }
+
+    #[test]
+    fn decode_skips_records_it_cannot_use() {
+        let record = |id: &[u8], metric: u8| {
+            let mut out = vec![id.len() as u8];
+            out.extend_from_slice(id);
+            out.push(metric);
+            for word in [7u32, 1, 0, 0, 0] {
+                out.extend_from_slice(&word.to_le_bytes());
+            }
+            out
+        };
+        let mut bytes = record(b"a", 0);
+        bytes.extend(record(b"b", METRICS.len() as u8)); // Unknown metric
+        bytes.extend(record(&[0xFF], 1)); // Not UTF-8
+        bytes.extend(record(b"c", 2));
+        let complete = bytes.len();
+        bytes.extend(&record(b"d", 0)[..10]);
+
+        let mut seen = Vec::new();
+        assert_eq!(decode(&bytes, |id, metric, bucket| seen.push((id.to_string(), metric, bucket.period))), complete);
+        assert_eq!(seen, [("a".to_string(), 0, 7), ("c".to_string(), 2, 7)]);
+    }
+
+    #[test]
+    fn parse_range_takes_a_unit_suffix() {
+        assert_eq!(parse_range("90s"), Some(Duration::from_secs(90)));
+        assert_eq!(parse_range("30m"), Some(Duration::from_secs(1800)));
+        assert_eq!(parse_range("6h"), Some(Duration::from_secs(21600)));
+        assert_eq!(parse_range("7d"), Some(Duration::from_secs(604800)));
+        assert_eq!(parse_range("120"), Some(Duration::from_secs(120)));
+        for bad in ["", "d", "0h", "-5m", "5w", "1.5h", "99999999999999999d"] {
+            assert_eq!(parse_range(bad), None, "{:?}", bad);
+        }
+    }
+
+    #[test]
+    fn recording_samples_read_the_upload_headers() {
+        let quality = serde_json::json!({"avgdb": -31.5, "clipcount": 2, "i2serrors": "n/a"});
+        assert_eq!(recording_samples(&quality), [(0, -31.5), (3, 2.0)]);
+        assert_eq!(parse_chunk_name("900s-12.bin"), Some((900, 12)));
+        assert_eq!(parse_chunk_name("900s-12.tmp"), None);
+    }
+}
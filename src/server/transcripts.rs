@@ -0,0 +1,327 @@
+use crate::server::search::{record_text, snippet, SearchIndex, SearchQuery};
+use chrono::{DateTime, Utc};
+use std::collections::HashMap;
+use std::fs::{self, File, OpenOptions};
+use std::io::{BufRead, BufReader, Write};
+use std::path::{Path, PathBuf};
+use std::sync::{Arc, Mutex, RwLock};
+use std::time::Duration;
+
+const LOG_FILE: &str = "transcripts.jsonl";
+
+/// Append-only transcript log (`transcripts/transcripts.jsonl`, one JSON
+/// record per line) plus an in-memory index in arrival order.
+///
+/// Every record gets a `seq` (its position in the log) which doubles as the
+/// pagination cursor, so a page is a binary search plus `limit` lookups no
+/// matter how large the archive is. Text is indexed for `/search` as
+/// records are appended.
+pub struct TranscriptStore {
+    log: Mutex<File>,
+    index: RwLock<TranscriptIndex>,
+}
+
+#[derive(Default)]
+struct TranscriptIndex {
+    /// Serialized records, position == seq
+    records: Vec<Arc<str>>,
+    /// Seqs per device, ascending
+    by_device: HashMap<String, Vec<u64>>,
+    /// Device -> `audio_sha256` -> seq and time of its latest transcript
+    by_audio_hash: HashMap<String, HashMap<String, (u64, Option<DateTime<Utc>>)>>,
+    search: SearchIndex,
+}
+
+impl TranscriptIndex {
+    fn push(&mut self, record: &serde_json::Value, line: Arc<str>) -> u64 {
+        let seq = self.records.len() as u64;
+        self.records.push(line);
+        let device_id = record.get("device_id").and_then(|d| d.as_str()).unwrap_or("");
+        self.by_device.entry(device_id.to_string()).or_default().push(seq);
+        if let Some(hash) = record.get("audio_sha256").and_then(|h| h.as_str()) {
+            let timestamp = record
+                .get("timestamp")
+                .and_then(|t| t.as_str())
+                .and_then(|t| DateTime::parse_from_rfc3339(t).ok())
+                .map(|t| t.with_timezone(&Utc));
+            self.by_audio_hash
+                .entry(device_id.to_string())
+                .or_default()
+                .insert(hash.to_string(), (seq, timestamp));
+        }
+        self.search.add(seq, record);
+        seq
+    }
+
+    fn find_by_audio_hash(&self, device_id: &str, hash: &str, max_age: Duration) -> Option<Arc<str>> {
+        let (seq, timestamp) = *self.by_audio_hash.get(device_id)?.get(hash)?;
+        let age = timestamp.map_or(Duration::MAX, |t| (Utc::now() - t).to_std().unwrap_or_default());
+        if age > max_age {
+            return None;
+        }
+        self.records.get(seq as usize).cloned()
+    }
+}
+
+pub struct TranscriptPage {
+    /// Newest first
+    pub records: Vec<Arc<str>>,
+    /// Cursor for the next (older) page, if there is one
+    pub next_before: Option<u64>,
+}
+
+impl TranscriptPage {
+    /// The page as a JSON array, without re-parsing the stored records
+    pub fn to_json_array(&self) -> String {
+        let len: usize = self.records.iter().map(|r| r.len() + 1).sum();
+        let mut body = String::with_capacity(len + 2);
+        body.push('[');
+        for (i, record) in self.records.iter().enumerate() {
+            if i > 0 {
+                body.push(',');
+            }
+            body.push_str(record);
+        }
+        body.push(']');
+        body
+    }
+}
+
+impl TranscriptStore {
+    /// Open (or create) the log under `dir` and rebuild the index from it.
+    /// The first time, transcripts saved as individual JSON files by older
+    /// versions are imported in timestamp order.
+    pub fn open(dir: &Path) -> anyhow::Result<Self> {
+        fs::create_dir_all(dir)?;
+        let log_path = dir.join(LOG_FILE);
+        let mut index = TranscriptIndex::default();
+
+        let mut valid_len = 0u64;
+        if log_path.exists() {
+            let mut reader = BufReader::new(File::open(&log_path)?);
+            let mut line = String::new();
+            while reader.read_line(&mut line)? > 0 {
+                // A torn final line (crash mid-append) has no newline; it is cut off below
+                if !line.ends_with('\n') {
+                    break;
+                }
+                valid_len += line.len() as u64;
+                let record_line = line.trim_end();
+                if let Ok(record) = serde_json::from_str::<serde_json::Value>(record_line) {
+                    index.push(&record, Arc::from(record_line));
+                }
+                line.clear();
+            }
+        }
+
+        let mut log = OpenOptions::new().create(true).append(true).open(&log_path)?;
+        if log.metadata()?.len() > valid_len {
+            log.set_len(valid_len)?;
+        }
+
+        if index.records.is_empty() {
+            for mut record in load_legacy_transcripts(dir) {
+                record["seq"] = serde_json::json!(index.records.len());
+                let line = serde_json::to_string(&record)?;
+                writeln!(log, "{}", line)?;
+                index.push(&record, Arc::from(line));
+            }
+            if !index.records.is_empty() {
+                println!("📚 Imported {} transcript(s) into {}", index.records.len(), log_path.display());
+            }
+        }
+
+        println!("📚 Transcript index: {} record(s)", index.records.len());
+        Ok(Self {
+            log: Mutex::new(log),
+            index: RwLock::new(index),
+        })
+    }
+
+    /// Append a record to the log and index; returns it with its `seq` set
+    pub fn append(&self, mut record: serde_json::Value) -> std::io::Result<serde_json::Value> {
+        // Log lock first so seq order matches log order
+        let mut log = self.log.lock().unwrap();
+        let seq = self.index.read().unwrap().records.len();
+        record["seq"] = serde_json::json!(seq);
+        let line = serde_json::to_string(&record)?;
+        let valid_len = log.metadata()?.len();
+        if let Err(e) = log.write_all(format!("{}\n", line).as_bytes()) {
+            // Cut off a partial line, or the next append would join onto it
+            let _ = log.set_len(valid_len);
+            return Err(e);
+        }
+        self.index.write().unwrap().push(&record, Arc::from(line));
+
+        Ok(record)
+    }
+
+    /// The device's newest transcript of audio with this `audio_sha256`, if
+    /// it is at most `max_age` old
+    pub fn find_by_audio_hash(&self, device_id: &str, hash: &str, max_age: Duration) -> Option<Arc<str>> {
+        self.index.read().unwrap().find_by_audio_hash(device_id, hash, max_age)
+    }
+
+    /// A page of ranked search results, each with a highlighted snippet
+    pub fn search(&self, query: &SearchQuery) -> serde_json::Value {
+        let (total, hits) = {
+            let index = self.index.read().unwrap();
+            let found = index.search.search(query);
+            let hits: Vec<(u64, f32, Arc<str>)> = found
+                .hits
+                .into_iter()
+                .map(|(seq, score)| (seq, score, index.records[seq as usize].clone()))
+                .collect();
+            (found.total, hits)
+        };
+        let results: Vec<serde_json::Value> = hits
+            .into_iter()
+            .map(|(seq, score, line)| {
+                let record: serde_json::Value = serde_json::from_str(&line).unwrap_or_default();
+                serde_json::json!({
+                    "seq": seq,
+                    "score": (score as f64 * 1000.0).round() / 1000.0,
+                    "snippet": snippet(record_text(&record), &query.terms),
+                    "transcript": record,
+                })
+            })
+            .collect();
+        serde_json::json!({
+            "total": total,
+            "offset": query.offset,
+            "limit": query.limit,
+            "results": results,
+        })
+    }
+
+    /// Records in total and per device
+    pub fn counts(&self) -> serde_json::Value {
+        let index = self.index.read().unwrap();
+        let devices: serde_json::Map<String, serde_json::Value> = index
+            .by_device
+            .iter()
+            .map(|(device, seqs)| (device.clone(), seqs.len().into()))
+            .collect();
+        serde_json::json!({ "total": index.records.len(), "devices": devices })
+    }
+
+    /// Up to `limit` records older than `before` (all if None), newest first
+    pub fn page(&self, before: Option<u64>, limit: usize, device: Option<&str>) -> TranscriptPage {
+        let index = self.index.read().unwrap();
+        let before = before.unwrap_or(u64::MAX);
+
+        let seqs: Vec<u64> = match device {
+            Some(device) => {
+                let Some(device_seqs) = index.by_device.get(device) else {
+                    return TranscriptPage { records: Vec::new(), next_before: None };
+                };
+                let end = device_seqs.partition_point(|&seq| seq < before);
+                device_seqs[end.saturating_sub(limit)..end].iter().rev().copied().collect()
+            }
+            None => {
+                let end = before.min(index.records.len() as u64);
+                (end.saturating_sub(limit as u64)..end).rev().collect()
+            }
+        };
+
+        // More below this page?
+        let next_before = seqs.last().copied().filter(|&oldest| match device {
+            Some(device) => index.by_device[device].first().is_some_and(|&first| first < oldest),
+            None => oldest > 0,
+        });
+
+        TranscriptPage {
+            records: seqs.iter().map(|&seq| index.records[seq as usize].clone()).collect(),
+            next_before,
+        }
+    }
+}
+
+/// Per-recording JSON files written before the log existed, oldest first,
+/// with timestamps normalized to RFC 3339
+fn load_legacy_transcripts(dir: &Path) -> Vec<serde_json::Value> {
+    let mut transcripts = Vec::new();
+    let Ok(entries) = fs::read_dir(dir) else {
+        return transcripts;
+    };
+
+    for entry in entries.flatten() {
+        let path: PathBuf = entry.path();
+        if path.extension().and_then(|s| s.to_str()) != Some("json") {
+            continue;
+        }
+        let Ok(content) = fs::read_to_string(&path) else {
+            continue;
+        };
+        let Ok(mut data) = serde_json::from_str::<serde_json::Value>(&content) else {
+            continue;
+        };
+
+        // Old format: "20260119_172003" - convert to ISO for the UI
+        if let Some(ts_str) = data.get("timestamp").and_then(|t| t.as_str()).map(str::to_string) {
+            if !ts_str.contains('T') && ts_str.len() >= 15 && ts_str.contains('_') {
+                if let Ok(dt) = chrono::NaiveDateTime::parse_from_str(&ts_str[..15], "%Y%m%d_%H%M%S") {
+                    data["timestamp"] = serde_json::json!(dt.and_utc().to_rfc3339());
+                }
+            }
+        }
+
+        // Ensure transcript field exists (UI expects it)
+        if data.get("transcript").is_none() {
+            if let Some(text) = data.get("text") {
+                data["transcript"] = text.clone();
+            }
+        }
+        transcripts.push(data);
+    }
+
+    transcripts.sort_by(|a, b| {
+        let ts_a = a.get("timestamp").and_then(|t| t.as_str()).unwrap_or("");
+        let ts_b = b.get("timestamp").and_then(|t| t.as_str()).unwrap_or("");
+        ts_a.cmp(ts_b)
+    });
+    transcripts
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn push(index: &mut TranscriptIndex, device_id: &str, hash: &str, age: chrono::Duration) -> u64 {
+        let record = serde_json::json!({
+            "device_id": device_id,
+            "timestamp": (Utc::now() - age).to_rfc3339(),
+            "transcript": "hello",
+            "audio_sha256": hash,
+        });
+        index.push(&record, Arc::from(record.to_string()))
+    }
+
+    #[test]
+    fn audio_hash_matches_only_the_same_device_within_the_window() {
+        let window = Duration::from_secs(600);
+        let mut index = TranscriptIndex::default();
+        push(&mut index, "a", "h1", chrono::Duration::seconds(5));
+        push(&mut index, "a", "h2", chrono::Duration::minutes(30));
+
+        assert!(index.find_by_audio_hash("a", "h1", window).is_some());
+        assert!(index.find_by_audio_hash("b", "h1", window).is_none());
+        assert!(index.find_by_audio_hash("a", "h3", window).is_none());
+        assert!(index.find_by_audio_hash("a", "h2", window).is_none());
+        assert!(index.find_by_audio_hash("a", "h2", Duration::MAX).is_some());
+
+        // The newest transcript of the audio wins
+        let seq = push(&mut index, "a", "h2", chrono::Duration::zero());
+        let record = index.find_by_audio_hash("a", "h2", window).unwrap();
+        assert!(Arc::ptr_eq(&record, &index.records[seq as usize]));
+    }
+
+    #[test]
+    fn records_without_a_timestamp_only_match_without_a_window() {
+        let mut index = TranscriptIndex::default();
+        let record = serde_json::json!({"device_id": "a", "audio_sha256": "h"});
+        index.push(&record, Arc::from(record.to_string()));
+        assert!(index.find_by_audio_hash("a", "h", Duration::from_secs(600)).is_none());
+        assert!(index.find_by_audio_hash("a", "h", Duration::MAX).is_some());
+    }
+}
@@ -7,16 +7,29 @@ Keyboard controls: SPACE = START/STOP recording, Q = Quit
 
 from http.server import HTTPServer, BaseHTTPRequestHandler
 from socketserver import ThreadingMixIn
-from urllib.parse import urlparse, parse_qs
+from urllib.parse import urlparse, parse_qs, unquote
 import datetime
+import email.utils
+import html
+import io
+import re
 import wave
 import os
 import subprocess
 import json
 from pathlib import Path
 import threading
+import array
+import bisect
+import collections
+import heapq
+import hashlib
+import math
+import struct
 import sys
 import select
+import shutil
+import time
 
 # Configuration
 # For better transcription quality, use medium.en or large-v3 models
@@ -37,25 +50,87 @@ recording_state = {}
 recording_lock = threading.Lock()
 
 # SSE clients
-sse_clients = []
+# Format: {wfile: set of device ids, or None for all devices}
+sse_clients = {}
 sse_lock = threading.Lock()
+# Recent events for clients resuming with Last-Event-ID: (id, device_id, message)
+SSE_REPLAY_EVENTS = 1024
+sse_replay = collections.deque(maxlen=SSE_REPLAY_EVENTS)
+# Ids start at the startup time in microseconds, so they keep increasing
+# across restarts and an id from a previous run reads as too old to resume
+sse_next_id = int(time.time() * 1_000_000)
 
 # Device tracking - tracks last seen time for each device
 # Format: {'device_id': {'last_seen': timestamp, 'ip': ip_address}}
 active_devices = {}
 devices_lock = threading.Lock()
 DEVICE_TIMEOUT_SECONDS = 10  # Consider device offline after 10 seconds of no status checks
+PRESENCE_CHECK_SECONDS = 2  # How often devices past the timeout are announced offline
+
+# Recently ingested recording ids (X-Recording-Id) - devices retry queued
+# uploads, so a retry of an upload that already landed is acknowledged and dropped
+recent_recording_ids = collections.OrderedDict()
+recent_recording_ids_lock = threading.Lock()
+RECENT_RECORDING_IDS_MAX = 1024
+
+# Content hashes of recently received audio, per device - a retry whose first
+# attempt actually landed carries the same bytes, even in a batch or under a
+# new id. Recording ids catch most retries; this is the fallback, so it only
+# matches the same device within a short window (identical audio from
+# different devices, or much later, is a new recording).
+recent_audio_hashes = collections.OrderedDict()
+recent_audio_hashes_lock = threading.Lock()
+RECENT_AUDIO_HASHES_MAX = 1024
+DUPLICATE_AUDIO_WINDOW_SECONDS = 600
 
 # Global Whisper model instances (singleton pattern)
 whisper_model_faster = None
 whisper_model_openai = None
 whisper_model_lock = threading.Lock()
 
-# Transcription queue to prevent concurrent transcriptions
-transcription_queue = []
-transcription_queue_lock = threading.Lock()
+# Transcription queue to prevent concurrent transcriptions (created in main())
+TRANSCRIPTION_QUEUE_MAX = int(os.environ.get('MEMO_INFERENCE_QUEUE', 64))
+transcription_scheduler = None
 transcription_worker_running = False
 
+# Write-ahead journal of queued transcriptions, opened in main()
+ingest_journal = None
+
+# Per-stage latency of recent recordings, for /latency (created in main())
+latency_log = None
+
+# Counters and histograms for /metrics (created in main())
+server_metrics = None
+
+# Transcripts in time order, with an inverted index over their text for
+# /search (built in main())
+transcript_index = None
+SEARCH_DEFAULT_LIMIT = 20
+SEARCH_MAX_LIMIT = 100
+TRANSCRIPTS_DEFAULT_LIMIT = 200
+TRANSCRIPTS_MAX_LIMIT = 1000
+
+# Opus copies of recordings for the UI, made on first request (created in main())
+TRANSCODE_CACHE_DIR = "audio_cache"
+TRANSCODE_CACHE_MAX_BYTES = int(os.environ.get('MEMO_TRANSCODE_CACHE_MB', 512)) * 1024 * 1024
+FFMPEG = os.environ.get('MEMO_FFMPEG', 'ffmpeg')
+FILE_CHUNK_BYTES = 64 * 1024
+transcode_cache = None
+
+# Recordings older than this are recompressed to FLAC while transcription is
+# idle (MEMO_ARCHIVE=0 keeps every WAV)
+ARCHIVE_ENABLED = os.environ.get('MEMO_ARCHIVE') != '0'
+ARCHIVE_AFTER_SECONDS = int(os.environ.get('MEMO_ARCHIVE_AFTER_HOURS', 24)) * 3600
+ARCHIVE_SCAN_SECONDS = 600
+ARCHIVE_DUTY_CYCLE = 0.25  # Share of one core the archiver uses while it runs
+audio_archiver = None
+transcription_in_progress = False
+
+# Per-device audio metrics and WiFi signal over time, for
+# /devices/<id>/metrics (opened in main())
+TELEMETRY_DIR = "telemetry"
+telemetry_store = None
+
 
 def detect_whisper_method():
     """Auto-detect available Whisper implementation"""
@@ -217,32 +292,65 @@ class TranscriptionServer(BaseHTTPRequestHandler):
 
 
     def do_GET(self):
-        if self.path == '/' or self.path == '/index.html':
-            self.serve_static('static/index.html', 'text/html')
-        elif self.path.startswith('/status'):
-            self.handle_status()
-        elif self.path.startswith('/devices'):
-            self.handle_get_devices()
-        elif self.path.startswith('/recording-status'):
-            self.handle_get_recording_status()
-        elif self.path.startswith('/transcripts'):
-            self.handle_get_transcripts()
-        elif self.path.startswith('/events'):
-            self.handle_sse()
-        elif self.path.startswith('/audio-file'):
-            self.handle_audio_file()
-        else:
-            self.send_error(404)
+        started = time.monotonic()
+        try:
+            if self.path == '/' or self.path == '/index.html':
+                self.serve_static('static/index.html', 'text/html')
+            elif self.path.startswith('/status'):
+                self.handle_status()
+            elif self.path.startswith('/devices/'):
+                self.handle_device_metrics()
+            elif self.path.startswith('/devices'):
+                self.handle_get_devices()
+            elif self.path.startswith('/recording-status'):
+                self.handle_get_recording_status()
+            elif self.path.startswith('/transcripts'):
+                self.handle_get_transcripts()
+            elif self.path.startswith('/transcript-counts'):
+                self.handle_get_transcript_counts()
+            elif self.path.startswith('/search'):
+                self.handle_search()
+            elif self.path.startswith('/events'):
+                self.handle_sse()
+            elif self.path.startswith('/audio-file'):
+                self.handle_audio_file()
+            elif self.path.startswith('/audio-peaks'):
+                self.handle_audio_peaks()
+            elif self.path.startswith('/inference-stats'):
+                self.handle_inference_stats()
+            elif self.path.startswith('/latency'):
+                self.handle_latency()
+            elif self.path.startswith('/metrics'):
+                self.handle_metrics()
+            else:
+                self.send_error(404)
+        finally:
+            self.record_metrics(started)
 
     def do_POST(self):
-        if self.path.startswith('/audio'):
-            self.handle_audio()
-        elif self.path.startswith('/record/start'):
-            self.handle_start_recording()
-        elif self.path.startswith('/record/stop'):
-            self.handle_stop_recording()
-        else:
-            self.send_error(404)
+        started = time.monotonic()
+        try:
+            if self.path.startswith('/audio-batch'):
+                self.handle_audio_batch()
+            elif self.path.startswith('/audio'):
+                self.handle_audio()
+            elif self.path.startswith('/record/start'):
+                self.handle_start_recording()
+            elif self.path.startswith('/record/stop'):
+                self.handle_stop_recording()
+            else:
+                self.send_error(404)
+        finally:
+            self.record_metrics(started)
+
+    def send_response(self, code, message=None):
+        self.response_status = code
+        super().send_response(code, message)
+
+    def record_metrics(self, started):
+        if server_metrics:
+            server_metrics.record_request(self.command, self.path, getattr(self, 'response_status', 500),
+                                          time.monotonic() - started, int(self.headers.get('Content-Length') or 0))
 
     def serve_static(self, filepath, content_type):
         """Serve static files"""
@@ -267,11 +375,28 @@ class TranscriptionServer(BaseHTTPRequestHandler):
         # Track this device as active (quick operation)
         if device_id:
             client_ip = self.client_address[0]
+            now = datetime.datetime.now()
             with devices_lock:
+                came_online = device_id not in active_devices
                 active_devices[device_id] = {
-                    'last_seen': datetime.datetime.now(),
-                    'ip': client_ip
+                    'last_seen': now,
+                    'ip': client_ip,
+                    # Devices only report their upload queue while it is non-empty
+                    'upload_queue': count_param(params, 'queue'),
+                    'upload_queue_age_ms': count_param(params, 'queue_age')
                 }
+                if came_online:
+                    presence = device_info(device_id, active_devices[device_id], now)
+            if came_online:
+                presence['online'] = True
+                broadcast_sse('presence', presence)
+            # Sent every few seconds rather than on every poll
+            rssi = params.get('rssi')
+            if rssi:
+                try:
+                    telemetry_store.record(device_id, time.time(), [(TELEMETRY_RSSI, float(rssi[0]))])
+                except ValueError:
+                    pass
 
         # Prepare response quickly - minimize lock time
         if not device_id:
@@ -301,21 +426,12 @@ class TranscriptionServer(BaseHTTPRequestHandler):
         now = datetime.datetime.now()
         devices = []
 
+        # Only devices seen within the timeout window; presence_monitor
+        # forgets the stale ones
         with devices_lock:
-            for device_id, info in list(active_devices.items()):
-                seconds_since_seen = (now - info['last_seen']).total_seconds()
-
-                # Only include devices seen within timeout window
-                if seconds_since_seen <= DEVICE_TIMEOUT_SECONDS:
-                    devices.append({
-                        'device_id': device_id,
-                        'ip': info['ip'],
-                        'last_seen': info['last_seen'].isoformat(),
-                        'seconds_ago': round(seconds_since_seen, 1)
-                    })
-                else:
-                    # Remove stale devices
-                    del active_devices[device_id]
+            for device_id, info in active_devices.items():
+                if (now - info['last_seen']).total_seconds() <= DEVICE_TIMEOUT_SECONDS:
+                    devices.append(device_info(device_id, info, now))
 
         self.send_response(200)
         self.send_header('Content-Type', 'application/json')
@@ -323,6 +439,76 @@ class TranscriptionServer(BaseHTTPRequestHandler):
         self.end_headers()
         self.wfile.write(json.dumps(devices).encode())
 
+    def handle_device_metrics(self):
+        """GET /devices/<id>/metrics?range= - the device's audio metrics and
+        WiFi signal over time, as min/mean/max per bucket"""
+        parsed = urlparse(self.path)
+        parts = parsed.path.split('/')
+        if len(parts) != 4 or parts[3] != 'metrics' or not parts[2]:
+            self.send_error(404)
+            return
+        params = parse_qs(parsed.query)
+        range_seconds = TELEMETRY_DEFAULT_RANGE
+        if 'range' in params:
+            range_seconds = parse_telemetry_range(params['range'][0])
+            if range_seconds is None:
+                self.send_error(400, "range must be like 90s, 30m, 6h or 7d")
+                return
+        result = telemetry_store.query(unquote(parts[2]), range_seconds)
+        if result is None:
+            self.send_error(404, "No telemetry for this device")
+            return
+        self.send_response(200)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Access-Control-Allow-Origin', '*')
+        self.end_headers()
+        self.wfile.write(json.dumps(result).encode())
+
+    def handle_inference_stats(self):
+        """Transcription queue state and per-device queue waits"""
+        self.send_response(200)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Access-Control-Allow-Origin', '*')
+        self.end_headers()
+        stats = transcription_scheduler.stats()
+        stats['archive'] = audio_archiver.stats()
+        self.wfile.write(json.dumps(stats).encode())
+
+    def handle_latency(self):
+        """Per-stage latency percentiles, capture to published transcript"""
+        self.send_response(200)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Access-Control-Allow-Origin', '*')
+        self.end_headers()
+        self.wfile.write(json.dumps(latency_log.percentiles()).encode())
+
+    def handle_metrics(self):
+        """Prometheus text format"""
+        now = datetime.datetime.now()
+        with devices_lock:
+            active = sum(1 for info in active_devices.values()
+                         if (now - info['last_seen']).total_seconds() <= DEVICE_TIMEOUT_SECONDS)
+        with sse_lock:
+            clients = len(sse_clients)
+        body = server_metrics.render([
+            ('memo_inference_queue_depth', 'Transcription jobs waiting for a worker', transcription_scheduler.length),
+            ('memo_inference_queue_capacity', 'Transcription jobs the queue admits', transcription_scheduler.capacity),
+            ('memo_sse_clients', 'Connected /events clients', clients),
+            ('memo_active_devices', 'Devices that polled /status recently', active),
+        ], counters=audio_archiver.counters())
+        self.send_response(200)
+        self.send_header('Content-Type', 'text/plain; version=0.0.4')
+        self.end_headers()
+        self.wfile.write(body.encode())
+
+    def send_busy(self):
+        """503 with a Retry-After sized to the transcription backlog"""
+        self.send_response(503)
+        self.send_header('Retry-After', str(transcription_scheduler.retry_after()))
+        self.send_header('Content-Type', 'application/json')
+        self.end_headers()
+        self.wfile.write(json.dumps({"status": "busy"}).encode())
+
     def handle_get_recording_status(self):
         """Return recording status for all devices"""
         with recording_lock:
@@ -335,70 +521,115 @@ class TranscriptionServer(BaseHTTPRequestHandler):
         self.wfile.write(json.dumps(status).encode())
 
     def handle_get_transcripts(self):
-        """Return list of all transcripts"""
-        transcripts = []
+        """Transcripts newest first, a page at a time (?limit=&before=&device=).
+        When older ones exist, X-Next-Before holds the cursor to pass as ?before="""
+        params = parse_qs(urlparse(self.path).query)
+        param = lambda name: params.get(name, [None])[0]
+        try:
+            before = int(param('before')) if param('before') else None
+            limit = min(max(0, int(param('limit') or TRANSCRIPTS_DEFAULT_LIMIT)), TRANSCRIPTS_MAX_LIMIT)
+        except ValueError:
+            self.send_response(400)
+            self.send_header('Content-Type', 'application/json')
+            self.send_header('Access-Control-Allow-Origin', '*')
+            self.end_headers()
+            self.wfile.write(json.dumps({"error": "before and limit must be integers"}).encode())
+            return
 
-        # Read all JSON files from transcript directory
-        for json_file in sorted(Path(TRANSCRIPT_DIR).glob("*.json"), reverse=True):
+        page, next_before = transcript_index.page(before, limit, param('device') or None)
+        transcripts = []
+        for seq, json_file in page:
             try:
                 with open(json_file, 'r', encoding='utf-8') as f:
                     data = json.load(f)
-                    
-                    # Validate required fields
-                    if 'timestamp' not in data:
-                        print(f"Warning: {json_file} missing timestamp, skipping")
-                        continue
-                    
-                    # Convert timestamp string to ISO format for JS
-                    timestamp_str = data['timestamp']
-                    try:
-                        # Try with microseconds first
-                        ts = datetime.datetime.strptime(timestamp_str, "%Y%m%d_%H%M%S_%f")
-                    except ValueError:
-                        try:
-                            # Fall back to without microseconds
-                            ts = datetime.datetime.strptime(timestamp_str, "%Y%m%d_%H%M%S")
-                        except ValueError:
-                            # If timestamp is already ISO format, try parsing it
-                            try:
-                                ts = datetime.datetime.fromisoformat(timestamp_str.replace('Z', '+00:00'))
-                            except:
-                                print(f"Warning: Could not parse timestamp '{timestamp_str}' in {json_file}, using current time")
-                                ts = datetime.datetime.now()
-                    
-                    data['timestamp'] = ts.isoformat()
-                    
-                    # Clean up any NaN or Infinity values that might break JSON
-                    data = clean_json_data(data)
-                    
-                    transcripts.append(data)
-            except json.JSONDecodeError as e:
-                print(f"Error: Invalid JSON in {json_file}: {e}")
-                continue
-            except Exception as e:
+            except (OSError, ValueError) as e:
                 print(f"Error reading {json_file}: {e}")
-                import traceback
-                traceback.print_exc()
                 continue
 
+            # Validate required fields
+            if 'timestamp' not in data:
+                print(f"Warning: {json_file} missing timestamp, skipping")
+                continue
+
+            # Convert timestamp string to ISO format for JS
+            timestamp = transcript_datetime(data['timestamp'])
+            if timestamp is None:
+                print(f"Warning: Could not parse timestamp '{data['timestamp']}' in {json_file}, using current time")
+                timestamp = datetime.datetime.now()
+            data['timestamp'] = timestamp.isoformat()
+            data['seq'] = seq
+
+            # Clean up any NaN or Infinity values that might break JSON
+            transcripts.append(clean_json_data(data))
+
+        response_json = json.dumps(transcripts, allow_nan=False)
         self.send_response(200)
         self.send_header('Content-Type', 'application/json')
         self.send_header('Access-Control-Allow-Origin', '*')
+        if next_before is not None:
+            self.send_header('X-Next-Before', str(next_before))
+            self.send_header('Access-Control-Expose-Headers', 'X-Next-Before')
         self.end_headers()
-        
+        self.wfile.write(response_json.encode('utf-8'))
+
+    def handle_get_transcript_counts(self):
+        """Transcripts in total and per device, so the UI can label tabs
+        without loading every page"""
+        self.send_response(200)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Access-Control-Allow-Origin', '*')
+        self.end_headers()
+        self.wfile.write(json.dumps(transcript_index.counts()).encode())
+
+    def handle_search(self):
+        """Transcripts ranked by relevance (/search?q=...[&device=&from=&to=&offset=&limit=]),
+        each with a <mark>-highlighted snippet"""
+        params = parse_qs(urlparse(self.path).query)
+        param = lambda name: params.get(name, [None])[0]
+        terms = search_terms(param('q') or '')
         try:
-            response_json = json.dumps(transcripts, allow_nan=False)
-            self.wfile.write(response_json.encode('utf-8'))
-        except (ValueError, TypeError) as e:
-            print(f"Error serializing transcripts to JSON: {e}")
-            # Send empty array as fallback
-            self.send_response(500)
+            since = parse_time_bound(param('from'), False) if param('from') else None
+            until = parse_time_bound(param('to'), True) if param('to') else None
+            offset = max(0, int(param('offset') or 0))
+            limit = min(max(1, int(param('limit') or SEARCH_DEFAULT_LIMIT)), SEARCH_MAX_LIMIT)
+        except ValueError:
+            terms = []
+        if not terms:
+            self.send_response(400)
+            self.send_header('Content-Type', 'application/json')
+            self.send_header('Access-Control-Allow-Origin', '*')
             self.end_headers()
-            self.wfile.write(json.dumps({"error": "Failed to serialize transcripts"}).encode('utf-8'))
-    
+            self.wfile.write(json.dumps({"error": "q parameter required (from/to: ISO date or time)"}).encode())
+            return
+
+        total, hits = transcript_index.search(terms, param('device') or None, since, until, offset, limit)
+        results = []
+        for json_path, score in hits:
+            try:
+                with open(json_path, 'r', encoding='utf-8') as f:
+                    record = json.load(f)
+            except (OSError, ValueError):
+                continue
+            timestamp = transcript_datetime(record.get('timestamp'))
+            if timestamp:
+                record['timestamp'] = timestamp.isoformat()
+            text = record.get('transcript') or record.get('text') or ''
+            results.append({
+                'score': round(score, 3),
+                'snippet': search_snippet(text, terms),
+                'transcript': clean_json_data(record),
+            })
+
+        self.send_response(200)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Access-Control-Allow-Origin', '*')
+        self.end_headers()
+        self.wfile.write(json.dumps({'total': total, 'offset': offset, 'limit': limit,
+                                     'results': results}).encode())
 
     def handle_audio_file(self):
-        """Serve audio files for playback"""
+        """Serve a recording for playback (?path=...[&format=opus]); archived
+        recordings are decoded back to WAV"""
         parsed = urlparse(self.path)
         params = parse_qs(parsed.query)
         filepath = params.get('path', [None])[0]
@@ -411,6 +642,73 @@ class TranscriptionServer(BaseHTTPRequestHandler):
             self.wfile.write(json.dumps({"error": "path parameter required"}).encode())
             return
 
+        normalized_path = self.resolve_audio_path(filepath)
+        if normalized_path is None:
+            return
+
+        # Opus copy for the UI if asked for (falls back to the WAV without ffmpeg)
+        if params.get('format', [None])[0] == 'opus':
+            normalized_path = transcode_cache.opus(normalized_path) or normalized_path
+
+        try:
+            if normalized_path.endswith('.flac'):
+                # Decoded once into the transcode cache, so seeking reads
+                # only the requested bytes; in memory if that fails
+                path = normalized_path
+                self.serve_file(path, load=lambda: (transcode_cache.decoded_wav(path, audio_archiver.decode_wav)
+                                                    or audio_archiver.decode_wav(path)))
+            else:
+                self.serve_file(normalized_path)
+        except (BrokenPipeError, ConnectionResetError):
+            pass  # Client seeked elsewhere or went away
+        except Exception as e:
+            print(f"Error serving audio file: {e}")
+            self.send_response(500)
+            self.end_headers()
+
+    def handle_audio_peaks(self):
+        """Waveform peaks of a recording (?path=...[&resolution=frames per peak]
+        [&start=&end= seconds]), from its .peaks file"""
+        params = parse_qs(urlparse(self.path).query)
+        filepath = params.get('path', [None])[0]
+        try:
+            resolution = int(params.get('resolution', [PEAKS_BASE_FRAMES])[0])
+            start = float(params.get('start', [0])[0])
+            end = float(params.get('end', ['inf'])[0])
+        except ValueError:
+            resolution = 0
+        if not filepath or resolution < 1 or math.isnan(start) or math.isnan(end):
+            self.send_response(400)
+            self.send_header('Content-Type', 'application/json')
+            self.send_header('Access-Control-Allow-Origin', '*')
+            self.end_headers()
+            self.wfile.write(json.dumps({"error": "path parameter required; resolution must be a positive "
+                                                  "integer, start and end numbers"}).encode())
+            return
+
+        normalized_path = self.resolve_audio_path(filepath)
+        if normalized_path is None:
+            return
+        try:
+            peaks = Peaks.load_or_build(normalized_path)
+        except Exception as e:
+            print(f"Error reading peaks of {normalized_path}: {e}")
+            self.send_response(500)
+            self.end_headers()
+            return
+
+        body = json.dumps(peaks.to_json(resolution, start, end)).encode()
+        self.send_response(200)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Content-Length', str(len(body)))
+        self.send_header('Access-Control-Allow-Origin', '*')
+        self.send_header('Cache-Control', 'public, max-age=3600')
+        self.end_headers()
+        self.wfile.write(body)
+
+    def resolve_audio_path(self, filepath):
+        """A recording path from a request, inside SAVE_DIR, or None once a
+        403/404 has been sent; archived recordings resolve to their FLAC"""
         # Security: ensure path is within allowed directories
         # Normalize path to prevent directory traversal
         # Remove any leading slashes or directory traversal attempts
@@ -420,7 +718,7 @@ class TranscriptionServer(BaseHTTPRequestHandler):
         if '..' in filepath or filepath.startswith('.'):
             self.send_response(403)
             self.end_headers()
-            return
+            return None
         
         # Handle paths that may already include SAVE_DIR or be just filenames
         save_dir_abs = os.path.abspath(SAVE_DIR)
@@ -447,7 +745,12 @@ class TranscriptionServer(BaseHTTPRequestHandler):
             print(f"Security check failed: {file_path_abs} not in {save_dir_abs}")
             self.send_response(403)
             self.end_headers()
-            return
+            return None
+
+        # Archived: the WAV has been replaced by a FLAC next to it
+        archived_path = os.path.splitext(normalized_path)[0] + '.flac'
+        if not os.path.exists(normalized_path) and os.path.exists(archived_path):
+            normalized_path = archived_path
 
         # Check if file exists
         if not os.path.exists(normalized_path):
@@ -473,32 +776,91 @@ class TranscriptionServer(BaseHTTPRequestHandler):
                     pass
                 self.send_response(404)
                 self.end_headers()
-                return
+                return None
 
-        # Serve the file
-        try:
-            with open(normalized_path, 'rb') as f:
-                content = f.read()
-            
-            # Determine content type
-            if normalized_path.endswith('.wav'):
-                content_type = 'audio/wav'
-            elif normalized_path.endswith('.mp3'):
-                content_type = 'audio/mpeg'
-            else:
-                content_type = 'application/octet-stream'
+        return normalized_path
+
+    def serve_file(self, path, load=None):
+        """Stream a file with Range, ETag and conditional request support.
+        Only the requested bytes are read, a chunk at a time.
+
+        With load, the body is a WAV from what it returns instead: the path of
+        a decoded archive, or its bytes. Validators still come from the file,
+        so revalidation skips the load."""
+        stat = os.stat(path)
+        length = stat.st_size
+        etag = f'"{length:x}-{stat.st_mtime_ns:x}"'
+        last_modified = email.utils.formatdate(stat.st_mtime, usegmt=True)
+
+        # If-None-Match wins over If-Modified-Since when both are sent
+        if_none_match = self.headers.get('If-None-Match')
+        if if_none_match is not None:
+            tags = [tag.strip().removeprefix('W/') for tag in if_none_match.split(',')]
+            not_modified = '*' in tags or etag in tags
+        else:
+            try:
+                since = email.utils.parsedate_to_datetime(self.headers.get('If-Modified-Since'))
+                not_modified = int(stat.st_mtime) <= since.timestamp()
+            except (TypeError, ValueError):
+                not_modified = False
+        if not_modified:
+            self.send_response(304)
+            self.send_header('ETag', etag)
+            self.send_header('Last-Modified', last_modified)
+            self.end_headers()
+            return
 
-            self.send_response(200)
+        content = load() if load else None
+        body_path = path
+        if isinstance(content, str):
+            body_path, content = content, None
+            length = os.path.getsize(body_path)
+        elif content is not None:
+            length = len(content)
+
+        # A stale If-Range means the client's partial copy is outdated: send it all
+        byte_range = None
+        if_range = self.headers.get('If-Range')
+        if if_range is None or if_range in (etag, last_modified):
+            byte_range = parse_byte_range(self.headers.get('Range'), length)
+        if byte_range == 'unsatisfiable':
+            self.send_response(416)
+            self.send_header('Content-Range', f'bytes */{length}')
+            self.end_headers()
+            return
+        start, end = byte_range or (0, length)
+
+        if path.endswith('.wav') or load:
+            content_type = 'audio/wav'
+        elif path.endswith('.opus'):
+            content_type = 'audio/ogg; codecs=opus'
+        elif path.endswith('.flac'):
+            content_type = 'audio/flac'
+        elif path.endswith('.mp3'):
+            content_type = 'audio/mpeg'
+        else:
+            content_type = 'application/octet-stream'
+
+        with (io.BytesIO(content) if content is not None else open(body_path, 'rb')) as f:
+            self.send_response(206 if byte_range else 200)
             self.send_header('Content-Type', content_type)
-            self.send_header('Content-Length', str(len(content)))
+            self.send_header('Content-Length', str(end - start))
+            self.send_header('Accept-Ranges', 'bytes')
+            self.send_header('ETag', etag)
+            self.send_header('Last-Modified', last_modified)
+            if byte_range:
+                self.send_header('Content-Range', f'bytes {start}-{end - 1}/{length}')
             self.send_header('Access-Control-Allow-Origin', '*')
             self.send_header('Cache-Control', 'public, max-age=3600')
             self.end_headers()
-            self.wfile.write(content)
-        except Exception as e:
-            print(f"Error serving audio file: {e}")
-            self.send_response(500)
-            self.end_headers()
+            f.seek(start)
+            remaining = end - start
+            while remaining > 0:
+                chunk = f.read(min(FILE_CHUNK_BYTES, remaining))
+                if not chunk:
+                    break
+                self.wfile.write(chunk)
+                remaining -= len(chunk)
 
     def handle_start_recording(self):
         """Start recording for a specific device"""
@@ -565,7 +927,13 @@ class TranscriptionServer(BaseHTTPRequestHandler):
         self.wfile.write(json.dumps({"status": "stopped", "device_id": device_id}).encode())
 
     def handle_sse(self):
-        """Handle Server-Sent Events connection"""
+        """Handle Server-Sent Events connection
+
+        A client reconnecting with Last-Event-ID (or ?last_event_id=) is sent
+        the events it missed from the replay buffer; a fresh one, or one whose
+        id is no longer buffered (after a 'resync' event), gets a 'status'
+        snapshot of recording state and online devices.
+        """
         self.send_response(200)
         self.send_header('Content-Type', 'text/event-stream')
         self.send_header('Cache-Control', 'no-cache')
@@ -573,18 +941,33 @@ class TranscriptionServer(BaseHTTPRequestHandler):
         self.send_header('Access-Control-Allow-Origin', '*')
         self.end_headers()
 
-        # Register this client
+        # Optional ?device=a,b filter
+        params = parse_qs(urlparse(self.path).query)
+        device_filter = params.get('device', [None])[0]
+        devices = set(d for d in device_filter.split(',') if d) if device_filter else None
+        last_event_id = self.headers.get('Last-Event-ID') or params.get('last_event_id', [''])[0]
+        last_event_id = int(last_event_id) if last_event_id.isdigit() else None
+
+        # The snapshot is built outside sse_lock (broadcasters may hold
+        # recording_lock); events from snapshot_id on are sent after it
         with sse_lock:
-            sse_clients.append(self.wfile)
+            snapshot_id = sse_next_id
+        status_msg = sse_status_message(devices)
 
         try:
-            # Send initial status for all devices
-            with recording_lock:
-                status_data = {"devices": recording_state.copy()}
-
-            status_msg = f"event: status\ndata: {json.dumps(status_data)}\n\n"
-            self.wfile.write(status_msg.encode())
-            self.wfile.flush()
+            # Catch up and register under the lock, so no event falls between
+            with sse_lock:
+                missed = sse_events_since(last_event_id) if last_event_id is not None else None
+                if missed is None:
+                    if last_event_id is not None:
+                        self.wfile.write(b'event: resync\ndata: {}\n\n')
+                    self.wfile.write(status_msg)
+                    missed = sse_events_since(snapshot_id - 1) or []
+                for _, device_id, message in missed:
+                    if not device_id or devices is None or device_id in devices:
+                        self.wfile.write(message)
+                self.wfile.flush()
+                sse_clients[self.wfile] = devices
 
             # Keep connection alive
             while True:
@@ -598,8 +981,7 @@ class TranscriptionServer(BaseHTTPRequestHandler):
         finally:
             # Unregister this client
             with sse_lock:
-                if self.wfile in sse_clients:
-                    sse_clients.remove(self.wfile)
+                sse_clients.pop(self.wfile, None)
 
     def handle_audio(self):
         """Handle complete audio recording upload"""
@@ -613,8 +995,12 @@ class TranscriptionServer(BaseHTTPRequestHandler):
         channels = int(params.get('channels', [1])[0])
 
         # Read complete audio data
+        upload_begin = time.time() * 1000
         content_length = int(self.headers['Content-Length'])
         audio_data = self.rfile.read(content_length)
+        trace = LatencyTrace.from_device(self.headers.get('X-Recording-Id'), self.headers.get('X-Trace-Ms'),
+                                         upload_begin)
+        trace.stamp('received')
         
         # Extract audio quality metrics from headers
         # Note: HTTP headers are case-insensitive, but Python's BaseHTTPRequestHandler
@@ -678,6 +1064,67 @@ class TranscriptionServer(BaseHTTPRequestHandler):
             import traceback
             traceback.print_exc()
 
+        # Queued uploads are retried by the device; drop ones we already have
+        recording_id = get_header('X-Recording-Id')
+        if recording_id:
+            if is_duplicate_recording(recording_id):
+                print(f"  Duplicate upload of {recording_id} - already ingested")
+                self.send_response(200)
+                self.send_header('Content-Type', 'application/json')
+                self.end_headers()
+                self.wfile.write(json.dumps({"status": "duplicate", "recording_id": recording_id}).encode())
+                return
+            print(f"  Recording {recording_id} (priority {get_header('X-Recording-Priority')}, "
+                  f"age {get_header('X-Recording-Age-Ms')} ms, attempt {get_header('X-Upload-Attempt')})")
+            with devices_lock:
+                if device_id in active_devices and get_header('X-Queue-Depth'):
+                    active_devices[device_id]['upload_queue'] = count_value(get_header('X-Queue-Depth'))
+                    active_devices[device_id]['upload_queue_age_ms'] = count_value(get_header('X-Queue-Oldest-Ms'))
+
+        content_hash = audio_hash(audio_data, sample_rate, channels)
+        if audio_data and is_duplicate_audio(device_id, content_hash):
+            print(f"  Same audio as a recent upload - not transcribing again")
+            self.send_response(200)
+            self.send_header('Content-Type', 'application/json')
+            self.end_headers()
+            self.wfile.write(json.dumps({"status": "duplicate", "audio_sha256": content_hash}).encode())
+            return
+
+        priority = priority_from_upload(get_header('X-Recording-Priority'))
+        job = None
+        if len(audio_data) > 0:
+            refusal = transcription_scheduler.refusal(device_id, priority)
+            if refusal:
+                print(f"⚠️  {refusal} - rejecting upload from {device_id}")
+                forget_audio_hash(device_id, content_hash)
+                if recording_id:
+                    forget_recording_id(recording_id)
+                self.send_busy()
+                return
+            job = {
+                'audio_data': audio_data,
+                'device_id': device_id,
+                'sample_rate': sample_rate,
+                'bits_per_sample': bits_per_sample,
+                'channels': channels,
+                'audio_quality': audio_quality,
+                'audio_sha256': content_hash,
+                'trace': trace
+            }
+            recorded_at = time.time() - count_value(get_header('X-Recording-Age-Ms')) / 1000
+            # Durable before the device is told it can drop the recording
+            try:
+                waited = ingest_journal.append([job])
+            except OSError:
+                forget_audio_hash(device_id, content_hash)
+                if recording_id:
+                    forget_recording_id(recording_id)
+                self.send_error(500, "Could not journal upload")
+                return
+            print(f"  Journaled in {waited * 1000:.1f} ms")
+            trace.stamp('journaled')
+            telemetry_store.record(device_id, recorded_at, telemetry_samples(audio_quality))
+
         # Send immediate response
         self.send_response(200)
         self.send_header('Content-Type', 'application/json')
@@ -686,16 +1133,132 @@ class TranscriptionServer(BaseHTTPRequestHandler):
         self.wfile.write(json.dumps(response).encode())
 
         # Add to transcription queue instead of processing directly
-        if len(audio_data) > 0:
-            with transcription_queue_lock:
-                transcription_queue.append({
-                    'audio_data': audio_data,
-                    'device_id': device_id,
-                    'sample_rate': sample_rate,
-                    'bits_per_sample': bits_per_sample,
-                    'channels': channels,
-                    'audio_quality': audio_quality
-                })
+        if job is not None:
+            trace.stamp('enqueued')
+            transcription_scheduler.push(job, priority)
+
+    def handle_audio_batch(self):
+        """Handle several queued recordings coalesced into one upload.
+
+        Body is a sequence of length-prefixed clips (little-endian u32 lengths):
+        [meta_len][meta JSON][pcm_len][pcm], repeated. The meta object carries the
+        per-clip fields of a single upload (id, priority, age_ms, attempt, avg_db, ...).
+
+        Answers with each clip's status (and code when rejected). If any clip
+        failed the response carries the worst failure's status code, so a device
+        that applies one code to the whole batch keeps the clips and retries.
+        """
+        parsed = urlparse(self.path)
+        params = parse_qs(parsed.query)
+
+        device_id = params.get('device', ['unknown'])[0]
+        sample_rate = int(params.get('rate', [16000])[0])
+        bits_per_sample = int(params.get('bits', [16])[0])
+        channels = int(params.get('channels', [1])[0])
+
+        upload_begin = time.time() * 1000
+        content_length = int(self.headers['Content-Length'])
+        body = self.rfile.read(content_length)
+        received = time.time() * 1000
+
+        clips = split_audio_batch(body)
+        if clips is None:
+            self.send_error(400, "Malformed audio batch")
+            return
+
+        print(f"\n📦 Received batch from {device_id}: {len(clips)} clips, {len(body)} bytes")
+
+        queue_depth = self.headers.get('X-Queue-Depth')
+        if queue_depth:
+            with devices_lock:
+                if device_id in active_devices:
+                    active_devices[device_id]['upload_queue'] = count_value(queue_depth)
+                    active_devices[device_id]['upload_queue_age_ms'] = count_value(self.headers.get('X-Queue-Oldest-Ms'))
+
+        results = []
+        jobs = []
+        busy = False
+        failed = 0
+        for meta, audio_data in clips:
+            recording_id = meta.get('id', '')
+            if recording_id and is_duplicate_recording(recording_id):
+                print(f"  Duplicate upload of {recording_id} - already ingested")
+                results.append({'id': recording_id, 'status': 'duplicate'})
+                continue
+            if not audio_data:
+                if recording_id:
+                    forget_recording_id(recording_id)
+                results.append({'id': recording_id, 'status': 'rejected', 'code': 400})
+                failed = max(failed, 400)
+                continue
+            content_hash = audio_hash(audio_data, sample_rate, channels)
+            if is_duplicate_audio(device_id, content_hash):
+                print(f"  Recording {recording_id}: same audio as a recent upload - not transcribing again")
+                results.append({'id': recording_id, 'status': 'duplicate'})
+                continue
+            priority = priority_from_upload(meta.get('priority'))
+            refusal = transcription_scheduler.refusal(device_id, priority, extra=len(jobs))
+            if refusal:
+                print(f"  Recording {recording_id}: {refusal.lower()} - busy")
+                forget_audio_hash(device_id, content_hash)
+                if recording_id:
+                    forget_recording_id(recording_id)
+                results.append({'id': recording_id, 'status': 'busy'})
+                busy = True
+                continue
+
+            print(f"  Recording {recording_id}: {len(audio_data)} bytes "
+                  f"(priority {meta.get('priority')}, age {meta.get('age_ms')} ms, attempt {meta.get('attempt')})")
+            audio_quality = {key: value for key, value in meta.items()
+                             if key not in ('id', 'priority', 'age_ms', 'attempt', 'trace')}
+            trace = LatencyTrace.from_device(recording_id or None, meta.get('trace'), upload_begin)
+            trace.stamps.append(('received', received))
+            jobs.append({
+                'recording_id': recording_id,
+                'audio_data': audio_data,
+                'device_id': device_id,
+                'sample_rate': sample_rate,
+                'bits_per_sample': bits_per_sample,
+                'channels': channels,
+                'audio_quality': audio_quality,
+                'audio_sha256': content_hash,
+                'priority': priority,
+                'trace': trace,
+                'recorded_at': received / 1000 - count_value(meta.get('age_ms')) / 1000
+            })
+            results.append({'id': recording_id, 'status': 'success'})
+
+        # One journal commit for the whole batch, before acknowledging it
+        if jobs:
+            try:
+                waited = ingest_journal.append(jobs)
+            except OSError:
+                # Nothing was ingested - let the device's retry through
+                for job in jobs:
+                    forget_audio_hash(job['device_id'], job['audio_sha256'])
+                    if job['recording_id']:
+                        forget_recording_id(job['recording_id'])
+                self.send_error(500, "Could not journal upload")
+                return
+            print(f"  Journaled {len(jobs)} clip(s) in {waited * 1000:.1f} ms")
+            for job in jobs:
+                job['trace'].stamp('journaled')
+                telemetry_store.record(device_id, job['recorded_at'], telemetry_samples(job['audio_quality']))
+
+        # Separate transcription jobs, same as individual uploads
+        for job in jobs:
+            job['trace'].stamp('enqueued')
+            transcription_scheduler.push(job, job['priority'])
+
+        # The device retries the whole batch; clips that made it are deduplicated
+        if busy:
+            self.send_busy()
+            return
+
+        self.send_response(failed or 200)
+        self.send_header('Content-Type', 'application/json')
+        self.end_headers()
+        self.wfile.write(json.dumps({"clips": results}).encode())
 
     def process_recording(self, audio_data, device_id, sample_rate, bits_per_sample, channels):
         """Process and transcribe the recording (delegates to standalone function)"""
@@ -725,31 +1288,1632 @@ class ThreadedHTTPServer(ThreadingMixIn, HTTPServer):
         super().handle_error(request, client_address)
 
 
+def is_duplicate_recording(recording_id):
+    """Record a recording id; True if it was already ingested recently"""
+    with recent_recording_ids_lock:
+        if recording_id in recent_recording_ids:
+            return True
+        recent_recording_ids[recording_id] = True
+        if len(recent_recording_ids) > RECENT_RECORDING_IDS_MAX:
+            recent_recording_ids.popitem(last=False)
+        return False
+
+
+def forget_recording_id(recording_id):
+    """Upload not taken - let the device's retry through"""
+    with recent_recording_ids_lock:
+        recent_recording_ids.pop(recording_id, None)
+
+
+def audio_hash(audio_data, sample_rate, channels):
+    """SHA-256 of the format and PCM bytes (same scheme as the Rust server)"""
+    digest = hashlib.sha256(struct.pack('<IH', sample_rate, channels))
+    digest.update(audio_data)
+    return digest.hexdigest()
+
+
+def is_duplicate_audio(device_id, content_hash):
+    """Record an audio hash; True if the device sent the same audio within
+    DUPLICATE_AUDIO_WINDOW_SECONDS"""
+    key = (device_id, content_hash)
+    now = time.monotonic()
+    with recent_audio_hashes_lock:
+        seen = recent_audio_hashes.get(key)
+        if seen is not None and now - seen < DUPLICATE_AUDIO_WINDOW_SECONDS:
+            return True
+        recent_audio_hashes[key] = now
+        recent_audio_hashes.move_to_end(key)
+        if len(recent_audio_hashes) > RECENT_AUDIO_HASHES_MAX:
+            recent_audio_hashes.popitem(last=False)
+        return False
+
+
+def forget_audio_hash(device_id, content_hash):
+    """Transcription failed - accept the same audio again"""
+    with recent_audio_hashes_lock:
+        recent_audio_hashes.pop((device_id, content_hash), None)
+
+
+def parse_byte_range(header, length):
+    """A single 'bytes=' range as (start, end), end exclusive. None means
+    ignore the header (malformed, another unit, several ranges) and send the
+    whole file; 'unsatisfiable' means no byte of it exists (416)."""
+    if not header or not header.strip().startswith('bytes=') or ',' in header:
+        return None
+    first, sep, last = header.strip()[len('bytes='):].partition('-')
+    if not sep:
+        return None
+    first, last = first.strip(), last.strip()
+    try:
+        if not first:
+            # Suffix: the last N bytes
+            suffix = int(last)
+            if suffix == 0:
+                return 'unsatisfiable'
+            start, end = max(0, length - suffix), length
+        else:
+            start = int(first)
+            end = min(int(last) + 1, length) if last else length
+            if last and int(last) < start:
+                return None
+    except ValueError:
+        return None
+    if start >= length:
+        return 'unsatisfiable'
+    return start, end
+
+
+class TranscodeCache:
+    """Opus copies of recordings for the UI (/audio-file?format=opus), made
+    with ffmpeg on first request. Speech at 24 kbit/s is about a tenth of the
+    16 kHz WAV. Archived recordings played as WAV are decoded into the same
+    cache.
+
+    A copy is named after its source's size and modification time, so a
+    changed source gets a new one. Concurrent requests for the same file wait
+    for one transcode; past max_bytes the oldest copies are removed.
+    """
+
+    def __init__(self, cache_dir, max_bytes, ffmpeg):
+        self.cache_dir = cache_dir
+        self.max_bytes = max_bytes
+        self.ffmpeg = ffmpeg
+        self.lock = threading.Lock()
+        self.in_flight = {}  # target path -> lock
+        self.unavailable = False  # ffmpeg failed to start
+
+    def opus(self, source):
+        """Path of the Opus copy of source, or None if it can't be made"""
+        if self.unavailable:
+            return None
+        target = self._target(source, 'opus')
+        return target and self._make_once(target, lambda: self._transcode(source, target))
+
+    def decoded_wav(self, flac_path, decode):
+        """Path of the WAV decode(flac_path) returns, decoded on first
+        request; None if it can't be written"""
+        target = self._target(flac_path, 'wav')
+        return target and self._make_once(target, lambda: self._decode(flac_path, target, decode))
+
+    def _target(self, source, extension):
+        """Cache path for source converted to extension"""
+        try:
+            stat = os.stat(source)
+        except OSError:
+            return None
+        stem = os.path.splitext(os.path.basename(source))[0]
+        return os.path.join(self.cache_dir, f"{stem}-{stat.st_size:x}-{int(stat.st_mtime):x}.{extension}")
+
+    def _make_once(self, target, make):
+        """target if it exists, otherwise what make() returns; concurrent
+        callers for one target share a single make()"""
+        if os.path.exists(target):
+            return target
+        with self.lock:
+            lock = self.in_flight.setdefault(target, threading.Lock())
+        with lock:
+            # Another request may have made it while we waited
+            result = target if os.path.exists(target) else make()
+        with self.lock:
+            self.in_flight.pop(target, None)
+        return result
+
+    def _decode(self, flac_path, target, decode):
+        partial = target + '.partial'
+        started = time.monotonic()
+        try:
+            os.makedirs(self.cache_dir, exist_ok=True)
+            wav = decode(flac_path)
+            with open(partial, 'wb') as f:
+                f.write(wav)
+            os.replace(partial, target)
+        except (OSError, ValueError, subprocess.SubprocessError) as e:
+            print(f"⚠️  Can't cache decoded {flac_path}: {e}")
+            if os.path.exists(partial):
+                os.remove(partial)
+            return None
+        print(f"🎧 Decoded {os.path.basename(flac_path)} to WAV in {(time.monotonic() - started) * 1000:.0f} ms")
+        self._evict()
+        return target
+
+    def _transcode(self, source, target):
+        os.makedirs(self.cache_dir, exist_ok=True)
+        partial = target + '.partial'
+        started = time.monotonic()
+        try:
+            result = subprocess.run(
+                [self.ffmpeg, '-nostdin', '-loglevel', 'error', '-y', '-i', source,
+                 '-c:a', 'libopus', '-b:a', '24k', '-application', 'voip', '-f', 'ogg', partial],
+                capture_output=True, text=True, timeout=120)
+        except OSError as e:
+            print(f"⚠️  Can't run {self.ffmpeg} ({e}) - serving WAV instead of Opus")
+            self.unavailable = True
+            return None
+        except subprocess.TimeoutExpired:
+            result = None
+        if result is None or result.returncode != 0:
+            print(f"⚠️  ffmpeg failed on {source}: {result.stderr.strip() if result else 'timed out'}")
+            if os.path.exists(partial):
+                os.remove(partial)
+            return None
+        os.replace(partial, target)
+        print(f"🎧 Transcoded {os.path.basename(source)} to Opus in {(time.monotonic() - started) * 1000:.0f} ms")
+        self._evict()
+        return target
+
+    def _evict(self):
+        """Remove the oldest copies while the cache is over its budget. Only
+        finished .opus and .wav files count; .partial ones are still being
+        written."""
+        files = []
+        for name in os.listdir(self.cache_dir):
+            if not name.endswith(('.opus', '.wav')):
+                continue
+            try:
+                stat = os.stat(os.path.join(self.cache_dir, name))
+            except OSError:
+                continue
+            files.append((stat.st_mtime, stat.st_size, os.path.join(self.cache_dir, name)))
+        total = sum(size for _, size, _ in files)
+        for _, size, path in sorted(files):
+            if total <= self.max_bytes:
+                break
+            try:
+                os.remove(path)
+                total -= size
+            except OSError:
+                pass
+
+
+def transcription_idle():
+    """Nothing queued and the worker not running a job"""
+    return transcription_scheduler.length == 0 and not transcription_in_progress
+
+
+class AudioArchiver:
+    """Recompresses recordings older than after_seconds from WAV to FLAC
+    (lossless, about two thirds the size for speech) with ffmpeg at the
+    lowest CPU priority.
+
+    Transcription comes first: a file is only started while the worker is
+    idle, and the archiver sleeps after each one so it averages
+    ARCHIVE_DUTY_CYCLE of a core. The WAV is removed only once the FLAC is
+    synced and decodes to the same samples; /audio-file serves archived
+    recordings decoded back to WAV.
+    """
+
+    def __init__(self, save_dir, after_seconds, ffmpeg):
+        self.save_dir = save_dir
+        self.after_seconds = after_seconds
+        self.ffmpeg = ffmpeg
+        self.lock = threading.Lock()
+        self.files = 0
+        self.wav_bytes = 0
+        self.flac_bytes = 0
+        self.failures = 0
+        self.yields = 0  # Times it held off because transcription was running
+        self.failed = set()  # Not retried until restart
+
+    def start(self):
+        threading.Thread(target=self._run, daemon=True, name='audio-archiver').start()
+
+    def _run(self):
+        if shutil.which(self.ffmpeg) is None:
+            print(f"⚠️  Can't find {self.ffmpeg} - recordings stay WAV")
+            return
+        while True:
+            for wav_path in self._due():
+                if wav_path in self.failed:
+                    continue
+                if not transcription_idle():
+                    with self.lock:
+                        self.yields += 1
+                    while not transcription_idle():
+                        time.sleep(0.5)
+                started = time.monotonic()
+                try:
+                    wav_bytes, flac_bytes = self._archive(wav_path)
+                except Exception as e:
+                    print(f"⚠️  Can't archive {wav_path}: {e}")
+                    self.failed.add(wav_path)
+                    with self.lock:
+                        self.failures += 1
+                else:
+                    with self.lock:
+                        self.files += 1
+                        self.wav_bytes += wav_bytes
+                        self.flac_bytes += flac_bytes
+                elapsed = time.monotonic() - started
+                time.sleep(elapsed * (1 - ARCHIVE_DUTY_CYCLE) / ARCHIVE_DUTY_CYCLE)
+            time.sleep(ARCHIVE_SCAN_SECONDS)
+
+    def _due(self):
+        """WAVs last modified at least after_seconds ago, oldest first"""
+        due = []
+        cutoff = time.time() - self.after_seconds
+        try:
+            names = os.listdir(self.save_dir)
+        except OSError:
+            return []
+        for name in names:
+            if not name.endswith('.wav'):
+                continue
+            path = os.path.join(self.save_dir, name)
+            try:
+                mtime = os.stat(path).st_mtime
+            except OSError:
+                continue
+            if mtime <= cutoff:
+                due.append((mtime, path))
+        return [path for _, path in sorted(due)]
+
+    def _ffmpeg(self, args, **kwargs):
+        return subprocess.run([self.ffmpeg, '-nostdin', '-loglevel', 'error', '-y'] + args,
+                              capture_output=True, timeout=300, check=True,
+                              preexec_fn=lambda: os.nice(19), **kwargs)
+
+    def _archive(self, wav_path):
+        """Replace one WAV with a FLAC next to it; returns the sizes before and after"""
+        with wave.open(wav_path, 'rb') as wav_file:
+            pcm = wav_file.readframes(wav_file.getnframes())
+        flac_path = os.path.splitext(wav_path)[0] + '.flac'
+        partial = flac_path + '.partial'
+        try:
+            self._ffmpeg(['-i', wav_path, '-c:a', 'flac', '-f', 'flac', partial])
+            decoded = self._ffmpeg(['-i', partial, '-f', 's16le', '-']).stdout
+            if decoded != pcm:
+                raise ValueError("FLAC does not decode to the original samples")
+            with open(partial, 'rb+') as f:
+                os.fsync(f.fileno())
+        except Exception:
+            if os.path.exists(partial):
+                os.remove(partial)
+            raise
+        os.replace(partial, flac_path)
+        dir_fd = os.open(os.path.dirname(flac_path) or '.', os.O_RDONLY)
+        try:
+            os.fsync(dir_fd)
+        finally:
+            os.close(dir_fd)
+        wav_bytes = os.path.getsize(wav_path)
+        # A job queued since the first idle check may be reading the WAV
+        while not transcription_idle():
+            time.sleep(0.5)
+        os.remove(wav_path)
+        return wav_bytes, os.path.getsize(flac_path)
+
+    def decode_wav(self, flac_path):
+        """An archived recording as WAV bytes"""
+        with open(flac_path, 'rb') as f:
+            header = f.read(42)
+        if header[:4] != b'fLaC':
+            raise ValueError(f"{flac_path} is not a FLAC file")
+        # STREAMINFO: 20-bit sample rate, then 3 bits of channels - 1
+        info = int.from_bytes(header[18:21], 'big')
+        sample_rate, channels = info >> 4, ((info >> 1) & 0x7) + 1
+        pcm = subprocess.run([self.ffmpeg, '-nostdin', '-loglevel', 'error', '-i', flac_path,
+                              '-f', 's16le', '-'], capture_output=True, timeout=60, check=True).stdout
+        out = io.BytesIO()
+        with wave.open(out, 'wb') as wav_file:
+            wav_file.setnchannels(channels)
+            wav_file.setsampwidth(2)
+            wav_file.setframerate(sample_rate)
+            wav_file.writeframes(pcm)
+        return out.getvalue()
+
+    def stats(self):
+        with self.lock:
+            return {
+                'files': self.files,
+                'wav_bytes': self.wav_bytes,
+                'flac_bytes': self.flac_bytes,
+                'saved_bytes': self.wav_bytes - self.flac_bytes,
+                'ratio': self.flac_bytes / self.wav_bytes if self.wav_bytes else 0.0,
+                'failures': self.failures,
+                'yields': self.yields,
+            }
+
+    def counters(self):
+        """(name, help, value) for /metrics"""
+        stats = self.stats()
+        return [
+            ('memo_archive_files_total', 'Recordings compressed to FLAC', stats['files']),
+            ('memo_archive_wav_bytes_total', 'WAV bytes compressed to FLAC', stats['wav_bytes']),
+            ('memo_archive_saved_bytes_total', 'Disk bytes freed by FLAC archiving', stats['saved_bytes']),
+            ('memo_archive_failures_total', 'Recordings the archiver could not compress', stats['failures']),
+        ]
+
+
+# Series kept per device: a recording's audio metrics, then the WiFi signal
+# its status polls report. The position is the metric's id on disk.
+TELEMETRY_METRICS = ('avg_db', 'max_db', 'min_db', 'clip_count', 'silence_chunks', 'i2s_errors', 'rssi')
+TELEMETRY_RSSI = 6
+# (seconds per bucket, buckets kept), finest first: a minute for 3 hours,
+# 15 minutes for a week, 4 hours for 90 days
+TELEMETRY_TIERS = ((60, 180), (15 * 60, 672), (4 * 3600, 540))
+TELEMETRY_FLUSH_SECONDS = 60
+TELEMETRY_DEFAULT_RANGE = 24 * 3600
+# On disk after the length-prefixed device id: metric, period, count, sum, min, max
+TELEMETRY_RECORD = struct.Struct('<BIIfff')
+TELEMETRY_RANGE_UNITS = {'s': 1, 'm': 60, 'h': 3600, 'd': 86400}
+
+
+class TelemetryRing:
+    """One tier of a series: fixed-interval buckets, oldest first, each
+    [period, count, sum, min, max, dirty] where period is the start time
+    divided by the tier's resolution. Only buckets with samples are kept."""
+
+    __slots__ = ('buckets', 'oldest_dirty')
+
+    def __init__(self):
+        self.buckets = []
+        self.oldest_dirty = None  # So a flush skips the older buckets
+
+    def bucket(self, period, capacity):
+        """The bucket for period, created if missing; None if it is older
+        than the tier keeps"""
+        buckets = self.buckets
+        newest = max(buckets[-1][0], period) if buckets else period
+        if period + capacity <= newest:
+            return None
+        self.oldest_dirty = period if self.oldest_dirty is None else min(self.oldest_dirty, period)
+        if not buckets or buckets[-1][0] < period:
+            del buckets[:bisect.bisect_left(buckets, [period - capacity + 1])]
+            buckets.append([period, 0, 0.0, math.inf, -math.inf, False])
+            return buckets[-1]
+        i = bisect.bisect_left(buckets, [period])
+        if buckets[i][0] != period:
+            # A late sample, e.g. from a recording that waited in the device's queue
+            buckets.insert(i, [period, 0, 0.0, math.inf, -math.inf, False])
+        return buckets[i]
+
+
+def merge_telemetry(bucket, count, total, low, high):
+    bucket[1] += count
+    bucket[2] += total
+    bucket[3] = min(bucket[3], low)
+    bucket[4] = max(bucket[4], high)
+    bucket[5] = True
+
+
+class TelemetryStore:
+    """Per-device time series of device telemetry, for spotting a failing
+    microphone or weak WiFi across the fleet.
+
+    Each sample lands in a bucket of every tier, so the coarse tiers need no
+    rollup pass. Closed buckets are appended to the directory once a minute,
+    one file per tier and retention span (60s-<n>.bin, the same format as the
+    Rust server's); a file is deleted once everything in it has aged out. The
+    newest buckets of the coarser tiers are rebuilt from the finer ones on
+    startup, so a restart loses at most the last couple of minutes.
+    """
+
+    def __init__(self, directory):
+        self.directory = directory
+        self.lock = threading.Lock()
+        self.devices = {}  # device_id -> [metric][tier] -> TelemetryRing
+
+    def _series(self, device_id):
+        series = self.devices.get(device_id)
+        if series is None:
+            series = self.devices[device_id] = [[TelemetryRing() for _ in TELEMETRY_TIERS]
+                                                for _ in TELEMETRY_METRICS]
+        return series
+
+    def _chunk_path(self, resolution, chunk):
+        return os.path.join(self.directory, f"{resolution}s-{chunk}.bin")
+
+    def load(self):
+        os.makedirs(self.directory, exist_ok=True)
+        now = int(time.time())
+        loaded = 0
+        for tier, (resolution, capacity) in enumerate(TELEMETRY_TIERS):
+            current = now // resolution // capacity
+            for chunk in range(max(current - 1, 0), current + 1):
+                path = self._chunk_path(resolution, chunk)
+                try:
+                    with open(path, 'rb') as f:
+                        data = f.read()
+                except FileNotFoundError:
+                    continue
+                pos = 0
+                while pos < len(data):
+                    fields = pos + 1 + data[pos]
+                    if fields + TELEMETRY_RECORD.size > len(data):
+                        break
+                    metric, period, count, total, low, high = TELEMETRY_RECORD.unpack_from(data, fields)
+                    device_id = data[pos + 1:fields]
+                    pos = fields + TELEMETRY_RECORD.size
+                    try:
+                        device_id = device_id.decode()
+                    except UnicodeDecodeError:
+                        continue
+                    if metric >= len(TELEMETRY_METRICS):
+                        continue
+                    ring = self._series(device_id)[metric][tier]
+                    bucket = ring.bucket(period, capacity)
+                    if bucket is not None:
+                        bucket[:] = [period, count, total, low, high, False]
+                    ring.oldest_dirty = None
+                    loaded += 1
+                if pos < len(data):
+                    # Torn by a crash mid-append
+                    os.truncate(path, pos)
+
+        # Coarse buckets are only written once closed: rebuild the ones after
+        # the newest on disk from the tier below
+        for series in self.devices.values():
+            for rings in series:
+                for tier in range(1, len(TELEMETRY_TIERS)):
+                    resolution, capacity = TELEMETRY_TIERS[tier]
+                    ratio = resolution // TELEMETRY_TIERS[tier - 1][0]
+                    ring = rings[tier]
+                    newest = ring.buckets[-1][0] if ring.buckets else -1
+                    for period, count, total, low, high, _ in list(rings[tier - 1].buckets):
+                        if period // ratio > newest:
+                            bucket = ring.bucket(period // ratio, capacity)
+                            if bucket is not None:
+                                merge_telemetry(bucket, count, total, low, high)
+        if loaded:
+            print(f"📈 Loaded {loaded} telemetry buckets for {len(self.devices)} device(s)")
+
+    def start(self):
+        threading.Thread(target=self._run, daemon=True, name='telemetry-flush').start()
+
+    def _run(self):
+        while True:
+            time.sleep(TELEMETRY_FLUSH_SECONDS)
+            try:
+                self.flush()
+            except OSError as e:
+                print(f"⚠️  Can't write telemetry: {e}")
+
+    def record(self, device_id, when, samples):
+        """Add (metric, value) samples taken at when (epoch seconds)"""
+        if not samples:
+            return
+        when = int(when)
+        with self.lock:
+            series = self._series(device_id)
+            for metric, value in samples:
+                if not math.isfinite(value):
+                    continue
+                for ring, (resolution, capacity) in zip(series[metric], TELEMETRY_TIERS):
+                    bucket = ring.bucket(when // resolution, capacity)
+                    if bucket is not None:
+                        merge_telemetry(bucket, 1, value, value, value)
+
+    def query(self, device_id, range_seconds):
+        """Every metric over the last range_seconds, from the finest tier that
+        keeps that long. Each point is [time ms, count, mean, min, max]. None
+        for a device that never reported any."""
+        tier = next((i for i, (resolution, capacity) in enumerate(TELEMETRY_TIERS)
+                     if range_seconds <= resolution * capacity), len(TELEMETRY_TIERS) - 1)
+        resolution, capacity = TELEMETRY_TIERS[tier]
+        range_seconds = min(range_seconds, resolution * capacity)
+        first = (int(time.time()) - range_seconds) // resolution
+        with self.lock:
+            series = self.devices.get(device_id)
+            if series is None:
+                return None
+            metrics = {}
+            for name, rings in zip(TELEMETRY_METRICS, series):
+                buckets = rings[tier].buckets
+                metrics[name] = [[period * resolution * 1000, count, round(total / count, 2), round(low, 2),
+                                  round(high, 2)]
+                                 for period, count, total, low, high, _ in
+                                 buckets[bisect.bisect_left(buckets, [first]):] if count]
+        return {
+            'device_id': device_id,
+            'range_seconds': range_seconds,
+            'resolution_seconds': resolution,
+            'columns': ['time', 'count', 'mean', 'min', 'max'],
+            'metrics': metrics,
+        }
+
+    def flush(self):
+        """Append the closed buckets changed since the last flush, and delete
+        files that have aged out"""
+        now = int(time.time())
+        pending = collections.defaultdict(bytearray)  # (resolution, file chunk) -> records
+        with self.lock:
+            for device_id, series in self.devices.items():
+                encoded_id = device_id.encode()
+                if len(encoded_id) > 255:
+                    continue  # Kept in memory only
+                for metric, rings in enumerate(series):
+                    for ring, (resolution, capacity) in zip(rings, TELEMETRY_TIERS):
+                        if ring.oldest_dirty is None:
+                            continue
+                        open_period = now // resolution
+                        start = bisect.bisect_left(ring.buckets, [ring.oldest_dirty])
+                        ring.oldest_dirty = None
+                        for bucket in ring.buckets[start:]:
+                            if not bucket[5]:
+                                continue
+                            period = bucket[0]
+                            if period >= open_period:
+                                if ring.oldest_dirty is None:
+                                    ring.oldest_dirty = period
+                                continue
+                            out = pending[(resolution, period // capacity)]
+                            out.append(len(encoded_id))
+                            out += encoded_id
+                            out += TELEMETRY_RECORD.pack(metric, period, *bucket[1:5])
+                            bucket[5] = False
+
+        for (resolution, chunk), records in pending.items():
+            with open(self._chunk_path(resolution, chunk), 'ab') as f:
+                f.write(records)
+        capacities = dict(TELEMETRY_TIERS)
+        for name in os.listdir(self.directory):
+            match = re.fullmatch(r'(\d+)s-(\d+)\.bin', name)
+            if match and int(match[1]) in capacities:
+                resolution, chunk = int(match[1]), int(match[2])
+                if chunk + 1 < now // resolution // capacities[resolution]:
+                    os.remove(os.path.join(self.directory, name))
+
+
+def telemetry_samples(audio_quality):
+    """(metric, value) for a recording's audio metrics"""
+    samples = []
+    for metric, name in enumerate(TELEMETRY_METRICS[:TELEMETRY_RSSI]):
+        value = audio_quality.get(name)
+        if isinstance(value, (int, float)) and not isinstance(value, bool):
+            samples.append((metric, float(value)))
+    return samples
+
+
+def parse_telemetry_range(value):
+    """90s, 30m, 6h, 7d or plain seconds; None if malformed"""
+    match = re.fullmatch(r'(\d+)([smhd]?)', value)
+    if not match or int(match[1]) == 0:
+        return None
+    return int(match[1]) * TELEMETRY_RANGE_UNITS[match[2] or 's']
+
+
+# Waveform peaks: the min and max sample of every PEAKS_BASE_FRAMES frames,
+# then levels of half as many up to a single peak, kept next to a recording
+# as <stem>.peaks. The format is the Rust server's, so either reads the other's.
+PEAKS_BASE_FRAMES = 256
+PEAKS_MAGIC = b'MPK1'
+# magic, sample rate, channels, base frames, frames, levels
+PEAKS_HEADER = struct.Struct('<4sIHIQB')
+
+
+class Peaks:
+    def __init__(self, sample_rate, channels, frames, levels):
+        self.sample_rate = sample_rate
+        self.channels = channels
+        self.frames = frames
+        # levels[k] is [min, max, min, max, ...] per PEAKS_BASE_FRAMES << k frames
+        self.levels = levels
+
+    @classmethod
+    def of(cls, pcm, sample_rate, channels):
+        """Peaks of 16-bit little-endian PCM (all channels of a frame count)"""
+        channels = max(channels, 1)
+        samples = array.array('h')
+        samples.frombytes(pcm[:len(pcm) // 2 * 2])
+        if sys.byteorder == 'big':
+            samples.byteswap()
+        block = PEAKS_BASE_FRAMES * channels
+        base = array.array('h')
+        for start in range(0, len(samples), block):
+            part = samples[start:start + block]
+            base.append(min(part))
+            base.append(max(part))
+        levels = [base]
+        while len(levels[-1]) > 2:
+            finer = levels[-1]
+            coarser = array.array('h')
+            for i in range(0, len(finer), 4):
+                coarser.append(min(finer[i:i + 4:2]))
+                coarser.append(max(finer[i + 1:i + 4:2]))
+            levels.append(coarser)
+        return cls(sample_rate, channels, len(samples) // channels, levels)
+
+    @classmethod
+    def load_or_build(cls, recording):
+        """The peaks file of a recording, built from its WAV or FLAC and saved
+        if there is none yet - recordings from before peaks were kept"""
+        path = peaks_path(recording)
+        try:
+            with open(path, 'rb') as f:
+                return cls.decode(f.read())
+        except FileNotFoundError:
+            pass
+        except ValueError as e:
+            print(f"⚠️  Rebuilding {path}: {e}")
+        if recording.endswith('.flac'):
+            wav_bytes = io.BytesIO(audio_archiver.decode_wav(recording))
+        else:
+            wav_bytes = recording
+        with wave.open(wav_bytes, 'rb') as wav_file:
+            if wav_file.getsampwidth() != 2:
+                raise ValueError(f"{recording} is not 16-bit")
+            peaks = cls.of(wav_file.readframes(wav_file.getnframes()),
+                           wav_file.getframerate(), wav_file.getnchannels())
+        try:
+            peaks.save(path)
+        except OSError as e:
+            print(f"⚠️  Can't save {path}: {e}")
+        return peaks
+
+    def save(self, path):
+        with open(path, 'wb') as f:
+            f.write(self.encode())
+
+    def encode(self):
+        out = bytearray(PEAKS_HEADER.pack(PEAKS_MAGIC, self.sample_rate, self.channels,
+                                          PEAKS_BASE_FRAMES, self.frames, len(self.levels)))
+        for level in self.levels:
+            values = array.array('h', level)
+            if sys.byteorder == 'big':
+                values.byteswap()
+            out += struct.pack('<I', len(values) // 2) + values.tobytes()
+        return bytes(out)
+
+    @classmethod
+    def decode(cls, data):
+        if len(data) < PEAKS_HEADER.size or data[:4] != PEAKS_MAGIC:
+            raise ValueError("not a peaks file")
+        _, sample_rate, channels, base_frames, frames, count = PEAKS_HEADER.unpack_from(data)
+        if base_frames != PEAKS_BASE_FRAMES:
+            raise ValueError(f"peaks of {base_frames} frames, not {PEAKS_BASE_FRAMES}")
+        levels = []
+        pos = PEAKS_HEADER.size
+        for _ in range(count):
+            if pos + 4 > len(data):
+                raise ValueError("truncated")
+            size = 4 * struct.unpack_from('<I', data, pos)[0]
+            if pos + 4 + size > len(data):
+                raise ValueError("truncated")
+            values = array.array('h')
+            values.frombytes(data[pos + 4:pos + 4 + size])
+            if sys.byteorder == 'big':
+                values.byteswap()
+            levels.append(values)
+            pos += 4 + size
+        return cls(sample_rate, channels, frames, levels)
+
+    def to_json(self, frames_per_peak, start, end):
+        """Peaks from the coarsest level with at most frames_per_peak frames
+        each, covering start..end seconds, with min and max interleaved"""
+        level = max(frames_per_peak // PEAKS_BASE_FRAMES, 1).bit_length() - 1
+        level = min(level, max(len(self.levels) - 1, 0))
+        frames_per_peak = PEAKS_BASE_FRAMES << level
+        values = self.levels[level] if self.levels else array.array('h')
+        count = len(values) // 2
+        rate = max(self.sample_rate, 1)
+        first = min(int(max(start, 0.0) * rate) // frames_per_peak, count)
+        end_frame = math.ceil(max(end, 0.0) * rate) if math.isfinite(end) else self.frames
+        last = min(-(-end_frame // frames_per_peak), count)
+        return {
+            'sample_rate': self.sample_rate,
+            'channels': self.channels,
+            'frames': self.frames,
+            'duration_sec': self.frames / rate,
+            'samples_per_peak': frames_per_peak,
+            'start_frame': first * frames_per_peak,
+            'peaks': values[2 * first:2 * max(last, first)].tolist(),
+        }
+
+
+def peaks_path(recording):
+    """Where a recording's peaks are kept (the same for its WAV and its FLAC)"""
+    return os.path.splitext(recording)[0] + '.peaks'
+
+
+def count_param(params, name):
+    """A non-negative integer query parameter; 0 if missing or malformed"""
+    try:
+        return max(int(params.get(name, [0])[0]), 0)
+    except ValueError:
+        return 0
+
+
+def count_value(value):
+    """A non-negative integer header or batch meta field; 0 if missing or malformed"""
+    try:
+        return max(int(value or 0), 0)
+    except (TypeError, ValueError):
+        return 0
+
+
+def split_audio_batch(body):
+    """Split an /audio-batch body into [(meta, pcm)], or None if malformed"""
+    clips = []
+    pos = 0
+
+    def take():
+        nonlocal pos
+        if pos + 4 > len(body):
+            raise ValueError("truncated length prefix")
+        length = struct.unpack_from('<I', body, pos)[0]
+        if pos + 4 + length > len(body):
+            raise ValueError("truncated part")
+        part = body[pos + 4:pos + 4 + length]
+        pos += 4 + length
+        return part
+
+    try:
+        while pos < len(body):
+            meta = json.loads(take())
+            pcm = take()
+            clips.append((meta, pcm))
+    except (ValueError, struct.error) as e:
+        print(f"⚠️  Malformed audio batch: {e}")
+        return None
+    return clips
+
+
+# Scheduling classes: live work (just recorded) is always taken before bulk
+# work (spooled uploads from a previous boot, journal replays)
+PRIORITY_LIVE = 0
+PRIORITY_BULK = 1
+
+
+def priority_from_upload(value):
+    """X-Recording-Priority / batch 'priority': 0 = live, 1 = spooled"""
+    try:
+        return PRIORITY_LIVE if int(value or 0) == 0 else PRIORITY_BULK
+    except ValueError:
+        return PRIORITY_LIVE
+
+
+class TranscriptionScheduler:
+    """Bounded transcription queue with a queue per device, so one chatty
+    device can't keep everyone else waiting behind it.
+
+    Within a priority class, devices are served by deficit round robin with
+    audio seconds as the cost: each turn a device gets QUANTUM_SEC of credit,
+    so long clips don't buy extra turns. Admission is decided up front: a job
+    is refused when the queue is full, when it is bulk work and only the
+    headroom kept for live work is left, or when its device already holds its
+    share of the queue.
+    """
+
+    QUANTUM_SEC = 3.0
+    WAIT_SAMPLES = 256
+
+    def __init__(self, capacity):
+        self.capacity = capacity
+        self.bulk_limit = max(capacity * 3 // 4, 1)
+        self.device_limit = max(capacity // 4, 1)
+        self.cond = threading.Condition()
+        # Per class: device -> {'jobs': deque, 'deficit': credit}; dict order is the rotation
+        self.classes = [collections.OrderedDict(), collections.OrderedDict()]
+        self.length = 0
+        self.queued_sec = 0.0
+        self.rejected = 0
+        self.devices = {}  # device -> {'queued', 'jobs', 'rejected', 'waits'}
+        self.audio_sec = 0.0
+        self.service_sec = 0.0
+
+    @staticmethod
+    def cost(job):
+        bytes_per_sec = job['sample_rate'] * job['channels'] * (job['bits_per_sample'] // 8)
+        return len(job['audio_data']) / bytes_per_sec if bytes_per_sec else 0.0
+
+    def _device_stats(self, device_id):
+        return self.devices.setdefault(device_id, {
+            'queued': 0, 'jobs': 0, 'rejected': 0,
+            'waits': collections.deque(maxlen=self.WAIT_SAMPLES)})
+
+    def _refusal(self, device_id, priority, extra):
+        limit = self.capacity if priority == PRIORITY_LIVE else self.bulk_limit
+        if self.length + extra >= limit:
+            return "Inference queue full"
+        if self.devices.get(device_id, {}).get('queued', 0) + extra >= self.device_limit:
+            return "Device has its share of the inference queue"
+        return None
+
+    def refusal(self, device_id, priority, extra=0):
+        """Why a job from this device would be refused now (None = admitted).
+        `extra` counts jobs from the same request already accepted."""
+        with self.cond:
+            reason = self._refusal(device_id, priority, extra)
+            if reason:
+                self.rejected += 1
+                self._device_stats(device_id)['rejected'] += 1
+            return reason
+
+    def push(self, job, priority):
+        """Queue an admitted job"""
+        device_id = job['device_id']
+        cost = self.cost(job)
+        with self.cond:
+            queues = self.classes[priority]
+            if device_id not in queues:
+                queues[device_id] = {'jobs': collections.deque(), 'deficit': self.QUANTUM_SEC}
+            queues[device_id]['jobs'].append((job, cost, time.monotonic()))
+            self.length += 1
+            self.queued_sec += cost
+            self._device_stats(device_id)['queued'] += 1
+            self.cond.notify()
+
+    def _pop_class(self, queues):
+        while queues:
+            device_id, queue = next(iter(queues.items()))
+            job, cost, enqueued_at = queue['jobs'][0]
+            if queue['deficit'] < cost:
+                queue['deficit'] += self.QUANTUM_SEC
+                queues.move_to_end(device_id)
+                continue
+            queue['deficit'] -= cost
+            queue['jobs'].popleft()
+            if not queue['jobs']:
+                # Idle devices don't bank credit
+                del queues[device_id]
+            return device_id, job, cost, enqueued_at
+        return None
+
+    def pop(self):
+        """Next job in fair order; blocks while the queue is empty"""
+        with self.cond:
+            while True:
+                for queues in self.classes:
+                    popped = self._pop_class(queues)
+                    if popped:
+                        device_id, job, cost, enqueued_at = popped
+                        self.length -= 1
+                        self.queued_sec -= cost
+                        stats = self.devices[device_id]
+                        stats['queued'] -= 1
+                        stats['jobs'] += 1
+                        wait = time.monotonic() - enqueued_at
+                        stats['waits'].append(wait)
+                        if server_metrics:
+                            server_metrics.queue_wait_seconds.observe(wait)
+                        return job
+                self.cond.wait()
+
+    def record_service(self, job, service_sec):
+        with self.cond:
+            self.audio_sec += self.cost(job)
+            self.service_sec += service_sec
+
+    def retry_after(self):
+        """Seconds a refused client should wait: the queued audio at the
+        measured real-time factor"""
+        with self.cond:
+            factor = self.service_sec / self.audio_sec if self.audio_sec else 1.0
+            return int(min(max(math.ceil(self.queued_sec * factor), 1), 60))
+
+    def stats(self):
+        """Queue depth per class, refusals, and per-device queue waits"""
+        def percentile(values, p):
+            if not values:
+                return None
+            rank = max(1, math.ceil(p / 100.0 * len(values)))
+            return round(values[min(rank, len(values)) - 1] * 1000)
+
+        with self.cond:
+            devices = []
+            for device_id in sorted(self.devices):
+                stats = self.devices[device_id]
+                waits = sorted(stats['waits'])
+                devices.append({
+                    'device_id': device_id,
+                    'queued': stats['queued'],
+                    'jobs': stats['jobs'],
+                    'rejected': stats['rejected'],
+                    'wait_p50_ms': percentile(waits, 50),
+                    'wait_p90_ms': percentile(waits, 90),
+                    'wait_p99_ms': percentile(waits, 99),
+                })
+            return {
+                'queue_depth': self.length,
+                'capacity': self.capacity,
+                'live_queued': sum(len(q['jobs']) for q in self.classes[PRIORITY_LIVE].values()),
+                'bulk_queued': sum(len(q['jobs']) for q in self.classes[PRIORITY_BULK].values()),
+                'device_limit': self.device_limit,
+                'bulk_limit': self.bulk_limit,
+                'rejected': self.rejected,
+                'devices': devices,
+            }
+
+
+class IngestJournal:
+    """Write-ahead journal of accepted uploads (received_audio/ingest.journal).
+
+    Records use the /audio-batch framing, [meta_len][meta JSON][pcm_len][pcm]:
+    a 'queued' record carries the job and its audio, a 'done' record (no
+    audio) follows once it is transcribed. Uploads are acknowledged only after
+    their record is on disk, and open jobs are replayed at startup.
+
+    One committer thread writes everything appended while the previous fsync
+    ran and syncs it once (group commit), so concurrent uploads share an fsync
+    instead of queueing behind each other's.
+    """
+
+    # Rewrite the journal once it passes this size, or twice its size after
+    # the last rewrite when the open jobs alone are bigger
+    COMPACT_BYTES = 64 * 1024 * 1024
+
+    def __init__(self, path, fsync=True):
+        self.path = path
+        self.fsync = fsync
+        self.cond = threading.Condition()
+        self.pending = []  # (record bytes, waiter or None, journal id, queued?)
+        self.next_id = 0
+        self.open_ids = set()
+
+        os.makedirs(os.path.dirname(path) or '.', exist_ok=True)
+        self.unfinished = self._load()
+        self.open_ids = {job['journal_id'] for job in self.unfinished}
+
+        # Start a fresh file holding only the open jobs
+        tmp_path = path + '.tmp'
+        with open(tmp_path, 'wb') as f:
+            for job in self.unfinished:
+                f.write(self._queued_record(job))
+            f.flush()
+            os.fsync(f.fileno())
+        os.replace(tmp_path, path)
+        self.file = open(path, 'ab')
+        self.compacted_bytes = self.file.tell()
+
+        threading.Thread(target=self._committer, daemon=True, name='ingest-journal').start()
+
+    @staticmethod
+    def _frame(meta, pcm=b''):
+        meta_bytes = json.dumps(meta, default=str).encode()
+        return (struct.pack('<I', len(meta_bytes)) + meta_bytes +
+                struct.pack('<I', len(pcm)) + pcm)
+
+    def _queued_record(self, job):
+        meta = {key: value for key, value in job.items() if key not in ('audio_data', 'trace')}
+        meta['op'] = 'queued'
+        return self._frame(meta, job['audio_data'])
+
+    @staticmethod
+    def _records(data):
+        """(meta, record start, pcm start, end) for each whole record in data"""
+        pos = 0
+        while True:
+            # A torn final record was never acknowledged
+            try:
+                meta_len = struct.unpack_from('<I', data, pos)[0]
+                meta = json.loads(data[pos + 4:pos + 4 + meta_len])
+                pcm_len = struct.unpack_from('<I', data, pos + 4 + meta_len)[0]
+            except (ValueError, struct.error):
+                return
+            pcm_start = pos + 8 + meta_len
+            if pcm_start + pcm_len > len(data):
+                return
+            yield meta, pos, pcm_start, pcm_start + pcm_len
+            pos = pcm_start + pcm_len
+
+    def _load(self):
+        """Jobs with a 'queued' record and no 'done' record, oldest first"""
+        if not os.path.exists(self.path):
+            return []
+        with open(self.path, 'rb') as f:
+            data = f.read()
+        jobs = {}
+        for meta, _, pcm_start, end in self._records(data):
+            journal_id = meta.pop('journal_id', None)
+            if journal_id is None:
+                continue
+            self.next_id = max(self.next_id, journal_id + 1)
+            if meta.pop('op', None) == 'queued':
+                meta['audio_data'] = data[pcm_start:end]
+                meta['journal_id'] = journal_id
+                jobs[journal_id] = meta
+            else:
+                jobs.pop(journal_id, None)
+        return [jobs[journal_id] for journal_id in sorted(jobs)]
+
+    def _compact(self, open_ids):
+        """Rewrite the journal with only the queued records of open jobs.
+        The old file stays in place if the rewrite fails."""
+        with open(self.path, 'rb') as f:
+            data = f.read()
+        tmp_path = self.path + '.tmp'
+        new_file = open(tmp_path, 'ab')
+        try:
+            new_file.truncate(0)
+            for meta, start, _, end in self._records(data):
+                if meta.get('op') == 'queued' and meta.get('journal_id') in open_ids:
+                    new_file.write(data[start:end])
+            new_file.flush()
+            os.fsync(new_file.fileno())
+            os.replace(tmp_path, self.path)
+        except OSError:
+            new_file.close()
+            if os.path.exists(tmp_path):
+                os.remove(tmp_path)
+            raise
+        # The new handle now names the journal itself
+        self.file.close()
+        self.file = new_file
+        self.compacted_bytes = new_file.tell()
+
+    def append(self, jobs):
+        """Journal queued jobs (setting their 'journal_id'); returns once they
+        are durable, with the seconds spent waiting. Raises OSError."""
+        waiters = []
+        with self.cond:
+            for job in jobs:
+                job['journal_id'] = self.next_id
+                self.next_id += 1
+                waiter = {'event': threading.Event(), 'error': None}
+                self.pending.append((self._queued_record(job), waiter, job['journal_id'], True))
+                waiters.append(waiter)
+            self.cond.notify()
+        started = time.monotonic()
+        for waiter in waiters:
+            waiter['event'].wait()
+            if waiter['error'] is not None:
+                raise waiter['error']
+        return time.monotonic() - started
+
+    def done(self, journal_id):
+        """Not waited for: if lost in a crash, the job is transcribed again"""
+        with self.cond:
+            self.pending.append((self._frame({'op': 'done', 'journal_id': journal_id}), None, journal_id, False))
+            self.cond.notify()
+
+    def _committer(self):
+        while True:
+            # Everything that queued up while the last commit was syncing
+            with self.cond:
+                while not self.pending:
+                    self.cond.wait()
+                batch, self.pending = self.pending, []
+
+            error = None
+            needs_sync = any(queued for _, _, _, queued in batch)
+            try:
+                self.file.write(b''.join(record for record, _, _, _ in batch))
+                self.file.flush()
+                if needs_sync and self.fsync:
+                    os.fsync(self.file.fileno())
+            except OSError as e:
+                print(f"❌ Ingest journal write failed: {e}")
+                error = e
+
+            with self.cond:
+                for _, _, journal_id, queued in batch:
+                    if queued:
+                        self.open_ids.add(journal_id)
+                    else:
+                        self.open_ids.discard(journal_id)
+                open_ids = set(self.open_ids)
+            for _, waiter, _, _ in batch:
+                if waiter is not None:
+                    waiter['error'] = error
+                    waiter['event'].set()
+
+            # Records of finished jobs are dead weight; a sustained backlog
+            # never leaves the journal empty, so open jobs are carried over
+            if self.file.tell() > max(self.COMPACT_BYTES, 2 * self.compacted_bytes):
+                try:
+                    self._compact(open_ids)
+                    print(f"🧾 Ingest journal compacted: {len(open_ids)} open job(s), "
+                          f"{self.compacted_bytes} bytes")
+                except OSError as e:
+                    print(f"⚠️  Ingest journal compaction failed: {e}")
+
+
+# Routes counted by /metrics, longest prefix first (as the handlers match them)
+METRICS_ROUTES = ('/audio-batch', '/audio-file', '/audio-peaks', '/audio', '/status', '/recording-status',
+                  '/devices/', '/devices', '/inference-stats', '/latency', '/metrics', '/transcripts',
+                  '/transcript-counts', '/search', '/events', '/record/start', '/record/stop')
+FAST_SECONDS = (0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 1.0)
+SLOW_SECONDS = (0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0)
+REAL_TIME_FACTORS = (0.02, 0.05, 0.1, 0.2, 0.3, 0.5, 0.75, 1.0, 1.5, 2.0)
+
+
+class Histogram:
+    """Fixed-bucket histogram in Prometheus form"""
+
+    def __init__(self, bounds):
+        self.bounds = bounds
+        self.buckets = [0] * (len(bounds) + 1)  # Not cumulative; the last is +Inf
+        self.sum = 0.0
+        self.lock = threading.Lock()
+
+    def observe(self, value):
+        bucket = bisect.bisect_left(self.bounds, value)
+        with self.lock:
+            self.buckets[bucket] += 1
+            self.sum += value
+
+    def render(self, out, name, help_text):
+        with self.lock:
+            buckets = list(self.buckets)
+            total = self.sum
+        out.append(f"# HELP {name} {help_text}\n# TYPE {name} histogram")
+        cumulative = 0
+        for bound, count in zip(list(self.bounds) + ['+Inf'], buckets):
+            cumulative += count
+            out.append(f'{name}_bucket{{le="{bound}"}} {cumulative}')
+        out.append(f"{name}_sum {total}\n{name}_count {cumulative}")
+
+
+class ServerMetrics:
+    """Counters and histograms behind /metrics (Prometheus text format).
+
+    Recording is a dict update or a bucket increment under a short lock;
+    gauges (queue depth, SSE clients, active devices) are read from their
+    own structures when /metrics is scraped.
+    """
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.requests = collections.Counter()  # (route, status class) -> count
+        self.upload_bytes = 0
+        self.sse_dropped = 0
+        self.status_seconds = Histogram(FAST_SECONDS)
+        self.upload_seconds = Histogram(SLOW_SECONDS)
+        self.wav_write_seconds = Histogram(FAST_SECONDS)
+        self.queue_wait_seconds = Histogram(SLOW_SECONDS)
+        self.real_time_factor = Histogram(REAL_TIME_FACTORS)
+
+    def record_request(self, method, path, status, seconds, body_bytes):
+        route = next((r for r in METRICS_ROUTES if path.startswith(r)), None)
+        if route is None:
+            return
+        with self.lock:
+            self.requests[(route, f"{status // 100}xx")] += 1
+            if method == 'POST' and route.startswith('/audio'):
+                self.upload_bytes += body_bytes
+        if method == 'POST' and route.startswith('/audio'):
+            self.upload_seconds.observe(seconds)
+        elif route == '/status':
+            self.status_seconds.observe(seconds)
+
+    def record_sse_dropped(self, count):
+        with self.lock:
+            self.sse_dropped += count
+
+    def render(self, gauges, counters=()):
+        out = ["# HELP memo_http_requests_total Requests handled, by route and status class",
+               "# TYPE memo_http_requests_total counter"]
+        with self.lock:
+            requests = sorted(self.requests.items())
+            upload_bytes = self.upload_bytes
+            sse_dropped = self.sse_dropped
+        for (route, status), count in requests:
+            out.append(f'memo_http_requests_total{{route="{route}",status="{status}"}} {count}')
+        self.status_seconds.render(out, 'memo_status_request_seconds', 'Time to answer a device /status poll')
+        out.append("# HELP memo_upload_bytes_total Audio bytes received in uploads\n"
+                   f"# TYPE memo_upload_bytes_total counter\nmemo_upload_bytes_total {upload_bytes}")
+        self.upload_seconds.render(out, 'memo_upload_seconds', 'Time to receive, store and journal an upload')
+        self.wav_write_seconds.render(out, 'memo_wav_write_seconds', "Time spent writing a recording's WAV file")
+        self.queue_wait_seconds.render(out, 'memo_inference_queue_wait_seconds',
+                                       'Time a transcription job waited for a worker')
+        self.real_time_factor.render(out, 'memo_inference_real_time_factor', 'Engine time per second of audio')
+        out.append("# HELP memo_sse_dropped_total SSE events not delivered to clients that went away\n"
+                   f"# TYPE memo_sse_dropped_total counter\nmemo_sse_dropped_total {sse_dropped}")
+        for name, help_text, value in counters:
+            out.append(f"# HELP {name} {help_text}\n# TYPE {name} counter\n{name} {value}")
+        for name, help_text, value in gauges:
+            out.append(f"# HELP {name} {help_text}\n# TYPE {name} gauge\n{name} {value}")
+        return '\n'.join(out) + '\n'
+
+
+# Stage name for the interval that ends at each stamp
+LATENCY_STAGES = {
+    'start_seen': 'poll',
+    'first_sample': 'capture_start',
+    'stop': 'recording',
+    'upload_begin': 'device_queue',
+    'received': 'upload',
+    'journaled': 'journal',
+    'enqueued': 'enqueue',
+    'dequeued': 'queue',
+    'stored': 'wav_write',
+    'inference_start': 'load',
+    'inference_end': 'inference',
+    'published': 'publish',
+}
+LATENCY_DEVICE_STAMPS = ('start_seen', 'first_sample', 'stop')
+RECENT_LATENCY_TRACES = 1024
+
+
+class LatencyTrace:
+    """Timestamps of one recording from capture to published transcript.
+
+    Device stamps arrive as offsets before the upload began (X-Trace-Ms:
+    start_seen=1830,first_sample=1790,stop=312,poll_rtt=40) and are placed on
+    the server clock relative to when the request arrived, so no clock sync
+    is needed; the one-way network delay before the first byte is not visible.
+    """
+
+    def __init__(self, recording_id=None):
+        self.recording_id = recording_id
+        self.stamps = []  # (name, epoch ms)
+
+    @classmethod
+    def from_device(cls, recording_id, device_trace, upload_begin_ms):
+        trace = cls(recording_id)
+        offsets = {}
+        for field in (device_trace or '').split(','):
+            name, _, value = field.partition('=')
+            try:
+                offsets[name.strip()] = float(value)
+            except ValueError:
+                continue
+        for name in LATENCY_DEVICE_STAMPS:
+            if name not in offsets:
+                continue
+            if name == 'start_seen' and offsets.get('poll_rtt', 0) > 0:
+                trace.stamps.append(('poll_sent', upload_begin_ms - offsets[name] - offsets['poll_rtt']))
+            trace.stamps.append((name, upload_begin_ms - offsets[name]))
+        trace.stamps.append(('upload_begin', upload_begin_ms))
+        return trace
+
+    def stamp(self, name):
+        self.stamps.append((name, time.time() * 1000))
+
+    def stages(self):
+        """Milliseconds per stage, each ending at one stamp"""
+        return [(LATENCY_STAGES.get(name, name), max(0.0, ms - prev_ms))
+                for (_, prev_ms), (name, ms) in zip(self.stamps, self.stamps[1:])]
+
+    def total_ms(self):
+        return self.stamps[-1][1] - self.stamps[0][1] if self.stamps else 0.0
+
+    def to_json(self):
+        """Stored as the transcript's 'latency' field"""
+        return {
+            'recording_id': self.recording_id,
+            'stamps_ms': {name: round(ms, 1) for name, ms in self.stamps},
+            'stages_ms': {name: round(ms, 1) for name, ms in self.stages()},
+            'total_ms': round(self.total_ms(), 1),
+        }
+
+
+class LatencyLog:
+    """Stage breakdowns of recent recordings, for /latency"""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.recent = collections.deque(maxlen=RECENT_LATENCY_TRACES)
+
+    def record(self, trace):
+        with self.lock:
+            self.recent.append((trace.stages(), trace.total_ms()))
+
+    def percentiles(self):
+        """Percentiles per stage over the recent recordings that have it"""
+        def summarize(samples):
+            samples = sorted(samples)
+
+            def percentile(p):
+                if not samples:
+                    return None
+                rank = max(1, math.ceil(p / 100.0 * len(samples)))
+                return round(samples[min(rank, len(samples)) - 1], 1)
+            return {
+                'count': len(samples),
+                'p50_ms': percentile(50),
+                'p90_ms': percentile(90),
+                'p99_ms': percentile(99),
+                'max_ms': round(samples[-1], 1) if samples else None,
+            }
+
+        with self.lock:
+            recent = list(self.recent)
+        by_stage = {}
+        for stages, _ in recent:
+            for stage, ms in stages:
+                by_stage.setdefault(stage, []).append(ms)
+
+        # Pipeline order, anything unknown after
+        order = list(LATENCY_STAGES.values())
+        stages = []
+        for stage in sorted(by_stage, key=lambda s: order.index(s) if s in order else len(order)):
+            summary = summarize(by_stage[stage])
+            summary['stage'] = stage
+            stages.append(summary)
+        return {
+            'recordings': len(recent),
+            'stages': stages,
+            'total': summarize([total for _, total in recent]),
+        }
+
+
+SEARCH_WORD = re.compile(r'[^\W_]+')
+SEARCH_MAX_TERM_CHARS = 32
+SEARCH_SNIPPET_WORDS = 24
+
+
+def search_terms(text):
+    """Index terms of text, in order: lowercased runs of letters and digits"""
+    return [word.lower()[:SEARCH_MAX_TERM_CHARS] for word in SEARCH_WORD.findall(text)]
+
+
+def transcript_datetime(timestamp):
+    """A transcript's timestamp (20260119_172003[_micros] or ISO) as a datetime, or None"""
+    if not timestamp:
+        return None
+    for fmt in ("%Y%m%d_%H%M%S_%f", "%Y%m%d_%H%M%S"):
+        try:
+            return datetime.datetime.strptime(timestamp, fmt)
+        except ValueError:
+            pass
+    try:
+        return datetime.datetime.fromisoformat(timestamp.replace('Z', '+00:00'))
+    except ValueError:
+        return None
+
+
+def parse_time_bound(value, end_of_day):
+    """from/to as epoch seconds: an ISO time, or a date meaning its midnight
+    UTC (the following midnight for 'to', so the day is included)"""
+    if len(value) == 10:
+        day = datetime.datetime.combine(datetime.date.fromisoformat(value), datetime.time(),
+                                        tzinfo=datetime.timezone.utc)
+        return (day + datetime.timedelta(days=1 if end_of_day else 0)).timestamp()
+    return datetime.datetime.fromisoformat(value.replace('Z', '+00:00')).timestamp()
+
+
+def search_snippet(text, terms):
+    """The SEARCH_SNIPPET_WORDS of text with the most query terms,
+    HTML-escaped, matches wrapped in <mark>"""
+    words = list(SEARCH_WORD.finditer(text))
+    if not words:
+        return html.escape(text)
+    wanted = set(terms)
+    matched = [word.group().lower()[:SEARCH_MAX_TERM_CHARS] in wanted for word in words]
+
+    # Densest window of matches
+    window = min(SEARCH_SNIPPET_WORDS, len(words))
+    count = sum(matched[:window])
+    best, best_count = 0, count
+    for first in range(1, len(words) - window + 1):
+        count += matched[first + window - 1] - matched[first - 1]
+        if count > best_count:
+            best, best_count = first, count
+    # Start a little before the first match so it has some context
+    first_match = next((i for i in range(best, best + window) if matched[i]), best)
+    first = min(max(first_match - 3, 0), len(words) - window)
+    last = first + window
+
+    out = ['…'] if first > 0 else []
+    pos = words[first].start() if first > 0 else 0
+    for i in range(first, last):
+        word = words[i]
+        out.append(html.escape(text[pos:word.start()]))
+        out.append(f"<mark>{html.escape(word.group())}</mark>" if matched[i] else html.escape(word.group()))
+        pos = word.end()
+    out.append('…' if last < len(words) else html.escape(text[pos:]))
+    return ''.join(out)
+
+
+class TranscriptSearchIndex:
+    """Inverted index over transcript text for /search, with device and time
+    per transcript for filtering. Built from transcripts/ at startup (oldest
+    first) and extended as each transcript is written, so posting lists stay
+    in document order and a document's number orders it in time; it is the
+    `seq` that /transcripts pages by.
+
+    Results are ranked by BM25. A term in more than COMMON_TERM_POSTINGS
+    transcripts only re-ranks results found by a rarer term of the same
+    query, so a stray "the" doesn't score every transcript.
+    """
+
+    K1 = 1.2
+    B = 0.75
+    COMMON_TERM_POSTINGS = 50000
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.postings = {}  # term -> (doc numbers, term frequencies), as array('I')
+        self.docs = []  # (json path, token count, epoch seconds, device_id)
+        self.device_docs = {}  # device_id -> doc numbers, as array('I')
+        self.total_len = 0
+
+    def load(self, transcript_dir):
+        records = []
+        for json_path in Path(transcript_dir).glob("*.json"):
+            try:
+                with open(json_path, 'r', encoding='utf-8') as f:
+                    record = json.load(f)
+            except (OSError, ValueError):
+                continue
+            timestamp = transcript_datetime(record.get('timestamp'))
+            # Only what add() reads, so the whole archive isn't held at once
+            records.append((timestamp.timestamp() if timestamp else 0, str(json_path), {
+                'transcript': record.get('transcript') or record.get('text') or '',
+                'timestamp': record.get('timestamp'),
+                'device_id': record.get('device_id', ''),
+            }))
+        records.sort(key=lambda item: item[:2])
+        for _, json_path, record in records:
+            self.add(json_path, record)
+        print(f"🔎 Search index: {len(self.docs)} transcript(s)")
+
+    def add(self, json_path, record):
+        """Index a transcript; returns its document number (seq)"""
+        counts = collections.Counter(search_terms(record.get('transcript') or record.get('text') or ''))
+        timestamp = transcript_datetime(record.get('timestamp'))
+        with self.lock:
+            doc = len(self.docs)
+            for term, tf in counts.items():
+                docs, tfs = self.postings.setdefault(term, (array.array('I'), array.array('I')))
+                docs.append(doc)
+                tfs.append(tf)
+            length = sum(counts.values())
+            self.docs.append((json_path, length, timestamp.timestamp() if timestamp else 0,
+                              record.get('device_id', '')))
+            self.device_docs.setdefault(record.get('device_id', ''), array.array('I')).append(doc)
+            self.total_len += length
+        return doc
+
+    def page(self, before=None, limit=TRANSCRIPTS_DEFAULT_LIMIT, device=None):
+        """([(seq, json path)] before seq `before`, newest first; the cursor
+        for the next page, or None if this is the oldest)"""
+        with self.lock:
+            if device is None:
+                end = len(self.docs) if before is None else min(before, len(self.docs))
+                seqs = range(end - 1, max(end - limit, 0) - 1, -1)
+            else:
+                docs = self.device_docs.get(device, array.array('I'))
+                end = len(docs) if before is None else bisect.bisect_left(docs, before)
+                seqs = reversed(docs[max(end - limit, 0):end])
+            page = [(seq, self.docs[seq][0]) for seq in seqs]
+        return page, (page[-1][0] if page and end > limit else None)
+
+    def counts(self):
+        with self.lock:
+            return {'total': len(self.docs),
+                    'devices': {device: len(docs) for device, docs in self.device_docs.items()}}
+
+    def search(self, terms, device=None, since=None, until=None, offset=0, limit=SEARCH_DEFAULT_LIMIT):
+        """(match count, [(json path, score)] for the requested page, best first)"""
+        with self.lock:
+            n = len(self.docs)
+            avg_len = max(self.total_len / max(n, 1), 1.0)
+            found = []
+            for term in dict.fromkeys(terms):
+                postings = self.postings.get(term)
+                if postings:
+                    df = len(postings[0])
+                    found.append((postings, math.log(1 + (n - df + 0.5) / (df + 0.5))))
+            if not found:
+                return 0, []
+            found.sort(key=lambda item: len(item[0][0]))
+
+            def bm25(tf, doc, idf):
+                return idf * tf * (self.K1 + 1) / (tf + self.K1 * (1 - self.B + self.B * self.docs[doc][1] / avg_len))
+
+            def accept(doc):
+                _, _, time_sec, device_id = self.docs[doc]
+                return ((device is None or device_id == device)
+                        and (since is None or time_sec >= since)
+                        and (until is None or time_sec < until))
+
+            # Rare terms find candidates, common ones only add to their scores
+            generators = max(1, sum(1 for (docs, _), _ in found if len(docs) <= self.COMMON_TERM_POSTINGS))
+            scores = {}
+            for (docs, tfs), idf in found[:generators]:
+                for doc, tf in zip(docs, tfs):
+                    if accept(doc):
+                        scores[doc] = scores.get(doc, 0.0) + bm25(tf, doc, idf)
+            for (docs, tfs), idf in found[generators:]:
+                for doc in scores:
+                    i = bisect.bisect_left(docs, doc)
+                    if i < len(docs) and docs[i] == doc:
+                        scores[doc] += bm25(tfs[i], doc, idf)
+
+            # Best first, newer first on ties
+            top = heapq.nsmallest(offset + limit, scores.items(), key=lambda item: (-item[1], -item[0]))
+            return len(scores), [(self.docs[doc][0], score) for doc, score in top[offset:]]
+
+
 def broadcast_sse(event, data):
-    """Broadcast SSE message to all connected clients"""
+    """Broadcast SSE message to all connected clients, numbered and kept for replay"""
+    global sse_next_id
     try:
         # Clean data to prevent JSON serialization errors
         clean_data = clean_json_data(data)
-        message = f"event: {event}\ndata: {json.dumps(clean_data, allow_nan=False)}\n\n"
+        payload = json.dumps(clean_data, allow_nan=False)
+        device_id = data.get('device_id') if isinstance(data, dict) else None
         with sse_lock:
+            event_id = sse_next_id
+            sse_next_id += 1
+            message = f"id: {event_id}\nevent: {event}\ndata: {payload}\n\n".encode('utf-8')
+            sse_replay.append((event_id, device_id, message))
             dead_clients = []
-            for client in sse_clients:
+            for client, devices in sse_clients.items():
+                if device_id and devices is not None and device_id not in devices:
+                    continue
                 try:
-                    client.write(message.encode('utf-8'))
+                    client.write(message)
                     client.flush()
                 except:
                     dead_clients.append(client)
 
             # Remove dead clients
             for client in dead_clients:
-                sse_clients.remove(client)
+                sse_clients.pop(client, None)
+            if dead_clients and server_metrics:
+                server_metrics.record_sse_dropped(len(dead_clients))
     except Exception as e:
         print(f"Error broadcasting SSE message: {e}")
         import traceback
         traceback.print_exc()
 
 
-def process_recording_standalone(audio_data, device_id, sample_rate, bits_per_sample, channels, audio_quality=None):
+def sse_events_since(last_id):
+    """Buffered (id, device_id, message) after last_id, or None if some of
+    those are no longer kept. Call with sse_lock held."""
+    if last_id >= sse_next_id:
+        return None  # Not an id this server handed out
+    first = sse_replay[0][0] if sse_replay else sse_next_id
+    if last_id + 1 < first:
+        return None
+    return [entry for entry in sse_replay if entry[0] > last_id]
+
+
+def sse_status_message(devices=None):
+    """'status' event: recording state and online devices, limited to devices if given"""
+    with recording_lock:
+        recording = {device_id: state for device_id, state in recording_state.items()
+                     if devices is None or device_id in devices}
+    now = datetime.datetime.now()
+    with devices_lock:
+        online = [device_info(device_id, info, now) for device_id, info in active_devices.items()
+                  if (devices is None or device_id in devices)
+                  and (now - info['last_seen']).total_seconds() <= DEVICE_TIMEOUT_SECONDS]
+    return f"event: status\ndata: {json.dumps({'devices': recording, 'online': online})}\n\n".encode('utf-8')
+
+
+def device_info(device_id, info, now):
+    """A device as listed by /devices and the presence/status events"""
+    return {
+        'device_id': device_id,
+        'ip': info['ip'],
+        'last_seen': info['last_seen'].isoformat(),
+        'seconds_ago': round((now - info['last_seen']).total_seconds(), 1),
+        'upload_queue': info.get('upload_queue', 0),
+        'upload_queue_age_ms': info.get('upload_queue_age_ms', 0)
+    }
+
+
+def presence_monitor():
+    """Announce devices that stopped polling /status as offline (their first
+    poll announces them online), so dashboards need not poll /devices"""
+    while True:
+        time.sleep(PRESENCE_CHECK_SECONDS)
+        now = datetime.datetime.now()
+        with devices_lock:
+            stale = [device_id for device_id, info in active_devices.items()
+                     if (now - info['last_seen']).total_seconds() > DEVICE_TIMEOUT_SECONDS]
+            for device_id in stale:
+                del active_devices[device_id]
+        for device_id in stale:
+            broadcast_sse('presence', {'device_id': device_id, 'online': False})
+
+
+def process_recording_standalone(audio_data, device_id, sample_rate, bits_per_sample, channels, audio_quality=None,
+                                 content_hash=None, trace=None):
     """Standalone function to process and transcribe a recording"""
     print("\n\n⏹️  Recording stopped. Processing...")
     print("\n" + "=" * 60)
@@ -789,13 +2953,18 @@ def process_recording_standalone(audio_data, device_id, sample_rate, bits_per_sa
 
     # Generate timestamp filename
     timestamp = datetime.datetime.now()
-    timestamp_str = timestamp.strftime("%Y%m%d_%H%M%S")
+    timestamp_str = timestamp.strftime("%Y%m%d_%H%M%S_%f")  # Batched clips can land in the same second
     base_filename = f"{device_id}_{timestamp_str}"
 
     # Analyze and save as WAV
     wav_path = os.path.join(SAVE_DIR, f"{base_filename}.wav")
+    write_started = time.monotonic()
     audio_analysis = save_wav_file(wav_path, audio_data, sample_rate, channels, bits_per_sample)
+    if server_metrics:
+        server_metrics.wav_write_seconds.observe(time.monotonic() - write_started)
     print(f"Saved: {wav_path}")
+    if trace:
+        trace.stamp('stored')
     
     # Add server-side analysis to metadata
     if audio_analysis and 'error' not in audio_analysis:
@@ -812,7 +2981,11 @@ def process_recording_standalone(audio_data, device_id, sample_rate, bits_per_sa
 
     # Transcribe
     print("Transcribing...")
+    if trace:
+        trace.stamp('inference_start')
     transcript = transcribe_audio_file(wav_path)
+    if trace:
+        trace.stamp('inference_end')
 
     if transcript:
         print(f"\n📝 Transcript: {transcript}")
@@ -840,6 +3013,8 @@ def process_recording_standalone(audio_data, device_id, sample_rate, bits_per_sa
             'bits_per_sample': bits_per_sample,
             'channels': channels
         }
+        if content_hash:
+            metadata['audio_sha256'] = content_hash
         
         # Add quality metrics to metadata
         if audio_quality:
@@ -892,23 +3067,36 @@ def process_recording_standalone(audio_data, device_id, sample_rate, bits_per_sa
             if math.isnan(quality_score) or math.isinf(quality_score):
                 quality_score = 0.0
             metadata['quality_score'] = round(float(quality_score), 1)
+
+        if trace:
+            trace.stamp('published')
+            metadata['latency'] = trace.to_json()
         
         # Clean metadata before saving to ensure no NaN/Inf values
         metadata = clean_json_data(metadata)
         
         with open(json_path, 'w', encoding='utf-8') as f:
             json.dump(metadata, f, indent=2, ensure_ascii=False, allow_nan=False)
+        seq = transcript_index.add(json_path, metadata)
 
         # Broadcast new transcript to all connected clients
         # Ensure timestamp is ISO format and clean any NaN values
         broadcast_data = metadata.copy()
         broadcast_data['timestamp'] = timestamp.isoformat()
+        broadcast_data['seq'] = seq
         
         # Clean broadcast data to prevent JSON serialization errors
         broadcast_data = clean_json_data(broadcast_data)
         broadcast_sse('transcript', broadcast_data)
+
+        if trace and latency_log:
+            latency_log.record(trace)
+            stages = ', '.join(f"{stage} {ms:.0f}" for stage, ms in trace.stages())
+            print(f"⏱️  Latency {trace.total_ms():.0f} ms ({stages})")
     else:
         print("\n⚠️  Transcription failed")
+        if content_hash:
+            forget_audio_hash(device_id, content_hash)
 
     print("=" * 60)
     print("\n⌨️  Press SPACE to start recording, Q to quit\n")
@@ -1128,6 +3316,13 @@ def save_wav_file(filename, pcm_data, sample_rate, channels, bits_per_sample):
         expected_size = 44 + len(pcm_data)  # WAV header (44 bytes) + data
         if abs(file_size - expected_size) > 100:  # Allow some tolerance
             print(f"⚠️  WAV file size mismatch: expected ~{expected_size} bytes, got {file_size} bytes")
+
+        # Waveform peaks from the same samples, so the UI never reads the audio
+        if bits_per_sample == 16:
+            try:
+                Peaks.of(pcm_data, sample_rate, channels).save(peaks_path(filename))
+            except OSError as e:
+                print(f"⚠️  Can't save peaks for {filename}: {e}")
         
         return analysis
     except Exception as e:
@@ -1158,29 +3353,37 @@ def transcribe_audio_file(wav_path):
 
 def transcription_worker():
     """Worker thread that processes transcription queue sequentially"""
-    global transcription_worker_running
+    global transcription_worker_running, transcription_in_progress
     transcription_worker_running = True
     
     while True:
-        item = None
-        with transcription_queue_lock:
-            if transcription_queue:
-                item = transcription_queue.pop(0)
-        
-        if item is None:
-            import time
-            time.sleep(0.1)  # Wait a bit if queue is empty
-            continue
-        
+        item = transcription_scheduler.pop()
+        transcription_in_progress = True
+        # Replayed journal entries start their trace here
+        trace = item.get('trace') or LatencyTrace()
+        trace.stamp('dequeued')
+
         # Process the transcription
+        started = time.monotonic()
         process_recording_standalone(
             item['audio_data'],
             item['device_id'],
             item['sample_rate'],
             item['bits_per_sample'],
             item['channels'],
-            item.get('audio_quality', None)
+            item.get('audio_quality', None),
+            item.get('audio_sha256'),
+            trace=trace
         )
+        service_sec = time.monotonic() - started
+        transcription_scheduler.record_service(item, service_sec)
+        stamps = dict(trace.stamps)
+        audio_sec = transcription_scheduler.cost(item)
+        if audio_sec > 0 and 'inference_end' in stamps:
+            engine_sec = (stamps['inference_end'] - stamps['inference_start']) / 1000
+            server_metrics.real_time_factor.observe(engine_sec / audio_sec)
+        ingest_journal.done(item['journal_id'])
+        transcription_in_progress = False
 
 
 def keyboard_listener(server_addr):
@@ -1355,12 +3558,41 @@ def main():
         print("Pre-loading openai-whisper model...")
         get_openai_whisper_model()
 
+    # Journal of accepted uploads; re-queue whatever was never transcribed
+    # (MEMO_JOURNAL_FSYNC=0 skips fsync, to measure what durability costs)
+    global ingest_journal, transcription_scheduler, latency_log, server_metrics, transcode_cache, audio_archiver
+    global transcript_index, telemetry_store
+    transcription_scheduler = TranscriptionScheduler(TRANSCRIPTION_QUEUE_MAX)
+    latency_log = LatencyLog()
+    server_metrics = ServerMetrics()
+    transcode_cache = TranscodeCache(TRANSCODE_CACHE_DIR, TRANSCODE_CACHE_MAX_BYTES, FFMPEG)
+    audio_archiver = AudioArchiver(SAVE_DIR, ARCHIVE_AFTER_SECONDS, FFMPEG)
+    transcript_index = TranscriptSearchIndex()
+    transcript_index.load(TRANSCRIPT_DIR)
+    telemetry_store = TelemetryStore(TELEMETRY_DIR)
+    telemetry_store.load()
+    ingest_journal = IngestJournal(os.path.join(SAVE_DIR, 'ingest.journal'),
+                                   fsync=os.environ.get('MEMO_JOURNAL_FSYNC') != '0')
+    if ingest_journal.unfinished:
+        print(f"🧾 Replaying {len(ingest_journal.unfinished)} unfinished transcription(s) from the ingest journal")
+        for job in ingest_journal.unfinished:
+            if job.get('audio_sha256'):
+                is_duplicate_audio(job['device_id'], job['audio_sha256'])
+        # Replays queue behind live work, and aren't refused
+        for job in ingest_journal.unfinished:
+            transcription_scheduler.push(job, PRIORITY_BULK)
+        ingest_journal.unfinished = []
+
     # Start transcription worker thread
     transcription_thread = threading.Thread(
         target=transcription_worker,
         daemon=True
     )
     transcription_thread.start()
+    threading.Thread(target=presence_monitor, daemon=True, name='presence-monitor').start()
+    telemetry_store.start()
+    if ARCHIVE_ENABLED:
+        audio_archiver.start()
 
     # Start keyboard listener in separate thread
     keyboard_thread = threading.Thread(